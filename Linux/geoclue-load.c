@@ -0,0 +1,505 @@
+/*
+ * Load generator for the GeoClue2 service: runs many clients at once and
+ * reports how the service keeps up.
+ *
+ * Clients are spread over one or more bus connections and cycle through
+ * the given accuracy levels and thresholds. With --churn each client
+ * stops and starts again every few seconds. For every client it records
+ * the time to the first fix after each Start, the time to fetch each new
+ * location, and the D-Bus messages it took. For every fix it records how
+ * long the service took to deliver it to all clients at the same
+ * accuracy level.
+ *
+ * Uses the system bus, or DBUS_SYSTEM_BUS_ADDRESS, so it can run against
+ * the private bus and stand-in services of geoclue/tools/gclue-replay.py:
+ *
+ *   geoclue/tools/gclue-replay.py --command "./geoclue-load -n 200" ...
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <glib-unix.h>
+#include <gio/gio.h>
+#include <signal.h>
+
+#define BUS_NAME "org.freedesktop.GeoClue2"
+#define MANAGER_PATH "/org/freedesktop/GeoClue2/Manager"
+#define MANAGER_INTERFACE "org.freedesktop.GeoClue2.Manager"
+#define CLIENT_INTERFACE "org.freedesktop.GeoClue2.Client"
+#define LOCATION_INTERFACE "org.freedesktop.GeoClue2.Location"
+#define PROPERTIES_INTERFACE "org.freedesktop.DBus.Properties"
+
+typedef struct {
+	guint index;
+	GDBusConnection *connection;
+	char *path;
+	guint accuracy_level;
+	guint distance_threshold;
+	guint time_threshold;
+
+	guint signal_id;
+	guint churn_id;
+	gboolean running;
+	gint64 started;		/* monotonic, of the last Start */
+	gboolean have_fix;	/* since the last Start */
+
+	guint starts;
+	guint updates;
+	guint messages;
+	guint errors;
+} LoadClient;
+
+typedef struct {
+	LoadClient *client;
+	gint64 received;
+} FetchData;
+
+/* Commandline options */
+static gint num_clients = 10;
+static gint num_connections = 1;
+static gchar *accuracy_levels = NULL;
+static gchar *distance_thresholds = NULL;
+static gchar *time_thresholds = NULL;
+static gdouble churn = 0;	/* seconds */
+static gint duration = 60;	/* seconds */
+static gchar *desktop_id = NULL;
+static gboolean verbose = FALSE;
+
+static GOptionEntry entries[] =
+{
+	{ "clients", 'n', 0, G_OPTION_ARG_INT, &num_clients,
+	  "Number of clients. Default: 10", "N" },
+	{ "connections", 'c', 0, G_OPTION_ARG_INT, &num_connections,
+	  "Spread the clients over N bus connections. Default: 1", "N" },
+	{ "accuracy", 'a', 0, G_OPTION_ARG_STRING, &accuracy_levels,
+	  "Accuracy levels the clients cycle through. Default: 8", "L1,L2,..." },
+	{ "distance-threshold", 'd', 0, G_OPTION_ARG_STRING, &distance_thresholds,
+	  "Distance thresholds in meters the clients cycle through", "D1,D2,..." },
+	{ "time-threshold", 'i', 0, G_OPTION_ARG_STRING, &time_thresholds,
+	  "Time thresholds in seconds the clients cycle through", "T1,T2,..." },
+	{ "churn", 'r', 0, G_OPTION_ARG_DOUBLE, &churn,
+	  "Stop and restart each client about every S seconds", "S" },
+	{ "duration", 't', 0, G_OPTION_ARG_INT, &duration,
+	  "Run for T seconds. Default: 60", "T" },
+	{ "desktop-id", 'D', 0, G_OPTION_ARG_STRING, &desktop_id,
+	  "Desktop ID of the clients. Default: geoclue-load", "ID" },
+	{ "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose,
+	  "Print every delivered location", NULL },
+	{ NULL }
+};
+
+static GMainLoop *main_loop;
+static LoadClient *clients;
+static gint64 load_started;
+
+/* Samples in milliseconds */
+static GArray *ttff_samples;
+static GArray *fetch_samples;
+static GArray *spread_samples;
+
+/* "timestamp:level" -> first delivery of that fix, monotonic (gint64 *) */
+static GHashTable *fixes;
+
+static void client_start(LoadClient *client);
+
+static void add_sample(GArray *samples, gint64 since)
+{
+	gdouble ms = (g_get_monotonic_time() - since) / 1000.0;
+
+	g_array_append_val(samples, ms);
+}
+
+/* Parses a comma separated list of numbers, or returns @fallback */
+static GArray *parse_list(const char *list, guint fallback)
+{
+	GArray *values = g_array_new(FALSE, FALSE, sizeof (guint));
+	g_auto(GStrv) items = NULL;
+	guint i;
+
+	if (list != NULL) {
+		items = g_strsplit(list, ",", -1);
+		for (i = 0; items[i] != NULL; i++) {
+			guint64 parsed;
+			guint value;
+
+			if (!g_ascii_string_to_unsigned(g_strstrip(items[i]), 10,
+			                                0, G_MAXUINT, &parsed, NULL)) {
+				fprintf(stderr, "Invalid number '%s'\n", items[i]);
+				exit(1);
+			}
+			value = parsed;
+			g_array_append_val(values, value);
+		}
+	}
+	if (values->len == 0)
+		g_array_append_val(values, fallback);
+
+	return values;
+}
+
+static void on_call_done(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	LoadClient *client = user_data;
+	g_autoptr(GVariant) reply = NULL;
+	g_autoptr(GError) error = NULL;
+
+	reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source_object), res, &error);
+	client->messages++;
+	if (reply == NULL) {
+		client->errors++;
+		if (verbose)
+			fprintf(stderr, "client %u: %s\n", client->index, error->message);
+	}
+}
+
+/* Calls @method on the client object; every call and its reply count as
+ * two messages.
+ */
+static void client_call(LoadClient *client, const char *interface,
+                        const char *method, GVariant *parameters,
+                        GAsyncReadyCallback callback)
+{
+	client->messages++;
+	g_dbus_connection_call(client->connection, BUS_NAME, client->path,
+	                       interface, method, parameters, NULL,
+	                       G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+	                       callback ? callback : on_call_done, client);
+}
+
+static void client_set(LoadClient *client, const char *name, GVariant *value)
+{
+	client_call(client, PROPERTIES_INTERFACE, "Set",
+	            g_variant_new("(ssv)", CLIENT_INTERFACE, name, value), NULL);
+}
+
+static void on_location_fetched(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	FetchData *data = user_data;
+	LoadClient *client = data->client;
+	g_autoptr(GVariant) reply = NULL;
+	g_autoptr(GVariant) properties = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autofree char *key = NULL;
+	guint64 sec = 0, usec = 0;
+	gdouble latitude = 0, longitude = 0, accuracy = 0;
+	gint64 *first;
+
+	reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source_object), res, &error);
+	client->messages++;
+	if (reply == NULL) {
+		client->errors++;
+		if (verbose)
+			fprintf(stderr, "client %u: %s\n", client->index, error->message);
+		g_free(data);
+		return;
+	}
+	add_sample(fetch_samples, data->received);
+
+	properties = g_variant_get_child_value(reply, 0);
+	g_variant_lookup(properties, "Timestamp", "(tt)", &sec, &usec);
+	g_variant_lookup(properties, "Latitude", "d", &latitude);
+	g_variant_lookup(properties, "Longitude", "d", &longitude);
+	g_variant_lookup(properties, "Accuracy", "d", &accuracy);
+	if (verbose)
+		printf("client %u: %f, %f ±%.0f m\n", client->index,
+		       latitude, longitude, accuracy);
+
+	/* Clients at the same level get the same fix from the same locator */
+	key = g_strdup_printf("%" G_GUINT64_FORMAT ".%06" G_GUINT64_FORMAT ":%u",
+	                      sec, usec, client->accuracy_level);
+	first = g_hash_table_lookup(fixes, key);
+	if (first == NULL) {
+		first = g_new(gint64, 1);
+		*first = data->received;
+		g_hash_table_insert(fixes, g_steal_pointer(&key), first);
+	} else {
+		gdouble ms = (data->received - *first) / 1000.0;
+
+		g_array_append_val(spread_samples, ms);
+	}
+
+	g_free(data);
+}
+
+static void on_location_updated(GDBusConnection *connection,
+                                const char *sender_name,
+                                const char *object_path,
+                                const char *interface_name,
+                                const char *signal_name,
+                                GVariant *parameters,
+                                gpointer user_data)
+{
+	LoadClient *client = user_data;
+	FetchData *data;
+	const char *new_path;
+
+	client->messages++;
+	if (!client->running)
+		return;
+
+	client->updates++;
+	if (!client->have_fix) {
+		client->have_fix = TRUE;
+		add_sample(ttff_samples, client->started);
+	}
+
+	g_variant_get(parameters, "(&o&o)", NULL, &new_path);
+
+	data = g_new0(FetchData, 1);
+	data->client = client;
+	data->received = g_get_monotonic_time();
+
+	client->messages++;
+	g_dbus_connection_call(connection, BUS_NAME, new_path,
+	                       PROPERTIES_INTERFACE, "GetAll",
+	                       g_variant_new("(s)", LOCATION_INTERFACE),
+	                       G_VARIANT_TYPE("(a{sv})"),
+	                       G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+	                       on_location_fetched, data);
+}
+
+static guint churn_interval(void)
+{
+	/* Spread restarts over 0.5 to 1.5 times the churn period */
+	return (guint) (churn * g_random_double_range(500, 1500));
+}
+
+static void on_stopped(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	LoadClient *client = user_data;
+
+	on_call_done(source_object, res, user_data);
+	client_start(client);
+}
+
+static gboolean on_churn(gpointer user_data)
+{
+	LoadClient *client = user_data;
+
+	client->churn_id = 0;
+	client->running = FALSE;
+	client_call(client, CLIENT_INTERFACE, "Stop", NULL, on_stopped);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void client_start(LoadClient *client)
+{
+	client->starts++;
+	client->running = TRUE;
+	client->have_fix = FALSE;
+	client->started = g_get_monotonic_time();
+	client_call(client, CLIENT_INTERFACE, "Start", NULL, NULL);
+
+	if (churn > 0)
+		client->churn_id = g_timeout_add(churn_interval(), on_churn, client);
+}
+
+static void on_client_created(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	LoadClient *client = user_data;
+	g_autoptr(GVariant) reply = NULL;
+	g_autoptr(GError) error = NULL;
+
+	reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source_object), res, &error);
+	client->messages++;
+	if (reply == NULL) {
+		fprintf(stderr, "client %u: CreateClient failed: %s\n",
+		        client->index, error->message);
+		client->errors++;
+		return;
+	}
+
+	g_variant_get(reply, "(o)", &client->path);
+	client->signal_id = g_dbus_connection_signal_subscribe(client->connection,
+	                                                       BUS_NAME,
+	                                                       CLIENT_INTERFACE,
+	                                                       "LocationUpdated",
+	                                                       client->path,
+	                                                       NULL,
+	                                                       G_DBUS_SIGNAL_FLAGS_NONE,
+	                                                       on_location_updated,
+	                                                       client, NULL);
+
+	/* Calls on one connection are handled in order, no need to wait */
+	client_set(client, "DesktopId", g_variant_new_string(desktop_id));
+	client_set(client, "RequestedAccuracyLevel",
+	           g_variant_new_uint32(client->accuracy_level));
+	if (client->distance_threshold > 0)
+		client_set(client, "DistanceThreshold",
+		           g_variant_new_uint32(client->distance_threshold));
+	if (client->time_threshold > 0)
+		client_set(client, "TimeThreshold",
+		           g_variant_new_uint32(client->time_threshold));
+	client_start(client);
+}
+
+static gdouble percentile(GArray *samples, gdouble p)
+{
+	gdouble k;
+	guint lower, upper;
+	gdouble *values = (gdouble *) samples->data;
+
+	k = (samples->len - 1) * p / 100;
+	lower = (guint) k;
+	upper = MIN(lower + 1, samples->len - 1);
+
+	return values[lower] + (values[upper] - values[lower]) * (k - lower);
+}
+
+static gint compare_doubles(gconstpointer a, gconstpointer b)
+{
+	gdouble x = *(const gdouble *) a, y = *(const gdouble *) b;
+
+	return (x > y) - (x < y);
+}
+
+static void print_samples(const char *label, GArray *samples)
+{
+	if (samples->len == 0) {
+		printf("%-22s -\n", label);
+		return;
+	}
+
+	g_array_sort(samples, compare_doubles);
+	printf("%-22s p50 %8.1f ms  p90 %8.1f ms  p99 %8.1f ms  max %8.1f ms  (n=%u)\n",
+	       label,
+	       percentile(samples, 50), percentile(samples, 90),
+	       percentile(samples, 99),
+	       g_array_index(samples, gdouble, samples->len - 1),
+	       samples->len);
+}
+
+static void print_summary(void)
+{
+	gdouble seconds = (g_get_monotonic_time() - load_started) / (gdouble) G_USEC_PER_SEC;
+	guint64 updates = 0, messages = 0, starts = 0, errors = 0;
+	guint min_updates = G_MAXUINT, max_updates = 0;
+	gint i;
+
+	for (i = 0; i < num_clients; i++) {
+		updates += clients[i].updates;
+		messages += clients[i].messages;
+		starts += clients[i].starts;
+		errors += clients[i].errors;
+		min_updates = MIN(min_updates, clients[i].updates);
+		max_updates = MAX(max_updates, clients[i].updates);
+	}
+
+	printf("%d clients on %d connections, %.1f s\n",
+	       num_clients, num_connections, seconds);
+	printf("%-22s %" G_GUINT64_FORMAT " (%.1f/s), %u to %u per client\n",
+	       "updates", updates, updates / seconds, min_updates, max_updates);
+	printf("%-22s %" G_GUINT64_FORMAT " (%.1f/s), %.1f per update\n",
+	       "messages", messages, messages / seconds,
+	       updates ? (gdouble) messages / updates : 0.0);
+	printf("%-22s %" G_GUINT64_FORMAT "\n", "starts", starts);
+	printf("%-22s %" G_GUINT64_FORMAT "\n", "errors", errors);
+	print_samples("time to first fix", ttff_samples);
+	print_samples("location fetch", fetch_samples);
+	print_samples("delivery spread", spread_samples);
+}
+
+static gboolean on_quit(gpointer user_data)
+{
+	g_main_loop_quit(main_loop);
+
+	return G_SOURCE_REMOVE;
+}
+
+int main(int argc, char **argv)
+{
+	GOptionContext *context;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GArray) levels = NULL;
+	g_autoptr(GArray) distances = NULL;
+	g_autoptr(GArray) times = NULL;
+	g_autofree char *address = NULL;
+	GDBusConnection **connections;
+	gint i;
+
+	context = g_option_context_new("- Put the GeoClue2 service under load");
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	if (num_clients <= 0 || num_connections <= 0 || duration <= 0) {
+		fprintf(stderr, "--clients, --connections and --duration must be positive\n");
+		return 1;
+	}
+	num_connections = MIN(num_connections, num_clients);
+	if (desktop_id == NULL)
+		desktop_id = g_strdup("geoclue-load");
+
+	levels = parse_list(accuracy_levels, 8);
+	distances = parse_list(distance_thresholds, 0);
+	times = parse_list(time_thresholds, 0);
+
+	address = g_dbus_address_get_for_bus_sync(G_BUS_TYPE_SYSTEM, NULL, &error);
+	if (address == NULL) {
+		fprintf(stderr, "No system bus: %s\n", error->message);
+		return 1;
+	}
+
+	/* Separate connections rather than the shared singleton, so each
+	 * one gets its own socket and its own unique name.
+	 */
+	connections = g_new0(GDBusConnection *, num_connections);
+	for (i = 0; i < num_connections; i++) {
+		connections[i] = g_dbus_connection_new_for_address_sync
+			(address,
+			 G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+			 G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+			 NULL, NULL, &error);
+		if (connections[i] == NULL) {
+			fprintf(stderr, "Failed to connect to %s: %s\n",
+			        address, error->message);
+			return 1;
+		}
+	}
+
+	ttff_samples = g_array_new(FALSE, FALSE, sizeof (gdouble));
+	fetch_samples = g_array_new(FALSE, FALSE, sizeof (gdouble));
+	spread_samples = g_array_new(FALSE, FALSE, sizeof (gdouble));
+	fixes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+	load_started = g_get_monotonic_time();
+	clients = g_new0(LoadClient, num_clients);
+	for (i = 0; i < num_clients; i++) {
+		LoadClient *client = &clients[i];
+
+		client->index = i;
+		client->connection = connections[i % num_connections];
+		client->accuracy_level = g_array_index(levels, guint, i % levels->len);
+		client->distance_threshold = g_array_index(distances, guint, i % distances->len);
+		client->time_threshold = g_array_index(times, guint, i % times->len);
+
+		client->messages++;
+		g_dbus_connection_call(client->connection, BUS_NAME, MANAGER_PATH,
+		                       MANAGER_INTERFACE, "CreateClient", NULL,
+		                       G_VARIANT_TYPE("(o)"),
+		                       G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+		                       on_client_created, client);
+	}
+
+	main_loop = g_main_loop_new(NULL, FALSE);
+	g_timeout_add_seconds(duration, on_quit, NULL);
+	g_unix_signal_add(SIGINT, on_quit, NULL);
+	g_unix_signal_add(SIGTERM, on_quit, NULL);
+	g_main_loop_run(main_loop);
+
+	print_summary();
+
+	for (i = 0; i < num_clients; i++)
+		g_clear_handle_id(&clients[i].churn_id, g_source_remove);
+	for (i = 0; i < num_connections; i++) {
+		g_dbus_connection_close_sync(connections[i], NULL, NULL);
+		g_object_unref(connections[i]);
+	}
+
+	return 0;
+}
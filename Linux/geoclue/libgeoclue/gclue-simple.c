@@ -29,7 +29,8 @@
  * #GClueSimple make it very simple to get latest location and monitoring
  * location updates. It takes care of the boring tasks of creating a
  * #GClueClientProxy instance, starting it, waiting till we have a location fix
- * and then creating a #GClueLocationProxy instance for it.
+ * and then fetching the properties of each new location into a
+ * #GClueLocation.
  *
  * Use #gclue_simple_new() or #gclue_simple_new_sync() to create a new
  * #GClueSimple instance. Once you have a #GClueSimple instance, you can get the
@@ -290,29 +291,76 @@ gclue_simple_class_init (GClueSimpleClass *klass)
                                          gParamSpecs[PROP_TIME_THRESHOLD]);
 }
 
+/* Builds a location from a dictionary of Location interface properties,
+ * as returned by GetAll or sent by the portal.
+ */
+static GClueLocation *
+location_new_from_properties (GVariant *properties)
+{
+        GClueLocation *location = gclue_location_skeleton_new ();
+        double value;
+        const char *description;
+        GVariant *timestamp;
+
+        if (g_variant_lookup (properties, "Latitude", "d", &value))
+                gclue_location_set_latitude (location, value);
+        if (g_variant_lookup (properties, "Longitude", "d", &value))
+                gclue_location_set_longitude (location, value);
+        if (g_variant_lookup (properties, "Altitude", "d", &value))
+                gclue_location_set_altitude (location, value);
+        if (g_variant_lookup (properties, "Accuracy", "d", &value))
+                gclue_location_set_accuracy (location, value);
+        if (g_variant_lookup (properties, "Speed", "d", &value))
+                gclue_location_set_speed (location, value);
+        if (g_variant_lookup (properties, "Heading", "d", &value))
+                gclue_location_set_heading (location, value);
+        if (g_variant_lookup (properties, "Description", "&s", &description))
+                gclue_location_set_description (location, description);
+        if (g_variant_lookup (properties, "Timestamp", "@(tt)", &timestamp)) {
+                gclue_location_set_timestamp (location, timestamp);
+                g_variant_unref (timestamp);
+        }
+
+        return location;
+}
+
 static void
-on_location_proxy_ready (GObject      *source_object,
-                         GAsyncResult *res,
-                         gpointer      user_data)
+on_location_properties_ready (GObject      *source_object,
+                              GAsyncResult *res,
+                              gpointer      user_data)
 {
-        GClueSimplePrivate *priv = GCLUE_SIMPLE (user_data)->priv;
-        GClueLocation *location;
+        GClueSimplePrivate *priv;
+        GVariant *reply, *properties;
         GError *error = NULL;
 
-        location = gclue_location_proxy_new_for_bus_finish (res, &error);
+        reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object),
+                                               res,
+                                               &error);
         if (error != NULL) {
+                if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                        g_error_free (error);
+                        return;
+                }
+
+                priv = GCLUE_SIMPLE (user_data)->priv;
                 if (priv->task != NULL) {
                         g_task_return_error (priv->task, error);
                         g_clear_object (&priv->task);
                 } else {
-                        g_warning ("Failed to create location proxy: %s",
+                        g_warning ("Failed to get location: %s",
                                    error->message);
+                        g_error_free (error);
                 }
 
                 return;
         }
+
+        priv = GCLUE_SIMPLE (user_data)->priv;
+        properties = g_variant_get_child_value (reply, 0);
         g_clear_object (&priv->location);
-        priv->location = location;
+        priv->location = location_new_from_properties (properties);
+        g_variant_unref (properties);
+        g_variant_unref (reply);
 
         if (priv->task != NULL) {
                 g_task_return_boolean (priv->task, TRUE);
@@ -333,13 +381,22 @@ on_location_updated (GClueClient *client,
         if (new_location == NULL || g_strcmp0 (new_location, "/") == 0)
                 return;
 
-        gclue_location_proxy_new_for_bus (G_BUS_TYPE_SYSTEM,
-                                          G_DBUS_PROXY_FLAGS_NONE,
-                                          BUS_NAME,
-                                          new_location,
-                                          priv->cancellable,
-                                          on_location_proxy_ready,
-                                          user_data);
+        /* Location objects never change, so a single GetAll is all we need;
+         * a proxy would also subscribe to signals for each of them.
+         */
+        g_dbus_connection_call (g_dbus_proxy_get_connection (G_DBUS_PROXY (client)),
+                                BUS_NAME,
+                                new_location,
+                                "org.freedesktop.DBus.Properties",
+                                "GetAll",
+                                g_variant_new ("(s)",
+                                               "org.freedesktop.GeoClue2.Location"),
+                                G_VARIANT_TYPE ("(a{sv})"),
+                                G_DBUS_CALL_FLAGS_NONE,
+                                -1,
+                                priv->cancellable,
+                                on_location_properties_ready,
+                                user_data);
 }
 
 static void
@@ -471,33 +528,7 @@ on_portal_location_updated (XdpLocation *portal,
 {
         GClueSimple *simple = user_data;
         GClueSimplePrivate *priv = simple->priv;
-        double latitude;
-        double longitude;
-        double altitude;
-        double accuracy;
-        double speed;
-        double heading;
-        const char *description;
-        GVariant *timestamp;
-        GClueLocation *location = gclue_location_skeleton_new ();
-
-        g_variant_lookup (data, "Latitude", "d", &latitude);
-        g_variant_lookup (data, "Longitude", "d", &longitude);
-        g_variant_lookup (data, "Altitude", "d", &altitude);
-        g_variant_lookup (data, "Accuracy", "d", &accuracy);
-        g_variant_lookup (data, "Speed", "d", &speed);
-        g_variant_lookup (data, "Heading", "d", &heading);
-        g_variant_lookup (data, "Description", "&s", &description);
-        g_variant_lookup (data, "Timestamp", "@(tt)", &timestamp);
-
-        gclue_location_set_latitude (location, latitude);
-        gclue_location_set_longitude (location, longitude);
-        gclue_location_set_altitude (location, altitude);
-        gclue_location_set_accuracy (location, accuracy);
-        gclue_location_set_speed (location, speed);
-        gclue_location_set_heading (location, heading);
-        gclue_location_set_description (location, description);
-        gclue_location_set_timestamp (location, timestamp);
+        GClueLocation *location = location_new_from_properties (data);
 
         g_set_object (&priv->location, location);
 
@@ -19,16 +19,20 @@
  * Authors: Zeeshan Ali (Khattak) <zeeshanak@gnome.org>
  */
 
+#include <errno.h>
 #include <stdlib.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <libsoup/soup.h>
 #include <string.h>
 #include "gclue-3g.h"
 #include "gclue-3g-tower.h"
+#include "gclue-config.h"
 #include "gclue-modem-manager.h"
 #include "gclue-location.h"
 #include "gclue-mozilla.h"
 #include "gclue-wifi.h"
+#include "gclue-metrics.h"
 
 /**
  * SECTION:gclue-3g
@@ -45,6 +49,28 @@
  */
 #define LOCATION_3GPP_TIMEOUT (25 * 60)
 
+/* Cell towers don't move, and the web service's idea of where a tower is only
+ * changes slowly, so cached tower locations are kept for a week. A tower cache
+ * entry is about 100B, so even a vehicle passing a new cell every minute for
+ * the whole week only takes around 1MB of heap.
+ * In seconds.
+ */
+#define TOWER_CACHE_ENTRY_MAX_AGE_SECONDS (7 * 24 * 60 * 60)
+
+/* The cache is saved here, so a restarted daemon doesn't query the web service
+ * again for towers it already knows. Each source instance has its own file:
+ * the exact one sends the WiFi networks along with the tower, so its answers
+ * are more accurate than a coarser instance may hand out.
+ */
+#define TOWER_CACHE_DIR LOCALSTATEDIR "/lib/geoclue"
+#define TOWER_CACHE_PATH TOWER_CACHE_DIR "/3g-towers"
+#define TOWER_CACHE_WIFI_PATH TOWER_CACHE_DIR "/3g-towers-wifi"
+
+/* How often the cache is written out if it changed.
+ * In seconds.
+ */
+#define TOWER_CACHE_SAVE_INTERVAL (5 * 60)
+
 static unsigned int gclue_3g_running;
 
 struct _GClue3GPrivate {
@@ -55,6 +81,12 @@ struct _GClue3GPrivate {
 
         gulong threeg_notify_id;
         guint location_3gpp_timeout_id;
+
+        GHashTable *location_cache;  /* (element-type GClue3GTower TowerCacheEntry) (owned) */
+        guint cache_hits, cache_misses;
+        const char *cache_path;      /* NULL until the cache was loaded */
+        gboolean cache_dirty;
+        guint cache_save_timer;
 };
 
 G_DEFINE_TYPE_WITH_CODE (GClue3G,
@@ -77,6 +109,64 @@ gclue_3g_create_submit_query (GClueWebSource  *web,
 static GClueAccuracyLevel
 gclue_3g_get_available_accuracy_level (GClueWebSource *web,
                                        gboolean available);
+static void
+gclue_3g_refresh_async (GClueWebSource      *source,
+                        GCancellable        *cancellable,
+                        GAsyncReadyCallback  callback,
+                        gpointer             user_data);
+static GClueLocation *
+gclue_3g_refresh_finish (GClueWebSource  *source,
+                         GAsyncResult    *result,
+                         GError         **error);
+
+typedef struct {
+        GClueLocation *location;
+        gint64 added; /* seconds since the epoch */
+} TowerCacheEntry;
+
+static TowerCacheEntry *
+tower_cache_entry_new (GClueLocation *location)
+{
+        TowerCacheEntry *entry;
+
+        entry = g_slice_new (TowerCacheEntry);
+        entry->location = g_object_ref (location);
+        entry->added = g_get_real_time () / G_USEC_PER_SEC;
+        return entry;
+}
+
+static void tower_cache_entry_free (gpointer data)
+{
+        TowerCacheEntry *entry = data;
+
+        g_clear_object (&entry->location);
+        g_slice_free (TowerCacheEntry, entry);
+}
+
+static guint
+tower_hash (gconstpointer key)
+{
+        const GClue3GTower *tower = key;
+        guint hash;
+
+        hash = g_str_hash (tower->opc);
+        hash = hash * 31 + (guint) tower->lac;
+        hash = hash * 31 + (guint) tower->cell_id;
+        hash = hash * 31 + (guint) tower->tec;
+        return hash;
+}
+
+static gboolean
+tower_equal (gconstpointer a,
+             gconstpointer b)
+{
+        const GClue3GTower *tower1 = a, *tower2 = b;
+
+        return tower1->lac == tower2->lac &&
+               tower1->cell_id == tower2->cell_id &&
+               tower1->tec == tower2->tec &&
+               g_strcmp0 (tower1->opc, tower2->opc) == 0;
+}
 
 static void
 on_3g_enabled (GObject      *source_object,
@@ -128,6 +218,9 @@ static void cancel_location_3gpp_timeout (GClue3G *g3g)
         priv->location_3gpp_timeout_id = 0;
 }
 
+static void
+save_cache (GClue3G *g3g);
+
 static void
 gclue_3g_finalize (GObject *g3g)
 {
@@ -144,6 +237,8 @@ gclue_3g_finalize (GObject *g3g)
 
         cancel_location_3gpp_timeout (source);
 
+        save_cache (source);
+        g_clear_pointer (&priv->location_cache, g_hash_table_unref);
         g_clear_object (&priv->modem);
         g_clear_object (&priv->mozilla);
         g_clear_object (&priv->cancellable);
@@ -162,15 +257,30 @@ gclue_3g_class_init (GClue3GClass *klass)
         source_class->stop = gclue_3g_stop;
         web_class->create_query = gclue_3g_create_query;
         web_class->create_submit_query = gclue_3g_create_submit_query;
+        web_class->refresh_async = gclue_3g_refresh_async;
+        web_class->refresh_finish = gclue_3g_refresh_finish;
         web_class->get_available_accuracy_level =
                 gclue_3g_get_available_accuracy_level;
 }
 
+static void
+on_config_changed (GClueConfig *config,
+                   gpointer     user_data)
+{
+        GClue3G *source = GCLUE_3G (user_data);
+        GClueWebSource *web_source = GCLUE_WEB_SOURCE (source);
+
+        gclue_web_source_set_locate_url (web_source,
+                                         gclue_mozilla_get_locate_url (source->priv->mozilla));
+        gclue_web_source_set_submit_url (web_source,
+                                         gclue_mozilla_get_submit_url (source->priv->mozilla));
+}
+
 static void
 gclue_3g_init (GClue3G *source)
 {
         GClue3GPrivate *priv;
-        GClueWebSource *web_source = GCLUE_WEB_SOURCE (source);
+        GClueConfig *config = gclue_config_get_singleton ();
 
         source->priv = gclue_3g_get_instance_private (source);
         priv = source->priv;
@@ -178,10 +288,12 @@ gclue_3g_init (GClue3G *source)
         priv->cancellable = g_cancellable_new ();
 
         priv->mozilla = gclue_mozilla_get_singleton ();
-        gclue_web_source_set_locate_url (web_source,
-                                         gclue_mozilla_get_locate_url (priv->mozilla));
-        gclue_web_source_set_submit_url (web_source,
-                                         gclue_mozilla_get_submit_url (priv->mozilla));
+        on_config_changed (config, source);
+        g_signal_connect_object (config,
+                                 "changed",
+                                 G_CALLBACK (on_config_changed),
+                                 source,
+                                 0);
 
         priv->modem = gclue_modem_manager_get_singleton ();
         priv->threeg_notify_id =
@@ -190,6 +302,11 @@ gclue_3g_init (GClue3G *source)
                                           G_CALLBACK (on_is_3g_available_notify),
                                           source);
         priv->location_3gpp_timeout_id = 0;
+
+        priv->location_cache = g_hash_table_new_full (tower_hash,
+                                                      tower_equal,
+                                                      g_free,
+                                                      tower_cache_entry_free);
 }
 
 static void
@@ -303,6 +420,360 @@ gboolean gclue_3g_should_skip_tower (GClueAccuracyLevel level)
         return level < GCLUE_ACCURACY_LEVEL_NEIGHBORHOOD;
 }
 
+static void
+cache_prune (GClue3G *g3g)
+{
+        GClue3GPrivate *priv = g3g->priv;
+        GHashTableIter iter;
+        gpointer value;
+        gint64 cutoff_seconds;
+        guint old_cache_size;
+
+        old_cache_size = g_hash_table_size (priv->location_cache);
+        cutoff_seconds = g_get_real_time () / G_USEC_PER_SEC -
+                         TOWER_CACHE_ENTRY_MAX_AGE_SECONDS;
+
+        g_hash_table_iter_init (&iter, priv->location_cache);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                TowerCacheEntry *entry = value;
+
+                if (entry->added < cutoff_seconds)
+                        g_hash_table_iter_remove (&iter);
+        }
+
+        if (g_hash_table_size (priv->location_cache) != old_cache_size)
+                priv->cache_dirty = TRUE;
+
+        g_debug ("Pruned tower cache (old size: %u, new size: %u)",
+                 old_cache_size, g_hash_table_size (priv->location_cache));
+}
+
+static gboolean
+parse_tower (const char   *group,
+             GClue3GTower *tower)
+{
+        g_auto(GStrv) fields = g_strsplit (group, "/", 0);
+        guint64 lac, cell_id, tec;
+
+        if (g_strv_length (fields) != 4 ||
+            strlen (fields[0]) > GCLUE_3G_TOWER_OPERATOR_CODE_STR_LEN ||
+            !g_ascii_string_to_unsigned (fields[1], 10, 0, G_MAXULONG,
+                                         &lac, NULL) ||
+            !g_ascii_string_to_unsigned (fields[2], 10, 0, G_MAXULONG,
+                                         &cell_id, NULL) ||
+            !g_ascii_string_to_unsigned (fields[3], 10, 0,
+                                         GCLUE_TOWER_TEC_MAX_VALID,
+                                         &tec, NULL))
+                return FALSE;
+
+        memset (tower, 0, sizeof (GClue3GTower));
+        g_strlcpy (tower->opc, fields[0], sizeof (tower->opc));
+        tower->lac = lac;
+        tower->cell_id = cell_id;
+        tower->tec = tec;
+
+        return TRUE;
+}
+
+/* Loads the cache saved by an earlier daemon, skipping expired and invalid
+ * entries. Done on the first start, as that's when the accuracy level, which
+ * picks the file, is known.
+ */
+static void
+load_cache (GClue3G *g3g)
+{
+        GClue3GPrivate *priv = g3g->priv;
+        g_autoptr(GKeyFile) key_file = NULL;
+        g_autoptr(GError) error = NULL;
+        g_auto(GStrv) groups = NULL;
+        gint64 now;
+        guint i;
+
+        if (priv->cache_path != NULL)
+                return;
+        priv->cache_path = g3g_should_skip_bsss (g3g) ? TOWER_CACHE_PATH :
+                                                        TOWER_CACHE_WIFI_PATH;
+
+        key_file = g_key_file_new ();
+        if (!g_key_file_load_from_file (key_file, priv->cache_path,
+                                        G_KEY_FILE_NONE, &error)) {
+                if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+                        g_warning ("Failed to load %s: %s",
+                                   priv->cache_path, error->message);
+                return;
+        }
+
+        now = g_get_real_time () / G_USEC_PER_SEC;
+        groups = g_key_file_get_groups (key_file, NULL);
+        for (i = 0; groups[i] != NULL; i++) {
+                g_autoptr(GError) entry_error = NULL;
+                g_autofree char *description = NULL;
+                TowerCacheEntry *entry;
+                GClue3GTower tower;
+                gdouble latitude, longitude, accuracy;
+                gint64 added;
+
+                if (!parse_tower (groups[i], &tower))
+                        continue;
+
+                latitude = g_key_file_get_double (key_file, groups[i],
+                                                  "latitude", &entry_error);
+                if (entry_error == NULL)
+                        longitude = g_key_file_get_double (key_file, groups[i],
+                                                           "longitude",
+                                                           &entry_error);
+                if (entry_error == NULL)
+                        accuracy = g_key_file_get_double (key_file, groups[i],
+                                                          "accuracy",
+                                                          &entry_error);
+                if (entry_error == NULL)
+                        added = g_key_file_get_int64 (key_file, groups[i],
+                                                      "added", &entry_error);
+                if (entry_error != NULL ||
+                    latitude < -90 || latitude > 90 ||
+                    longitude < -180 || longitude > 180 ||
+                    accuracy < 0 || added > now ||
+                    now - added > TOWER_CACHE_ENTRY_MAX_AGE_SECONDS)
+                        continue;
+
+                description = g_key_file_get_string (key_file, groups[i],
+                                                     "description", NULL);
+
+                entry = g_slice_new (TowerCacheEntry);
+                entry->location = gclue_location_new (latitude,
+                                                      longitude,
+                                                      accuracy,
+                                                      description);
+                entry->added = added;
+                g_hash_table_replace (priv->location_cache,
+                                      g_memdup2 (&tower, sizeof (GClue3GTower)),
+                                      entry);
+        }
+
+        g_debug ("Loaded %u towers from %s",
+                 g_hash_table_size (priv->location_cache), priv->cache_path);
+}
+
+/* Writes the cache out if it changed since the last time. Called
+ * periodically, when the source stops and when it goes away.
+ */
+static void
+save_cache (GClue3G *g3g)
+{
+        GClue3GPrivate *priv = g3g->priv;
+        g_autoptr(GKeyFile) key_file = NULL;
+        g_autoptr(GError) error = NULL;
+        g_autofree char *data = NULL;
+        GHashTableIter iter;
+        gpointer key, value;
+        gsize length;
+
+        g_clear_handle_id (&priv->cache_save_timer, g_source_remove);
+
+        if (!priv->cache_dirty || priv->cache_path == NULL)
+                return;
+
+        key_file = g_key_file_new ();
+        g_hash_table_iter_init (&iter, priv->location_cache);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+                const GClue3GTower *tower = key;
+                const TowerCacheEntry *entry = value;
+                const char *description;
+                g_autofree char *group = NULL;
+
+                group = g_strdup_printf ("%s/%lu/%lu/%u",
+                                         tower->opc, tower->lac,
+                                         tower->cell_id, tower->tec);
+                g_key_file_set_double (key_file, group, "latitude",
+                                       gclue_location_get_latitude (entry->location));
+                g_key_file_set_double (key_file, group, "longitude",
+                                       gclue_location_get_longitude (entry->location));
+                g_key_file_set_double (key_file, group, "accuracy",
+                                       gclue_location_get_accuracy (entry->location));
+                g_key_file_set_int64 (key_file, group, "added", entry->added);
+                description = gclue_location_get_description (entry->location);
+                if (description != NULL)
+                        g_key_file_set_string (key_file, group,
+                                               "description", description);
+        }
+        data = g_key_file_to_data (key_file, &length, NULL);
+
+        if (g_mkdir_with_parents (TOWER_CACHE_DIR, 0700) < 0) {
+                g_warning ("Failed to create " TOWER_CACHE_DIR ": %s",
+                           g_strerror (errno));
+                return;
+        }
+
+        if (!g_file_set_contents_full (priv->cache_path, data, length,
+                                       G_FILE_SET_CONTENTS_CONSISTENT,
+                                       0600, &error)) {
+                g_warning ("Failed to save tower cache: %s", error->message);
+                return;
+        }
+
+        priv->cache_dirty = FALSE;
+        g_debug ("Saved %u towers to %s",
+                 g_hash_table_size (priv->location_cache), priv->cache_path);
+}
+
+static gboolean
+on_cache_save_timer (gpointer user_data)
+{
+        GClue3G *g3g = GCLUE_3G (user_data);
+
+        g3g->priv->cache_save_timer = 0;
+        save_cache (g3g);
+
+        return G_SOURCE_REMOVE;
+}
+
+static GClueLocation *
+find_cached_location (GHashTable         *cache,
+                      const GClue3GTower *tower)
+{
+        TowerCacheEntry *entry;
+        gint64 age;
+
+        entry = g_hash_table_lookup (cache, tower);
+        if (!entry) {
+                g_debug ("Tower cache miss for %s/%lu/%lu/%u",
+                         tower->opc, tower->lac, tower->cell_id, tower->tec);
+                return NULL;
+        }
+
+        age = g_get_real_time () / G_USEC_PER_SEC - entry->added;
+        if (age > TOWER_CACHE_ENTRY_MAX_AGE_SECONDS) {
+                g_debug ("Tower cache entry for %s/%lu/%lu/%u expired",
+                         tower->opc, tower->lac, tower->cell_id, tower->tec);
+                g_hash_table_remove (cache, tower);
+                return NULL;
+        }
+
+        g_debug ("Tower cache hit for %s/%lu/%lu/%u: got location %p (%s)",
+                 tower->opc, tower->lac, tower->cell_id, tower->tec,
+                 entry->location,
+                 gclue_location_get_description (entry->location));
+
+        return entry->location;
+}
+
+static void
+refresh_cb (GObject      *source_object,
+            GAsyncResult *result,
+            gpointer      user_data);
+
+static void
+gclue_3g_refresh_async (GClueWebSource      *source,
+                        GCancellable        *cancellable,
+                        GAsyncReadyCallback  callback,
+                        gpointer             user_data)
+{
+        GClue3G *g3g = GCLUE_3G (source);
+        GClue3GPrivate *priv = g3g->priv;
+        g_autoptr(GTask) task = g_task_new (source, cancellable, callback, user_data);
+        GClue3GTower *tower = gclue_mozilla_get_tower (priv->mozilla);
+
+        g_task_set_source_tag (task, gclue_3g_refresh_async);
+
+        if (tower != NULL &&
+            gclue_location_source_get_active (GCLUE_LOCATION_SOURCE (source))) {
+                GClueLocation *cached_location;
+
+                /* Try the cache. */
+                cached_location = find_cached_location (priv->location_cache,
+                                                        tower);
+                if (cached_location != NULL) {
+                        g_autoptr(GClueLocation) new_location = NULL;
+
+                        priv->cache_hits++;
+                        gclue_metrics_inc (GCLUE_METRIC_CACHE_HITS, "3g");
+
+                        /* Duplicate the location so its timestamp is updated. */
+                        new_location = gclue_location_duplicate_fresh (cached_location);
+                        gclue_location_source_set_location (GCLUE_LOCATION_SOURCE (source),
+                                                            new_location);
+
+                        g_task_return_pointer (task,
+                                               g_steal_pointer (&new_location),
+                                               g_object_unref);
+                        return;
+                }
+
+                priv->cache_misses++;
+                gclue_metrics_inc (GCLUE_METRIC_CACHE_MISSES, "3g");
+
+                /* Remember which tower the query is for, the modem may well
+                 * report another one before the response arrives.
+                 */
+                g_task_set_task_data (task,
+                                      g_memdup2 (tower, sizeof (GClue3GTower)),
+                                      g_free);
+        }
+
+        /* Fall back to querying the web service. */
+        GCLUE_WEB_SOURCE_CLASS (gclue_3g_parent_class)->refresh_async
+                (source, cancellable, refresh_cb, g_steal_pointer (&task));
+}
+
+static void
+refresh_cb (GObject      *source_object,
+            GAsyncResult *result,
+            gpointer      user_data)
+{
+        GClueWebSource *source = GCLUE_WEB_SOURCE (source_object);
+        GClue3GPrivate *priv = GCLUE_3G (source)->priv;
+        g_autoptr(GTask) task = g_steal_pointer (&user_data);
+        g_autoptr(GClueLocation) location = NULL;
+        g_autoptr(GError) local_error = NULL;
+        GClue3GTower *tower;
+        double cache_hit_ratio;
+
+        /* Finish querying the web service. */
+        location = GCLUE_WEB_SOURCE_CLASS (gclue_3g_parent_class)->refresh_finish
+                (source, result, &local_error);
+
+        if (local_error != NULL) {
+                g_task_return_error (task, g_steal_pointer (&local_error));
+                return;
+        }
+
+        /* Cache the result. */
+        tower = g_task_get_task_data (task);
+        if (tower != NULL) {
+                g_hash_table_replace (priv->location_cache,
+                                      g_memdup2 (tower, sizeof (GClue3GTower)),
+                                      tower_cache_entry_new (location));
+                priv->cache_dirty = TRUE;
+                if (priv->cache_save_timer == 0)
+                        priv->cache_save_timer =
+                                g_timeout_add_seconds (TOWER_CACHE_SAVE_INTERVAL,
+                                                       on_cache_save_timer,
+                                                       source);
+
+                cache_hit_ratio = priv->cache_hits * 100.0 /
+                                  (priv->cache_hits + priv->cache_misses);
+
+                g_debug ("Adding tower %s/%lu/%lu/%u / %s to cache "
+                         "(new size: %u; hit ratio %.2f%%)",
+                         tower->opc, tower->lac, tower->cell_id, tower->tec,
+                         gclue_location_get_description (location),
+                         g_hash_table_size (priv->location_cache),
+                         cache_hit_ratio);
+        }
+
+        g_task_return_pointer (task, g_steal_pointer (&location), g_object_unref);
+}
+
+static GClueLocation *
+gclue_3g_refresh_finish (GClueWebSource  *source,
+                         GAsyncResult    *result,
+                         GError         **error)
+{
+        GTask *task = G_TASK (result);
+
+        return g_task_propagate_pointer (task, error);
+}
+
 static gboolean
 on_location_3gpp_timeout (gpointer user_data)
 {
@@ -381,6 +852,8 @@ gclue_3g_start (GClueLocationSource *source)
         if (base_result != GCLUE_LOCATION_SOURCE_START_RESULT_OK)
                 return base_result;
 
+        load_cache (GCLUE_3G (source));
+
         if (gclue_3g_running == 0) {
                 g_debug ("First 3GPP source starting up");
         }
@@ -421,6 +894,8 @@ gclue_3g_stop (GClueLocationSource *source)
                                               source);
 
         cancel_location_3gpp_timeout (g3g);
+        cache_prune (g3g);
+        save_cache (g3g);
 
         g_assert (gclue_3g_running > 0);
         gclue_3g_running--;
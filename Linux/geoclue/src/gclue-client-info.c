@@ -21,6 +21,12 @@
  */
 
 #include <glib/gi18n.h>
+#include <gio/gunixfdlist.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include "gclue-client-info.h"
 
@@ -33,7 +39,6 @@ struct _GClueClientInfoPrivate
 {
         char *bus_name;
         GDBusConnection *connection;
-        GDBusProxy *dbus_proxy;
         guint watch_id;
 
         guint32 user_id;
@@ -74,7 +79,6 @@ gclue_client_info_finalize (GObject *object)
                 priv->watch_id = 0;
         }
 
-        g_clear_object (&priv->dbus_proxy);
         g_clear_pointer (&priv->bus_name, g_free);
         g_clear_pointer (&priv->xdg_id, g_free);
         g_clear_object (&priv->connection);
@@ -171,134 +175,270 @@ gclue_client_info_class_init (GClueClientInfoClass *klass)
                               G_TYPE_NONE);
 }
 
+/* Unique bus names are never reused by the bus daemon, so whatever we learn
+ * about a peer stays true until its name vanishes. Short-lived clients that
+ * reconnect (or call CreateClient, GetClient and AddAgent in a row) then get
+ * their identity resolved without a single extra round trip.
+ */
+typedef struct
+{
+        guint32 user_id;
+        char *xdg_id;
+        guint name_owner_changed_id;
+} ClientCredentials;
+
+static GHashTable *credentials_cache;
+static GDBusConnection *credentials_connection;
+
+static void
+client_credentials_free (ClientCredentials *credentials)
+{
+        g_dbus_connection_signal_unsubscribe (credentials_connection,
+                                              credentials->name_owner_changed_id);
+        g_free (credentials->xdg_id);
+        g_slice_free (ClientCredentials, credentials);
+}
+
+static void
+credentials_cache_remove (GDBusConnection *connection,
+                          const char      *bus_name)
+{
+        if (credentials_cache == NULL || connection != credentials_connection)
+                return;
+
+        if (g_hash_table_remove (credentials_cache, bus_name))
+                g_debug ("Dropped cached credentials of `%s`", bus_name);
+}
+
 static void
 on_name_vanished (GDBusConnection *connection,
                   const gchar     *name,
                   gpointer         user_data)
 {
+        /* Also covers peers that vanished while their credentials were in
+         * flight, for which NameOwnerChanged came before we subscribed.
+         */
+        credentials_cache_remove (connection, name);
+
         g_signal_emit (GCLUE_CLIENT_INFO (user_data),
                        signals[PEER_VANISHED],
                        0);
 }
 
-
-static gchar *
-parse_cgroup_v2 (GStrv lines)
+static void
+on_name_owner_changed (GDBusConnection *connection,
+                       const char      *sender_name,
+                       const char      *object_path,
+                       const char      *interface_name,
+                       const char      *signal_name,
+                       GVariant        *parameters,
+                       gpointer         user_data)
 {
-        const char *unit, *name;
-        char *dash, *xdg_id;
-        g_autofree char *scope = NULL;
+        const char *name, *old_owner, *new_owner;
 
-        /* Cgroup v2 is always a single line:
-         * 0::/user.slice/user-1000.slice/user@1000.service/app.slice/app-flatpak-org.gnome.Maps-3358.scope
-         */
-        if (g_strv_length (lines) != 2)
-                return NULL;
+        g_variant_get (parameters, "(&s&s&s)", &name, &old_owner, &new_owner);
+        if (new_owner[0] != '\0')
+                return;
 
-        if (!g_str_has_prefix (lines[0], "0::"))
-                 return NULL;
+        credentials_cache_remove (connection, name);
+}
 
-        unit = lines[0] + strlen ("0::");
-        scope = g_path_get_basename (unit);
-        if (!g_str_has_prefix (scope, "app-flatpak-") ||
-            !g_str_has_suffix (scope, ".scope"))
-                return NULL;
+static gboolean
+credentials_cache_ensure (GDBusConnection *connection)
+{
+        if (credentials_cache != NULL)
+                return connection == credentials_connection;
+
+        credentials_cache = g_hash_table_new_full
+                (g_str_hash,
+                 g_str_equal,
+                 g_free,
+                 (GDestroyNotify) client_credentials_free);
+        /* Not a reference: the connection outlives every client anyway */
+        credentials_connection = connection;
+        return TRUE;
+}
 
-        name = scope + strlen("app-flatpak-");
-        dash = strchr (name, '-');
-        if (dash == NULL)
+static const ClientCredentials *
+credentials_cache_lookup (GDBusConnection *connection,
+                          const char      *bus_name)
+{
+        if (!credentials_cache_ensure (connection))
                 return NULL;
-        *dash = 0;
 
-        xdg_id = g_strdup (name);
-        g_debug ("Found xdg_id %s", xdg_id);
-
-        return xdg_id;
+        return g_hash_table_lookup (credentials_cache, bus_name);
 }
 
-
-/* Based on got_credentials_cb() from xdg-app source code */
-static char *
-get_xdg_id (guint32 pid)
+static void
+credentials_cache_insert (GDBusConnection *connection,
+                          const char      *bus_name,
+                          guint32          user_id,
+                          const char      *xdg_id)
 {
-        char *xdg_id = NULL;
-        g_autofree char *path = NULL;
-        g_autofree char *content = NULL;
-        g_auto(GStrv) lines = NULL;
-        int i;
+        ClientCredentials *credentials;
 
-        path = g_strdup_printf ("/proc/%u/cgroup", pid);
-
-        if (!g_file_get_contents (path, &content, NULL, NULL))
-                return NULL;
-        lines =  g_strsplit (content, "\n", -1);
-
-        xdg_id = parse_cgroup_v2 (lines);
-        if (xdg_id != NULL)
-                return xdg_id;
-
-        for (i = 0; lines[i] != NULL; i++) {
-                const char *unit = lines[i] + strlen ("1:name=systemd:");
-                g_autofree char *scope = NULL;
-                const char *name;
-                char *dash;
-                const char *prefix = NULL;
+        if (!credentials_cache_ensure (connection))
+                return;
 
-                if (!g_str_has_prefix (lines[i], "1:name=systemd:"))
-                        continue;
+        credentials = g_slice_new (ClientCredentials);
+        credentials->user_id = user_id;
+        credentials->xdg_id = g_strdup (xdg_id);
+        /* Only this peer's signal, rather than every name change on the bus.
+         * It outlives the peer's GClueClientInfo objects, which may all be
+         * gone long before the peer disconnects.
+         */
+        credentials->name_owner_changed_id =
+                g_dbus_connection_signal_subscribe (connection,
+                                                    "org.freedesktop.DBus",
+                                                    "org.freedesktop.DBus",
+                                                    "NameOwnerChanged",
+                                                    "/org/freedesktop/DBus",
+                                                    bus_name,
+                                                    G_DBUS_SIGNAL_FLAGS_NONE,
+                                                    on_name_owner_changed,
+                                                    NULL,
+                                                    NULL);
+        g_hash_table_replace (credentials_cache,
+                              g_strdup (bus_name),
+                              credentials);
+}
 
-                scope = g_path_get_basename (unit);
+/* Checks if the last path component of the cgroup @unit (@len bytes, not
+ * NUL-terminated) is a flatpak scope and if so, returns the start and length
+ * of the application ID in it.
+ */
+static gboolean
+parse_flatpak_scope (const char         *unit,
+                     gsize               len,
+                     const char * const *prefixes,
+                     const char        **name,
+                     gsize              *name_len)
+{
+        const char *scope, *end, *dash;
+        gsize scope_len;
+        guint i;
 
-                if (g_str_has_prefix (scope, "xdg-app-"))
-                        prefix = "xdg-app-";
-                else if (g_str_has_prefix (scope, "flatpak-"))
-                        prefix = "flatpak-";
-                else if (g_str_has_prefix (scope, "app-flatpak-"))
-                        prefix = "app-flatpak-";
+        end = unit + len;
+        scope = g_strrstr_len (unit, len, "/");
+        scope = (scope != NULL) ? scope + 1 : unit;
+        scope_len = end - scope;
 
-                if (prefix == NULL || !g_str_has_suffix (scope, ".scope"))
-                        break;
+        if (scope_len < strlen (".scope") ||
+            memcmp (end - strlen (".scope"), ".scope", strlen (".scope")) != 0)
+                return FALSE;
 
-                name = scope + strlen(prefix);
-                dash = strchr (name, '-');
+        for (i = 0; prefixes[i] != NULL; i++) {
+                gsize prefix_len = strlen (prefixes[i]);
 
-                if (dash == NULL)
+                if (scope_len > prefix_len &&
+                    memcmp (scope, prefixes[i], prefix_len) == 0)
                         break;
-
-                *dash = 0;
-                xdg_id = g_strdup (name);
         }
+        if (prefixes[i] == NULL)
+                return FALSE;
 
-        return xdg_id;
+        *name = scope + strlen (prefixes[i]);
+        dash = memchr (*name, '-', end - *name);
+        if (dash == NULL)
+                return FALSE;
+        *name_len = dash - *name;
+
+        return TRUE;
 }
 
-static void
-on_get_pid_ready (GObject      *source_object,
-                  GAsyncResult *res,
-                  gpointer      user_data)
+static const char * const cgroup_v2_prefixes[] = { "app-flatpak-", NULL };
+static const char * const cgroup_v1_prefixes[] = { "xdg-app-",
+                                                   "flatpak-",
+                                                   "app-flatpak-",
+                                                   NULL };
+
+/* Based on got_credentials_cb() from xdg-app source code. The cgroup file is
+ * parsed in place, the only allocation being the returned ID.
+ */
+static char *
+get_xdg_id (guint32 pid)
 {
-        GTask *task = G_TASK (user_data);
-        gpointer *info = g_task_get_source_object (task);
-        GClueClientInfoPrivate *priv = GCLUE_CLIENT_INFO (info)->priv;
-        guint32 pid;
-        GError *error = NULL;
-        GVariant *results = NULL;
+        char path[32];
+        char content[MAX_CMDLINE_LEN];
+        const char *line, *end, *name = NULL;
+        gsize name_len = 0;
+        gssize len;
+        int fd;
+
+        g_snprintf (path, sizeof (path), "/proc/%u/cgroup", pid);
+        fd = open (path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+                return NULL;
+        do {
+                len = read (fd, content, sizeof (content));
+        } while (len < 0 && errno == EINTR);
+        close (fd);
+        if (len <= 0)
+                return NULL;
+        end = content + len;
 
-        results = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object),
-                                            res,
-                                            &error);
-        if (results == NULL) {
-                g_task_return_error (task, error);
-                g_object_unref (task);
+        /* Cgroup v2 is always a single line:
+         * 0::/user.slice/user-1000.slice/user@1000.service/app.slice/app-flatpak-org.gnome.Maps-3358.scope
+         */
+        if (len > 3 && memcmp (content, "0::", 3) == 0) {
+                const char *eol = memchr (content, '\n', len);
+
+                if (eol == NULL || eol + 1 == end) {
+                        line = content + 3;
+                        eol = (eol != NULL) ? eol : end;
+                        if (!parse_flatpak_scope (line,
+                                                  eol - line,
+                                                  cgroup_v2_prefixes,
+                                                  &name,
+                                                  &name_len))
+                                return NULL;
+
+                        g_debug ("Found xdg_id %.*s", (int) name_len, name);
+                        return g_strndup (name, name_len);
+                }
+        }
 
-                return;
+        for (line = content; line < end; ) {
+                const char *eol = memchr (line, '\n', end - line);
+                const char *unit = line + strlen ("1:name=systemd:");
+
+                if (eol == NULL)
+                        eol = end;
+
+                if (eol - line > (gssize) strlen ("1:name=systemd:") &&
+                    memcmp (line, "1:name=systemd:",
+                            strlen ("1:name=systemd:")) == 0) {
+                        if (!parse_flatpak_scope (unit,
+                                                  eol - unit,
+                                                  cgroup_v1_prefixes,
+                                                  &name,
+                                                  &name_len))
+                                name = NULL;
+                        break;
+                }
+                line = eol + 1;
         }
 
-        g_assert (g_variant_n_children (results) > 0);
-        g_variant_get_child (results, 0, "u", &pid);
-        g_variant_unref (results);
+        return (name != NULL) ? g_strndup (name, name_len) : NULL;
+}
 
-        priv->xdg_id = get_xdg_id (pid);
+/* With a pidfd we can tell if @pid was recycled while we were reading its
+ * cgroup, in which case the ID we found belongs to someone else.
+ */
+static gboolean
+pidfd_is_alive (int pidfd)
+{
+#ifdef SYS_pidfd_send_signal
+        if (syscall (SYS_pidfd_send_signal, pidfd, 0, NULL, 0) < 0)
+                return errno != ESRCH;
+#endif
+        return TRUE;
+}
+
+static void
+watch_peer (GClueClientInfo *info)
+{
+        GClueClientInfoPrivate *priv = info->priv;
 
         priv->watch_id = g_bus_watch_name_on_connection (priv->connection,
                                                          priv->bus_name,
@@ -307,26 +447,26 @@ on_get_pid_ready (GObject      *source_object,
                                                          on_name_vanished,
                                                          info,
                                                          NULL);
-
-        g_task_return_boolean (task, TRUE);
-
-        g_object_unref (task);
 }
 
 static void
-on_get_user_id_ready (GObject      *source_object,
-                      GAsyncResult *res,
-                      gpointer      user_data)
+on_get_credentials_ready (GObject      *source_object,
+                          GAsyncResult *res,
+                          gpointer      user_data)
 {
         GTask *task = G_TASK (user_data);
         gpointer *info = g_task_get_source_object (task);
         GClueClientInfoPrivate *priv = GCLUE_CLIENT_INFO (info)->priv;
+        g_autoptr(GUnixFDList) fd_list = NULL;
+        g_autoptr(GVariant) results = NULL;
+        g_autoptr(GVariant) credentials = NULL;
         GError *error = NULL;
-        GVariant *results = NULL;
+        guint32 pid;
+        gint32 fd_index;
+        int pidfd = -1;
 
-        results = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object),
-                                            res,
-                                            &error);
+        results = g_dbus_connection_call_with_unix_fd_list_finish
+                (G_DBUS_CONNECTION (source_object), &fd_list, res, &error);
         if (results == NULL) {
                 g_task_return_error (task, error);
                 g_object_unref (task);
@@ -334,48 +474,39 @@ on_get_user_id_ready (GObject      *source_object,
                 return;
         }
 
-        g_assert (g_variant_n_children (results) > 0);
-        g_variant_get_child (results, 0, "u", &priv->user_id);
-        g_variant_unref (results);
-
-        g_dbus_proxy_call (priv->dbus_proxy,
-                           "GetConnectionUnixProcessID",
-                           g_variant_new ("(s)", priv->bus_name),
-                           G_DBUS_CALL_FLAGS_NONE,
-                           -1,
-                           g_task_get_cancellable (task),
-                           on_get_pid_ready,
-                           task);
-}
-
-static void
-on_dbus_proxy_ready (GObject      *source_object,
-                     GAsyncResult *res,
-                     gpointer      user_data)
-{
-        GTask *task = G_TASK (user_data);
-        gpointer *info = g_task_get_source_object (task);
-        GClueClientInfoPrivate *priv = GCLUE_CLIENT_INFO (info)->priv;
-        GDBusProxy *dbus_proxy;
-        GError *error = NULL;
-
-        dbus_proxy = g_dbus_proxy_new_for_bus_finish (res, &error);
-        if (dbus_proxy == NULL) {
-                g_task_return_error (task, error);
+        credentials = g_variant_get_child_value (results, 0);
+        if (!g_variant_lookup (credentials, "UnixUserID", "u", &priv->user_id) ||
+            !g_variant_lookup (credentials, "ProcessID", "u", &pid)) {
+                g_task_return_new_error (task,
+                                         G_IO_ERROR,
+                                         G_IO_ERROR_FAILED,
+                                         "Failed to get credentials of `%s`",
+                                         priv->bus_name);
                 g_object_unref (task);
+
                 return;
         }
 
-        priv->dbus_proxy = dbus_proxy;
+        if (fd_list != NULL &&
+            g_variant_lookup (credentials, "ProcessFD", "h", &fd_index))
+                pidfd = g_unix_fd_list_get (fd_list, fd_index, NULL);
 
-        g_dbus_proxy_call (priv->dbus_proxy,
-                           "GetConnectionUnixUser",
-                           g_variant_new ("(s)", priv->bus_name),
-                           G_DBUS_CALL_FLAGS_NONE,
-                           -1,
-                           g_task_get_cancellable (task),
-                           on_get_user_id_ready,
-                           task);
+        priv->xdg_id = get_xdg_id (pid);
+        if (pidfd >= 0) {
+                if (!pidfd_is_alive (pidfd))
+                        g_clear_pointer (&priv->xdg_id, g_free);
+                close (pidfd);
+        }
+
+        credentials_cache_insert (priv->connection,
+                                  priv->bus_name,
+                                  priv->user_id,
+                                  priv->xdg_id);
+        watch_peer (GCLUE_CLIENT_INFO (info));
+
+        g_task_return_boolean (task, TRUE);
+
+        g_object_unref (task);
 }
 
 static void
@@ -385,19 +516,39 @@ gclue_client_info_init_async (GAsyncInitable     *initable,
                               GAsyncReadyCallback callback,
                               gpointer            user_data)
 {
+        GClueClientInfoPrivate *priv = GCLUE_CLIENT_INFO (initable)->priv;
+        const ClientCredentials *credentials;
         GTask *task;
 
         task = g_task_new (initable, cancellable, callback, user_data);
 
-        g_dbus_proxy_new_for_bus (G_BUS_TYPE_SYSTEM,
-                                  G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES,
-                                  NULL,
-                                  "org.freedesktop.DBus",
-                                  "/org/freedesktop/DBus",
-                                  "org.freedesktop.DBus",
-                                  cancellable,
-                                  on_dbus_proxy_ready,
-                                  task);
+        credentials = credentials_cache_lookup (priv->connection,
+                                                priv->bus_name);
+        if (credentials != NULL) {
+                priv->user_id = credentials->user_id;
+                priv->xdg_id = g_strdup (credentials->xdg_id);
+                watch_peer (GCLUE_CLIENT_INFO (initable));
+
+                g_task_return_boolean (task, TRUE);
+                g_object_unref (task);
+
+                return;
+        }
+
+        g_dbus_connection_call_with_unix_fd_list
+                (priv->connection,
+                 "org.freedesktop.DBus",
+                 "/org/freedesktop/DBus",
+                 "org.freedesktop.DBus",
+                 "GetConnectionCredentials",
+                 g_variant_new ("(s)", priv->bus_name),
+                 G_VARIANT_TYPE ("(a{sv})"),
+                 G_DBUS_CALL_FLAGS_NONE,
+                 -1,
+                 NULL,
+                 cancellable,
+                 on_get_credentials_ready,
+                 task);
 }
 
 static gboolean
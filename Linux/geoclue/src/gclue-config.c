@@ -26,15 +26,29 @@
 
 #include "gclue-config.h"
 
-#define CONFIG_FILE_PATH SYSCONFDIR "/geoclue/geoclue.conf"
-#define CONFIG_D_DIRECTORY SYSCONFDIR "/geoclue/conf.d/"
+#define CONFIG_DIRECTORY SYSCONFDIR "/geoclue"
+
+#define CONFIG_RELOAD_DELAY_MSECS 500
+
+/* Set before the singleton is created, e.g. to run against a test setup. */
+static char *config_directory = NULL;
 
 /* This class will be responsible for fetching configuration. */
 
-struct _GClueConfigPrivate
+typedef struct
 {
-        GKeyFile *key_file;
+        char *id;
+        gboolean allowed;
+        gboolean system;
+        int* users;
+        gsize num_users;
+} AppConfig;
 
+/* Everything the getters hand out. A reload builds a new snapshot from the
+ * (mostly cached) per-file key files and swaps it in as a whole.
+ */
+typedef struct
+{
         char **agents;
         gsize num_agents;
 
@@ -47,11 +61,32 @@ struct _GClueConfigPrivate
         gboolean enable_wifi_source;
         gboolean enable_compass;
         gboolean enable_static_source;
+        gboolean enable_plugins;
+        gboolean enable_metrics;
+        gboolean enable_last_location;
         char *wifi_submit_url;
         char *wifi_submit_nick;
         char *nmea_socket;
 
-        GList *app_configs;
+        GHashTable *app_configs; /* id -> AppConfig */
+} ConfigSnapshot;
+
+struct _GClueConfigPrivate
+{
+        ConfigSnapshot *snapshot;
+
+        char *config_file_path;
+        char *config_d_directory;
+
+        GHashTable *key_files; /* path -> parsed GKeyFile */
+        GFileMonitor *file_monitor;
+        GFileMonitor *dir_monitor;
+        guint reload_id;
+
+        /* Commandline overrides, applied on top of every snapshot */
+        gboolean submit_override;
+        char *submit_nick_override;
+        char *nmea_socket_override;
 };
 
 G_DEFINE_TYPE_WITH_CODE (GClueConfig,
@@ -59,14 +94,12 @@ G_DEFINE_TYPE_WITH_CODE (GClueConfig,
                          G_TYPE_OBJECT,
                          G_ADD_PRIVATE (GClueConfig))
 
-typedef struct
-{
-        char *id;
-        gboolean allowed;
-        gboolean system;
-        int* users;
-        gsize num_users;
-} AppConfig;
+enum {
+        CHANGED,
+        SIGNAL_LAST
+};
+
+static guint signals[SIGNAL_LAST];
 
 static void
 app_config_free (AppConfig *app_config)
@@ -76,6 +109,32 @@ app_config_free (AppConfig *app_config)
         g_slice_free (AppConfig, app_config);
 }
 
+static ConfigSnapshot *
+config_snapshot_new (void)
+{
+        ConfigSnapshot *snapshot = g_slice_new0 (ConfigSnapshot);
+
+        snapshot->app_configs = g_hash_table_new_full
+                (g_str_hash,
+                 g_str_equal,
+                 NULL,
+                 (GDestroyNotify) app_config_free);
+
+        return snapshot;
+}
+
+static void
+config_snapshot_free (ConfigSnapshot *snapshot)
+{
+        g_strfreev (snapshot->agents);
+        g_free (snapshot->wifi_url);
+        g_free (snapshot->wifi_submit_url);
+        g_free (snapshot->wifi_submit_nick);
+        g_free (snapshot->nmea_socket);
+        g_hash_table_unref (snapshot->app_configs);
+        g_slice_free (ConfigSnapshot, snapshot);
+}
+
 static void
 gclue_config_finalize (GObject *object)
 {
@@ -83,14 +142,15 @@ gclue_config_finalize (GObject *object)
 
         priv = GCLUE_CONFIG (object)->priv;
 
-        g_clear_pointer (&priv->key_file, g_key_file_unref);
-        g_clear_pointer (&priv->agents, g_strfreev);
-        g_clear_pointer (&priv->wifi_url, g_free);
-        g_clear_pointer (&priv->wifi_submit_url, g_free);
-        g_clear_pointer (&priv->wifi_submit_nick, g_free);
-        g_clear_pointer (&priv->nmea_socket, g_free);
-
-        g_list_foreach (priv->app_configs, (GFunc) app_config_free, NULL);
+        g_clear_handle_id (&priv->reload_id, g_source_remove);
+        g_clear_object (&priv->file_monitor);
+        g_clear_object (&priv->dir_monitor);
+        g_clear_pointer (&priv->key_files, g_hash_table_unref);
+        g_clear_pointer (&priv->snapshot, config_snapshot_free);
+        g_clear_pointer (&priv->submit_nick_override, g_free);
+        g_clear_pointer (&priv->nmea_socket_override, g_free);
+        g_clear_pointer (&priv->config_file_path, g_free);
+        g_clear_pointer (&priv->config_d_directory, g_free);
 
         G_OBJECT_CLASS (gclue_config_parent_class)->finalize (object);
 }
@@ -102,28 +162,46 @@ gclue_config_class_init (GClueConfigClass *klass)
 
         object_class = G_OBJECT_CLASS (klass);
         object_class->finalize = gclue_config_finalize;
+
+        /**
+         * GClueConfig::changed:
+         *
+         * Emitted after the configuration has been (re)loaded. Strings
+         * returned by the getters before are no longer valid.
+         **/
+        signals[CHANGED] =
+                g_signal_new ("changed",
+                              GCLUE_TYPE_CONFIG,
+                              G_SIGNAL_RUN_LAST,
+                              0,
+                              NULL,
+                              NULL,
+                              g_cclosure_marshal_VOID__VOID,
+                              G_TYPE_NONE,
+                              0);
 }
 
 static void
-load_agent_config (GClueConfig *config, gboolean initial)
+load_agent_config (ConfigSnapshot *snapshot,
+                   GKeyFile       *key_file,
+                   gboolean        initial)
 {
-        GClueConfigPrivate *priv = config->priv;
         g_autoptr(GError) error = NULL;
         g_auto(GStrv) agents = NULL;
         gsize num_agents;
 
-        if (!initial && !g_key_file_has_key (priv->key_file, "agent", "whitelist", NULL))
+        if (!initial && !g_key_file_has_key (key_file, "agent", "whitelist", NULL))
                 return;
 
-        agents = g_key_file_get_string_list (priv->key_file,
+        agents = g_key_file_get_string_list (key_file,
                                              "agent",
                                              "whitelist",
                                              &num_agents,
                                              &error);
         if (error == NULL) {
-                g_clear_pointer (&priv->agents, g_strfreev);
-                priv->agents = g_steal_pointer (&agents);
-                priv->num_agents = num_agents;
+                g_clear_pointer (&snapshot->agents, g_strfreev);
+                snapshot->agents = g_steal_pointer (&agents);
+                snapshot->num_agents = num_agents;
 
         } else
                 g_warning ("Failed to read 'agent/whitelist' key: %s",
@@ -131,23 +209,23 @@ load_agent_config (GClueConfig *config, gboolean initial)
 }
 
 static void
-load_app_configs (GClueConfig *config)
+load_app_configs (ConfigSnapshot *snapshot,
+                  GKeyFile       *key_file)
 {
         const char *known_groups[] = { "agent", "wifi", "3g", "cdma",
                                        "modem-gps", "network-nmea", "compass",
-                                       "static-source", NULL };
-        GClueConfigPrivate *priv = config->priv;
+                                       "static-source", "plugins", "metrics",
+                                       "last-location", NULL };
         gsize num_groups = 0, i;
         g_auto(GStrv) groups = NULL;
 
-        groups = g_key_file_get_groups (priv->key_file, &num_groups);
+        groups = g_key_file_get_groups (key_file, &num_groups);
         if (num_groups == 0)
                 return;
 
         for (i = 0; i < num_groups; i++) {
                 AppConfig *app_config = NULL;
                 g_autofree int *users = NULL;
-                GList *node;
                 gsize num_users = 0, j;
                 gboolean allowed, system;
                 gboolean ignore = FALSE;
@@ -168,16 +246,11 @@ load_app_configs (GClueConfig *config)
                         continue;
 
                 /* Check if entry is new or is overwritten */
-                for (node = priv->app_configs; node != NULL; node = node->next) {
-                        if (strcmp (((AppConfig *) node->data)->id, groups[i]) == 0) {
-                                app_config = (AppConfig *) node->data;
-                                new_app_config = FALSE;
+                app_config = g_hash_table_lookup (snapshot->app_configs,
+                                                  groups[i]);
+                new_app_config = (app_config == NULL);
 
-                                break;
-                        }
-                }
-
-                allowed = g_key_file_get_boolean (priv->key_file,
+                allowed = g_key_file_get_boolean (key_file,
                                                   groups[i],
                                                   "allowed",
                                                   &error);
@@ -186,7 +259,7 @@ load_app_configs (GClueConfig *config)
                         goto error_out;
                 g_clear_error (&error);
 
-                system = g_key_file_get_boolean (priv->key_file,
+                system = g_key_file_get_boolean (key_file,
                                                  groups[i],
                                                  "system",
                                                  &error);
@@ -195,7 +268,7 @@ load_app_configs (GClueConfig *config)
                         goto error_out;
                 g_clear_error (&error);
 
-                users = g_key_file_get_integer_list (priv->key_file,
+                users = g_key_file_get_integer_list (key_file,
                                                      groups[i],
                                                      "users",
                                                      &num_users,
@@ -209,8 +282,10 @@ load_app_configs (GClueConfig *config)
                 /* New app config, without erroring out above */
                 if (new_app_config) {
                         app_config = g_slice_new0 (AppConfig);
-                        priv->app_configs = g_list_prepend (priv->app_configs, app_config);
                         app_config->id = g_strdup (groups[i]);
+                        g_hash_table_insert (snapshot->app_configs,
+                                             app_config->id,
+                                             app_config);
                 }
 
                 /* New app configs will have all of them, overwrites only some */
@@ -235,20 +310,19 @@ error_out:
 }
 
 static gboolean
-load_enable_source_config (GClueConfig *config,
-                           const char  *source_name,
-                           gboolean initial,
-                           gboolean enabled)
+load_enable_source_config (GKeyFile   *key_file,
+                           const char *source_name,
+                           gboolean    initial,
+                           gboolean    enabled)
 {
-        GClueConfigPrivate *priv = config->priv;
         g_autoptr(GError) error = NULL;
         gboolean enable;
 
         /* Source should be initially enabled by default */
-        if (!g_key_file_has_key (priv->key_file, source_name, "enable", NULL))
+        if (!g_key_file_has_key (key_file, source_name, "enable", NULL))
                 return initial? TRUE: enabled;
 
-        enable = g_key_file_get_boolean (priv->key_file,
+        enable = g_key_file_get_boolean (key_file,
                                          source_name,
                                          "enable",
                                          &error);
@@ -268,38 +342,39 @@ load_enable_source_config (GClueConfig *config,
 #define DEFAULT_WIFI_SUBMIT_NICK "geoclue"
 
 static void
-load_wifi_config (GClueConfig *config, gboolean initial)
+load_wifi_config (ConfigSnapshot *snapshot,
+                  GKeyFile       *key_file,
+                  gboolean        initial)
 {
-        GClueConfigPrivate *priv = config->priv;
         g_autoptr(GError) error = NULL;
         g_autofree char *wifi_url = NULL;
         g_autofree char *wifi_submit_url = NULL;
         g_autofree char *wifi_submit_nick = NULL;
         guint wifi_submit_nick_length;
 
-        priv->enable_wifi_source =
-                load_enable_source_config (config, "wifi", initial,
-                                           priv->enable_wifi_source);
+        snapshot->enable_wifi_source =
+                load_enable_source_config (key_file, "wifi", initial,
+                                           snapshot->enable_wifi_source);
 
-        if (initial || g_key_file_has_key (priv->key_file, "wifi", "url", NULL)) {
-                wifi_url = g_key_file_get_string (priv->key_file,
+        if (initial || g_key_file_has_key (key_file, "wifi", "url", NULL)) {
+                wifi_url = g_key_file_get_string (key_file,
                                                   "wifi",
                                                   "url",
                                                   &error);
                 if (error == NULL) {
-                        g_clear_pointer (&priv->wifi_url, g_free);
-                        priv->wifi_url = g_steal_pointer (&wifi_url);
-                } else if (priv->enable_wifi_source)
+                        g_clear_pointer (&snapshot->wifi_url, g_free);
+                        snapshot->wifi_url = g_steal_pointer (&wifi_url);
+                } else if (snapshot->enable_wifi_source)
                         g_warning ("Failed to get config \"wifi/url\": %s", error->message);
 
                 g_clear_error (&error);
         }
 
-        if (initial || g_key_file_has_key (priv->key_file, "wifi", "submit-data", NULL)) {
-                priv->wifi_submit = g_key_file_get_boolean (priv->key_file,
-                                                            "wifi",
-                                                            "submit-data",
-                                                            &error);
+        if (initial || g_key_file_has_key (key_file, "wifi", "submit-data", NULL)) {
+                snapshot->wifi_submit = g_key_file_get_boolean (key_file,
+                                                                "wifi",
+                                                                "submit-data",
+                                                                &error);
                 if (error != NULL) {
                         g_warning ("Failed to get config \"wifi/submit-data\": %s",
                                    error->message);
@@ -308,23 +383,23 @@ load_wifi_config (GClueConfig *config, gboolean initial)
                 g_clear_error (&error);
         }
 
-        if (initial || g_key_file_has_key (priv->key_file, "wifi", "submission-url", NULL)) {
-                wifi_submit_url = g_key_file_get_string (priv->key_file,
+        if (initial || g_key_file_has_key (key_file, "wifi", "submission-url", NULL)) {
+                wifi_submit_url = g_key_file_get_string (key_file,
                                                          "wifi",
                                                          "submission-url",
                                                          &error);
 
                 if (error == NULL) {
-                        g_clear_pointer (&priv->wifi_submit_url, g_free);
-                        priv->wifi_submit_url = g_steal_pointer (&wifi_submit_url);
-                } else if (priv->wifi_submit)
+                        g_clear_pointer (&snapshot->wifi_submit_url, g_free);
+                        snapshot->wifi_submit_url = g_steal_pointer (&wifi_submit_url);
+                } else if (snapshot->wifi_submit)
                         g_warning ("Failed to get config \"wifi/submission-url\": %s", error->message);
 
                 g_clear_error (&error);
         }
 
-        if (initial || g_key_file_has_key (priv->key_file, "wifi", "submission-nick", NULL)) {
-                wifi_submit_nick = g_key_file_get_string (priv->key_file,
+        if (initial || g_key_file_has_key (key_file, "wifi", "submission-nick", NULL)) {
+                wifi_submit_nick = g_key_file_get_string (key_file,
                                                           "wifi",
                                                           "submission-nick",
                                                           &error);
@@ -333,113 +408,117 @@ load_wifi_config (GClueConfig *config, gboolean initial)
                         /* Submission nickname must be 2-32 characters long */
                         wifi_submit_nick_length = strlen (wifi_submit_nick);
                         if (wifi_submit_nick_length >= 2 && wifi_submit_nick_length <= 32) {
-                                g_clear_pointer (&priv->wifi_submit_nick, g_free);
-                                priv->wifi_submit_nick = g_steal_pointer (&wifi_submit_nick);
+                                g_clear_pointer (&snapshot->wifi_submit_nick, g_free);
+                                snapshot->wifi_submit_nick = g_steal_pointer (&wifi_submit_nick);
                         } else {
                                 g_warning ("Submission nick must be between 2-32 characters long");
 
                                 if (initial) {
-                                        g_debug ("Using the default submission nick: %s", error->message);
-                                        g_clear_pointer (&priv->wifi_submit_nick, g_free);
-                                        priv->wifi_submit_nick = g_strdup (DEFAULT_WIFI_SUBMIT_NICK);
+                                        g_debug ("Using the default submission nick: %s", DEFAULT_WIFI_SUBMIT_NICK);
+                                        g_clear_pointer (&snapshot->wifi_submit_nick, g_free);
+                                        snapshot->wifi_submit_nick = g_strdup (DEFAULT_WIFI_SUBMIT_NICK);
                                 }
                         }
                 } else if (initial) {
                         g_debug ("Using the default submission nick: %s", error->message);
-                        g_clear_pointer (&priv->wifi_submit_nick, g_free);
-                        priv->wifi_submit_nick = g_strdup (DEFAULT_WIFI_SUBMIT_NICK);
+                        g_clear_pointer (&snapshot->wifi_submit_nick, g_free);
+                        snapshot->wifi_submit_nick = g_strdup (DEFAULT_WIFI_SUBMIT_NICK);
                 } else
                         g_warning ("Failed to get config \"wifi/submission-nick\": %s", error->message);
         }
 }
 
 static void
-load_3g_config (GClueConfig *config, gboolean initial)
-{
-        config->priv->enable_3g_source =
-                load_enable_source_config (config, "3g", initial,
-                                           config->priv->enable_3g_source);
-}
-
-static void
-load_cdma_config (GClueConfig *config, gboolean initial)
-{
-        config->priv->enable_cdma_source =
-                load_enable_source_config (config, "cdma", initial,
-                                           config->priv->enable_cdma_source);
-}
-
-static void
-load_modem_gps_config (GClueConfig *config, gboolean initial)
-{
-        config->priv->enable_modem_gps_source =
-                load_enable_source_config (config, "modem-gps", initial,
-                                           config->priv->enable_modem_gps_source);
-}
-
-static void
-load_network_nmea_config (GClueConfig *config, gboolean initial)
+load_network_nmea_config (ConfigSnapshot *snapshot,
+                          GKeyFile       *key_file,
+                          gboolean        initial)
 {
         g_autoptr(GError) error = NULL;
         g_autofree char* nmea_socket = NULL;
 
-        config->priv->enable_nmea_source =
-                load_enable_source_config (config, "network-nmea", initial,
-                                           config->priv->enable_nmea_source);
+        snapshot->enable_nmea_source =
+                load_enable_source_config (key_file, "network-nmea", initial,
+                                           snapshot->enable_nmea_source);
 
-        if (g_key_file_has_key (config->priv->key_file, "network-nmea", "nmea-socket", NULL)) {
-                nmea_socket = g_key_file_get_string (config->priv->key_file,
+        if (g_key_file_has_key (key_file, "network-nmea", "nmea-socket", NULL)) {
+                nmea_socket = g_key_file_get_string (key_file,
                                                      "network-nmea",
                                                      "nmea-socket",
                                                      &error);
                 if (error == NULL) {
-                        g_clear_pointer (&config->priv->nmea_socket, g_free);
-                        config->priv->nmea_socket = g_steal_pointer (&nmea_socket);
+                        g_clear_pointer (&snapshot->nmea_socket, g_free);
+                        snapshot->nmea_socket = g_steal_pointer (&nmea_socket);
                 } else
                         g_warning ("Failed to get config \"nmea-socket\": %s", error->message);
         }
 }
 
 static void
-load_compass_config (GClueConfig *config, gboolean initial)
+apply_config_file (ConfigSnapshot *snapshot,
+                   GKeyFile       *key_file,
+                   gboolean        initial)
 {
-        config->priv->enable_compass =
-                load_enable_source_config (config, "compass", initial,
-                                           config->priv->enable_compass);
+        load_agent_config (snapshot, key_file, initial);
+        load_app_configs (snapshot, key_file);
+        load_wifi_config (snapshot, key_file, initial);
+        snapshot->enable_3g_source =
+                load_enable_source_config (key_file, "3g", initial,
+                                           snapshot->enable_3g_source);
+        snapshot->enable_cdma_source =
+                load_enable_source_config (key_file, "cdma", initial,
+                                           snapshot->enable_cdma_source);
+        snapshot->enable_modem_gps_source =
+                load_enable_source_config (key_file, "modem-gps", initial,
+                                           snapshot->enable_modem_gps_source);
+        load_network_nmea_config (snapshot, key_file, initial);
+        snapshot->enable_compass =
+                load_enable_source_config (key_file, "compass", initial,
+                                           snapshot->enable_compass);
+        snapshot->enable_static_source =
+                load_enable_source_config (key_file, "static-source", initial,
+                                           snapshot->enable_static_source);
+        snapshot->enable_plugins =
+                load_enable_source_config (key_file, "plugins", initial,
+                                           snapshot->enable_plugins);
+        snapshot->enable_metrics =
+                load_enable_source_config (key_file, "metrics", initial,
+                                           snapshot->enable_metrics);
+        snapshot->enable_last_location =
+                load_enable_source_config (key_file, "last-location", initial,
+                                           snapshot->enable_last_location);
 }
 
-static void
-load_static_source_config (GClueConfig *config, gboolean initial)
+/* Returns the parsed @path, only touching the disk if it changed since the
+ * last time it was loaded.
+ */
+static GKeyFile *
+get_config_file (GClueConfig *config, const char *path)
 {
-        config->priv->enable_static_source =
-                load_enable_source_config (config, "static-source", initial,
-                                           config->priv->enable_static_source);
-}
-
-static void
-load_config_file (GClueConfig *config, const char *path, gboolean initial) {
+        GClueConfigPrivate *priv = config->priv;
+        g_autoptr(GKeyFile) key_file = NULL;
         g_autoptr(GError) error = NULL;
 
+        key_file = g_hash_table_lookup (priv->key_files, path);
+        if (key_file != NULL)
+                return g_key_file_ref (key_file);
+
         g_debug ("Loading config: %s", path);
-        g_key_file_load_from_file (config->priv->key_file,
+        key_file = g_key_file_new ();
+        g_key_file_load_from_file (key_file,
                                    path,
                                    0,
                                    &error);
         if (error != NULL) {
                 g_critical ("Failed to load configuration file '%s': %s",
                             path, error->message);
-                return;
+                return NULL;
         }
 
-        load_agent_config (config, initial);
-        load_app_configs (config);
-        load_wifi_config (config, initial);
-        load_3g_config (config, initial);
-        load_cdma_config (config, initial);
-        load_modem_gps_config (config, initial);
-        load_network_nmea_config (config, initial);
-        load_compass_config (config, initial);
-        load_static_source_config (config, initial);
+        g_hash_table_insert (priv->key_files,
+                             g_strdup (path),
+                             g_key_file_ref (key_file));
+
+        return g_steal_pointer (&key_file);
 }
 
 static void
@@ -482,48 +561,55 @@ redact_api_key (char *url)
 static void
 gclue_config_print (GClueConfig *config)
 {
-        GList *node;
+        ConfigSnapshot *snapshot = config->priv->snapshot;
+        GHashTableIter iter;
         AppConfig *app_config = NULL;
         g_autofree char *redacted_locate_url = NULL;
         g_autofree char *redacted_submit_url = NULL;
         gsize i;
 
         g_debug ("GeoClue configuration:");
-        if (config->priv->num_agents > 0) {
+        if (snapshot->num_agents > 0) {
                 g_debug ("Allowed agents:");
-                for (i = 0; i < config->priv->num_agents; i++)
-                        g_debug ("\t%s", config->priv->agents[i]);
+                for (i = 0; i < snapshot->num_agents; i++)
+                        g_debug ("\t%s", snapshot->agents[i]);
         } else
                 g_debug ("Allowed agents: none");
         g_debug ("Network NMEA source: %s",
-                 config->priv->enable_nmea_source? "enabled": "disabled");
+                 snapshot->enable_nmea_source? "enabled": "disabled");
         g_debug ("\tNetwork NMEA socket: %s",
-                 config->priv->nmea_socket == NULL? "none": config->priv->nmea_socket);
+                 snapshot->nmea_socket == NULL? "none": snapshot->nmea_socket);
         g_debug ("3G source: %s",
-                 config->priv->enable_3g_source? "enabled": "disabled");
+                 snapshot->enable_3g_source? "enabled": "disabled");
         g_debug ("CDMA source: %s",
-                 config->priv->enable_cdma_source? "enabled": "disabled");
+                 snapshot->enable_cdma_source? "enabled": "disabled");
         g_debug ("Modem GPS source: %s",
-                 config->priv->enable_modem_gps_source? "enabled": "disabled");
+                 snapshot->enable_modem_gps_source? "enabled": "disabled");
         g_debug ("WiFi source: %s",
-                 config->priv->enable_wifi_source? "enabled": "disabled");
-        redacted_locate_url = redact_api_key (config->priv->wifi_url);
+                 snapshot->enable_wifi_source? "enabled": "disabled");
+        redacted_locate_url = redact_api_key (snapshot->wifi_url);
         g_debug ("\tWiFi locate URL: %s",
                  redacted_locate_url == NULL ? "none" : redacted_locate_url);
-        redacted_submit_url = redact_api_key (config->priv->wifi_submit_url);
+        redacted_submit_url = redact_api_key (snapshot->wifi_submit_url);
         g_debug ("\tWiFi submit URL: %s",
                  redacted_submit_url == NULL ? "none" : redacted_submit_url);
         g_debug ("\tWiFi submit data: %s",
-                 config->priv->wifi_submit? "enabled": "disabled");
+                 snapshot->wifi_submit? "enabled": "disabled");
         g_debug ("\tWiFi submission nickname: %s",
-                 config->priv->wifi_submit_nick == NULL? "none": config->priv->wifi_submit_nick);
+                 snapshot->wifi_submit_nick == NULL? "none": snapshot->wifi_submit_nick);
         g_debug ("Static source: %s",
-                 config->priv->enable_static_source? "enabled": "disabled");
+                 snapshot->enable_static_source? "enabled": "disabled");
         g_debug ("Compass: %s",
-                 config->priv->enable_compass? "enabled": "disabled");
+                 snapshot->enable_compass? "enabled": "disabled");
+        g_debug ("Source plugins: %s",
+                 snapshot->enable_plugins? "enabled": "disabled");
+        g_debug ("Metrics export: %s",
+                 snapshot->enable_metrics? "enabled": "disabled");
+        g_debug ("Last known location: %s",
+                 snapshot->enable_last_location? "enabled": "disabled");
         g_debug ("Application configs:");
-        for (node = config->priv->app_configs; node != NULL; node = node->next) {
-                app_config = (AppConfig *) node->data;
+        g_hash_table_iter_init (&iter, snapshot->app_configs);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &app_config)) {
                 g_debug ("\tID: %s", app_config->id);
                 g_debug ("\t\tAllowed: %s", app_config->allowed? "yes": "no");
                 g_debug ("\t\tSystem: %s", app_config->system? "yes": "no");
@@ -537,31 +623,53 @@ gclue_config_print (GClueConfig *config)
 }
 
 static void
-gclue_config_init (GClueConfig *config)
+apply_overrides (GClueConfig *config)
+{
+        GClueConfigPrivate *priv = config->priv;
+        ConfigSnapshot *snapshot = priv->snapshot;
+
+        if (priv->submit_override)
+                snapshot->wifi_submit = TRUE;
+        if (priv->submit_nick_override != NULL) {
+                g_clear_pointer (&snapshot->wifi_submit_nick, g_free);
+                snapshot->wifi_submit_nick = g_strdup (priv->submit_nick_override);
+        }
+        if (priv->nmea_socket_override != NULL) {
+                g_clear_pointer (&snapshot->nmea_socket, g_free);
+                snapshot->nmea_socket = g_strdup (priv->nmea_socket_override);
+        }
+}
+
+static void
+load_config (GClueConfig *config)
 {
+        GClueConfigPrivate *priv = config->priv;
+        ConfigSnapshot *snapshot;
         g_autoptr(GDir) dir = NULL;
         g_autoptr(GError) error = NULL;
         g_autoptr(GArray) files = NULL;
+        g_autoptr(GKeyFile) key_file = NULL;
         char *name;
         gsize i;
 
-        config->priv = gclue_config_get_instance_private (config);
-        config->priv->key_file = g_key_file_new ();
+        snapshot = config_snapshot_new ();
 
         /* Load config file from default path, log all missing parameters */
-        load_config_file (config, CONFIG_FILE_PATH, TRUE);
+        key_file = get_config_file (config, priv->config_file_path);
+        if (key_file != NULL)
+                apply_config_file (snapshot, key_file, TRUE);
 
         /*
          * Apply config overwrites from conf.d style config files,
          * files are sorted alphabetically, example: '90-config.conf'
          * will overwrite '50-config.conf'.
          */
-        dir = g_dir_open (CONFIG_D_DIRECTORY, 0, &error);
+        dir = g_dir_open (priv->config_d_directory, 0, &error);
 
         if (error != NULL) {
                 if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
                         g_warning ("Failed to open %s: %s",
-                                   CONFIG_D_DIRECTORY, error->message);
+                                   priv->config_d_directory, error->message);
                 }
                 goto out;
         }
@@ -572,41 +680,186 @@ gclue_config_init (GClueConfig *config)
         while ((name = g_strdup (g_dir_read_name (dir)))) {
                 if (g_str_has_suffix (name, ".conf"))
                         g_array_append_val (files, name);
+                else
+                        g_free (name);
         }
 
         g_array_sort (files, sort_files);
 
         for (i = 0; i < files->len; i++) {
                 g_autofree char *path = NULL;
+                g_autoptr(GKeyFile) drop_in = NULL;
 
-                path = g_build_filename (CONFIG_D_DIRECTORY,
+                path = g_build_filename (priv->config_d_directory,
                                          g_array_index (files, char *, i),
                                          NULL);
-                load_config_file (config, path, FALSE);
+                drop_in = get_config_file (config, path);
+                if (drop_in != NULL)
+                        apply_config_file (snapshot, drop_in, FALSE);
         }
 out:
-        if (!config->priv->wifi_url
-            && (config->priv->enable_wifi_source || config->priv->enable_3g_source)) {
+        if (!snapshot->wifi_url
+            && (snapshot->enable_wifi_source || snapshot->enable_3g_source)) {
                 g_warning ("Wifi URL is not set, disabling wifi and 3g sources");
-                config->priv->enable_wifi_source = FALSE;
-                config->priv->enable_3g_source = FALSE;
+                snapshot->enable_wifi_source = FALSE;
+                snapshot->enable_3g_source = FALSE;
         }
-        if (!config->priv->wifi_submit_url && config->priv->wifi_submit) {
+
+        g_clear_pointer (&priv->snapshot, config_snapshot_free);
+        priv->snapshot = snapshot;
+        apply_overrides (config);
+
+        if (!snapshot->wifi_submit_url && snapshot->wifi_submit) {
                 g_warning ("Wifi submit URL is not set, disabling wifi submissions");
-                config->priv->wifi_submit = FALSE;
+                snapshot->wifi_submit = FALSE;
         }
         gclue_config_print (config);
+
+        g_signal_emit (config, signals[CHANGED], 0);
+}
+
+static gboolean
+on_reload_timeout (gpointer user_data)
+{
+        GClueConfig *config = GCLUE_CONFIG (user_data);
+
+        config->priv->reload_id = 0;
+        g_debug ("Configuration changed, reloading");
+        load_config (config);
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+on_monitor_event (GFileMonitor     *monitor,
+                  GFile            *file,
+                  GFile            *other_file,
+                  GFileMonitorEvent event_type,
+                  gpointer          user_data)
+{
+        GClueConfig *config = GCLUE_CONFIG (user_data);
+        GClueConfigPrivate *priv = config->priv;
+        g_autofree char *path = NULL;
+        g_autofree char *other_path = NULL;
+
+        switch (event_type) {
+        case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+        case G_FILE_MONITOR_EVENT_DELETED:
+        case G_FILE_MONITOR_EVENT_CREATED:
+        case G_FILE_MONITOR_EVENT_MOVED_IN:
+        case G_FILE_MONITOR_EVENT_MOVED_OUT:
+        case G_FILE_MONITOR_EVENT_RENAMED:
+                break;
+        default:
+                return;
+        }
+
+        /* Only the files that changed get parsed again */
+        path = g_file_get_path (file);
+        if (path != NULL)
+                g_hash_table_remove (priv->key_files, path);
+        if (other_file != NULL) {
+                other_path = g_file_get_path (other_file);
+                if (other_path != NULL)
+                        g_hash_table_remove (priv->key_files, other_path);
+        }
+
+        /* Editors tend to generate bursts of events, coalesce them */
+        if (priv->reload_id == 0)
+                priv->reload_id = g_timeout_add (CONFIG_RELOAD_DELAY_MSECS,
+                                                 on_reload_timeout,
+                                                 config);
+}
+
+static GFileMonitor *
+monitor_config_path (GClueConfig *config,
+                     const char  *path,
+                     gboolean     directory)
+{
+        g_autoptr(GFile) file = NULL;
+        g_autoptr(GError) error = NULL;
+        GFileMonitor *monitor;
+
+        file = g_file_new_for_path (path);
+        if (directory)
+                monitor = g_file_monitor_directory (file,
+                                                    G_FILE_MONITOR_WATCH_MOVES,
+                                                    NULL,
+                                                    &error);
+        else
+                monitor = g_file_monitor_file (file,
+                                               G_FILE_MONITOR_NONE,
+                                               NULL,
+                                               &error);
+        if (monitor == NULL) {
+                g_warning ("Failed to monitor '%s': %s", path, error->message);
+                return NULL;
+        }
+
+        g_signal_connect_object (monitor, "changed",
+                                 G_CALLBACK (on_monitor_event),
+                                 config, 0);
+
+        return monitor;
+}
+
+static void
+gclue_config_init (GClueConfig *config)
+{
+        GClueConfigPrivate *priv;
+
+        config->priv = gclue_config_get_instance_private (config);
+        priv = config->priv;
+        priv->config_file_path =
+                g_build_filename (config_directory != NULL ?
+                                  config_directory : CONFIG_DIRECTORY,
+                                  "geoclue.conf", NULL);
+        priv->config_d_directory =
+                g_build_filename (config_directory != NULL ?
+                                  config_directory : CONFIG_DIRECTORY,
+                                  "conf.d", NULL);
+        priv->key_files = g_hash_table_new_full
+                (g_str_hash,
+                 g_str_equal,
+                 g_free,
+                 (GDestroyNotify) g_key_file_unref);
+
+        load_config (config);
+
+        priv->file_monitor = monitor_config_path (config,
+                                                  priv->config_file_path,
+                                                  FALSE);
+        priv->dir_monitor = monitor_config_path (config,
+                                                 priv->config_d_directory,
+                                                 TRUE);
 }
 
+static GClueConfig *config_singleton = NULL;
+
 GClueConfig *
 gclue_config_get_singleton (void)
 {
-        static GClueConfig *config = NULL;
+        if (config_singleton == NULL)
+                config_singleton = g_object_new (GCLUE_TYPE_CONFIG, NULL);
 
-        if (config == NULL)
-                config = g_object_new (GCLUE_TYPE_CONFIG, NULL);
+        return config_singleton;
+}
 
-        return config;
+/**
+ * gclue_config_set_directory:
+ * @directory: directory containing geoclue.conf and conf.d
+ *
+ * Reads the configuration from @directory rather than from the system
+ * configuration directory. Must be called before
+ * gclue_config_get_singleton().
+ **/
+void
+gclue_config_set_directory (const char *directory)
+{
+        g_return_if_fail (config_singleton == NULL);
+
+        g_free (config_directory);
+        config_directory = g_strdup (directory);
 }
 
 gboolean
@@ -616,8 +869,8 @@ gclue_config_is_agent_allowed (GClueConfig     *config,
 {
         gsize i;
 
-        for (i = 0; i < config->priv->num_agents; i++) {
-                if (g_strcmp0 (desktop_id, config->priv->agents[i]) == 0)
+        for (i = 0; i < config->priv->snapshot->num_agents; i++) {
+                if (g_strcmp0 (desktop_id, config->priv->snapshot->agents[i]) == 0)
                         return TRUE;
         }
 
@@ -627,7 +880,7 @@ gclue_config_is_agent_allowed (GClueConfig     *config,
 gsize
 gclue_config_get_num_allowed_agents (GClueConfig *config)
 {
-        return config->priv->num_agents;
+        return config->priv->snapshot->num_agents;
 }
 
 GClueAppPerm
@@ -635,21 +888,14 @@ gclue_config_get_app_perm (GClueConfig     *config,
                            const char      *desktop_id,
                            GClueClientInfo *app_info)
 {
-        GClueConfigPrivate *priv = config->priv;
-        GList *node;
         AppConfig *app_config = NULL;
         gsize i;
         guint64 uid;
 
         g_return_val_if_fail (desktop_id != NULL, GCLUE_APP_PERM_DISALLOWED);
 
-        for (node = priv->app_configs; node != NULL; node = node->next) {
-                if (strcmp (((AppConfig *) node->data)->id, desktop_id) == 0) {
-                        app_config = (AppConfig *) node->data;
-
-                        break;
-                }
-        }
+        app_config = g_hash_table_lookup (config->priv->snapshot->app_configs,
+                                          desktop_id);
 
         if (app_config == NULL) {
                 g_debug ("'%s' not in configuration", desktop_id);
@@ -680,114 +926,138 @@ gboolean
 gclue_config_is_system_component (GClueConfig *config,
                                   const char  *desktop_id)
 {
-        GClueConfigPrivate *priv = config->priv;
-        GList *node;
         AppConfig *app_config = NULL;
 
         g_return_val_if_fail (desktop_id != NULL, FALSE);
 
-        for (node = priv->app_configs; node != NULL; node = node->next) {
-                if (strcmp (((AppConfig *) node->data)->id, desktop_id) == 0) {
-                        app_config = (AppConfig *) node->data;
-
-                        break;
-                }
-        }
+        app_config = g_hash_table_lookup (config->priv->snapshot->app_configs,
+                                          desktop_id);
 
         return (app_config != NULL && app_config->system);
 }
 
+gboolean
+gclue_config_is_app_configured (GClueConfig *config,
+                                const char  *desktop_id)
+{
+        g_return_val_if_fail (desktop_id != NULL, FALSE);
+
+        return g_hash_table_contains (config->priv->snapshot->app_configs,
+                                      desktop_id);
+}
+
 const char *
 gclue_config_get_nmea_socket (GClueConfig *config)
 {
-        return config->priv->nmea_socket;
+        return config->priv->snapshot->nmea_socket;
 }
 
 const char *
 gclue_config_get_wifi_url (GClueConfig *config)
 {
-        return config->priv->wifi_url;
+        return config->priv->snapshot->wifi_url;
 }
 
 const char *
 gclue_config_get_wifi_submit_url (GClueConfig *config)
 {
-        return config->priv->wifi_submit_url;
+        return config->priv->snapshot->wifi_submit_url;
 }
 
 const char *
 gclue_config_get_wifi_submit_nick (GClueConfig *config)
 {
-        return config->priv->wifi_submit_nick;
+        return config->priv->snapshot->wifi_submit_nick;
 }
 
 void
 gclue_config_set_wifi_submit_nick (GClueConfig *config,
                                    const char  *nick)
 {
-        g_clear_pointer (&config->priv->wifi_submit_nick, g_free);
-        config->priv->wifi_submit_nick = g_strdup (nick);
+        g_clear_pointer (&config->priv->submit_nick_override, g_free);
+        config->priv->submit_nick_override = g_strdup (nick);
+        apply_overrides (config);
 }
 
 gboolean
 gclue_config_get_wifi_submit_data (GClueConfig *config)
 {
-        return config->priv->wifi_submit;
+        return config->priv->snapshot->wifi_submit;
 }
 
 void
 gclue_config_set_wifi_submit_data (GClueConfig *config,
                                    gboolean     submit)
 {
-        config->priv->wifi_submit = submit;
+        config->priv->submit_override = submit;
+        config->priv->snapshot->wifi_submit = submit;
 }
 
 gboolean
 gclue_config_get_enable_wifi_source (GClueConfig *config)
 {
-        return config->priv->enable_wifi_source;
+        return config->priv->snapshot->enable_wifi_source;
 }
 
 gboolean
 gclue_config_get_enable_3g_source (GClueConfig *config)
 {
-        return config->priv->enable_3g_source;
+        return config->priv->snapshot->enable_3g_source;
 }
 
 gboolean
 gclue_config_get_enable_modem_gps_source (GClueConfig *config)
 {
-        return config->priv->enable_modem_gps_source;
+        return config->priv->snapshot->enable_modem_gps_source;
 }
 
 gboolean
 gclue_config_get_enable_cdma_source (GClueConfig *config)
 {
-        return config->priv->enable_cdma_source;
+        return config->priv->snapshot->enable_cdma_source;
 }
 
 gboolean
 gclue_config_get_enable_nmea_source (GClueConfig *config)
 {
-        return config->priv->enable_nmea_source;
+        return config->priv->snapshot->enable_nmea_source;
 }
 
 void
 gclue_config_set_nmea_socket (GClueConfig *config,
                               const char  *nmea_socket)
 {
-        g_clear_pointer (&config->priv->nmea_socket, g_free);
-        config->priv->nmea_socket = g_strdup (nmea_socket);
+        g_clear_pointer (&config->priv->nmea_socket_override, g_free);
+        config->priv->nmea_socket_override = g_strdup (nmea_socket);
+        apply_overrides (config);
 }
 
 gboolean
 gclue_config_get_enable_compass (GClueConfig *config)
 {
-        return config->priv->enable_compass;
+        return config->priv->snapshot->enable_compass;
 }
 
 gboolean
 gclue_config_get_enable_static_source (GClueConfig *config)
 {
-        return config->priv->enable_static_source;
+        return config->priv->snapshot->enable_static_source;
+}
+
+gboolean
+gclue_config_get_enable_plugins (GClueConfig *config)
+{
+        return config->priv->snapshot->enable_plugins;
+}
+
+gboolean
+gclue_config_get_enable_metrics (GClueConfig *config)
+{
+        return config->priv->snapshot->enable_metrics;
+}
+
+gboolean
+gclue_config_get_enable_last_location (GClueConfig *config)
+{
+        return config->priv->snapshot->enable_last_location;
 }
@@ -64,6 +64,7 @@ struct _GClueConfigClass
 GType gclue_config_get_type (void) G_GNUC_CONST;
 
 GClueConfig *       gclue_config_get_singleton          (void);
+void                gclue_config_set_directory          (const char      *directory);
 gboolean            gclue_config_is_agent_allowed       (GClueConfig     *config,
                                                          const char      *desktop_id,
                                                          GClueClientInfo *agent_info);
@@ -73,6 +74,8 @@ GClueAppPerm        gclue_config_get_app_perm           (GClueConfig     *config
                                                          GClueClientInfo *app_info);
 gboolean            gclue_config_is_system_component    (GClueConfig     *config,
                                                          const char      *desktop_id);
+gboolean            gclue_config_is_app_configured      (GClueConfig     *config,
+                                                         const char      *desktop_id);
 const char *        gclue_config_get_nmea_socket        (GClueConfig     *config);
 void                gclue_config_set_nmea_socket        (GClueConfig     *config,
                                                          const char  *nmea_socket);
@@ -94,6 +97,10 @@ gboolean            gclue_config_get_enable_nmea_source (GClueConfig     *config
 gboolean            gclue_config_get_enable_compass     (GClueConfig     *config);
 gboolean            gclue_config_get_enable_static_source
                                                         (GClueConfig *config);
+gboolean            gclue_config_get_enable_plugins     (GClueConfig     *config);
+gboolean            gclue_config_get_enable_metrics     (GClueConfig     *config);
+gboolean            gclue_config_get_enable_last_location
+                                                        (GClueConfig     *config);
 
 G_END_DECLS
 
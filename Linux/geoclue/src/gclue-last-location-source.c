@@ -0,0 +1,474 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+#include "gclue-last-location-source.h"
+#include "gclue-location.h"
+#include "gclue-enum-types.h"
+
+/**
+ * SECTION:gclue-last-location-source
+ * @short_description: Last known location
+ *
+ * Remembers the best recent location the locators settled on and saves it
+ * to disk, periodically and when the daemon exits. When a client starts
+ * again, possibly in a new daemon, the remembered location is published
+ * right away as a provisional location, with its accuracy widened by its
+ * age, while the real sources are still scanning or querying.
+ **/
+
+#define LAST_LOCATION_DIR LOCALSTATEDIR "/lib/geoclue"
+#define LAST_LOCATION_PATH LAST_LOCATION_DIR "/last-location"
+#define LAST_LOCATION_GROUP "last-location"
+
+/* How fast we assume the device might have moved since the location was
+ * found, in meters per second. Widening the accuracy circle at walking speed
+ * keeps the location plausible for the seconds it takes the real sources to
+ * answer, without dismissing it for a device that stayed home overnight.
+ */
+#define ASSUMED_SPEED 1.5
+
+/* How often the remembered location is written out if it changed.
+ * In seconds.
+ */
+#define SAVE_INTERVAL (5 * 60)
+
+struct _GClueLastLocationSource {
+        /* <private> */
+        GClueLocationSource parent_instance;
+};
+
+typedef struct {
+        GClueLocation *location;
+        guint location_set_timer;
+} GClueLastLocationSourcePrivate;
+
+G_DEFINE_TYPE_WITH_PRIVATE (GClueLastLocationSource,
+                            gclue_last_location_source,
+                            GCLUE_TYPE_LOCATION_SOURCE)
+
+/* Shared by all locators, outlives the source singletons. */
+static GClueLocation *last_location;
+static gboolean last_location_loaded;
+static gboolean last_location_dirty;
+static guint save_timer;
+
+static GClueLastLocationSourcePrivate *
+get_priv (GClueLastLocationSource *source)
+{
+        return gclue_last_location_source_get_instance_private (source);
+}
+
+/* Accuracy of @location at Unix time @now. */
+static gdouble
+get_aged_accuracy (GClueLocation *location,
+                   gint64         now)
+{
+        gint64 age;
+
+        age = now - (gint64) gclue_location_get_timestamp (location);
+
+        return gclue_location_get_accuracy (location) +
+               MAX (age, 0) * ASSUMED_SPEED;
+}
+
+static GClueAccuracyLevel
+accuracy_to_level (gdouble accuracy)
+{
+        if (accuracy <= GCLUE_LOCATION_ACCURACY_EXACT)
+                return GCLUE_ACCURACY_LEVEL_EXACT;
+        if (accuracy <= GCLUE_LOCATION_ACCURACY_STREET)
+                return GCLUE_ACCURACY_LEVEL_STREET;
+        if (accuracy <= GCLUE_LOCATION_ACCURACY_NEIGHBORHOOD)
+                return GCLUE_ACCURACY_LEVEL_NEIGHBORHOOD;
+        if (accuracy <= GCLUE_LOCATION_ACCURACY_CITY)
+                return GCLUE_ACCURACY_LEVEL_CITY;
+        if (accuracy <= GCLUE_LOCATION_ACCURACY_COUNTRY)
+                return GCLUE_ACCURACY_LEVEL_COUNTRY;
+
+        return GCLUE_ACCURACY_LEVEL_NONE;
+}
+
+static void
+load_last_location (void)
+{
+        g_autoptr(GKeyFile) key_file = NULL;
+        g_autoptr(GError) error = NULL;
+        gdouble latitude, longitude, accuracy, altitude;
+        guint64 timestamp;
+
+        if (last_location_loaded)
+                return;
+        last_location_loaded = TRUE;
+
+        key_file = g_key_file_new ();
+        if (!g_key_file_load_from_file (key_file, LAST_LOCATION_PATH,
+                                        G_KEY_FILE_NONE, &error)) {
+                if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+                        g_warning ("Failed to load " LAST_LOCATION_PATH ": %s",
+                                   error->message);
+                return;
+        }
+
+        latitude = g_key_file_get_double (key_file, LAST_LOCATION_GROUP,
+                                          "latitude", &error);
+        if (error == NULL)
+                longitude = g_key_file_get_double (key_file,
+                                                   LAST_LOCATION_GROUP,
+                                                   "longitude", &error);
+        if (error == NULL)
+                accuracy = g_key_file_get_double (key_file,
+                                                  LAST_LOCATION_GROUP,
+                                                  "accuracy", &error);
+        if (error == NULL)
+                timestamp = g_key_file_get_uint64 (key_file,
+                                                   LAST_LOCATION_GROUP,
+                                                   "timestamp", &error);
+        if (error != NULL) {
+                g_warning ("Invalid " LAST_LOCATION_PATH ": %s",
+                           error->message);
+                return;
+        }
+
+        altitude = g_key_file_get_double (key_file, LAST_LOCATION_GROUP,
+                                          "altitude", NULL);
+        if (!g_key_file_has_key (key_file, LAST_LOCATION_GROUP,
+                                 "altitude", NULL))
+                altitude = GCLUE_LOCATION_ALTITUDE_UNKNOWN;
+
+        if (latitude < -90 || latitude > 90 ||
+            longitude < -180 || longitude > 180 ||
+            accuracy < 0 || timestamp == 0) {
+                g_warning ("Invalid " LAST_LOCATION_PATH ": "
+                           "location out of range");
+                return;
+        }
+
+        last_location = gclue_location_new_full (latitude,
+                                                 longitude,
+                                                 accuracy,
+                                                 GCLUE_LOCATION_SPEED_UNKNOWN,
+                                                 GCLUE_LOCATION_HEADING_UNKNOWN,
+                                                 altitude,
+                                                 timestamp,
+                                                 "Last known location");
+        g_debug ("Loaded last known location from %" G_GUINT64_FORMAT,
+                 timestamp);
+}
+
+/**
+ * gclue_last_location_source_save:
+ *
+ * Writes the remembered location to disk, if it changed since the last
+ * time. Called periodically, and by the main loop's owner before exiting.
+ **/
+void
+gclue_last_location_source_save (void)
+{
+        g_autoptr(GKeyFile) key_file = NULL;
+        g_autoptr(GError) error = NULL;
+        g_autofree char *data = NULL;
+        gsize length;
+        gdouble altitude;
+
+        g_clear_handle_id (&save_timer, g_source_remove);
+
+        if (!last_location_dirty || last_location == NULL)
+                return;
+
+        key_file = g_key_file_new ();
+        g_key_file_set_double (key_file, LAST_LOCATION_GROUP, "latitude",
+                               gclue_location_get_latitude (last_location));
+        g_key_file_set_double (key_file, LAST_LOCATION_GROUP, "longitude",
+                               gclue_location_get_longitude (last_location));
+        g_key_file_set_double (key_file, LAST_LOCATION_GROUP, "accuracy",
+                               gclue_location_get_accuracy (last_location));
+        altitude = gclue_location_get_altitude (last_location);
+        if (altitude != GCLUE_LOCATION_ALTITUDE_UNKNOWN)
+                g_key_file_set_double (key_file, LAST_LOCATION_GROUP,
+                                       "altitude", altitude);
+        g_key_file_set_uint64 (key_file, LAST_LOCATION_GROUP, "timestamp",
+                               gclue_location_get_timestamp (last_location));
+        data = g_key_file_to_data (key_file, &length, NULL);
+
+        if (g_mkdir_with_parents (LAST_LOCATION_DIR, 0700) < 0) {
+                g_warning ("Failed to create " LAST_LOCATION_DIR ": %s",
+                           g_strerror (errno));
+                return;
+        }
+
+        if (!g_file_set_contents_full (LAST_LOCATION_PATH, data, length,
+                                       G_FILE_SET_CONTENTS_CONSISTENT,
+                                       0600, &error)) {
+                g_warning ("Failed to save last known location: %s",
+                           error->message);
+                return;
+        }
+
+        last_location_dirty = FALSE;
+        g_debug ("Saved last known location to " LAST_LOCATION_PATH);
+}
+
+static gboolean
+on_save_timer (gpointer user_data)
+{
+        save_timer = 0;
+        gclue_last_location_source_save ();
+
+        return G_SOURCE_REMOVE;
+}
+
+/**
+ * gclue_last_location_source_remember:
+ * @location: a location a locator just accepted
+ *
+ * Remembers @location if it is better than the remembered one has become
+ * by the time @location was found. The remembered location is what
+ * sources created from now on publish, and is saved to disk later.
+ **/
+void
+gclue_last_location_source_remember (GClueLocation *location)
+{
+        gdouble accuracy;
+
+        load_last_location ();
+
+        accuracy = gclue_location_get_accuracy (location);
+        if (accuracy == GCLUE_LOCATION_ACCURACY_UNKNOWN)
+                return;
+
+        if (last_location != NULL &&
+            get_aged_accuracy (last_location,
+                               gclue_location_get_timestamp (location)) <
+            accuracy)
+                return;
+
+        g_clear_object (&last_location);
+        last_location = gclue_location_new_full
+                (gclue_location_get_latitude (location),
+                 gclue_location_get_longitude (location),
+                 accuracy,
+                 GCLUE_LOCATION_SPEED_UNKNOWN,
+                 GCLUE_LOCATION_HEADING_UNKNOWN,
+                 gclue_location_get_altitude (location),
+                 gclue_location_get_timestamp (location),
+                 "Last known location");
+        last_location_dirty = TRUE;
+
+        if (save_timer == 0)
+                save_timer = g_timeout_add_seconds (SAVE_INTERVAL,
+                                                    on_save_timer,
+                                                    NULL);
+}
+
+static void
+update_accuracy (GClueLastLocationSource *source)
+{
+        GClueLastLocationSourcePrivate *priv = get_priv (source);
+        GClueAccuracyLevel level_old, level_new;
+
+        if (!priv->location) {
+                level_new = GCLUE_ACCURACY_LEVEL_NONE;
+        } else {
+                gboolean scramble_location;
+
+                level_new = accuracy_to_level
+                        (gclue_location_get_accuracy (priv->location));
+
+                g_object_get (G_OBJECT(source), "scramble-location",
+                              &scramble_location, NULL);
+                if (scramble_location)
+                        level_new = MIN (level_new, GCLUE_ACCURACY_LEVEL_CITY);
+        }
+
+        level_old = gclue_location_source_get_available_accuracy_level
+                (GCLUE_LOCATION_SOURCE (source));
+        if (level_new == level_old)
+                return;
+
+        g_debug ("Available accuracy level from %s: %u",
+                 G_OBJECT_TYPE_NAME (source), level_new);
+        g_object_set (G_OBJECT (source),
+                      "available-accuracy-level", level_new,
+                      NULL);
+}
+
+/* Picks up the remembered location, aged to now, unless the source is
+ * already publishing one.
+ */
+static void
+refresh_location (GClueLastLocationSource *source)
+{
+        GClueLastLocationSourcePrivate *priv = get_priv (source);
+        gdouble accuracy;
+
+        if (gclue_location_source_get_active (GCLUE_LOCATION_SOURCE (source)))
+                return;
+
+        g_clear_object (&priv->location);
+
+        load_last_location ();
+        if (last_location != NULL) {
+                accuracy = get_aged_accuracy
+                        (last_location, g_get_real_time () / G_USEC_PER_SEC);
+
+                if (accuracy_to_level (accuracy) != GCLUE_ACCURACY_LEVEL_NONE) {
+                        priv->location = gclue_location_new_full
+                                (gclue_location_get_latitude (last_location),
+                                 gclue_location_get_longitude (last_location),
+                                 accuracy,
+                                 GCLUE_LOCATION_SPEED_UNKNOWN,
+                                 GCLUE_LOCATION_HEADING_UNKNOWN,
+                                 gclue_location_get_altitude (last_location),
+                                 gclue_location_get_timestamp (last_location),
+                                 "Last known location");
+                } else {
+                        g_debug ("Last known location too old to use");
+                }
+        }
+
+        update_accuracy (source);
+}
+
+static gboolean
+on_location_set_timer (gpointer user_data)
+{
+        GClueLastLocationSource *source = GCLUE_LAST_LOCATION_SOURCE (user_data);
+        GClueLastLocationSourcePrivate *priv = get_priv (source);
+
+        priv->location_set_timer = 0;
+
+        g_debug ("Publishing last known location, accuracy %.0f m",
+                 gclue_location_get_accuracy (priv->location));
+        gclue_location_source_set_location
+                (GCLUE_LOCATION_SOURCE (source), priv->location);
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+gclue_last_location_source_finalize (GObject *object)
+{
+        GClueLastLocationSource *source = GCLUE_LAST_LOCATION_SOURCE (object);
+        GClueLastLocationSourcePrivate *priv = get_priv (source);
+
+        g_clear_handle_id (&priv->location_set_timer, g_source_remove);
+        g_clear_object (&priv->location);
+
+        G_OBJECT_CLASS (gclue_last_location_source_parent_class)->finalize (object);
+}
+
+static GClueLocationSourceStartResult
+gclue_last_location_source_start (GClueLocationSource *source)
+{
+        GClueLastLocationSourcePrivate *priv;
+        GClueLocationSourceClass *base_class;
+        GClueLocationSourceStartResult base_result;
+
+        g_return_val_if_fail (GCLUE_IS_LAST_LOCATION_SOURCE (source),
+                              GCLUE_LOCATION_SOURCE_START_RESULT_FAILED);
+        priv = get_priv (GCLUE_LAST_LOCATION_SOURCE (source));
+
+        base_class = GCLUE_LOCATION_SOURCE_CLASS
+                (gclue_last_location_source_parent_class);
+        base_result = base_class->start (source);
+        if (base_result != GCLUE_LOCATION_SOURCE_START_RESULT_OK)
+                return base_result;
+
+        /* Publish from the main loop, once the locator is listening. */
+        if (priv->location != NULL && priv->location_set_timer == 0)
+                priv->location_set_timer = g_idle_add (on_location_set_timer,
+                                                       source);
+
+        return base_result;
+}
+
+static GClueLocationSourceStopResult
+gclue_last_location_source_stop (GClueLocationSource *source)
+{
+        GClueLastLocationSourcePrivate *priv;
+        GClueLocationSourceClass *base_class;
+        GClueLocationSourceStopResult base_result;
+
+        g_return_val_if_fail (GCLUE_IS_LAST_LOCATION_SOURCE (source),
+                              GCLUE_LOCATION_SOURCE_STOP_RESULT_FAILED);
+        priv = get_priv (GCLUE_LAST_LOCATION_SOURCE (source));
+
+        base_class = GCLUE_LOCATION_SOURCE_CLASS
+                (gclue_last_location_source_parent_class);
+        base_result = base_class->stop (source);
+        if (base_result == GCLUE_LOCATION_SOURCE_STOP_RESULT_OK)
+                g_clear_handle_id (&priv->location_set_timer, g_source_remove);
+
+        return base_result;
+}
+
+static void
+gclue_last_location_source_class_init (GClueLastLocationSourceClass *klass)
+{
+        GClueLocationSourceClass *source_class = GCLUE_LOCATION_SOURCE_CLASS (klass);
+        GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+        object_class->finalize = gclue_last_location_source_finalize;
+
+        source_class->start = gclue_last_location_source_start;
+        source_class->stop = gclue_last_location_source_stop;
+}
+
+static void
+gclue_last_location_source_init (GClueLastLocationSource *source)
+{
+}
+
+/**
+ * gclue_last_location_source_get_singleton:
+ *
+ * Get the #GClueLastLocationSource singleton, for the specified max accuracy
+ * level @level.
+ *
+ * Returns: (transfer full): a new ref to #GClueLastLocationSource. Use
+ * g_object_unref() when done.
+ **/
+GClueLastLocationSource *
+gclue_last_location_source_get_singleton (GClueAccuracyLevel level)
+{
+        static GClueLastLocationSource *source[] = { NULL, NULL };
+        gboolean is_exact;
+        int i;
+
+        is_exact = level == GCLUE_ACCURACY_LEVEL_EXACT;
+
+        i = is_exact ? 0 : 1;
+        if (source[i] == NULL) {
+                source[i] = g_object_new (GCLUE_TYPE_LAST_LOCATION_SOURCE,
+                                          "compute-movement", FALSE,
+                                          "scramble-location", !is_exact,
+                                          NULL);
+                g_object_add_weak_pointer (G_OBJECT (source[i]),
+                                           (gpointer) &source[i]);
+        } else {
+                g_object_ref (source[i]);
+        }
+
+        refresh_location (source[i]);
+
+        return source[i];
+}
@@ -0,0 +1,42 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef GCLUE_LAST_LOCATION_SOURCE_H
+#define GCLUE_LAST_LOCATION_SOURCE_H
+
+#include <glib.h>
+#include "gclue-location-source.h"
+
+G_BEGIN_DECLS
+
+#define GCLUE_TYPE_LAST_LOCATION_SOURCE gclue_last_location_source_get_type ()
+
+G_DECLARE_FINAL_TYPE (GClueLastLocationSource,
+                      gclue_last_location_source,
+                      GCLUE, LAST_LOCATION_SOURCE,
+                      GClueLocationSource)
+
+GClueLastLocationSource *gclue_last_location_source_get_singleton
+                                        (GClueAccuracyLevel level);
+
+void gclue_last_location_source_remember (GClueLocation *location);
+void gclue_last_location_source_save     (void);
+
+G_END_DECLS
+
+#endif /* GCLUE_LAST_LOCATION_SOURCE_H */
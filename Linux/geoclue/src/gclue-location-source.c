@@ -20,8 +20,11 @@
  */
 
 #include <glib.h>
+#include <math.h>
 #include <config.h>
 #include "gclue-location-source.h"
+#include "gclue-metrics.h"
+#include "gclue-trace.h"
 
 #if GCLUE_USE_COMPASS
 #include "gclue-compass.h"
@@ -41,9 +44,24 @@ start_source (GClueLocationSource *source);
 static GClueLocationSourceStopResult
 stop_source (GClueLocationSource *source);
 
+/* Quantized identity of a location handed to set_location(), used to drop
+ * updates that wouldn't change anything downstream. Coordinates are kept to
+ * 1e-7 degrees (~1cm), accuracy to centimeters and the timestamp to seconds,
+ * which is as precise as any of our sources report them.
+ */
+typedef struct {
+        gint64 latitude;
+        gint64 longitude;
+        gint64 accuracy;
+        guint64 timestamp;
+} LocationFingerprint;
+
 struct _GClueLocationSourcePrivate
 {
         GClueLocation *location;
+        LocationFingerprint fingerprint;
+        gboolean fingerprint_valid;
+        guint updates, suppressed_updates;
 
         guint active_counter;
         GClueMinUINT *time_threshold;
@@ -363,6 +381,11 @@ stop_source (GClueLocationSource *source)
                 return GCLUE_LOCATION_SOURCE_STOP_RESULT_STILL_USED;
         }
 
+        /* Let the first location after a restart through, even if it's the
+         * one we had before.
+         */
+        source->priv->fingerprint_valid = FALSE;
+
 #if GCLUE_USE_COMPASS
         if (source->priv->compass) {
                 g_signal_handler_disconnect (source->priv->compass,
@@ -423,6 +446,29 @@ gclue_location_source_get_location (GClueLocationSource *source)
 /* 1 km in latitude is always .00899928005759539236 degrees */
 #define LATITUDE_IN_KM .00899928005759539236
 
+static void
+location_fingerprint_fill (LocationFingerprint *fingerprint,
+                           GClueLocation       *location)
+{
+        fingerprint->latitude =
+                llround (gclue_location_get_latitude (location) * 1e7);
+        fingerprint->longitude =
+                llround (gclue_location_get_longitude (location) * 1e7);
+        fingerprint->accuracy =
+                llround (gclue_location_get_accuracy (location) * 100);
+        fingerprint->timestamp = gclue_location_get_timestamp (location);
+}
+
+static gboolean
+location_fingerprint_equal (const LocationFingerprint *a,
+                            const LocationFingerprint *b)
+{
+        return a->latitude == b->latitude &&
+               a->longitude == b->longitude &&
+               a->accuracy == b->accuracy &&
+               a->timestamp == b->timestamp;
+}
+
 /**
  * gclue_location_source_set_location:
  * @source: a #GClueLocationSource
@@ -436,10 +482,44 @@ gclue_location_source_set_location (GClueLocationSource *source,
 {
         GClueLocationSourcePrivate *priv = source->priv;
         GClueLocation *cur_location;
+        LocationFingerprint fingerprint;
         gdouble speed, heading;
+        guint64 trace_id;
+
+        priv->updates++;
+
+        /* Sources that don't trace their own stages start a trace here. */
+        trace_id = gclue_location_get_trace_id (location);
+        if (trace_id == 0)
+                trace_id = gclue_trace_new_id ();
+
+        /* Drop no-op updates before they reach the locator and clients. This
+         * is done on the location as given to us, so a duplicate doesn't get
+         * scrambled a second time either.
+         */
+        location_fingerprint_fill (&fingerprint, location);
+        if (priv->fingerprint_valid &&
+            location_fingerprint_equal (&fingerprint, &priv->fingerprint)) {
+                priv->suppressed_updates++;
+                g_debug ("%s: suppressed duplicate location update "
+                         "(%u of %u updates suppressed)",
+                         G_OBJECT_TYPE_NAME (source),
+                         priv->suppressed_updates, priv->updates);
+                gclue_metrics_inc (GCLUE_METRIC_FIXES_DROPPED, "duplicate");
+                GCLUE_TRACE_INSTANT ("location-dropped", trace_id,
+                                     "duplicate");
+                return;
+        }
+        priv->fingerprint = fingerprint;
+        priv->fingerprint_valid = TRUE;
+        gclue_metrics_inc (GCLUE_METRIC_SOURCE_UPDATES,
+                           G_OBJECT_TYPE_NAME (source));
+        GCLUE_TRACE_INSTANT ("source-location", trace_id,
+                             G_OBJECT_TYPE_NAME (source));
 
         cur_location = priv->location;
         priv->location = gclue_location_duplicate (location);
+        gclue_location_set_trace_id (priv->location, trace_id);
 
         if (priv->scramble_location) {
                 gdouble latitude, distance, accuracy, scramble_range;
@@ -507,6 +587,21 @@ gclue_location_source_set_location (GClueLocationSource *source,
         g_clear_object (&cur_location);
 }
 
+/**
+ * gclue_location_source_get_suppressed_updates:
+ * @source: a #GClueLocationSource
+ *
+ * Returns: The number of location updates that were dropped because they
+ * were identical to the previous one.
+ **/
+guint
+gclue_location_source_get_suppressed_updates (GClueLocationSource *source)
+{
+        g_return_val_if_fail (GCLUE_IS_LOCATION_SOURCE (source), 0);
+
+        return source->priv->suppressed_updates;
+}
+
 /**
  * gclue_location_source_get_active:
  * @source: a #GClueLocationSource
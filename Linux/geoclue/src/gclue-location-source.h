@@ -84,6 +84,8 @@ void              gclue_location_source_set_location
                                                GClueLocation       *location);
 gboolean          gclue_location_source_get_active
                                               (GClueLocationSource *source);
+guint             gclue_location_source_get_suppressed_updates
+                                              (GClueLocationSource *source);
 gboolean          gclue_location_source_get_priority_source
                                               (GClueLocationSource *source);
 GClueAccuracyLevel
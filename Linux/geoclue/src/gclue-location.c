@@ -45,6 +45,8 @@ struct _GClueLocationPrivate {
         guint64 timestamp;
         gdouble speed;
         gdouble heading;
+
+        guint64 trace_id;
 };
 
 enum {
@@ -775,9 +777,11 @@ gclue_location_create_from_nmeas (const char     *nmeas[],
 GClueLocation *
 gclue_location_duplicate (GClueLocation *location)
 {
+        GClueLocation *copy;
+
         g_return_val_if_fail (GCLUE_IS_LOCATION (location), NULL);
 
-        return g_object_new
+        copy = g_object_new
                 (GCLUE_TYPE_LOCATION,
                  "latitude", location->priv->latitude,
                  "longitude", location->priv->longitude,
@@ -788,6 +792,9 @@ gclue_location_duplicate (GClueLocation *location)
                  "heading", location->priv->heading,
                  "description", location->priv->description,
                  NULL);
+        copy->priv->trace_id = location->priv->trace_id;
+
+        return copy;
 }
 
 /**
@@ -1120,3 +1127,36 @@ gclue_location_get_distance_from (GClueLocation *loca,
         c = 2 * atan2 (sqrt (a), sqrt (1-a));
         return 1000.0 * EARTH_RADIUS_KM * c;
 }
+
+/**
+ * gclue_location_get_trace_id:
+ * @loc: a #GClueLocation
+ *
+ * Gets the correlation ID of the trace events about @loc.
+ *
+ * Returns: The trace ID, or 0 if none was assigned.
+ **/
+guint64
+gclue_location_get_trace_id (GClueLocation *loc)
+{
+        g_return_val_if_fail (GCLUE_IS_LOCATION (loc), 0);
+
+        return loc->priv->trace_id;
+}
+
+/**
+ * gclue_location_set_trace_id:
+ * @loc: a #GClueLocation
+ * @trace_id: a correlation ID from gclue_trace_new_id()
+ *
+ * Sets the correlation ID of the trace events about @loc. It is kept by
+ * gclue_location_duplicate().
+ **/
+void
+gclue_location_set_trace_id (GClueLocation *loc,
+                             guint64        trace_id)
+{
+        g_return_if_fail (GCLUE_IS_LOCATION (loc));
+
+        loc->priv->trace_id = trace_id;
+}
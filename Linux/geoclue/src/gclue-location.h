@@ -206,4 +206,9 @@ double gclue_location_get_distance_from
                                   (GClueLocation *loca,
                                    GClueLocation *locb);
 
+guint64 gclue_location_get_trace_id
+                                  (GClueLocation *loc);
+void gclue_location_set_trace_id  (GClueLocation *loc,
+                                   guint64        trace_id);
+
 #endif /* GCLUE_LOCATION_H */
@@ -29,8 +29,11 @@
 #include "gclue-locator.h"
 
 #include "gclue-static-source.h"
+#include "gclue-last-location-source.h"
 #include "gclue-wifi.h"
 #include "gclue-config.h"
+#include "gclue-metrics.h"
+#include "gclue-trace.h"
 
 #if GCLUE_USE_3G_SOURCE
 #include "gclue-3g.h"
@@ -48,6 +51,10 @@
 #include "gclue-nmea-source.h"
 #endif
 
+#if GCLUE_USE_PLUGINS
+#include "gclue-plugin-loader.h"
+#endif
+
 /* This class is like a master location source that hides all individual
  * location sources from rest of the code
  */
@@ -94,15 +101,21 @@ set_location (GClueLocator  *locator,
         GClueLocation *location;
         const char *src_name = NULL;
         gboolean update_priority_source = FALSE;
+        guint64 trace_id;
 
         location = gclue_location_source_get_location (source);
         src_name = G_OBJECT_TYPE_NAME (source);
+        trace_id = gclue_location_get_trace_id (location);
 
         if (gclue_location_get_accuracy (location) ==
             GCLUE_LOCATION_ACCURACY_UNKNOWN) {
                 /* If we do not know the accuracy, discard the update */
                 g_debug ("Discarding %s location with unknown accuracy",
                          src_name);
+                gclue_metrics_inc (GCLUE_METRIC_FIXES_DROPPED,
+                                   "unknown-accuracy");
+                GCLUE_TRACE_INSTANT ("location-dropped", trace_id,
+                                     "unknown-accuracy");
                 return;
         }
 
@@ -118,6 +131,9 @@ set_location (GClueLocator  *locator,
             if (new_timestamp < cur_timestamp) {
                     g_debug ("New %s location older than current, ignoring.",
                              src_name);
+                    gclue_metrics_inc (GCLUE_METRIC_FIXES_DROPPED, "older");
+                    GCLUE_TRACE_INSTANT ("location-dropped", trace_id,
+                                         "older");
                     return;
             }
 
@@ -156,6 +172,10 @@ set_location (GClueLocator  *locator,
                      g_debug ("Priority Source Lock (age %u s) active, ignoring new %s location",
                               (guint) (new_timestamp - locator->priv->priority_source_lock_timestamp),
                               src_name);
+                     gclue_metrics_inc (GCLUE_METRIC_FIXES_DROPPED,
+                                        "priority-lock");
+                     GCLUE_TRACE_INSTANT ("location-dropped", trace_id,
+                                          "priority-lock");
                      return;
             }
 
@@ -172,13 +192,29 @@ set_location (GClueLocator  *locator,
                      * the previous one.
                      */
                     g_debug ("Ignoring less accurate new %s location", src_name);
+                    gclue_metrics_inc (GCLUE_METRIC_FIXES_DROPPED,
+                                       "less-accurate");
+                    GCLUE_TRACE_INSTANT ("location-dropped", trace_id,
+                                         "less-accurate");
                     return;
             }
         }
 
         g_debug ("New location available from %s", src_name);
+        GCLUE_TRACE_INSTANT ("locator-accepted", trace_id, src_name);
         gclue_location_source_set_location (GCLUE_LOCATION_SOURCE (locator),
                                             location);
+
+        if (gclue_config_get_enable_last_location (gclue_config_get_singleton ()) &&
+            !GCLUE_IS_LAST_LOCATION_SOURCE (source)) {
+                gboolean scramble_location;
+
+                /* Scrambled locations are not worth keeping. */
+                g_object_get (G_OBJECT (source), "scramble-location",
+                              &scramble_location, NULL);
+                if (!scramble_location)
+                        gclue_last_location_source_remember (location);
+        }
 }
 
 static gint
@@ -464,6 +500,24 @@ gclue_locator_constructed (GObject *object)
                 locator->priv->sources = g_list_append (locator->priv->sources,
                                                         static_source);
         }
+        if (gclue_config_get_enable_last_location (gconfig)) {
+                GClueLastLocationSource *last_location_source;
+
+                last_location_source = gclue_last_location_source_get_singleton
+                        (locator->priv->accuracy_level);
+                locator->priv->sources = g_list_append (locator->priv->sources,
+                                                        last_location_source);
+        }
+#if GCLUE_USE_PLUGINS
+        if (gclue_config_get_enable_plugins (gconfig)) {
+                GList *plugin_sources;
+
+                plugin_sources = gclue_plugin_loader_create_sources
+                        (locator->priv->accuracy_level);
+                locator->priv->sources = g_list_concat (locator->priv->sources,
+                                                        plugin_sources);
+        }
+#endif
 
         for (node = locator->priv->sources; node != NULL; node = node->next) {
                 g_signal_connect (G_OBJECT (node->data),
@@ -22,12 +22,17 @@
 #include <config.h>
 
 #include <glib.h>
+#include <glib-unix.h>
 #include <locale.h>
+#include <signal.h>
 #include <glib/gi18n.h>
 #include <stdlib.h>
 
 #include "gclue-service-manager.h"
 #include "gclue-config.h"
+#include "gclue-last-location-source.h"
+#include "gclue-metrics.h"
+#include "gclue-trace.h"
 
 #define BUS_NAME "org.freedesktop.GeoClue2"
 
@@ -37,6 +42,7 @@ static gint inactivity_timeout = 60;
 static gboolean submit_data = FALSE;
 static char *submit_nick = NULL;
 static char *nmea_socket = NULL;
+static char *config_dir = NULL;
 
 static GOptionEntry entries[] =
 {
@@ -75,6 +81,13 @@ static GOptionEntry entries[] =
           &nmea_socket,
           N_("Path to nmea UNIX socket"),
           NULL },
+        { "config-dir",
+          'c',
+          0,
+          G_OPTION_ARG_FILENAME,
+          &config_dir,
+          N_("Read geoclue.conf and conf.d from DIR"),
+          "DIR" },
         { NULL }
 };
 
@@ -92,6 +105,16 @@ on_inactivity_timeout (gpointer user_data)
         return FALSE;
 }
 
+static gboolean
+on_quit_signal (gpointer user_data)
+{
+        g_message ("Received signal %d. Shutting down..",
+                   GPOINTER_TO_INT (user_data));
+        g_main_loop_quit (main_loop);
+
+        return G_SOURCE_REMOVE;
+}
+
 static void
 on_active_notify (GObject    *gobject,
                   GParamSpec *pspec,
@@ -137,6 +160,9 @@ on_bus_acquired (GDBusConnection *connection,
                           G_CALLBACK (on_active_notify),
                           NULL);
 
+        gclue_metrics_export (connection);
+        gclue_trace_export (connection);
+
         if (inactivity_timeout > 0)
                 inactivity_timeout_id =
                         g_timeout_add_seconds (inactivity_timeout,
@@ -182,6 +208,8 @@ main (int argc, char **argv)
                 exit (0);
         }
 
+        if (config_dir != NULL)
+                gclue_config_set_directory (config_dir);
         config = gclue_config_get_singleton ();
         if (submit_data)
                 gclue_config_set_wifi_submit_data (config, submit_data);
@@ -200,8 +228,12 @@ main (int argc, char **argv)
                                    NULL);
 
         main_loop = g_main_loop_new (NULL, FALSE);
+        g_unix_signal_add (SIGTERM, on_quit_signal, GINT_TO_POINTER (SIGTERM));
+        g_unix_signal_add (SIGINT, on_quit_signal, GINT_TO_POINTER (SIGINT));
         g_main_loop_run (main_loop);
 
+        gclue_last_location_source_save ();
+
         if (manager != NULL)
                 g_object_unref (manager);
         g_bus_unown_name (owner_id);
@@ -0,0 +1,550 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+#include <gio/gunixsocketaddress.h>
+
+#include "gclue-metrics.h"
+#include "gclue-config.h"
+
+/**
+ * SECTION:gclue-metrics
+ * @short_description: Daemon metrics
+ *
+ * Counters and histograms about what the daemon is doing, exported through
+ * the org.freedesktop.GeoClue2.Metrics D-Bus interface and, in the
+ * Prometheus text format, on a local Unix socket.
+ *
+ * Every metric has a single label. Recording only does a hash table lookup
+ * on the label, memory is allocated the first time a label value is seen.
+ **/
+
+#define METRICS_OBJECT_PATH "/org/freedesktop/GeoClue2/Metrics"
+#define METRICS_SOCKET_DIR "/run/geoclue"
+#define METRICS_SOCKET_PATH METRICS_SOCKET_DIR "/metrics"
+
+/* Upper bounds of the histogram buckets, in seconds. Covers everything from
+ * a cached web query to a slow WiFi scan.
+ */
+static const gdouble bucket_bounds[] = {
+        0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30
+};
+#define N_BUCKETS G_N_ELEMENTS (bucket_bounds)
+
+/* Label values are never pruned, so any more than this are counted as
+ * "other" to keep memory and scrape size bounded.
+ */
+#define MAX_LABEL_VALUES 64
+
+typedef struct {
+        const char *name;
+        const char *help;
+        const char *label;
+        gboolean histogram;
+} MetricInfo;
+
+static const MetricInfo metric_info[GCLUE_METRIC_LAST] = {
+        [GCLUE_METRIC_SOURCE_UPDATES] = {
+                "geoclue_source_updates_total",
+                "Location updates published by each source",
+                "source", FALSE },
+        [GCLUE_METRIC_FIXES_DROPPED] = {
+                "geoclue_fixes_dropped_total",
+                "Location updates discarded before reaching clients",
+                "reason", FALSE },
+        [GCLUE_METRIC_CACHE_HITS] = {
+                "geoclue_cache_hits_total",
+                "Location lookups answered from a cache",
+                "cache", FALSE },
+        [GCLUE_METRIC_CACHE_MISSES] = {
+                "geoclue_cache_misses_total",
+                "Location lookups that had to query the web service",
+                "cache", FALSE },
+        [GCLUE_METRIC_CLIENT_DELIVERIES] = {
+                "geoclue_client_deliveries_total",
+                "Locations signaled to clients",
+                "app", FALSE },
+        [GCLUE_METRIC_WEB_QUERY_SECONDS] = {
+                "geoclue_web_query_seconds",
+                "Duration of web service queries",
+                "query", TRUE },
+        [GCLUE_METRIC_WIFI_SCAN_SECONDS] = {
+                "geoclue_wifi_scan_seconds",
+                "Duration of WiFi scans",
+                "result", TRUE },
+};
+
+typedef struct {
+        guint64 count;
+        gdouble sum;
+        guint64 buckets[N_BUCKETS]; /* Not cumulative */
+} Histogram;
+
+/* (element-type utf8 guint64|Histogram) per metric */
+static GHashTable *metric_values[GCLUE_METRIC_LAST];
+static gint64 start_time;
+
+static gpointer
+lookup_value (GClueMetric  metric,
+              const char  *label)
+{
+        GHashTable *values;
+        gpointer value;
+
+        g_return_val_if_fail (metric < GCLUE_METRIC_LAST, NULL);
+
+        if (label == NULL)
+                label = "";
+
+        values = metric_values[metric];
+        if (values == NULL) {
+                values = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                g_free, g_free);
+                metric_values[metric] = values;
+        }
+
+        value = g_hash_table_lookup (values, label);
+        if (value == NULL &&
+            g_hash_table_size (values) >= MAX_LABEL_VALUES) {
+                label = "other";
+                value = g_hash_table_lookup (values, label);
+        }
+        if (value == NULL) {
+                if (metric_info[metric].histogram)
+                        value = g_new0 (Histogram, 1);
+                else
+                        value = g_new0 (guint64, 1);
+                g_hash_table_insert (values, g_strdup (label), value);
+        }
+
+        return value;
+}
+
+/**
+ * gclue_metrics_count:
+ * @metric: a counter
+ * @label: value of the metric's label
+ * @n: amount to add
+ **/
+void
+gclue_metrics_count (GClueMetric  metric,
+                     const char  *label,
+                     guint64      n)
+{
+        guint64 *counter;
+
+        g_return_if_fail (!metric_info[metric].histogram);
+
+        counter = lookup_value (metric, label);
+        *counter += n;
+}
+
+/**
+ * gclue_metrics_observe:
+ * @metric: a histogram
+ * @label: value of the metric's label
+ * @seconds: the observed duration
+ **/
+void
+gclue_metrics_observe (GClueMetric  metric,
+                       const char  *label,
+                       gdouble      seconds)
+{
+        Histogram *histogram;
+        guint i;
+
+        g_return_if_fail (metric_info[metric].histogram);
+
+        histogram = lookup_value (metric, label);
+        histogram->count++;
+        histogram->sum += seconds;
+        for (i = 0; i < N_BUCKETS; i++) {
+                if (seconds <= bucket_bounds[i]) {
+                        histogram->buckets[i]++;
+                        break;
+                }
+        }
+}
+
+/**
+ * gclue_metrics_observe_since:
+ * @metric: a histogram
+ * @label: value of the metric's label
+ * @start_time: g_get_monotonic_time() at the start of the observed operation
+ **/
+void
+gclue_metrics_observe_since (GClueMetric  metric,
+                             const char  *label,
+                             gint64       start_time)
+{
+        gclue_metrics_observe (metric, label,
+                               (gdouble) (g_get_monotonic_time () - start_time) /
+                               G_USEC_PER_SEC);
+}
+
+typedef void (*SampleFunc) (const char *sample,
+                            gdouble     value,
+                            gboolean    integral,
+                            gpointer    user_data);
+
+static void
+append_label (GString    *str,
+              const char *name,
+              const char *value)
+{
+        const char *p;
+
+        g_string_append_printf (str, "%s=\"", name);
+        for (p = value; *p != '\0'; p++) {
+                if (*p == '\\' || *p == '"')
+                        g_string_append_c (str, '\\');
+                if (*p == '\n')
+                        g_string_append (str, "\\n");
+                else
+                        g_string_append_c (str, *p);
+        }
+        g_string_append_c (str, '"');
+}
+
+static void
+foreach_sample (GClueMetric metric,
+                SampleFunc  func,
+                gpointer    user_data)
+{
+        const MetricInfo *info = &metric_info[metric];
+        g_autoptr(GString) sample = g_string_new (NULL);
+        g_autoptr(GList) labels = NULL;
+        GList *l;
+
+        if (metric_values[metric] == NULL)
+                return;
+
+        /* Stable output makes diffing scrapes easier. */
+        labels = g_list_sort (g_hash_table_get_keys (metric_values[metric]),
+                              (GCompareFunc) g_strcmp0);
+
+        for (l = labels; l != NULL; l = l->next) {
+                const char *label = l->data;
+                gpointer value = g_hash_table_lookup (metric_values[metric],
+                                                      label);
+                const Histogram *histogram = value;
+                guint64 cumulative = 0;
+                guint i;
+
+                if (!info->histogram) {
+                        g_string_printf (sample, "%s{", info->name);
+                        append_label (sample, info->label, label);
+                        g_string_append_c (sample, '}');
+                        func (sample->str, *(guint64 *) value, TRUE, user_data);
+                        continue;
+                }
+
+                for (i = 0; i <= N_BUCKETS; i++) {
+                        char bound[G_ASCII_DTOSTR_BUF_SIZE];
+
+                        if (i < N_BUCKETS) {
+                                cumulative += histogram->buckets[i];
+                                g_ascii_dtostr (bound, sizeof (bound),
+                                                bucket_bounds[i]);
+                        } else {
+                                cumulative = histogram->count;
+                                g_strlcpy (bound, "+Inf", sizeof (bound));
+                        }
+
+                        g_string_printf (sample, "%s_bucket{", info->name);
+                        append_label (sample, info->label, label);
+                        g_string_append_c (sample, ',');
+                        append_label (sample, "le", bound);
+                        g_string_append_c (sample, '}');
+                        func (sample->str, cumulative, TRUE, user_data);
+                }
+
+                g_string_printf (sample, "%s_sum{", info->name);
+                append_label (sample, info->label, label);
+                g_string_append_c (sample, '}');
+                func (sample->str, histogram->sum, FALSE, user_data);
+
+                g_string_printf (sample, "%s_count{", info->name);
+                append_label (sample, info->label, label);
+                g_string_append_c (sample, '}');
+                func (sample->str, histogram->count, TRUE, user_data);
+        }
+}
+
+static gdouble
+get_uptime (void)
+{
+        if (start_time == 0)
+                return 0;
+
+        return (gdouble) (g_get_monotonic_time () - start_time) /
+               G_USEC_PER_SEC;
+}
+
+static void
+add_variant_sample (const char *sample,
+                    gdouble     value,
+                    gboolean    integral,
+                    gpointer    user_data)
+{
+        GVariantBuilder *builder = user_data;
+
+        g_variant_builder_add (builder, "{sv}", sample,
+                               integral ?
+                               g_variant_new_uint64 ((guint64) value) :
+                               g_variant_new_double (value));
+}
+
+/**
+ * gclue_metrics_to_variant:
+ *
+ * Returns: (transfer floating): all samples as an a{sv}, keyed by the
+ * Prometheus sample name including labels. Counters are 't', sums and the
+ * uptime 'd'.
+ **/
+GVariant *
+gclue_metrics_to_variant (void)
+{
+        GVariantBuilder builder;
+        guint i;
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+        g_variant_builder_add (&builder, "{sv}", "geoclue_uptime_seconds",
+                               g_variant_new_double (get_uptime ()));
+        for (i = 0; i < GCLUE_METRIC_LAST; i++)
+                foreach_sample (i, add_variant_sample, &builder);
+
+        return g_variant_builder_end (&builder);
+}
+
+static void
+append_text_sample (const char *sample,
+                    gdouble     value,
+                    gboolean    integral,
+                    gpointer    user_data)
+{
+        GString *text = user_data;
+        char buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+        if (integral)
+                g_string_append_printf (text, "%s %" G_GUINT64_FORMAT "\n",
+                                        sample, (guint64) value);
+        else
+                g_string_append_printf (text, "%s %s\n", sample,
+                                        g_ascii_dtostr (buf, sizeof (buf),
+                                                        value));
+}
+
+/**
+ * gclue_metrics_to_text:
+ *
+ * Returns: (transfer full): all metrics in the Prometheus text exposition
+ * format.
+ **/
+char *
+gclue_metrics_to_text (void)
+{
+        GString *text = g_string_new (NULL);
+        char buf[G_ASCII_DTOSTR_BUF_SIZE];
+        guint i;
+
+        g_string_append_printf (text,
+                                "# HELP geoclue_uptime_seconds Time since metrics were exported\n"
+                                "# TYPE geoclue_uptime_seconds gauge\n"
+                                "geoclue_uptime_seconds %s\n",
+                                g_ascii_dtostr (buf, sizeof (buf),
+                                                get_uptime ()));
+
+        for (i = 0; i < GCLUE_METRIC_LAST; i++) {
+                const MetricInfo *info = &metric_info[i];
+
+                g_string_append_printf (text, "# HELP %s %s\n# TYPE %s %s\n",
+                                        info->name, info->help, info->name,
+                                        info->histogram ? "histogram" :
+                                                          "counter");
+                foreach_sample (i, append_text_sample, text);
+        }
+
+        return g_string_free (text, FALSE);
+}
+
+static const char metrics_introspection[] =
+        "<node>"
+        "  <interface name='org.freedesktop.GeoClue2.Metrics'>"
+        "    <method name='GetMetrics'>"
+        "      <arg name='metrics' type='a{sv}' direction='out'/>"
+        "    </method>"
+        "  </interface>"
+        "</node>";
+
+static void
+handle_method_call (GDBusConnection       *connection,
+                    const char            *sender,
+                    const char            *object_path,
+                    const char            *interface_name,
+                    const char            *method_name,
+                    GVariant              *parameters,
+                    GDBusMethodInvocation *invocation,
+                    gpointer               user_data)
+{
+        if (g_strcmp0 (method_name, "GetMetrics") == 0) {
+                g_dbus_method_invocation_return_value
+                        (invocation,
+                         g_variant_new_tuple ((GVariant *[]) {
+                                 gclue_metrics_to_variant () }, 1));
+                return;
+        }
+
+        g_dbus_method_invocation_return_error (invocation,
+                                               G_DBUS_ERROR,
+                                               G_DBUS_ERROR_UNKNOWN_METHOD,
+                                               "Unknown method %s",
+                                               method_name);
+}
+
+static const GDBusInterfaceVTable metrics_vtable = {
+        handle_method_call, NULL, NULL, { 0 }
+};
+
+static void
+on_text_written (GObject      *source_object,
+                 GAsyncResult *res,
+                 gpointer      user_data)
+{
+        g_autoptr(GSocketConnection) connection = user_data;
+        g_autoptr(GError) error = NULL;
+
+        if (!g_output_stream_write_all_finish (G_OUTPUT_STREAM (source_object),
+                                               res, NULL, &error))
+                g_debug ("Failed to write metrics: %s", error->message);
+
+        g_io_stream_close (G_IO_STREAM (connection), NULL, NULL);
+}
+
+static gboolean
+on_metrics_connection (GSocketService    *service,
+                       GSocketConnection *connection,
+                       GObject           *source_object,
+                       gpointer           user_data)
+{
+        GOutputStream *output;
+        char *text;
+
+        /* Scrapers only read, so a connection is answered right away. The
+         * text is kept alive with the stream until the write completes.
+         */
+        text = gclue_metrics_to_text ();
+        output = g_io_stream_get_output_stream (G_IO_STREAM (connection));
+        g_object_set_data_full (G_OBJECT (output), "metrics-text", text,
+                                g_free);
+        g_output_stream_write_all_async (output, text, strlen (text),
+                                         G_PRIORITY_DEFAULT, NULL,
+                                         on_text_written,
+                                         g_object_ref (connection));
+
+        return TRUE;
+}
+
+static void
+start_metrics_socket (void)
+{
+        static GSocketService *service = NULL;
+        g_autoptr(GSocketAddress) address = NULL;
+        g_autoptr(GError) error = NULL;
+        mode_t old_umask;
+        gboolean listening;
+
+        if (service != NULL)
+                return;
+
+        if (g_mkdir_with_parents (METRICS_SOCKET_DIR, 0755) < 0) {
+                g_warning ("Failed to create " METRICS_SOCKET_DIR ": %s",
+                           g_strerror (errno));
+                return;
+        }
+
+        /* A stale socket file from a previous run would make bind() fail. */
+        g_unlink (METRICS_SOCKET_PATH);
+
+        /* Per-application counts say which apps use location. Created
+         * 0600 right away, a chmod after bind() would leave a window.
+         */
+        service = g_socket_service_new ();
+        address = g_unix_socket_address_new (METRICS_SOCKET_PATH);
+        old_umask = umask (0177);
+        listening = g_socket_listener_add_address (G_SOCKET_LISTENER (service),
+                                                   address,
+                                                   G_SOCKET_TYPE_STREAM,
+                                                   G_SOCKET_PROTOCOL_DEFAULT,
+                                                   NULL, NULL, &error);
+        umask (old_umask);
+        if (!listening) {
+                g_warning ("Failed to listen on " METRICS_SOCKET_PATH ": %s",
+                           error->message);
+                g_clear_object (&service);
+                return;
+        }
+
+        g_signal_connect (service, "incoming",
+                          G_CALLBACK (on_metrics_connection), NULL);
+        g_socket_service_start (service);
+
+        g_debug ("Serving metrics on " METRICS_SOCKET_PATH);
+}
+
+/**
+ * gclue_metrics_export:
+ * @connection: the system bus connection
+ *
+ * Exports the metrics on D-Bus and, if enabled in the configuration, on the
+ * metrics socket.
+ **/
+void
+gclue_metrics_export (GDBusConnection *connection)
+{
+        static GDBusNodeInfo *node_info = NULL;
+        g_autoptr(GError) error = NULL;
+
+        if (start_time == 0)
+                start_time = g_get_monotonic_time ();
+
+        if (!gclue_config_get_enable_metrics (gclue_config_get_singleton ())) {
+                g_debug ("Metrics export disabled in config");
+                return;
+        }
+
+        if (node_info == NULL)
+                node_info = g_dbus_node_info_new_for_xml (metrics_introspection,
+                                                          NULL);
+
+        if (g_dbus_connection_register_object (connection,
+                                               METRICS_OBJECT_PATH,
+                                               node_info->interfaces[0],
+                                               &metrics_vtable,
+                                               NULL, NULL,
+                                               &error) == 0)
+                g_warning ("Failed to export metrics on D-Bus: %s",
+                           error->message);
+
+        start_metrics_socket ();
+}
@@ -0,0 +1,60 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef GCLUE_METRICS_H
+#define GCLUE_METRICS_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+        GCLUE_METRIC_SOURCE_UPDATES,      /* counter, by source */
+        GCLUE_METRIC_FIXES_DROPPED,       /* counter, by reason */
+        GCLUE_METRIC_CACHE_HITS,          /* counter, by cache */
+        GCLUE_METRIC_CACHE_MISSES,        /* counter, by cache */
+        GCLUE_METRIC_CLIENT_DELIVERIES,   /* counter, by application */
+        GCLUE_METRIC_WEB_QUERY_SECONDS,   /* histogram, by query kind */
+        GCLUE_METRIC_WIFI_SCAN_SECONDS,   /* histogram, by result */
+        GCLUE_METRIC_LAST
+} GClueMetric;
+
+void      gclue_metrics_count     (GClueMetric  metric,
+                                   const char  *label,
+                                   guint64      n);
+void      gclue_metrics_observe   (GClueMetric  metric,
+                                   const char  *label,
+                                   gdouble      seconds);
+void      gclue_metrics_observe_since
+                                  (GClueMetric  metric,
+                                   const char  *label,
+                                   gint64       start_time);
+GVariant *gclue_metrics_to_variant (void);
+char     *gclue_metrics_to_text   (void);
+void      gclue_metrics_export    (GDBusConnection *connection);
+
+static inline void
+gclue_metrics_inc (GClueMetric metric,
+                   const char *label)
+{
+        gclue_metrics_count (metric, label, 1);
+}
+
+G_END_DECLS
+
+#endif /* GCLUE_METRICS_H */
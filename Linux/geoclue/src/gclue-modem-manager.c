@@ -494,6 +494,35 @@ on_location_changed_get_cdma (GObject *modem_object,
 #endif
 }
 
+/* Talker IDs we accept fixes from, in order of preference. Combined
+ * multi-constellation solutions (GN) come first, then the single
+ * constellation ones: GPS, GLONASS, Galileo, BeiDou (both IDs) and QZSS.
+ */
+static const char *nmea_talkers[] = { "GN", "GP", "GL", "GA", "BD", "GB", "GQ" };
+
+/* Returns the trace of NMEA sentence type @type ("GGA", "RMC") from the most
+ * preferred talker present in @location_nmea, or NULL if there's none. */
+static const char *
+get_nmea_trace (MMLocationGpsNmea *location_nmea,
+                const char        *type)
+{
+        guint i;
+
+        for (i = 0; i < G_N_ELEMENTS (nmea_talkers); i++) {
+                char trace_type[8];
+                const char *trace;
+
+                g_snprintf (trace_type, sizeof (trace_type),
+                            "$%s%s", nmea_talkers[i], type);
+                trace = mm_location_gps_nmea_get_trace (location_nmea,
+                                                        trace_type);
+                if (trace != NULL && gclue_nmea_type_is (trace, type))
+                        return trace;
+        }
+
+        return NULL;
+}
+
 static gboolean
 is_location_gga_same (GClueModemManager *manager,
                        const char       *new_gga)
@@ -504,7 +533,7 @@ is_location_gga_same (GClueModemManager *manager,
         if (priv->location_nmea == NULL)
                 return FALSE;
 
-        gga = mm_location_gps_nmea_get_trace (priv->location_nmea, "$GPGGA");
+        gga = get_nmea_trace (priv->location_nmea, "GGA");
         return (g_strcmp0 (gga, new_gga) == 0);
 }
 
@@ -546,18 +575,18 @@ on_get_gps_nmea_ready (GObject      *source_object,
                 return;
         }
 
-        gga = mm_location_gps_nmea_get_trace (location_nmea, "$GPGGA");
-        if (gga != NULL && gclue_nmea_type_is (gga, "GGA")) {
+        gga = get_nmea_trace (location_nmea, "GGA");
+        if (gga != NULL) {
                 if (is_location_gga_same (manager, gga)) {
                         g_debug ("New GGA trace is same as last one: %s", gga);
                         return;
                 }
-                g_debug ("New GPGGA trace: %s", gga);
+                g_debug ("New GGA trace: %s", gga);
                 sentences[i++] = gga;
         }
-        rmc = mm_location_gps_nmea_get_trace (location_nmea, "$GPRMC");
-        if (rmc != NULL && gclue_nmea_type_is (rmc, "RMC")) {
-                g_debug ("New GPRMC trace: %s", rmc);
+        rmc = get_nmea_trace (location_nmea, "RMC");
+        if (rmc != NULL) {
+                g_debug ("New RMC trace: %s", rmc);
                 sentences[i++] = rmc;
         }
         sentences[i] = NULL;
@@ -58,62 +58,19 @@ G_DEFINE_TYPE_WITH_CODE (GClueMozilla,
                          G_TYPE_OBJECT,
                          G_ADD_PRIVATE (GClueMozilla))
 
-#define BSSID_LEN 6
-#define BSSID_STR_LEN 17
-#define MAX_SSID_LEN 32
-
-static guint
-variant_to_string (GVariant *variant, guint max_len, char *ret)
-{
-        guint i;
-        guint len;
-
-        len = g_variant_n_children (variant);
-        if (len == 0)
-                return 0;
-        g_return_val_if_fail(len <= max_len, 0);
-        ret[len] = '\0';
-
-        for (i = 0; i < len; i++)
-                g_variant_get_child (variant,
-                                     i,
-                                     "y",
-                                     &ret[i]);
-
-        return len;
-}
-
-static guint
-get_ssid_from_bss (WPABSS *bss, char *ssid)
-{
-        GVariant *variant = wpa_bss_get_ssid (bss);
-        if (variant == NULL)
-                return 0;
-
-        return variant_to_string (variant, MAX_SSID_LEN, ssid);
-}
-
 static gboolean
-get_bssid_from_bss (WPABSS *bss, char *bssid)
+get_bssid_from_bss (const GClueWifiBss *bss, char *bssid)
 {
-        GVariant *variant;
-        char raw_bssid[BSSID_LEN + 1] = { 0 };
-        guint raw_len, i;
+        guint i;
 
-        variant = wpa_bss_get_bssid (bss);
-        if (variant == NULL)
+        if (!bss->has_bssid)
                 return FALSE;
 
-        raw_len = variant_to_string (variant, BSSID_LEN, raw_bssid);
-        g_return_val_if_fail (raw_len == BSSID_LEN, FALSE);
-
-        for (i = 0; i < BSSID_LEN; i++) {
-                unsigned char c = (unsigned char) raw_bssid[i];
-
-                if (i == BSSID_LEN - 1) {
-                        g_snprintf (bssid + (i * 3), 3, "%02x", c);
+        for (i = 0; i < GCLUE_WIFI_BSSID_LEN; i++) {
+                if (i == GCLUE_WIFI_BSSID_LEN - 1) {
+                        g_snprintf (bssid + (i * 3), 3, "%02x", bss->bssid[i]);
                 } else {
-                        g_snprintf (bssid + (i * 3), 4, "%02x:", c);
+                        g_snprintf (bssid + (i * 3), 4, "%02x:", bss->bssid[i]);
                 }
         }
 
@@ -184,14 +141,14 @@ gclue_mozilla_create_query (GClueMozilla  *mozilla,
         gboolean has_tower = FALSE, has_bss = FALSE;
         SoupMessage *ret = NULL;
         JsonBuilder *builder;
-        g_autoptr(GList) bss_list = NULL;
+        GArray *bss_list = NULL;
         JsonGenerator *generator;
         JsonNode *root_node;
         char *data;
         gsize data_len;
         const char *uri, *radiotype;
         guint n_non_ignored_bsss;
-        GList *iter;
+        guint i;
         gint64 mcc, mnc;
         g_autoptr(GBytes) body = NULL;
 
@@ -209,13 +166,9 @@ gclue_mozilla_create_query (GClueMozilla  *mozilla,
          * See https://ichnaea.readthedocs.io/en/latest/api/geolocate.html#field-definition
          */
         n_non_ignored_bsss = 0;
-        for (iter = bss_list; iter != NULL; iter = iter->next) {
-                WPABSS *bss = WPA_BSS (iter->data);
-
-                if (gclue_mozilla_should_ignore_bss (bss))
-                        continue;
-
-                n_non_ignored_bsss++;
+        for (i = 0; bss_list != NULL && i < bss_list->len; i++) {
+                if (g_array_index (bss_list, GClueWifiBss, i).usable)
+                        n_non_ignored_bsss++;
         }
 
         if (mozilla->priv->tower_valid && !skip_tower &&
@@ -251,13 +204,13 @@ gclue_mozilla_create_query (GClueMozilla  *mozilla,
                 json_builder_set_member_name (builder, "wifiAccessPoints");
                 json_builder_begin_array (builder);
 
-                for (iter = bss_list; iter != NULL; iter = iter->next) {
-                        WPABSS *bss = WPA_BSS (iter->data);
-                        char mac[BSSID_STR_LEN + 1] = { 0 };
+                for (i = 0; i < bss_list->len; i++) {
+                        const GClueWifiBss *bss = &g_array_index (bss_list, GClueWifiBss, i);
+                        char mac[GCLUE_WIFI_BSSID_STR_LEN + 1] = { 0 };
                         gint16 strength_dbm;
                         guint age_ms;
 
-                        if (gclue_mozilla_should_ignore_bss (bss))
+                        if (!bss->usable)
                                 continue;
 
                         json_builder_begin_object (builder);
@@ -267,11 +220,11 @@ gclue_mozilla_create_query (GClueMozilla  *mozilla,
                         json_builder_add_string_value (builder, mac);
 
                         json_builder_set_member_name (builder, "signalStrength");
-                        strength_dbm = wpa_bss_get_signal (bss);
+                        strength_dbm = bss->signal;
                         json_builder_add_int_value (builder, strength_dbm);
 
                         json_builder_set_member_name (builder, "age");
-                        age_ms = 1000 * wpa_bss_get_age (bss);
+                        age_ms = 1000 * bss->age;
                         json_builder_add_int_value (builder, age_ms);
 
                         json_builder_end_object (builder);
@@ -400,10 +353,10 @@ gclue_mozilla_create_submit_query (GClueMozilla  *mozilla,
         JsonGenerator *generator;
         JsonNode *root_node;
         char *data;
-        g_autoptr(GList) bss_list = NULL;
+        GArray *bss_list = NULL;
         const char *url, *nick, *radiotype;
         gsize data_len;
-        GList *iter;
+        guint i;
         gdouble lat, lon, accuracy, altitude, speed;
         guint64 time_ms;
         gint64 mcc, mnc;
@@ -474,18 +427,18 @@ gclue_mozilla_create_submit_query (GClueMozilla  *mozilla,
         if (mozilla->priv->wifi) {
                 bss_list = gclue_wifi_get_bss_list (mozilla->priv->wifi);
         }
-        if (bss_list != NULL) {
+        if (bss_list != NULL && bss_list->len > 0) {
                 json_builder_set_member_name (builder, "wifiAccessPoints");
                 json_builder_begin_array (builder);
 
-                for (iter = bss_list; iter != NULL; iter = iter->next) {
-                        WPABSS *bss = WPA_BSS (iter->data);
-                        char mac[BSSID_STR_LEN + 1] = { 0 };
+                for (i = 0; i < bss_list->len; i++) {
+                        const GClueWifiBss *bss = &g_array_index (bss_list, GClueWifiBss, i);
+                        char mac[GCLUE_WIFI_BSSID_STR_LEN + 1] = { 0 };
                         gint16 strength_dbm;
                         guint16 frequency;
                         guint age_ms;
 
-                        if (gclue_mozilla_should_ignore_bss (bss))
+                        if (!bss->usable)
                                 continue;
 
                         json_builder_begin_object (builder);
@@ -495,15 +448,15 @@ gclue_mozilla_create_submit_query (GClueMozilla  *mozilla,
                         json_builder_add_string_value (builder, mac);
 
                         json_builder_set_member_name (builder, "signalStrength");
-                        strength_dbm = wpa_bss_get_signal (bss);
+                        strength_dbm = bss->signal;
                         json_builder_add_int_value (builder, strength_dbm);
 
                         json_builder_set_member_name (builder, "frequency");
-                        frequency = wpa_bss_get_frequency (bss);
+                        frequency = bss->frequency;
                         json_builder_add_int_value (builder, frequency);
 
                         json_builder_set_member_name (builder, "age");
-                        age_ms = 1000 * wpa_bss_get_age (bss);
+                        age_ms = 1000 * bss->age;
                         json_builder_add_int_value (builder, age_ms);
 
                         json_builder_end_object (builder);
@@ -567,19 +520,16 @@ out:
 }
 
 gboolean
-gclue_mozilla_should_ignore_bss (WPABSS *bss)
+gclue_mozilla_should_ignore_bss (const GClueWifiBss *bss)
 {
-        char ssid[MAX_SSID_LEN + 1] = { 0 };
-        char bssid[BSSID_STR_LEN + 1] = { 0 };
-        guint len;
+        char bssid[GCLUE_WIFI_BSSID_STR_LEN + 1] = { 0 };
 
         if (!get_bssid_from_bss (bss, bssid)) {
                 g_debug ("Ignoring WiFi AP with unknown BSSID..");
                 return TRUE;
         }
 
-        len = get_ssid_from_bss (bss, ssid);
-        if (len == 0 || g_str_has_suffix (ssid, "_nomap")) {
+        if (bss->ssid_len == 0 || g_str_has_suffix (bss->ssid, "_nomap")) {
                 g_debug ("SSID for WiFi AP '%s' missing or has '_nomap' suffix."
                          ", Ignoring..",
                          bssid);
@@ -27,6 +27,7 @@
 #include "wpa_supplicant-interface.h"
 #include "gclue-location.h"
 #include "gclue-3g-tower.h"
+#include "gclue-wifi-bss.h"
 
 G_BEGIN_DECLS
 
@@ -91,7 +92,7 @@ gclue_mozilla_create_submit_query (GClueMozilla  *mozilla,
                                    GClueLocation   *location,
                                    GError         **error);
 gboolean
-gclue_mozilla_should_ignore_bss (WPABSS *bss);
+gclue_mozilla_should_ignore_bss (const GClueWifiBss *bss);
 
 const char *gclue_mozilla_get_locate_url (GClueMozilla *mozilla);
 const char *gclue_mozilla_get_submit_url (GClueMozilla *mozilla);
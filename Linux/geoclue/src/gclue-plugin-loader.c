@@ -0,0 +1,160 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <gmodule.h>
+
+#include "gclue-plugin.h"
+#include "gclue-plugin-loader.h"
+
+/**
+ * SECTION:gclue-plugin-loader
+ * @short_description: Loads location source plugins
+ *
+ * Scans the plugin directory once and hands the plugins' sources to
+ * locators.
+ **/
+
+static GPtrArray *plugins; /* (element-type GCluePluginInfo) */
+
+static const GCluePluginInfo *
+load_plugin (const char *path)
+{
+        const GCluePluginInfo *(*get_info) (void) = NULL;
+        const GCluePluginInfo *info;
+        GModule *module;
+
+        module = g_module_open (path, G_MODULE_BIND_LAZY | G_MODULE_BIND_LOCAL);
+        if (module == NULL) {
+                g_warning ("Failed to load plugin '%s': %s",
+                           path, g_module_error ());
+                return NULL;
+        }
+
+        if (!g_module_symbol (module, "gclue_plugin_get_info",
+                              (gpointer *) &get_info) ||
+            get_info == NULL) {
+                g_warning ("'%s' is not a Geoclue plugin", path);
+                g_module_close (module);
+                return NULL;
+        }
+
+        info = get_info ();
+        if (info == NULL || info->abi_version != GCLUE_PLUGIN_ABI_VERSION) {
+                g_warning ("Plugin '%s' was built for ABI version %u, "
+                           "expected %u",
+                           path, info ? info->abi_version : 0,
+                           GCLUE_PLUGIN_ABI_VERSION);
+                g_module_close (module);
+                return NULL;
+        }
+
+        /* Plugins register GTypes, which can't be unregistered. */
+        g_module_make_resident (module);
+        g_debug ("Loaded plugin '%s' from '%s'", info->name, path);
+
+        return info;
+}
+
+static gint
+compare_plugin_names (gconstpointer a,
+                      gconstpointer b)
+{
+        const GCluePluginInfo *info_a = *(const GCluePluginInfo **) a;
+        const GCluePluginInfo *info_b = *(const GCluePluginInfo **) b;
+
+        return g_strcmp0 (info_a->name, info_b->name);
+}
+
+static void
+load_plugins (void)
+{
+        g_autoptr(GDir) dir = NULL;
+        g_autoptr(GError) error = NULL;
+        const char *name;
+
+        plugins = g_ptr_array_new ();
+
+        if (!g_module_supported ()) {
+                g_debug ("No module support, not loading plugins");
+                return;
+        }
+
+        dir = g_dir_open (PLUGINDIR, 0, &error);
+        if (dir == NULL) {
+                g_debug ("Not loading plugins: %s", error->message);
+                return;
+        }
+
+        while ((name = g_dir_read_name (dir)) != NULL) {
+                g_autofree char *path = NULL;
+                const GCluePluginInfo *info;
+
+                if (!g_str_has_suffix (name, "." G_MODULE_SUFFIX))
+                        continue;
+
+                path = g_build_filename (PLUGINDIR, name, NULL);
+                info = load_plugin (path);
+                if (info != NULL)
+                        g_ptr_array_add (plugins, (gpointer) info);
+        }
+
+        /* Directory order is arbitrary; keep the source order stable. */
+        g_ptr_array_sort (plugins, compare_plugin_names);
+}
+
+/**
+ * gclue_plugin_loader_create_sources:
+ * @level: the maximum accuracy level of the requesting locator
+ *
+ * Loads the plugins on first use and asks each of them for a source.
+ *
+ * Returns: (transfer full) (element-type GClueLocationSource): the plugin
+ * sources.
+ **/
+GList *
+gclue_plugin_loader_create_sources (GClueAccuracyLevel level)
+{
+        GList *sources = NULL;
+        guint i;
+
+        if (plugins == NULL)
+                load_plugins ();
+
+        for (i = 0; i < plugins->len; i++) {
+                const GCluePluginInfo *info = g_ptr_array_index (plugins, i);
+                GClueLocationSource *source;
+
+                source = info->create_source (level);
+                if (source == NULL)
+                        continue;
+
+                if (!GCLUE_IS_LOCATION_SOURCE (source)) {
+                        g_warning ("Plugin '%s' returned an invalid source",
+                                   info->name);
+                        continue;
+                }
+
+                g_debug ("Using %s from plugin '%s'",
+                         G_OBJECT_TYPE_NAME (source), info->name);
+                sources = g_list_append (sources, source);
+        }
+
+        return sources;
+}
@@ -0,0 +1,109 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef GCLUE_PLUGIN_H
+#define GCLUE_PLUGIN_H
+
+#include <glib.h>
+#include <gmodule.h>
+#include "gclue-location-source.h"
+#include "gclue-location.h"
+
+G_BEGIN_DECLS
+
+/**
+ * SECTION:gclue-plugin
+ * @short_description: Location source plugins
+ *
+ * A plugin is a shared module in the plugin directory that exports
+ * gclue_plugin_get_info(). It provides one or more #GClueLocationSource
+ * subclasses which then take part in location fusion exactly like the
+ * built-in sources:
+ *
+ * - The source advertises what it can currently deliver through the
+ *   #GClueLocationSource:available-accuracy-level property, and
+ *   %GCLUE_ACCURACY_LEVEL_NONE while it has nothing. Locators only start
+ *   sources advertising a level they are allowed to use.
+ * - Locations are published with gclue_location_source_set_location(), from
+ *   the main thread.
+ * - The start and stop vfuncs must chain up.
+ *
+ * Plugins are built against the same Geoclue tree as the daemon and checked
+ * against %GCLUE_PLUGIN_ABI_VERSION when loaded. They are never unloaded.
+ **/
+
+/**
+ * GCLUE_PLUGIN_ABI_VERSION:
+ *
+ * Bumped whenever #GCluePluginInfo or the behaviour expected from plugin
+ * sources changes incompatibly.
+ */
+#define GCLUE_PLUGIN_ABI_VERSION 1
+
+typedef struct _GCluePluginInfo GCluePluginInfo;
+
+/**
+ * GCluePluginInfo:
+ * @abi_version: Must be %GCLUE_PLUGIN_ABI_VERSION.
+ * @name: Name of the plugin, used in log messages.
+ * @create_source: Returns a new ref to the plugin's source for a locator
+ * with the maximum accuracy level @level, or %NULL if the plugin has nothing
+ * to offer at that level. Called once per locator; plugins will usually want
+ * to hand out singletons.
+ */
+struct _GCluePluginInfo {
+        guint abi_version;
+        const char *name;
+        GClueLocationSource *(*create_source) (GClueAccuracyLevel level);
+};
+
+/**
+ * gclue_plugin_get_info:
+ *
+ * The entry point every plugin has to export.
+ *
+ * Returns: (transfer none): the plugin description, valid for the lifetime
+ * of the process.
+ */
+G_MODULE_EXPORT const GCluePluginInfo *gclue_plugin_get_info (void);
+
+/**
+ * gclue_plugin_accuracy_level_for:
+ * @accuracy: accuracy radius of a location, in meters
+ *
+ * Returns: the accuracy level a source delivering locations of @accuracy
+ * should advertise.
+ */
+static inline GClueAccuracyLevel
+gclue_plugin_accuracy_level_for (gdouble accuracy)
+{
+        if (accuracy < 0)
+                return GCLUE_ACCURACY_LEVEL_NONE;
+        else if (accuracy <= GCLUE_LOCATION_ACCURACY_EXACT)
+                return GCLUE_ACCURACY_LEVEL_EXACT;
+        else if (accuracy <= GCLUE_LOCATION_ACCURACY_STREET)
+                return GCLUE_ACCURACY_LEVEL_STREET;
+        else if (accuracy <= GCLUE_LOCATION_ACCURACY_NEIGHBORHOOD)
+                return GCLUE_ACCURACY_LEVEL_NEIGHBORHOOD;
+        else
+                return GCLUE_ACCURACY_LEVEL_CITY;
+}
+
+G_END_DECLS
+
+#endif /* GCLUE_PLUGIN_H */
@@ -27,6 +27,8 @@
 #include "gclue-locator.h"
 #include "gclue-enum-types.h"
 #include "gclue-config.h"
+#include "gclue-metrics.h"
+#include "gclue-trace.h"
 
 #define DEFAULT_ACCURACY_LEVEL GCLUE_ACCURACY_LEVEL_CITY
 #define DEFAULT_AGENT_STARTUP_WAIT_SECS 5
@@ -203,17 +205,24 @@ on_locator_location_changed (GObject    *gobject,
         GClueLocation *new_location;
         g_autofree char *path = NULL;
         const char *prev_path;
+        const char *desktop_id;
+        guint64 trace_id;
         g_autoptr(GError) error = NULL;
 
         new_location = gclue_location_source_get_location (locator);
         if (new_location == NULL)
                 return; /* No location found yet */
 
+        trace_id = gclue_location_get_trace_id (new_location);
+        GCLUE_TRACE_BEGIN ("client-delivery", trace_id, NULL);
+
         if (priv->location != NULL && below_threshold (client, new_location)) {
                 g_debug ("Updating location, below threshold");
                 g_object_set (priv->location,
                               "location", new_location,
                               NULL);
+                GCLUE_TRACE_END ("client-delivery", trace_id,
+                                 "below-threshold");
                 return;
         }
 
@@ -245,10 +254,21 @@ on_locator_location_changed (GObject    *gobject,
         if (!emit_location_updated (client, prev_path, path, &error))
                 goto error_out;
 
+        /* Clients pick their own DesktopId, only label the configured ones */
+        desktop_id = gclue_dbus_client_get_desktop_id
+                (GCLUE_DBUS_CLIENT (client));
+        if (desktop_id == NULL ||
+            !gclue_config_is_app_configured (gclue_config_get_singleton (),
+                                             desktop_id))
+                desktop_id = "other";
+        gclue_metrics_inc (GCLUE_METRIC_CLIENT_DELIVERIES, desktop_id);
+        GCLUE_TRACE_END ("client-delivery", trace_id, "signaled");
+
         return;
 
 error_out:
         g_warning ("Failed to update location info: %s", error->message);
+        GCLUE_TRACE_END ("client-delivery", trace_id, "failed");
 }
 
 static void
@@ -307,6 +327,9 @@ ensure_valid_accuracy_level (GClueAccuracyLevel accuracy_level,
         return accuracy;
 }
 
+static void
+auth_cache_invalidate (GClueAgent *agent);
+
 static void
 on_agent_props_changed (GDBusProxy *agent_proxy,
                         GVariant   *changed_properties,
@@ -322,6 +345,9 @@ on_agent_props_changed (GDBusProxy *agent_proxy,
         if (g_variant_n_children (changed_properties) <= 0)
                 return;
 
+        /* Any earlier decision may no longer reflect the agent's policy */
+        auth_cache_invalidate (GCLUE_AGENT (agent_proxy));
+
         g_variant_get (changed_properties, "a{sv}", &iter);
         while (g_variant_iter_loop (iter, "{&sv}", &key, &value)) {
                 GClueAccuracyLevel max_accuracy;
@@ -389,47 +415,232 @@ complete_start (StartData *data)
         start_data_free (data);
 }
 
+/* Agent decisions are cached on the agent proxy itself, so they are shared by
+ * all clients of the same user and die with the agent. Concurrent Start()
+ * calls for the same app and accuracy level share a single AuthorizeApp call.
+ */
+#define AUTH_CACHE_KEY "gclue-auth-cache"
+#define AUTH_DECISION_TTL_SECS 300
+
+typedef struct
+{
+        GHashTable *decisions; /* key -> AuthDecision */
+        GHashTable *pending;   /* key -> AuthRequest (not owned) */
+        guint generation;
+} AuthCache;
+
+typedef struct
+{
+        gint64 expires; /* monotonic time, usec */
+        gboolean authorized;
+        GClueAccuracyLevel accuracy_level;
+} AuthDecision;
+
+typedef struct
+{
+        GClueAgent *agent;
+        char *key;
+        guint generation;
+        GList *waiters; /* StartData */
+} AuthRequest;
+
+static void
+auth_decision_free (AuthDecision *decision)
+{
+        g_slice_free (AuthDecision, decision);
+}
+
+static void
+auth_cache_free (AuthCache *cache)
+{
+        g_hash_table_unref (cache->decisions);
+        g_hash_table_unref (cache->pending);
+        g_slice_free (AuthCache, cache);
+}
+
+static AuthCache *
+auth_cache_get (GClueAgent *agent)
+{
+        AuthCache *cache;
+
+        cache = g_object_get_data (G_OBJECT (agent), AUTH_CACHE_KEY);
+        if (cache != NULL)
+                return cache;
+
+        cache = g_slice_new0 (AuthCache);
+        cache->decisions = g_hash_table_new_full
+                (g_str_hash,
+                 g_str_equal,
+                 g_free,
+                 (GDestroyNotify) auth_decision_free);
+        cache->pending = g_hash_table_new_full (g_str_hash,
+                                                g_str_equal,
+                                                g_free,
+                                                NULL);
+        g_object_set_data_full (G_OBJECT (agent),
+                                AUTH_CACHE_KEY,
+                                cache,
+                                (GDestroyNotify) auth_cache_free);
+
+        return cache;
+}
+
+static void
+auth_cache_invalidate (GClueAgent *agent)
+{
+        AuthCache *cache;
+
+        cache = g_object_get_data (G_OBJECT (agent), AUTH_CACHE_KEY);
+        if (cache == NULL)
+                return;
+
+        g_hash_table_remove_all (cache->decisions);
+        /* In-flight requests still complete their waiters but their outcome
+         * is not remembered.
+         */
+        g_hash_table_remove_all (cache->pending);
+        cache->generation++;
+}
+
+static char *
+auth_cache_key (StartData *data)
+{
+        GClueServiceClientPrivate *priv = data->client->priv;
+
+        return g_strdup_printf ("%s:%u:%u",
+                                data->desktop_id,
+                                gclue_client_info_get_user_id (priv->client_info),
+                                data->accuracy_level);
+}
+
+static void
+finish_authorization (StartData         *data,
+                      gboolean           authorized,
+                      GClueAccuracyLevel accuracy_level)
+{
+        GClueServiceClientPrivate *priv = data->client->priv;
+        guint32 uid;
+
+        if (authorized) {
+                data->accuracy_level = accuracy_level;
+                complete_start (data);
+
+                return;
+        }
+
+        uid = gclue_client_info_get_user_id (priv->client_info);
+        g_dbus_method_invocation_return_error (data->invocation,
+                                               G_DBUS_ERROR,
+                                               G_DBUS_ERROR_ACCESS_DENIED,
+                                               "Agent rejected '%s' for user "
+                                               "'%u'. Please ensure that '%s' "
+                                               "has installed a valid "
+                                               "%s.desktop file.",
+                                               data->desktop_id,
+                                               uid,
+                                               data->desktop_id,
+                                               data->desktop_id);
+        start_data_free (data);
+}
+
 static void
 on_authorize_app_ready (GObject      *source_object,
                         GAsyncResult *res,
                         gpointer      user_data)
 {
-        StartData *data = (StartData *) user_data;
-        GClueServiceClientPrivate *priv = data->client->priv;
+        AuthRequest *request = (AuthRequest *) user_data;
+        AuthCache *cache = auth_cache_get (request->agent);
+        GClueAccuracyLevel accuracy_level = GCLUE_ACCURACY_LEVEL_NONE;
         GError *error = NULL;
         gboolean authorized = FALSE;
+        GList *l;
+
+        if (request->generation == cache->generation)
+                g_hash_table_remove (cache->pending, request->key);
 
         if (!gclue_agent_call_authorize_app_finish (GCLUE_AGENT (source_object),
                                                     &authorized,
-                                                    &data->accuracy_level,
+                                                    &accuracy_level,
                                                     res,
-                                                    &error))
-                goto error_out;
+                                                    &error)) {
+                for (l = request->waiters; l != NULL; l = l->next) {
+                        StartData *data = (StartData *) l->data;
 
-        if (!authorized) {
-                guint32 uid;
+                        g_dbus_method_invocation_return_gerror (data->invocation,
+                                                                error);
+                        start_data_free (data);
+                }
+                g_error_free (error);
 
-                uid = gclue_client_info_get_user_id (priv->client_info);
+                goto out;
+        }
 
-                g_set_error (&error,
-                             G_DBUS_ERROR,
-                             G_DBUS_ERROR_ACCESS_DENIED,
-                             "Agent rejected '%s' for user '%u'. Please ensure "
-                             "that '%s' has installed a valid %s.desktop file.",
-                             data->desktop_id,
-                             uid,
-                             data->desktop_id,
-                             data->desktop_id);
-                goto error_out;
+        if (request->generation == cache->generation) {
+                AuthDecision *decision = g_slice_new (AuthDecision);
+
+                decision->expires = g_get_monotonic_time () +
+                                    AUTH_DECISION_TTL_SECS * G_USEC_PER_SEC;
+                decision->authorized = authorized;
+                decision->accuracy_level = accuracy_level;
+                g_hash_table_replace (cache->decisions,
+                                      g_strdup (request->key),
+                                      decision);
         }
 
-        complete_start (data);
+        for (l = request->waiters; l != NULL; l = l->next)
+                finish_authorization ((StartData *) l->data,
+                                      authorized,
+                                      accuracy_level);
 
-        return;
+out:
+        g_list_free (request->waiters);
+        g_free (request->key);
+        g_object_unref (request->agent);
+        g_slice_free (AuthRequest, request);
+}
 
-error_out:
-        g_dbus_method_invocation_take_error (data->invocation, error);
-        start_data_free (data);
+static void
+authorize_app (StartData *data)
+{
+        GClueServiceClientPrivate *priv = data->client->priv;
+        AuthCache *cache = auth_cache_get (priv->agent_proxy);
+        AuthDecision *decision;
+        AuthRequest *request;
+        g_autofree char *key = NULL;
+
+        key = auth_cache_key (data);
+        decision = g_hash_table_lookup (cache->decisions, key);
+        if (decision != NULL) {
+                if (decision->expires > g_get_monotonic_time ()) {
+                        g_debug ("Using cached agent decision for '%s'", key);
+                        finish_authorization (data,
+                                              decision->authorized,
+                                              decision->accuracy_level);
+                        return;
+                }
+                g_hash_table_remove (cache->decisions, key);
+        }
+
+        request = g_hash_table_lookup (cache->pending, key);
+        if (request != NULL) {
+                g_debug ("Joining pending agent request for '%s'", key);
+                request->waiters = g_list_append (request->waiters, data);
+                return;
+        }
+
+        request = g_slice_new0 (AuthRequest);
+        request->agent = g_object_ref (priv->agent_proxy);
+        request->key = g_steal_pointer (&key);
+        request->generation = cache->generation;
+        request->waiters = g_list_append (NULL, data);
+        g_hash_table_insert (cache->pending, g_strdup (request->key), request);
+
+        gclue_agent_call_authorize_app (priv->agent_proxy,
+                                        data->desktop_id,
+                                        data->accuracy_level,
+                                        NULL,
+                                        on_authorize_app_ready,
+                                        request);
 }
 
 static void
@@ -474,12 +685,7 @@ handle_post_agent_check_auth (StartData *data)
                 return;
         }
 
-        gclue_agent_call_authorize_app (priv->agent_proxy,
-                                        data->desktop_id,
-                                        data->accuracy_level,
-                                        NULL,
-                                        on_authorize_app_ready,
-                                        data);
+        authorize_app (data);
 }
 
 static gboolean
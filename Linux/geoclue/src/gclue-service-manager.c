@@ -50,6 +50,12 @@ struct _GClueServiceManagerPrivate
         guint unix_signal_source;
 
         GClueLocator *locator;
+
+        /* Never started; only keeps the scrambled source singletons
+         * around between clients, like @locator does for the exact ones.
+         */
+        GClueLocator *city_locator;
+        guint warm_up_id;
 };
 
 G_DEFINE_TYPE_WITH_CODE (GClueServiceManager,
@@ -610,7 +616,9 @@ gclue_service_manager_finalize (GObject *object)
 {
         GClueServiceManagerPrivate *priv = GCLUE_SERVICE_MANAGER (object)->priv;
 
+        g_clear_handle_id (&priv->warm_up_id, g_source_remove);
         g_clear_object (&priv->locator);
+        g_clear_object (&priv->city_locator);
         g_clear_object (&priv->connection);
         if (priv->clients != NULL) {
                 g_list_free_full (priv->clients, g_object_unref);
@@ -682,6 +690,17 @@ on_avail_accuracy_level_changed (GObject    *object,
                 (GCLUE_DBUS_MANAGER (user_data), level);
 }
 
+static gboolean
+on_warm_up (gpointer user_data)
+{
+        GClueServiceManagerPrivate *priv = GCLUE_SERVICE_MANAGER (user_data)->priv;
+
+        priv->warm_up_id = 0;
+        priv->city_locator = gclue_locator_new (GCLUE_ACCURACY_LEVEL_CITY);
+
+        return G_SOURCE_REMOVE;
+}
+
 static void
 gclue_service_manager_constructed (GObject *object)
 {
@@ -698,6 +717,9 @@ gclue_service_manager_constructed (GObject *object)
         on_avail_accuracy_level_changed (G_OBJECT (priv->locator),
                                          NULL,
                                          object);
+
+        /* Once the bus name request is on its way, so it isn't delayed. */
+        priv->warm_up_id = g_idle_add (on_warm_up, object);
         priv->unix_signal_source = g_unix_signal_add (SIGUSR1, log_client_list, manager);
 }
 
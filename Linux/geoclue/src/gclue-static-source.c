@@ -18,6 +18,7 @@
  *
  */
 
+#include <errno.h>
 #include <string.h>
 #include <gio/gio.h>
 #include "gclue-location.h"
@@ -33,11 +34,37 @@
  */
 #define GEO_FILE_MONITOR_RATE_LIMIT 2500
 
+/* Most fields a line of the geolocation file can have. */
+#define MAX_LINE_FIELDS 6
+
+/* Longest we wait before re-checking which scheduled location is valid.
+ * In seconds.
+ */
+#define SCHEDULE_MAX_CHECK_INTERVAL (24 * 60 * 60)
+
+/* Pause between the end of a track and its replay starting over.
+ * In seconds.
+ */
+#define TRACK_LOOP_DELAY 1
+
 struct _GClueStaticSource {
         /* <private> */
         GClueLocationSource parent_instance;
 };
 
+/* A line of the geolocation file. Plain points and points with a validity
+ * window make up a schedule, points with a time offset make up a track.
+ */
+typedef struct {
+        gdouble latitude;
+        gdouble longitude;
+        gdouble altitude;
+        gdouble accuracy;
+        gint64 valid_from;      /* Unix time, G_MININT64 if open */
+        gint64 valid_until;     /* Unix time, G_MAXINT64 if open */
+        gdouble offset;         /* Seconds into the track, -1 if not a track */
+} StaticEntry;
+
 typedef struct {
         GClueLocation *location;
         guint location_set_timer;
@@ -46,21 +73,19 @@ typedef struct {
 
         GCancellable *cancellable;
         gboolean file_open_quiet;
-        GFileInputStream *file_stream;
-        GDataInputStream *data_stream;
-        enum { L_LAT = 0, L_LON, L_ALT, L_ACCURACY } file_line;
-        gdouble latitude;
-        gdouble longitude;
-        gdouble altitude;
+        char *etag;
+
+        GArray *entries;        /* (element-type StaticEntry) (owned) */
+        gboolean is_track;
+        gint current_entry;
+        guint entry_timer;      /* Only armed while the source is active */
+        gint64 track_start;     /* Monotonic time the track was started */
 } GClueStaticSourcePrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (GClueStaticSource,
                             gclue_static_source,
                             GCLUE_TYPE_LOCATION_SOURCE)
 
-static void
-file_read_next_line (GClueStaticSource *source);
-
 static GClueStaticSourcePrivate *
 get_priv (GClueStaticSource *source)
 {
@@ -162,18 +187,27 @@ close_file (GClueStaticSource *source)
                 return;
 
         g_cancellable_cancel (priv->cancellable);
-
-        g_clear_object (&priv->data_stream);
-        g_clear_object (&priv->file_stream);
         g_clear_object (&priv->cancellable);
 }
 
+static void
+clear_entries (GClueStaticSource *source)
+{
+        GClueStaticSourcePrivate *priv = get_priv (source);
+
+        g_clear_handle_id (&priv->entry_timer, g_source_remove);
+        g_clear_pointer (&priv->entries, g_array_unref);
+        g_clear_pointer (&priv->etag, g_free);
+        priv->current_entry = -1;
+}
+
 static void
 close_file_clear_location (GClueStaticSource *source)
 {
         GClueStaticSourcePrivate *priv = get_priv (source);
 
         close_file (source);
+        clear_entries (source);
 
         if (!priv->location)
                 return;
@@ -192,6 +226,7 @@ gclue_static_source_finalize (GObject *gstatic)
         G_OBJECT_CLASS (gclue_static_source_parent_class)->finalize (gstatic);
 
         close_file (source);
+        clear_entries (source);
 
         g_clear_object (&priv->location);
         g_clear_handle_id (&priv->location_set_timer, g_source_remove);
@@ -199,6 +234,9 @@ gclue_static_source_finalize (GObject *gstatic)
         g_clear_object (&priv->monitor);
 }
 
+static void
+start_entries (GClueStaticSource *source);
+
 static GClueLocationSourceStartResult
 gclue_static_source_start (GClueLocationSource *source)
 {
@@ -215,6 +253,27 @@ gclue_static_source_start (GClueLocationSource *source)
 
         /* Set initial location */
         location_set_refresh_timer (GCLUE_STATIC_SOURCE (source));
+        start_entries (GCLUE_STATIC_SOURCE (source));
+
+        return base_result;
+}
+
+static GClueLocationSourceStopResult
+gclue_static_source_stop (GClueLocationSource *source)
+{
+        GClueStaticSourcePrivate *priv = get_priv (GCLUE_STATIC_SOURCE (source));
+        GClueLocationSourceClass *base_class;
+        GClueLocationSourceStopResult base_result;
+
+        g_return_val_if_fail (GCLUE_IS_STATIC_SOURCE (source),
+                              GCLUE_LOCATION_SOURCE_STOP_RESULT_FAILED);
+
+        base_class = GCLUE_LOCATION_SOURCE_CLASS (gclue_static_source_parent_class);
+        base_result = base_class->stop (source);
+        if (base_result != GCLUE_LOCATION_SOURCE_STOP_RESULT_OK)
+                return base_result;
+
+        g_clear_handle_id (&priv->entry_timer, g_source_remove);
 
         return base_result;
 }
@@ -228,126 +287,394 @@ gclue_static_source_class_init (GClueStaticSourceClass *klass)
         gstatic_class->finalize = gclue_static_source_finalize;
 
         source_class->start = gclue_static_source_start;
+        source_class->stop = gclue_static_source_stop;
 }
 
 static void
-on_line_read (GObject *object,
-              GAsyncResult *result,
-              gpointer user_data)
+set_entry_location (GClueStaticSource *source,
+                    gint               index)
 {
-        GDataInputStream *data_stream = G_DATA_INPUT_STREAM (object);
-        GClueStaticSource *source;
-        GClueStaticSourcePrivate *priv;
-        g_autoptr(GError) error = NULL;
-        g_autofree char *line = NULL;
-        char *comment_start;
-        gdouble accuracy;
+        GClueStaticSourcePrivate *priv = get_priv (source);
+        g_autoptr(GClueLocation) prev_location = NULL;
+        const StaticEntry *entry;
 
-        line = g_data_input_stream_read_line_finish (data_stream, result,
-                                                     NULL, &error);
-        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        if (index == priv->current_entry)
                 return;
-        }
+        priv->current_entry = index;
+        prev_location = g_steal_pointer (&priv->location);
 
-        source = GCLUE_STATIC_SOURCE (user_data);
-        priv = get_priv (source);
+        if (index < 0) {
+                g_debug ("Static source has no location valid now");
+                location_updated (source);
+                return;
+        }
 
-        if (line == NULL) {
-                if (error != NULL) {
-                        g_warning ("Static source error when reading file: %s",
-                                   error->message);
-                } else {
-                        g_warning ("Static source unexpected EOF reading file (truncated?)");
-                }
+        entry = &g_array_index (priv->entries, StaticEntry, index);
+        priv->location = gclue_location_new_full (entry->latitude,
+                                                  entry->longitude,
+                                                  entry->accuracy,
+                                                  GCLUE_LOCATION_SPEED_UNKNOWN,
+                                                  GCLUE_LOCATION_HEADING_UNKNOWN,
+                                                  entry->altitude,
+                                                  0, "Static location");
+        g_assert (priv->location);
 
-                close_file_clear_location (source);
-                return;
+        /* Consecutive track points carry the movement between them. */
+        if (priv->is_track && index > 0 && prev_location != NULL) {
+                const StaticEntry *prev = entry - 1;
+                gdouble dt = entry->offset - prev->offset;
+
+                if (dt > 0)
+                        gclue_location_set_speed
+                                (priv->location,
+                                 gclue_location_get_distance_from
+                                        (priv->location, prev_location) / dt);
+                gclue_location_set_heading_from_prev_location (priv->location,
+                                                               prev_location);
         }
 
-        comment_start = strchr (line, '#');
-        if (comment_start) {
-                *comment_start = '\0';
+        g_debug ("Static source moved to entry %d", index);
+        location_updated (source);
+}
+
+static gboolean
+on_schedule_timer (gpointer user_data);
+
+/* Publishes the first schedule entry valid now, and arranges to be called
+ * again when the next window opens or closes.
+ */
+static void
+schedule_update (GClueStaticSource *source)
+{
+        GClueStaticSourcePrivate *priv = get_priv (source);
+        gint64 now, next = G_MAXINT64;
+        gint found = -1;
+        guint i;
+
+        g_clear_handle_id (&priv->entry_timer, g_source_remove);
+
+        now = g_get_real_time () / G_USEC_PER_SEC;
+        for (i = 0; i < priv->entries->len; i++) {
+                const StaticEntry *entry =
+                        &g_array_index (priv->entries, StaticEntry, i);
+
+                if (found < 0 &&
+                    entry->valid_from <= now && now < entry->valid_until)
+                        found = i;
+
+                if (entry->valid_from > now)
+                        next = MIN (next, entry->valid_from);
+                if (entry->valid_until > now)
+                        next = MIN (next, entry->valid_until);
         }
 
-        g_strstrip (line);
+        set_entry_location (source, found);
 
-        if (strlen (line) == 0) {
-                file_read_next_line (source);
+        if (next == G_MAXINT64 ||
+            !gclue_location_source_get_active (GCLUE_LOCATION_SOURCE (source)))
                 return;
+
+        /* Re-check at least daily, so wall clock changes are picked up. */
+        priv->entry_timer = g_timeout_add_seconds
+                ((guint) MIN (next - now, SCHEDULE_MAX_CHECK_INTERVAL),
+                 on_schedule_timer, source);
+}
+
+static gboolean
+on_schedule_timer (gpointer user_data)
+{
+        GClueStaticSource *source = GCLUE_STATIC_SOURCE (user_data);
+        GClueStaticSourcePrivate *priv = get_priv (source);
+
+        priv->entry_timer = 0;
+        schedule_update (source);
+
+        return G_SOURCE_REMOVE;
+}
+
+static gboolean
+on_track_timer (gpointer user_data)
+{
+        GClueStaticSource *source = GCLUE_STATIC_SOURCE (user_data);
+        GClueStaticSourcePrivate *priv = get_priv (source);
+        const StaticEntry *first, *next;
+        gint index;
+        gint64 target, now;
+
+        priv->entry_timer = 0;
+
+        index = priv->current_entry + 1;
+        if (index >= (gint) priv->entries->len) {
+                /* Start over; the jump back isn't movement. */
+                index = 0;
+                priv->current_entry = -1;
+                priv->track_start = g_get_monotonic_time ();
         }
+        set_entry_location (source, index);
 
-        do {
-                gdouble * const coords[] = {
-                        /* L_LAT */ &priv->latitude,
-                        /* L_LON */ &priv->longitude,
-                        /* L_ALT */ &priv->altitude,
-                        /* L_ACCURACY */ &accuracy,
-                };
-                char *endptr;
-
-                g_assert (priv->file_line >= L_LAT &&
-                          priv->file_line <= L_ACCURACY);
-
-                *coords[priv->file_line] = g_ascii_strtod (line, &endptr);
-                if (errno != 0 || *endptr != '\0') {
-                        g_warning ("Static source invalid line %d '%s'",
-                                   priv->file_line, line);
-                        close_file_clear_location (source);
-                        return;
-                }
-        } while (FALSE);
+        if (priv->entries->len == 1 ||
+            !gclue_location_source_get_active (GCLUE_LOCATION_SOURCE (source)))
+                return G_SOURCE_REMOVE;
 
-        if (priv->file_line < L_ACCURACY) {
-                priv->file_line++;
-                file_read_next_line (source);
-                return;
+        /* Time every step from the start of the track, so timer latency
+         * doesn't accumulate over long tracks.
+         */
+        first = &g_array_index (priv->entries, StaticEntry, 0);
+        if (index + 1 < (gint) priv->entries->len) {
+                next = &g_array_index (priv->entries, StaticEntry, index + 1);
+                target = priv->track_start +
+                         (gint64) ((next->offset - first->offset) * G_USEC_PER_SEC);
+        } else {
+                const StaticEntry *last =
+                        &g_array_index (priv->entries, StaticEntry, index);
+
+                target = priv->track_start +
+                         (gint64) ((last->offset - first->offset) * G_USEC_PER_SEC) +
+                         TRACK_LOOP_DELAY * G_USEC_PER_SEC;
         }
 
-        close_file (source);
+        now = g_get_monotonic_time ();
+        priv->entry_timer = g_timeout_add (target > now ?
+                                           (guint) ((target - now) / 1000) : 0,
+                                           on_track_timer, source);
 
-        g_debug ("Static source read a new location");
-        g_clear_object (&priv->location);
-        priv->location = gclue_location_new_full (priv->latitude,
-                                                  priv->longitude,
-                                                  accuracy,
-                                                  GCLUE_LOCATION_SPEED_UNKNOWN,
-                                                  GCLUE_LOCATION_HEADING_UNKNOWN,
-                                                  priv->altitude,
-                                                  0, "Static location");
-        g_assert (priv->location);
-        location_updated (source);
+        return G_SOURCE_REMOVE;
 }
 
 static void
-file_read_next_line (GClueStaticSource *source)
+apply_entries (GClueStaticSource *source,
+               GArray            *entries,
+               gboolean           is_track)
 {
         GClueStaticSourcePrivate *priv = get_priv (source);
 
-        g_assert (priv->data_stream);
-        g_data_input_stream_read_line_async (priv->data_stream,
-                                             G_PRIORITY_DEFAULT,
-                                             priv->cancellable,
-                                             on_line_read, source);
+        g_clear_handle_id (&priv->entry_timer, g_source_remove);
+        g_clear_pointer (&priv->entries, g_array_unref);
+        priv->entries = entries;
+        priv->is_track = is_track;
+
+        if (is_track)
+                g_debug ("Static source read a track of %u points",
+                         entries->len);
+        else
+                g_debug ("Static source read %u location(s)", entries->len);
+
+        /* Force the first entry to be published even if its index matches
+         * the one we had before the file changed.
+         */
+        priv->current_entry = G_MININT;
+        start_entries (source);
 }
 
+/* Publishes the entry valid now, or the first point of the track, so the
+ * available accuracy is right even while we're stopped. The timers moving
+ * on to later entries are only armed while we're active; a track replays
+ * from its first point every time the source is started.
+ */
 static void
-on_file_open (GObject *source_object,
-              GAsyncResult *res,
-              gpointer user_data)
+start_entries (GClueStaticSource *source)
+{
+        GClueStaticSourcePrivate *priv = get_priv (source);
+
+        if (priv->entries == NULL)
+                return;
+
+        if (priv->is_track) {
+                priv->current_entry = -1;
+                priv->track_start = g_get_monotonic_time ();
+                on_track_timer (source);
+        } else {
+                schedule_update (source);
+        }
+}
+
+static gboolean
+parse_double (const char *str,
+              gdouble    *value)
+{
+        char *endptr;
+
+        errno = 0;
+        *value = g_ascii_strtod (str, &endptr);
+
+        return errno == 0 && endptr != str && *endptr == '\0';
+}
+
+static gboolean
+parse_time (const char *str,
+            GTimeZone  *tz,
+            gint64      open_value,
+            gint64     *value)
+{
+        g_autoptr(GDateTime) dt = NULL;
+
+        if (strcmp (str, "-") == 0) {
+                *value = open_value;
+                return TRUE;
+        }
+
+        dt = g_date_time_new_from_iso8601 (str, tz);
+        if (dt == NULL)
+                return FALSE;
+
+        *value = g_date_time_to_unix (dt);
+        return TRUE;
+}
+
+static gboolean
+parse_point (char       **fields,
+             StaticEntry *entry)
+{
+        return parse_double (fields[0], &entry->latitude) &&
+               parse_double (fields[1], &entry->longitude) &&
+               parse_double (fields[2], &entry->altitude) &&
+               parse_double (fields[3], &entry->accuracy) &&
+               entry->latitude >= -90 && entry->latitude <= 90 &&
+               entry->longitude >= -180 && entry->longitude <= 180 &&
+               entry->accuracy >= 0;
+}
+
+/* Parses the geolocation file in place; @contents gets modified. Lines that
+ * don't make sense are skipped with a warning instead of failing the whole
+ * file. Returns the entries, or NULL if there are none.
+ */
+static GArray *
+parse_contents (char     *contents,
+                gsize     length,
+                gboolean *is_track)
+{
+        g_autoptr(GArray) entries = NULL;
+        g_autoptr(GTimeZone) tz = g_time_zone_new_local ();
+        char *line = contents, *end = contents + length;
+        gdouble pending[4];
+        guint n_pending = 0, line_no = 0;
+        gboolean have_kind = FALSE;
+
+        entries = g_array_new (FALSE, FALSE, sizeof (StaticEntry));
+        *is_track = FALSE;
+
+        while (line < end) {
+                char *eol, *comment_start, *saveptr = NULL, *field;
+                char *fields[MAX_LINE_FIELDS + 1];
+                guint n_fields = 0;
+                StaticEntry entry;
+                gboolean track_line;
+
+                eol = memchr (line, '\n', end - line);
+                if (eol == NULL)
+                        eol = end;
+                *eol = '\0';
+                line_no++;
+
+                comment_start = strchr (line, '#');
+                if (comment_start)
+                        *comment_start = '\0';
+
+                for (field = strtok_r (line, " \t\r,", &saveptr);
+                     field != NULL && n_fields <= MAX_LINE_FIELDS;
+                     field = strtok_r (NULL, " \t\r,", &saveptr))
+                        fields[n_fields++] = field;
+
+                line = eol + 1;
+                if (n_fields == 0)
+                        continue;
+
+                /* The original format: one value per line. */
+                if (n_fields == 1) {
+                        if (!parse_double (fields[0], &pending[n_pending])) {
+                                g_warning ("Static source ignoring invalid line %u '%s'",
+                                           line_no, fields[0]);
+                                continue;
+                        }
+                        if (++n_pending < G_N_ELEMENTS (pending))
+                                continue;
+
+                        n_pending = 0;
+                        entry.latitude = pending[0];
+                        entry.longitude = pending[1];
+                        entry.altitude = pending[2];
+                        entry.accuracy = pending[3];
+                        entry.valid_from = G_MININT64;
+                        entry.valid_until = G_MAXINT64;
+                        entry.offset = -1;
+                        track_line = FALSE;
+                } else if (n_fields == 4 && parse_point (fields, &entry)) {
+                        entry.valid_from = G_MININT64;
+                        entry.valid_until = G_MAXINT64;
+                        entry.offset = -1;
+                        track_line = FALSE;
+                } else if (n_fields == 6 && parse_point (fields, &entry) &&
+                           parse_time (fields[4], tz, G_MININT64, &entry.valid_from) &&
+                           parse_time (fields[5], tz, G_MAXINT64, &entry.valid_until) &&
+                           entry.valid_from < entry.valid_until) {
+                        entry.offset = -1;
+                        track_line = FALSE;
+                } else if (n_fields == 5 && fields[0][0] == '+' &&
+                           parse_double (fields[0] + 1, &entry.offset) &&
+                           parse_point (fields + 1, &entry)) {
+                        entry.valid_from = G_MININT64;
+                        entry.valid_until = G_MAXINT64;
+                        track_line = TRUE;
+                } else {
+                        g_warning ("Static source ignoring invalid line %u",
+                                   line_no);
+                        continue;
+                }
+
+                if (!have_kind) {
+                        *is_track = track_line;
+                        have_kind = TRUE;
+                } else if (track_line != *is_track) {
+                        g_warning ("Static source ignoring line %u: can't mix "
+                                   "track points with other locations",
+                                   line_no);
+                        continue;
+                }
+
+                if (track_line && entries->len > 0 &&
+                    entry.offset < g_array_index (entries, StaticEntry,
+                                                  entries->len - 1).offset) {
+                        g_warning ("Static source ignoring line %u: track "
+                                   "offsets must not decrease", line_no);
+                        continue;
+                }
+
+                g_array_append_val (entries, entry);
+        }
+
+        if (n_pending > 0)
+                g_warning ("Static source unexpected EOF reading file (truncated?)");
+
+        if (entries->len == 0)
+                return NULL;
+
+        return g_steal_pointer (&entries);
+}
+
+static void
+on_file_loaded (GObject      *source_object,
+                GAsyncResult *res,
+                gpointer      user_data)
 {
         GFile *file = G_FILE (source_object);
         GClueStaticSource *source;
         GClueStaticSourcePrivate *priv;
-        g_autoptr(GFileInputStream) file_stream = NULL;
         g_autoptr(GError) error = NULL;
-
-        file_stream = g_file_read_finish (file, res, &error);
-        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        g_autofree char *contents = NULL;
+        g_autofree char *etag = NULL;
+        GArray *entries;
+        gboolean is_track;
+        gsize length;
+
+        if (!g_file_load_contents_finish (file, res, &contents, &length,
+                                          &etag, &error) &&
+            g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
                 return;
         }
 
         source = GCLUE_STATIC_SOURCE (user_data);
         priv = get_priv (source);
+        g_clear_object (&priv->cancellable);
 
         if (error != NULL) {
                 if (!priv->file_open_quiet) {
@@ -362,16 +689,21 @@ on_file_open (GObject *source_object,
                 return;
         }
 
-        g_return_if_fail (file_stream != NULL);
-        g_assert (!priv->file_stream);
-        priv->file_stream = g_steal_pointer (&file_stream);
+        if (priv->entries != NULL && g_strcmp0 (etag, priv->etag) == 0) {
+                g_debug ("Static source file unchanged");
+                return;
+        }
 
-        g_assert (!priv->data_stream);
-        priv->data_stream = g_data_input_stream_new
-                (G_INPUT_STREAM (priv->file_stream));
+        entries = parse_contents (contents, length, &is_track);
+        if (entries == NULL) {
+                g_warning ("Static source found no valid location in file");
+                close_file_clear_location (source);
+                return;
+        }
 
-        priv->file_line = L_LAT;
-        file_read_next_line (source);
+        g_free (priv->etag);
+        priv->etag = g_steal_pointer (&etag);
+        apply_entries (source, entries, is_track);
 }
 
 static void
@@ -383,8 +715,8 @@ open_file (GClueStaticSource *source, GFile *file, gboolean quiet)
 
         priv->cancellable = g_cancellable_new ();
         priv->file_open_quiet = quiet;
-        g_file_read_async (file, G_PRIORITY_DEFAULT, priv->cancellable,
-                           on_file_open, source);
+        g_file_load_contents_async (file, priv->cancellable,
+                                    on_file_loaded, source);
 }
 
 static void
@@ -452,6 +784,7 @@ check_monitor (GClueStaticSource *source)
 static void
 gclue_static_source_init (GClueStaticSource *source)
 {
+        get_priv (source)->current_entry = -1;
         check_monitor (source);
 }
 
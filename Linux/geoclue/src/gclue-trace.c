@@ -0,0 +1,286 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include <glib-unix.h>
+
+#if HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#endif
+
+#include "gclue-trace.h"
+
+/**
+ * SECTION:gclue-trace
+ * @short_description: Location pipeline trace events
+ *
+ * Records the stages a location goes through, from a WiFi scan or a web
+ * query to the signal sent to clients, in a fixed size ring buffer. All
+ * stages of a location share a correlation ID, so a viewer shows each fix
+ * on its own track.
+ *
+ * The buffer is dumped in the Chrome trace event format, which Perfetto
+ * and chrome://tracing open, by the GetTrace method of the
+ * org.freedesktop.GeoClue2.Trace D-Bus interface or to
+ * /run/geoclue/trace.json on SIGUSR2 (SIGUSR1 logs the client list).
+ *
+ * Without the tracing build option none of this is set up: the macros
+ * compile to nothing, no IDs are handed out and nothing is exported.
+ *
+ * If the system has sys/sdt.h, every event is also a geoclue:event USDT
+ * probe for bpftrace and friends.
+ **/
+
+#define TRACE_OBJECT_PATH "/org/freedesktop/GeoClue2/Trace"
+#define TRACE_DUMP_DIR "/run/geoclue"
+#define TRACE_DUMP_PATH TRACE_DUMP_DIR "/trace.json"
+
+/* At a handful of events per fix, this covers hours of normal use. */
+#define TRACE_BUFFER_SIZE 4096
+
+typedef struct {
+        gint64 timestamp; /* Monotonic, in microseconds */
+        guint64 id;
+        const char *name;
+        const char *arg;
+        char phase;
+} TraceEvent;
+
+static TraceEvent events[TRACE_BUFFER_SIZE];
+static guint next_event;
+static gboolean wrapped;
+#if GCLUE_USE_TRACING
+static guint64 last_id;
+#endif
+
+/**
+ * gclue_trace_new_id:
+ *
+ * Returns: a new correlation ID, never 0, or 0 if tracing is disabled.
+ **/
+guint64
+gclue_trace_new_id (void)
+{
+#if GCLUE_USE_TRACING
+        return ++last_id;
+#else
+        return 0;
+#endif
+}
+
+/**
+ * gclue_trace_event:
+ * @name: the stage
+ * @phase: 'b' for the start of a stage, 'e' for its end, 'n' for an instant
+ * @id: the correlation ID
+ * @arg: (nullable): extra detail, e.g. the source or why a fix was dropped
+ *
+ * Records an event, overwriting the oldest one if the buffer is full. Use
+ * the GCLUE_TRACE_* macros rather than calling this directly.
+ **/
+void
+gclue_trace_event (const char *name,
+                   char        phase,
+                   guint64     id,
+                   const char *arg)
+{
+        TraceEvent *event = &events[next_event];
+
+        event->timestamp = g_get_monotonic_time ();
+        event->id = id;
+        event->name = name;
+        event->arg = arg;
+        event->phase = phase;
+
+        if (++next_event == TRACE_BUFFER_SIZE) {
+                next_event = 0;
+                wrapped = TRUE;
+        }
+
+#if HAVE_SYS_SDT_H
+        DTRACE_PROBE4 (geoclue, event, name, phase, id, arg);
+#endif
+}
+
+static void
+append_json_string (GString    *str,
+                    const char *value)
+{
+        const char *p;
+
+        g_string_append_c (str, '"');
+        for (p = value; *p != '\0'; p++) {
+                if (*p == '"' || *p == '\\')
+                        g_string_append_c (str, '\\');
+                if ((guchar) *p < 0x20)
+                        g_string_append_printf (str, "\\u%04x", (guchar) *p);
+                else
+                        g_string_append_c (str, *p);
+        }
+        g_string_append_c (str, '"');
+}
+
+/**
+ * gclue_trace_to_json:
+ *
+ * Returns: (transfer full): the buffered events, oldest first, in the
+ * Chrome trace event JSON format.
+ **/
+char *
+gclue_trace_to_json (void)
+{
+        GString *json;
+        guint first, count, i;
+        int pid = getpid ();
+
+        first = wrapped ? next_event : 0;
+        count = wrapped ? TRACE_BUFFER_SIZE : next_event;
+
+        json = g_string_sized_new (count * 128 + 64);
+        g_string_append (json, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+        for (i = 0; i < count; i++) {
+                const TraceEvent *event;
+
+                event = &events[(first + i) % TRACE_BUFFER_SIZE];
+                if (i > 0)
+                        g_string_append_c (json, ',');
+                g_string_append (json, "\n{\"name\":");
+                append_json_string (json, event->name);
+                g_string_append_printf (json,
+                                        ",\"cat\":\"geoclue\",\"ph\":\"%c\","
+                                        "\"ts\":%" G_GINT64_FORMAT ","
+                                        "\"pid\":%d,\"tid\":%d,"
+                                        "\"id\":\"0x%" G_GINT64_MODIFIER "x\"",
+                                        event->phase,
+                                        event->timestamp,
+                                        pid, pid,
+                                        event->id);
+                if (event->arg != NULL) {
+                        g_string_append (json, ",\"args\":{\"detail\":");
+                        append_json_string (json, event->arg);
+                        g_string_append_c (json, '}');
+                }
+                g_string_append_c (json, '}');
+        }
+
+        g_string_append (json, "\n]}\n");
+
+        return g_string_free (json, FALSE);
+}
+
+#if GCLUE_USE_TRACING
+static gboolean
+on_dump_signal (gpointer user_data)
+{
+        g_autofree char *json = NULL;
+        g_autoptr(GError) error = NULL;
+
+        if (g_mkdir_with_parents (TRACE_DUMP_DIR, 0755) < 0) {
+                g_warning ("Failed to create " TRACE_DUMP_DIR ": %s",
+                           g_strerror (errno));
+                return G_SOURCE_CONTINUE;
+        }
+
+        json = gclue_trace_to_json ();
+        if (!g_file_set_contents_full (TRACE_DUMP_PATH, json, -1,
+                                       G_FILE_SET_CONTENTS_CONSISTENT,
+                                       0600, &error)) {
+                g_warning ("Failed to write trace: %s", error->message);
+                return G_SOURCE_CONTINUE;
+        }
+
+        g_message ("Trace written to " TRACE_DUMP_PATH);
+
+        return G_SOURCE_CONTINUE;
+}
+
+static const char trace_introspection[] =
+        "<node>"
+        "  <interface name='org.freedesktop.GeoClue2.Trace'>"
+        "    <method name='GetTrace'>"
+        "      <arg name='trace' type='s' direction='out'/>"
+        "    </method>"
+        "  </interface>"
+        "</node>";
+
+static void
+handle_method_call (GDBusConnection       *connection,
+                    const char            *sender,
+                    const char            *object_path,
+                    const char            *interface_name,
+                    const char            *method_name,
+                    GVariant              *parameters,
+                    GDBusMethodInvocation *invocation,
+                    gpointer               user_data)
+{
+        if (g_strcmp0 (method_name, "GetTrace") == 0) {
+                g_autofree char *json = gclue_trace_to_json ();
+
+                g_dbus_method_invocation_return_value
+                        (invocation, g_variant_new ("(s)", json));
+                return;
+        }
+
+        g_dbus_method_invocation_return_error (invocation,
+                                               G_DBUS_ERROR,
+                                               G_DBUS_ERROR_UNKNOWN_METHOD,
+                                               "Unknown method %s",
+                                               method_name);
+}
+
+static const GDBusInterfaceVTable trace_vtable = {
+        handle_method_call, NULL, NULL, { 0 }
+};
+#endif
+
+/**
+ * gclue_trace_export:
+ * @connection: the system bus connection
+ *
+ * Makes the trace available on D-Bus and dumps it on SIGUSR2. Does nothing
+ * if tracing is disabled.
+ **/
+void
+gclue_trace_export (GDBusConnection *connection)
+{
+#if GCLUE_USE_TRACING
+        static GDBusNodeInfo *node_info = NULL;
+        g_autoptr(GError) error = NULL;
+
+        if (node_info != NULL)
+                return;
+
+        node_info = g_dbus_node_info_new_for_xml (trace_introspection, NULL);
+        if (g_dbus_connection_register_object (connection,
+                                               TRACE_OBJECT_PATH,
+                                               node_info->interfaces[0],
+                                               &trace_vtable,
+                                               NULL, NULL,
+                                               &error) == 0)
+                g_warning ("Failed to export trace on D-Bus: %s",
+                           error->message);
+
+        g_unix_signal_add (SIGUSR2, on_dump_signal, NULL);
+#endif
+}
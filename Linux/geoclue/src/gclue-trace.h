@@ -0,0 +1,53 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef GCLUE_TRACE_H
+#define GCLUE_TRACE_H
+
+#include <gio/gio.h>
+#include "config.h"
+
+G_BEGIN_DECLS
+
+guint64 gclue_trace_new_id  (void);
+void    gclue_trace_event   (const char      *name,
+                             char             phase,
+                             guint64          id,
+                             const char      *arg);
+char   *gclue_trace_to_json (void);
+void    gclue_trace_export  (GDBusConnection *connection);
+
+/* @name and @arg must outlive the daemon: string literals or type names.
+ * Events with the same @id end up on the same track of the trace viewer.
+ */
+#if GCLUE_USE_TRACING
+#define GCLUE_TRACE_BEGIN(name, id, arg) \
+        gclue_trace_event ((name), 'b', (id), (arg))
+#define GCLUE_TRACE_END(name, id, arg) \
+        gclue_trace_event ((name), 'e', (id), (arg))
+#define GCLUE_TRACE_INSTANT(name, id, arg) \
+        gclue_trace_event ((name), 'n', (id), (arg))
+#else
+#define GCLUE_TRACE_BEGIN(name, id, arg) G_STMT_START { (void) (id); } G_STMT_END
+#define GCLUE_TRACE_END(name, id, arg) G_STMT_START { (void) (id); } G_STMT_END
+#define GCLUE_TRACE_INSTANT(name, id, arg) G_STMT_START { (void) (id); } G_STMT_END
+#endif
+
+G_END_DECLS
+
+#endif /* GCLUE_TRACE_H */
@@ -28,6 +28,8 @@
 #include "gclue-error.h"
 #include "gclue-location.h"
 #include "gclue-mozilla.h"
+#include "gclue-metrics.h"
+#include "gclue-trace.h"
 
 /**
  * SECTION:gclue-web-source
@@ -49,14 +51,18 @@ struct _GClueWebSourcePrivate {
 
         SoupMessage *query;
         const char *query_data_description;
+        gint64 query_started;
+        gint64 submit_started;
+        guint64 next_trace_id;
+        guint64 query_trace_id;
 
         gulong network_changed_id;
         gulong connectivity_changed_id;
 
         guint64 last_submitted;
 
-        const char *locate_url;
-        const char *submit_url;
+        char *locate_url;
+        char *submit_url;
         gboolean locate_url_reachable;
         gboolean submit_url_reachable;
 };
@@ -117,6 +123,13 @@ gclue_web_source_real_refresh_async (GClueWebSource      *source,
                 return;
         }
 
+        source->priv->query_started = g_get_monotonic_time ();
+        source->priv->query_trace_id = source->priv->next_trace_id;
+        if (source->priv->query_trace_id == 0)
+                source->priv->query_trace_id = gclue_trace_new_id ();
+        source->priv->next_trace_id = 0;
+        GCLUE_TRACE_BEGIN ("web-query", source->priv->query_trace_id,
+                           G_OBJECT_TYPE_NAME (source));
         soup_session_send_and_read_async (source->priv->soup_session,
                                           source->priv->query,
                                           G_PRIORITY_DEFAULT,
@@ -144,6 +157,10 @@ refresh_callback (SoupSession  *session,
         query = g_steal_pointer (&web->priv->query);
 
         body = soup_session_send_and_read_finish (session, result, &local_error);
+        gclue_metrics_observe_since (GCLUE_METRIC_WEB_QUERY_SECONDS, "locate",
+                                     web->priv->query_started);
+        GCLUE_TRACE_END ("web-query", web->priv->query_trace_id,
+                         body != NULL ? "ok" : "failed");
         if (!body) {
                 g_task_return_error (task, g_steal_pointer (&local_error));
                 return;
@@ -168,6 +185,7 @@ refresh_callback (SoupSession  *session,
                 return;
         }
 
+        gclue_location_set_trace_id (location, web->priv->query_trace_id);
         gclue_location_source_set_location (GCLUE_LOCATION_SOURCE (web),
                                             location);
 
@@ -398,6 +416,8 @@ gclue_web_source_finalize (GObject *gsource)
 
         g_clear_object (&priv->query);
         g_clear_object (&priv->cancellable);
+        g_clear_pointer (&priv->locate_url, g_free);
+        g_clear_pointer (&priv->submit_url, g_free);
 
         G_OBJECT_CLASS (gclue_web_source_parent_class)->finalize (gsource);
 }
@@ -518,6 +538,7 @@ submit_query_callback (SoupSession  *session,
                        GAsyncResult *result,
                        gpointer      user_data)
 {
+        GClueWebSource *web = GCLUE_WEB_SOURCE (user_data);
         g_autoptr(GBytes) body = NULL;
         g_autoptr(GError) local_error = NULL;
         SoupMessage *query;
@@ -528,6 +549,8 @@ submit_query_callback (SoupSession  *session,
         uri_str = g_uri_to_string (soup_message_get_uri (query));
 
         body = soup_session_send_and_read_finish (session, result, &local_error);
+        gclue_metrics_observe_since (GCLUE_METRIC_WEB_QUERY_SECONDS, "submit",
+                                     web->priv->submit_started);
         if (!body) {
                 g_warning ("Failed to submit location data to '%s': %s",
                            uri_str, local_error->message);
@@ -586,6 +609,7 @@ on_submit_source_location_notify (GObject    *source_object,
                 return;
         }
 
+        web->priv->submit_started = g_get_monotonic_time ();
         soup_session_send_and_read_async (web->priv->soup_session,
                                           query,
                                           G_PRIORITY_DEFAULT,
@@ -620,16 +644,47 @@ gclue_web_source_set_submit_source (GClueWebSource      *web,
         on_submit_source_location_notify (G_OBJECT (submit_source), NULL, web);
 }
 
+static void
+set_url (GClueWebSource *source,
+         char          **field,
+         const char     *url)
+{
+        if (g_strcmp0 (*field, url) == 0)
+                return;
+
+        g_free (*field);
+        *field = g_strdup (url);
+
+        /* Until constructed, the reachability check is still to come */
+        if (source->priv->soup_session != NULL)
+                on_network_changed (NULL, FALSE, source);
+}
+
 void
 gclue_web_source_set_locate_url (GClueWebSource *source,
                                  const char     *url)
 {
-        source->priv->locate_url = url;
+        set_url (source, &source->priv->locate_url, url);
 }
 
 void
 gclue_web_source_set_submit_url (GClueWebSource *source,
                                  const char     *url)
 {
-        source->priv->submit_url = url;
+        set_url (source, &source->priv->submit_url, url);
+}
+
+/**
+ * gclue_web_source_set_trace_id:
+ * @source: a #GClueWebSource
+ * @trace_id: a correlation ID from gclue_trace_new_id()
+ *
+ * Makes the next query and its location part of the trace of @trace_id,
+ * e.g. of the WiFi scan that triggered it. Queries get a new ID otherwise.
+ **/
+void
+gclue_web_source_set_trace_id (GClueWebSource *source,
+                               guint64         trace_id)
+{
+        source->priv->next_trace_id = trace_id;
 }
@@ -88,6 +88,8 @@ void gclue_web_source_set_locate_url    (GClueWebSource      *source,
                                          const char          *url);
 void gclue_web_source_set_submit_url    (GClueWebSource      *source,
                                          const char          *url);
+void gclue_web_source_set_trace_id      (GClueWebSource      *source,
+                                         guint64              trace_id);
 
 G_END_DECLS
 
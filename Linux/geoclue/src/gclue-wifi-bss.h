@@ -0,0 +1,58 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef GCLUE_WIFI_BSS_H
+#define GCLUE_WIFI_BSS_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define GCLUE_WIFI_BSSID_LEN 6
+#define GCLUE_WIFI_BSSID_STR_LEN 17
+#define GCLUE_WIFI_MAX_SSID_LEN 32
+
+typedef struct _GClueWifiBss GClueWifiBss;
+
+/* One scan result, as reported by wpa_supplicant. These are kept by value in
+ * a flat array and filled from the BSS property dictionaries directly, so no
+ * per-BSS D-Bus proxy is needed.
+ */
+struct _GClueWifiBss {
+        char    *path;
+        guint8   bssid[GCLUE_WIFI_BSSID_LEN];
+        gboolean has_bssid;
+        char     ssid[GCLUE_WIFI_MAX_SSID_LEN + 1];
+        guint    ssid_len;
+        gint16   signal;
+        guint16  frequency;
+        guint32  age;
+
+        /* Whether the AP is worth sending to the location service: it has a
+         * BSSID and SSID, doesn't opt out with '_nomap' and is above the
+         * noise level. */
+        gboolean usable;
+
+        /* < private > */
+        gboolean filled;
+        gboolean ignored;
+        gboolean fresh;
+};
+
+G_END_DECLS
+
+#endif /* GCLUE_WIFI_BSS_H */
@@ -28,6 +28,8 @@
 #include "gclue-config.h"
 #include "gclue-error.h"
 #include "gclue-mozilla.h"
+#include "gclue-metrics.h"
+#include "gclue-trace.h"
 
 #define WIFI_SCAN_TIMEOUT_HIGH_ACCURACY 10
 /* Since this is only used for city-level accuracy, 5 minutes between each
@@ -40,10 +42,6 @@
  */
 #define WIFI_SCAN_BSS_NOISE_LEVEL -90
 
-#define BSSID_LEN 6
-#define BSSID_STR_LEN 17
-#define MAX_SSID_LEN 32
-
 /* Drop entries from the cache when they are more than 48 hours old. If we are
  * polling at high accuracy for that entire period, that gives a maximum cache
  * size of 17280 entries. At roughly 400B each, that’s about 7MB of heap for a
@@ -139,16 +137,18 @@ struct _GClueWifiPrivate {
         GClueMozilla *mozilla;
         WPASupplicant *supplicant;
         WPAInterface *interface;
-        GHashTable *bss_proxies;
-        GHashTable *ignored_bss_proxies;
+        GArray *bss_list;  /* (element-type GClueWifiBss) (owned) */
+        guint n_usable_bss;
+        guint bss_fetches_pending;
         gboolean bss_list_changed;
 
         gulong bss_added_id;
         gulong bss_removed_id;
         gulong scan_done_id;
-        guint scan_wait_id;
 
         guint scan_timeout;
+        gint64 scan_started;
+        guint64 scan_trace_id;
 
         GHashTable *location_cache;  /* (element-type GVariant LocationCacheValue) (owned) */
         guint cache_prune_timeout_id;
@@ -202,8 +202,7 @@ gclue_wifi_finalize (GObject *gwifi)
 
         g_clear_object (&wifi->priv->supplicant);
         g_clear_object (&wifi->priv->interface);
-        g_clear_pointer (&wifi->priv->bss_proxies, g_hash_table_unref);
-        g_clear_pointer (&wifi->priv->ignored_bss_proxies, g_hash_table_unref);
+        g_clear_pointer (&wifi->priv->bss_list, g_array_unref);
         g_clear_pointer (&wifi->priv->location_cache, g_hash_table_unref);
         g_clear_object (&wifi->priv->mozilla);
         g_clear_object (&wifi->priv->intf_cancellable);
@@ -236,162 +235,253 @@ on_bss_added (WPAInterface *object,
               const gchar  *path,
               GVariant     *properties,
               gpointer      user_data);
+static void
+on_bss_list_ready (GClueWifi *wifi);
 
-static guint
-variant_to_string (GVariant *variant, guint max_len, char *ret)
-{
-        guint i;
-        guint len;
-
-        len = g_variant_n_children (variant);
-        if (len == 0)
-                return 0;
-        g_return_val_if_fail(len <= max_len, 0);
-        ret[len] = '\0';
-
-        for (i = 0; i < len; i++)
-                g_variant_get_child (variant,
-                                     i,
-                                     "y",
-                                     &ret[i]);
-
-        return len;
-}
-
-static guint
-get_ssid_from_bss (WPABSS *bss, char *ssid)
+static void
+bss_clear (gpointer data)
 {
-        GVariant *variant = wpa_bss_get_ssid (bss);
+        GClueWifiBss *bss = data;
 
-        return variant_to_string (variant, MAX_SSID_LEN, ssid);
+        g_clear_pointer (&bss->path, g_free);
 }
 
 static gboolean
-get_bssid_from_bss (WPABSS *bss, char *bssid)
+get_bssid_from_bss (const GClueWifiBss *bss, char *bssid)
 {
-        GVariant *variant;
-        char raw_bssid[BSSID_LEN + 1] = { 0 };
-        guint raw_len, i;
+        guint i;
 
-        variant = wpa_bss_get_bssid (bss);
-        if (variant == NULL)
+        if (!bss->has_bssid)
                 return FALSE;
 
-        raw_len = variant_to_string (variant, BSSID_LEN, raw_bssid);
-        g_return_val_if_fail (raw_len == BSSID_LEN, FALSE);
-
-        for (i = 0; i < BSSID_LEN; i++) {
-                unsigned char c = (unsigned char) raw_bssid[i];
-
-                if (i == BSSID_LEN - 1) {
-                        g_snprintf (bssid + (i * 3), 3, "%02x", c);
+        for (i = 0; i < GCLUE_WIFI_BSSID_LEN; i++) {
+                if (i == GCLUE_WIFI_BSSID_LEN - 1) {
+                        g_snprintf (bssid + (i * 3), 3, "%02x", bss->bssid[i]);
                 } else {
-                        g_snprintf (bssid + (i * 3), 4, "%02x:", c);
+                        g_snprintf (bssid + (i * 3), 4, "%02x:", bss->bssid[i]);
                 }
         }
 
         return TRUE;
 }
 
-static void
-add_bss_proxy (GClueWifi *wifi,
-               WPABSS    *bss)
+/* A scan result rarely has more than a few dozen entries, so a linear search
+ * over the flat array is cheaper than keeping a path index in sync with it.
+ */
+static GClueWifiBss *
+find_bss (GClueWifi   *wifi,
+          const gchar *path,
+          guint       *index)
 {
-        const char *path;
+        GArray *bss_list = wifi->priv->bss_list;
+        guint i;
 
-        path = g_dbus_proxy_get_object_path (G_DBUS_PROXY (bss));
-        if (g_hash_table_replace (wifi->priv->bss_proxies,
-                                  g_strdup (path),
-                                  bss)) {
-                char ssid[MAX_SSID_LEN + 1] = { 0 };
+        for (i = 0; i < bss_list->len; i++) {
+                GClueWifiBss *bss = &g_array_index (bss_list, GClueWifiBss, i);
 
-                wifi->priv->bss_list_changed = TRUE;
-                get_ssid_from_bss (bss, ssid);
-                g_debug ("WiFi AP '%s' added.", ssid);
+                if (g_strcmp0 (bss->path, path) == 0) {
+                        if (index != NULL)
+                                *index = i;
+                        return bss;
+                }
         }
+
+        return NULL;
 }
 
-static void
-on_bss_signal_notify (GObject    *gobject,
-                      GParamSpec *pspec,
-                      gpointer    user_data)
+static GClueWifiBss *
+find_or_add_bss (GClueWifi   *wifi,
+                 const gchar *path)
 {
-        GClueWifi *wifi = GCLUE_WIFI (user_data);
-        WPABSS *bss = WPA_BSS (gobject);
-        const char *path;
+        GClueWifiBss *bss;
+        GClueWifiBss new_bss = { 0 };
 
-        if (wpa_bss_get_signal (bss) <= WIFI_SCAN_BSS_NOISE_LEVEL) {
-                char bssid[BSSID_STR_LEN + 1] = { 0 };
+        bss = find_bss (wifi, path, NULL);
+        if (bss != NULL)
+                return bss;
 
-                get_bssid_from_bss (bss, bssid);
-                g_debug ("WiFi AP '%s' still has very low strength (%d dBm)"
-                         ", ignoring again…",
-                         bssid,
-                         wpa_bss_get_signal (bss));
-                return;
-        }
+        new_bss.path = g_strdup (path);
+        g_array_append_val (wifi->priv->bss_list, new_bss);
 
-        g_signal_handlers_disconnect_by_func (G_OBJECT (bss),
-                                              on_bss_signal_notify,
-                                              user_data);
-        add_bss_proxy (wifi, g_object_ref (bss));
-        path = g_dbus_proxy_get_object_path (G_DBUS_PROXY (bss));
-        g_hash_table_remove (wifi->priv->ignored_bss_proxies, path);
+        return &g_array_index (wifi->priv->bss_list,
+                               GClueWifiBss,
+                               wifi->priv->bss_list->len - 1);
 }
 
 static void
-on_bss_proxy_ready (GObject      *source_object,
-                    GAsyncResult *res,
-                    gpointer      user_data)
+set_bss_usable (GClueWifi    *wifi,
+                GClueWifiBss *bss,
+                gboolean      usable)
 {
-        GClueWifi *wifi;
-        WPABSS *bss;
-        g_autoptr(GError) error = NULL;
-        char ssid[MAX_SSID_LEN + 1] = { 0 };
-
-        bss = wpa_bss_proxy_new_for_bus_finish (res, &error);
-        if (bss == NULL) {
-                if (error && !g_error_matches (error, G_IO_ERROR,
-                                               G_IO_ERROR_CANCELLED)) {
-                        g_warning ("BSS proxy setup failed: %s",
-                                   error->message);
-                }
+        GClueWifiPrivate *priv = wifi->priv;
 
+        if (bss->usable == usable)
                 return;
-        }
 
-        wifi = GCLUE_WIFI (user_data);
+        bss->usable = usable;
+        priv->bss_list_changed = TRUE;
+        if (usable)
+                priv->n_usable_bss++;
+        else
+                priv->n_usable_bss--;
+}
 
-        if (gclue_mozilla_should_ignore_bss (bss)) {
-                g_object_unref (bss);
+/* Fill @bss from a `fi.w1.wpa_supplicant1.BSS` property dictionary, as found
+ * in both the `BSSAdded` signal and the reply to `GetAll`.
+ */
+static void
+update_bss (GClueWifi    *wifi,
+            GClueWifiBss *bss,
+            GVariant     *properties)
+{
+        g_autoptr(GVariant) bssid = NULL;
+        g_autoptr(GVariant) ssid = NULL;
+        char bssid_str[GCLUE_WIFI_BSSID_STR_LEN + 1] = { 0 };
+        gboolean usable;
+
+        bssid = g_variant_lookup_value (properties,
+                                        "BSSID",
+                                        G_VARIANT_TYPE_BYTESTRING);
+        if (bssid != NULL) {
+                const guint8 *data;
+                gsize len;
+
+                data = g_variant_get_fixed_array (bssid, &len, 1);
+                bss->has_bssid = (len == GCLUE_WIFI_BSSID_LEN);
+                if (bss->has_bssid)
+                        memcpy (bss->bssid, data, GCLUE_WIFI_BSSID_LEN);
+        }
 
-                return;
+        ssid = g_variant_lookup_value (properties,
+                                       "SSID",
+                                       G_VARIANT_TYPE_BYTESTRING);
+        if (ssid != NULL) {
+                const char *data;
+                gsize len;
+
+                data = g_variant_get_fixed_array (ssid, &len, 1);
+                len = MIN (len, GCLUE_WIFI_MAX_SSID_LEN);
+                memcpy (bss->ssid, data, len);
+                bss->ssid[len] = '\0';
+                bss->ssid_len = len;
         }
 
-        get_ssid_from_bss (bss, ssid);
-        g_debug ("Got WiFi AP '%s'", ssid);
+        g_variant_lookup (properties, "Signal", "n", &bss->signal);
+        g_variant_lookup (properties, "Frequency", "q", &bss->frequency);
+        g_variant_lookup (properties, "Age", "u", &bss->age);
+
+        /* BSSID and SSID don't change for a given BSS object, so only decide
+         * once whether the AP is to be ignored altogether. */
+        if (!bss->filled) {
+                bss->filled = TRUE;
+                bss->ignored = gclue_mozilla_should_ignore_bss (bss);
+                if (!bss->ignored)
+                        g_debug ("Got WiFi AP '%s'", bss->ssid);
+        }
 
-        if (wpa_bss_get_signal (bss) <= WIFI_SCAN_BSS_NOISE_LEVEL) {
-                const char *path;
-                char bssid[BSSID_STR_LEN + 1] = { 0 };
+        if (bss->ignored)
+                return;
+
+        usable = bss->signal > WIFI_SCAN_BSS_NOISE_LEVEL;
+        if (usable == bss->usable)
+                return;
 
-                get_bssid_from_bss (bss, bssid);
+        if (usable) {
+                g_debug ("WiFi AP '%s' added.", bss->ssid);
+        } else {
+                get_bssid_from_bss (bss, bssid_str);
                 g_debug ("WiFi AP '%s' has very low strength (%d dBm)"
                          ", ignoring for now…",
-                         bssid,
-                         wpa_bss_get_signal (bss));
-                g_signal_connect (G_OBJECT (bss),
-                                  "notify::signal",
-                                  G_CALLBACK (on_bss_signal_notify),
-                                  user_data);
-                path = g_dbus_proxy_get_object_path (G_DBUS_PROXY (bss));
-                g_hash_table_replace (wifi->priv->ignored_bss_proxies,
-                                      g_strdup (path),
-                                      bss);
+                         bssid_str,
+                         bss->signal);
+        }
+        set_bss_usable (wifi, bss, usable);
+}
+
+typedef struct {
+        GClueWifi *wifi;
+        char *path;
+} BssFetchData;
+
+static void
+bss_fetch_data_free (BssFetchData *data)
+{
+        g_free (data->path);
+        g_slice_free (BssFetchData, data);
+}
+
+static void
+on_bss_get_all_ready (GObject      *source_object,
+                      GAsyncResult *res,
+                      gpointer      user_data)
+{
+        BssFetchData *data = user_data;
+        GClueWifi *wifi;
+        GClueWifiBss *bss;
+        g_autoptr(GVariant) reply = NULL;
+        g_autoptr(GVariant) properties = NULL;
+        g_autoptr(GError) error = NULL;
+
+        reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object),
+                                               res,
+                                               &error);
+        if (reply == NULL &&
+            g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                bss_fetch_data_free (data);
                 return;
         }
 
-        add_bss_proxy (wifi, bss);
+        wifi = data->wifi;
+        if (reply == NULL) {
+                /* Most likely the BSS went away before we got to it. */
+                g_debug ("Failed to fetch properties of WiFi AP '%s': %s",
+                         data->path, error->message);
+        } else {
+                bss = find_bss (wifi, data->path, NULL);
+                if (bss != NULL) {
+                        properties = g_variant_get_child_value (reply, 0);
+                        update_bss (wifi, bss, properties);
+                }
+        }
+        bss_fetch_data_free (data);
+
+        g_return_if_fail (wifi->priv->bss_fetches_pending > 0);
+        if (--wifi->priv->bss_fetches_pending == 0)
+                on_bss_list_ready (wifi);
+}
+
+/* Request all properties of the BSS at @path. All requests of a batch are
+ * pipelined on the connection rather than serialised, and on_bss_list_ready()
+ * runs as soon as the last reply is in.
+ */
+static void
+fetch_bss (GClueWifi   *wifi,
+           const gchar *path)
+{
+        GClueWifiPrivate *priv = wifi->priv;
+        GDBusConnection *connection;
+        BssFetchData *data;
+
+        connection = g_dbus_proxy_get_connection (G_DBUS_PROXY (priv->interface));
+
+        data = g_slice_new (BssFetchData);
+        data->wifi = wifi;
+        data->path = g_strdup (path);
+
+        priv->bss_fetches_pending++;
+        g_dbus_connection_call (connection,
+                                "fi.w1.wpa_supplicant1",
+                                path,
+                                "org.freedesktop.DBus.Properties",
+                                "GetAll",
+                                g_variant_new ("(s)",
+                                               "fi.w1.wpa_supplicant1.BSS"),
+                                G_VARIANT_TYPE ("(a{sv})"),
+                                G_DBUS_CALL_FLAGS_NONE,
+                                -1,
+                                priv->bss_cancellable,
+                                on_bss_get_all_ready,
+                                data);
 }
 
 static void
@@ -401,44 +491,69 @@ on_bss_added (WPAInterface *object,
               gpointer      user_data)
 {
         GClueWifi *wifi = GCLUE_WIFI (user_data);
+        GClueWifiBss *bss;
 
-        wpa_bss_proxy_new_for_bus (G_BUS_TYPE_SYSTEM,
-                                   G_DBUS_PROXY_FLAGS_NONE,
-                                   "fi.w1.wpa_supplicant1",
-                                   path,
-                                   wifi->priv->bss_cancellable,
-                                   on_bss_proxy_ready,
-                                   wifi);
+        bss = find_or_add_bss (wifi, path);
+
+        /* wpa_supplicant hands us the full property set with the signal, so
+         * there is nothing to fetch. This is also up to date for the next
+         * `ScanDone`, which won't need to fetch it again either. */
+        if (properties != NULL) {
+                update_bss (wifi, bss, properties);
+                bss->fresh = TRUE;
+        } else {
+                fetch_bss (wifi, path);
+        }
 }
 
-static gboolean
-remove_bss_from_hashtable (const gchar *path, GHashTable *hash_table)
+static void
+on_bss_removed (WPAInterface *object,
+                const gchar  *path,
+                gpointer      user_data)
 {
-        char ssid[MAX_SSID_LEN + 1] = { 0 };
-        WPABSS *bss = NULL;
+        GClueWifi *wifi = GCLUE_WIFI (user_data);
+        GClueWifiBss *bss;
+        guint index;
 
-        bss = g_hash_table_lookup (hash_table, path);
+        bss = find_bss (wifi, path, &index);
         if (bss == NULL)
-                return FALSE;
-
-        get_ssid_from_bss (bss, ssid);
-        g_debug ("WiFi AP '%s' removed.", ssid);
+                return;
 
-        g_hash_table_remove (hash_table, path);
+        if (bss->usable) {
+                g_debug ("WiFi AP '%s' removed.", bss->ssid);
+                set_bss_usable (wifi, bss, FALSE);
+        }
 
-        return TRUE;
+        g_array_remove_index_fast (wifi->priv->bss_list, index);
 }
 
+/* Bring signal strength and age of all known BSSs up to date after a scan,
+ * skipping those that were just announced with their properties.
+ */
 static void
-on_bss_removed (WPAInterface *object,
-                const gchar  *path,
-                gpointer      user_data)
+fetch_all_bss (GClueWifi *wifi)
 {
-        GClueWifiPrivate *priv = GCLUE_WIFI (user_data)->priv;
+        GClueWifiPrivate *priv = wifi->priv;
+        guint i, n_fetches = 0;
 
-        if (remove_bss_from_hashtable (path, priv->bss_proxies))
-                priv->bss_list_changed = TRUE;
-        remove_bss_from_hashtable (path, priv->ignored_bss_proxies);
+        for (i = 0; i < priv->bss_list->len; i++) {
+                GClueWifiBss *bss = &g_array_index (priv->bss_list,
+                                                    GClueWifiBss,
+                                                    i);
+
+                if (bss->fresh) {
+                        bss->fresh = FALSE;
+                        continue;
+                }
+
+                fetch_bss (wifi, bss->path);
+                n_fetches++;
+        }
+
+        g_debug ("Fetching properties of %u of %u WiFi APs",
+                 n_fetches, priv->bss_list->len);
+        if (priv->bss_fetches_pending == 0)
+                on_bss_list_ready (wifi);
 }
 
 static void
@@ -449,6 +564,9 @@ start_wifi_scan (GClueWifi *wifi)
         GVariant *args;
 
         g_debug ("Starting WiFi scan…");
+        priv->scan_started = g_get_monotonic_time ();
+        priv->scan_trace_id = gclue_trace_new_id ();
+        GCLUE_TRACE_BEGIN ("wifi-scan", priv->scan_trace_id, NULL);
 
         if (priv->scan_done_id == 0)
                 priv->scan_done_id = g_signal_connect
@@ -480,11 +598,6 @@ cancel_wifi_scan (GClueWifi *wifi)
                 priv->scan_timeout = 0;
         }
 
-        if (priv->scan_wait_id != 0) {
-                g_source_remove (priv->scan_wait_id);
-                priv->scan_wait_id = 0;
-        }
-
         if (priv->scan_done_id != 0) {
                 g_signal_handler_disconnect (priv->interface,
                                              priv->scan_done_id);
@@ -513,13 +626,10 @@ gboolean gclue_wifi_should_skip_bsss (GClueAccuracyLevel level)
         return level < GCLUE_ACCURACY_LEVEL_STREET;
 }
 
-static gboolean
-on_scan_wait_done (gpointer wifi)
+static void
+on_bss_list_ready (GClueWifi *wifi)
 {
-        GClueWifiPrivate *priv;
-
-        g_return_val_if_fail (GCLUE_IS_WIFI (wifi), G_SOURCE_REMOVE);
-        priv = GCLUE_WIFI(wifi)->priv;
+        GClueWifiPrivate *priv = wifi->priv;
 
         /* We have the latest scan result */
         gclue_mozilla_set_wifi (priv->mozilla, wifi);
@@ -530,9 +640,6 @@ on_scan_wait_done (gpointer wifi)
                 gclue_mozilla_set_bss_dirty (priv->mozilla);
                 gclue_web_source_refresh (GCLUE_WEB_SOURCE (wifi));
         }
-        priv->scan_wait_id = 0;
-
-        return G_SOURCE_REMOVE;
 }
 
 static GClueAccuracyLevel
@@ -553,6 +660,18 @@ on_scan_done (WPAInterface *object,
         GClueWifiPrivate *priv = wifi->priv;
         guint timeout;
 
+        /* ScanDone also follows scans started by other clients, those we
+         * didn't time.
+         */
+        if (priv->scan_started != 0) {
+                gclue_metrics_observe_since (GCLUE_METRIC_WIFI_SCAN_SECONDS,
+                                             success ? "ok" : "failed",
+                                             priv->scan_started);
+                GCLUE_TRACE_END ("wifi-scan", priv->scan_trace_id,
+                                 success ? "ok" : "failed");
+                priv->scan_started = 0;
+        }
+
         if (!success) {
                 g_warning ("WiFi scan failed");
 
@@ -562,10 +681,7 @@ on_scan_done (WPAInterface *object,
         if (priv->interface == NULL)
                 return;
 
-        if (priv->scan_wait_id != 0)
-            g_source_remove (priv->scan_wait_id);
-
-        priv->scan_wait_id = g_timeout_add_seconds (1, on_scan_wait_done, wifi);
+        fetch_all_bss (wifi);
 
         /* If there was another scan already scheduled, cancel that and
          * re-schedule. Regardless of our internal book-keeping, this can happen
@@ -681,8 +797,9 @@ disconnect_bss_signals (GClueWifi *wifi)
                 priv->bss_removed_id = 0;
         }
 
-        g_hash_table_remove_all (priv->bss_proxies);
-        g_hash_table_remove_all (priv->ignored_bss_proxies);
+        g_array_set_size (priv->bss_list, 0);
+        priv->n_usable_bss = 0;
+        priv->bss_fetches_pending = 0;
 }
 
 static void
@@ -968,64 +1085,56 @@ on_interface_removed (WPASupplicant *supplicant,
 }
 
 static void
-gclue_wifi_init (GClueWifi *wifi)
+on_config_changed (GClueConfig *config,
+                   gpointer     user_data)
 {
+        GClueWifi *wifi = GCLUE_WIFI (user_data);
         GClueWebSource *web_source = GCLUE_WEB_SOURCE (wifi);
 
-        wifi->priv = gclue_wifi_get_instance_private (wifi);
-
-        wifi->priv->intf_cancellable = g_cancellable_new ();
-        wifi->priv->mozilla = gclue_mozilla_get_singleton ();
+        /* The web source keeps copies, the config strings die on reload */
         gclue_web_source_set_locate_url (web_source,
                                          gclue_mozilla_get_locate_url (wifi->priv->mozilla));
         gclue_web_source_set_submit_url (web_source,
                                          gclue_mozilla_get_submit_url (wifi->priv->mozilla));
+}
 
-        wifi->priv->bss_proxies = g_hash_table_new_full (g_str_hash,
-                                                         g_str_equal,
-                                                         g_free,
-                                                         g_object_unref);
-        wifi->priv->ignored_bss_proxies = g_hash_table_new_full (g_str_hash,
-                                                                 g_str_equal,
-                                                                 g_free,
-                                                                 g_object_unref);
+static void
+gclue_wifi_init (GClueWifi *wifi)
+{
+        GClueConfig *config = gclue_config_get_singleton ();
+
+        wifi->priv = gclue_wifi_get_instance_private (wifi);
+
+        wifi->priv->intf_cancellable = g_cancellable_new ();
+        wifi->priv->mozilla = gclue_mozilla_get_singleton ();
+        on_config_changed (config, wifi);
+        g_signal_connect_object (config,
+                                 "changed",
+                                 G_CALLBACK (on_config_changed),
+                                 wifi,
+                                 0);
+
+        wifi->priv->bss_list = g_array_new (FALSE, FALSE, sizeof (GClueWifiBss));
+        g_array_set_clear_func (wifi->priv->bss_list, bss_clear);
         wifi->priv->location_cache = g_hash_table_new_full (variant_hash,
                                                             g_variant_equal,
                                                             (GDestroyNotify) g_variant_unref,
                                                             location_cache_value_free);
 }
 
+/* Shared by all instances and kept for the life of the daemon, so a new
+ * client doesn't wait for the proxy's round trips to wpa_supplicant.
+ */
+static WPASupplicant *shared_supplicant = NULL;
+
 static void
-gclue_wifi_constructed (GObject *object)
+set_supplicant (GClueWifi     *wifi,
+                WPASupplicant *supplicant)
 {
-        GClueWifi *wifi = GCLUE_WIFI (object);
         GClueWifiPrivate *priv = wifi->priv;
         const gchar *const *interfaces;
-        g_autoptr(GError) error = NULL;
-
-        G_OBJECT_CLASS (gclue_wifi_parent_class)->constructed (object);
-
-        if (get_accuracy_level (wifi) == GCLUE_ACCURACY_LEVEL_CITY) {
-                GClueConfig *config = gclue_config_get_singleton ();
-
-                if (!gclue_config_get_enable_wifi_source (config))
-                        goto refresh_n_exit;
-        }
 
-        /* FIXME: We should be using async variant */
-        priv->supplicant = wpa_supplicant_proxy_new_for_bus_sync
-                        (G_BUS_TYPE_SYSTEM,
-                         G_DBUS_PROXY_FLAGS_NONE,
-                         "fi.w1.wpa_supplicant1",
-                         "/fi/w1/wpa_supplicant1",
-                         NULL,
-                         &error);
-        if (priv->supplicant == NULL) {
-                if (error)
-                        g_warning ("Failed to connect to wpa_supplicant service: %s",
-                                   error->message);
-                goto refresh_n_exit;
-        }
+        priv->supplicant = g_object_ref (supplicant);
 
         g_signal_connect_object (priv->supplicant,
                                  "interface-added",
@@ -1042,6 +1151,57 @@ gclue_wifi_constructed (GObject *object)
                                     interfaces[0],
                                     NULL,
                                     wifi);
+}
+
+static void
+on_supplicant_proxy_ready (GObject      *source_object,
+                           GAsyncResult *res,
+                           gpointer      user_data)
+{
+        WPASupplicant *supplicant;
+        g_autoptr(GError) error = NULL;
+
+        supplicant = wpa_supplicant_proxy_new_for_bus_finish (res, &error);
+        if (supplicant == NULL) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_warning ("Failed to connect to wpa_supplicant service: %s",
+                                   error->message);
+                return;
+        }
+
+        /* Another instance may have got there first. */
+        if (shared_supplicant == NULL)
+                shared_supplicant = supplicant;
+        else
+                g_object_unref (supplicant);
+
+        set_supplicant (GCLUE_WIFI (user_data), shared_supplicant);
+}
+
+static void
+gclue_wifi_constructed (GObject *object)
+{
+        GClueWifi *wifi = GCLUE_WIFI (object);
+
+        G_OBJECT_CLASS (gclue_wifi_parent_class)->constructed (object);
+
+        if (get_accuracy_level (wifi) == GCLUE_ACCURACY_LEVEL_CITY) {
+                GClueConfig *config = gclue_config_get_singleton ();
+
+                if (!gclue_config_get_enable_wifi_source (config))
+                        goto refresh_n_exit;
+        }
+
+        if (shared_supplicant != NULL)
+                set_supplicant (wifi, shared_supplicant);
+        else
+                wpa_supplicant_proxy_new_for_bus (G_BUS_TYPE_SYSTEM,
+                                                  G_DBUS_PROXY_FLAGS_NONE,
+                                                  "fi.w1.wpa_supplicant1",
+                                                  "/fi/w1/wpa_supplicant1",
+                                                  wifi->priv->intf_cancellable,
+                                                  on_supplicant_proxy_ready,
+                                                  wifi);
 
 refresh_n_exit:
         gclue_web_source_refresh (GCLUE_WEB_SOURCE (object));
@@ -1114,11 +1274,14 @@ wifi_should_skip_tower (GClueWifi *wifi)
         return gclue_3g_should_skip_tower (get_accuracy_level (wifi));
 }
 
-/* Can return NULL, signifying an empty BSS list. */
-GList *
+/* Returns all BSSs of the last scan, including ignored and low-signal ones;
+ * check GClueWifiBss.usable. The array is owned by @wifi and only valid until
+ * the next scan result.
+ */
+GArray *
 gclue_wifi_get_bss_list (GClueWifi *wifi)
 {
-        return g_hash_table_get_values (wifi->priv->bss_proxies);
+        return wifi->priv->bss_list;
 }
 
 static SoupMessage *
@@ -1134,7 +1297,7 @@ gclue_wifi_create_query (GClueWebSource *source,
         }
 
         /* Empty list? */
-        if (!g_hash_table_size (wifi->priv->bss_proxies)) {
+        if (wifi->priv->n_usable_bss == 0) {
                 g_set_error_literal (error,
                                      G_IO_ERROR,
                                      G_IO_ERROR_FAILED,
@@ -1169,7 +1332,7 @@ gclue_wifi_create_submit_query (GClueWebSource  *source,
         }
 
         /* Empty list? */
-        if (!g_hash_table_size (wifi->priv->bss_proxies)) {
+        if (wifi->priv->n_usable_bss == 0) {
                 g_set_error_literal (error,
                                      G_IO_ERROR,
                                      G_IO_ERROR_FAILED,
@@ -1191,27 +1354,17 @@ static gint
 bss_compare (gconstpointer a,
              gconstpointer b)
 {
-        WPABSS **_bss_a = (WPABSS **) a;
-        WPABSS **_bss_b = (WPABSS **) b;
-        WPABSS *bss_a = WPA_BSS (*_bss_a);
-        WPABSS *bss_b = WPA_BSS (*_bss_b);
-        GVariant *bssid_a = wpa_bss_get_bssid (bss_a);
-        GVariant *bssid_b = wpa_bss_get_bssid (bss_b);
-        g_autoptr(GBytes) bssid_bytes_a = NULL;
-        g_autoptr(GBytes) bssid_bytes_b = NULL;
-
-        /* Can’t use g_variant_compare() as it isn’t defined over `ay` types */
-        if (bssid_a == NULL && bssid_b == NULL)
+        const GClueWifiBss *bss_a = *(const GClueWifiBss **) a;
+        const GClueWifiBss *bss_b = *(const GClueWifiBss **) b;
+
+        if (!bss_a->has_bssid && !bss_b->has_bssid)
                 return 0;
-        else if (bssid_a == NULL)
+        else if (!bss_a->has_bssid)
                 return -1;
-        else if (bssid_b == NULL)
+        else if (!bss_b->has_bssid)
                 return 1;
 
-        bssid_bytes_a = g_variant_get_data_as_bytes (bssid_a);
-        bssid_bytes_b = g_variant_get_data_as_bytes (bssid_b);
-
-        return g_bytes_compare (bssid_bytes_a, bssid_bytes_b);
+        return memcmp (bss_a->bssid, bss_b->bssid, GCLUE_WIFI_BSSID_LEN);
 }
 
 static guint
@@ -1253,20 +1406,19 @@ static void location_cache_key_add_tower (GClueWifi *wifi, GVariantBuilder *buil
 static GPtrArray *
 get_location_cache_bss_array (GClueWifi *wifi)
 {
-        GHashTableIter iter;
-        gpointer value;
-        g_autoptr(GPtrArray) bss_array = g_ptr_array_new_with_free_func (NULL);  /* (element-type WPABSS) */
+        GArray *bss_list = wifi->priv->bss_list;
+        guint i;
+        g_autoptr(GPtrArray) bss_array = g_ptr_array_new_with_free_func (NULL);  /* (element-type GClueWifiBss) */
 
         /* The Mozilla service puts BSSID and signal strength for each BSS into
          * its query. Pack the whole lot into a #GVariant for simplicity, sorted
          * by MAC address. The sorting has to happen in an array beforehand,
          * as variants are immutable.
          */
-        g_hash_table_iter_init (&iter, wifi->priv->bss_proxies);
+        for (i = 0; i < bss_list->len; i++) {
+                GClueWifiBss *bss = &g_array_index (bss_list, GClueWifiBss, i);
 
-        while (g_hash_table_iter_next (&iter, NULL, &value)) {
-                WPABSS *bss = WPA_BSS (value);
-                if (bss != NULL)
+                if (bss->usable)
                         g_ptr_array_add (bss_array, bss);
         }
 
@@ -1287,14 +1439,16 @@ get_location_cache_hashtable_key (GClueWifi *wifi, GPtrArray *bss_array)
 
         g_variant_builder_open (&builder, G_VARIANT_TYPE ("aay"));
         for (i = 0; i < bss_array->len; i++) {
-                WPABSS *bss = WPA_BSS (bss_array->pdata[i]);
-                GVariant *bssid;
+                const GClueWifiBss *bss = bss_array->pdata[i];
 
-                bssid = wpa_bss_get_bssid (bss);
-                if (bssid == NULL)
+                if (!bss->has_bssid)
                         continue;
 
-                g_variant_builder_add_value (&builder, bssid);
+                g_variant_builder_add_value (&builder,
+                                             g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+                                                                        bss->bssid,
+                                                                        GCLUE_WIFI_BSSID_LEN,
+                                                                        1));
         }
         g_variant_builder_close (&builder);
 
@@ -1309,8 +1463,8 @@ get_location_cache_signal_array (GClueWifi *wifi, GPtrArray *bss_array)
 
         signal_array = g_array_sized_new (FALSE, FALSE, sizeof (gint16), bss_array->len);
         for (i = 0; i < bss_array->len; i++) {
-                WPABSS *bss = WPA_BSS (bss_array->pdata[i]);
-                gint16 signal = wpa_bss_get_signal (bss);
+                const GClueWifiBss *bss = bss_array->pdata[i];
+                gint16 signal = bss->signal;
 
                 g_array_append_val (signal_array, signal);
         }
@@ -1424,18 +1578,29 @@ gclue_wifi_refresh_async (GClueWebSource      *source,
         GClueLocation *cached_location = find_cached_location (wifi->priv->location_cache,
                                                                cache_key, signal_array);
         RefreshTaskData *tdata;
+        guint64 trace_id;
 
         g_task_set_source_tag (task, gclue_wifi_refresh_async);
 
+        /* The first refresh after a scan continues its trace. */
+        trace_id = wifi->priv->scan_trace_id;
+        if (trace_id == 0)
+                trace_id = gclue_trace_new_id ();
+        wifi->priv->scan_trace_id = 0;
+
         if (gclue_location_source_get_active (GCLUE_LOCATION_SOURCE (source))) {
                 /* Try the cache. */
                 if (cached_location != NULL) {
                         g_autoptr(GClueLocation) new_location = NULL;
 
                         wifi->priv->cache_hits++;
+                        gclue_metrics_inc (GCLUE_METRIC_CACHE_HITS, "wifi");
 
                         /* Duplicate the location so its timestamp is updated. */
                         new_location = gclue_location_duplicate_fresh (cached_location);
+                        gclue_location_set_trace_id (new_location, trace_id);
+                        GCLUE_TRACE_INSTANT ("wifi-refresh", trace_id,
+                                             "cache-hit");
                         gclue_location_source_set_location (GCLUE_LOCATION_SOURCE (source), new_location);
 
                         g_task_return_pointer (task, g_steal_pointer (&new_location), g_object_unref);
@@ -1443,12 +1608,15 @@ gclue_wifi_refresh_async (GClueWebSource      *source,
                 }
 
                 wifi->priv->cache_misses++;
+                gclue_metrics_inc (GCLUE_METRIC_CACHE_MISSES, "wifi");
         }
 
         tdata = refresh_task_data_new (cache_key, g_steal_pointer (&signal_array));
         g_task_set_task_data (task, tdata, refresh_task_data_free);
 
         /* Fall back to querying the web service. */
+        GCLUE_TRACE_INSTANT ("wifi-refresh", trace_id, "cache-miss");
+        gclue_web_source_set_trace_id (source, trace_id);
         GCLUE_WEB_SOURCE_CLASS (gclue_wifi_parent_class)->refresh_async (source, cancellable, refresh_cb, g_steal_pointer (&task));
 }
 
@@ -25,6 +25,7 @@
 #include <glib.h>
 #include <gio/gio.h>
 #include "gclue-web-source.h"
+#include "gclue-wifi-bss.h"
 
 G_BEGIN_DECLS
 
@@ -64,7 +65,7 @@ struct _GClueWifiClass {
 
 GClueWifi *        gclue_wifi_get_singleton      (GClueAccuracyLevel level);
 gboolean gclue_wifi_should_skip_bsss (GClueAccuracyLevel level);
-GList *gclue_wifi_get_bss_list (GClueWifi *wifi);
+GArray *gclue_wifi_get_bss_list (GClueWifi *wifi);
 
 G_END_DECLS
 
@@ -0,0 +1,415 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <gio/gunixsocketaddress.h>
+
+#include "gclue-plugin.h"
+
+/**
+ * SECTION:gclue-socket-source
+ * @short_description: Reference plugin taking fixes over a socket
+ *
+ * Lets another process on the machine (a CAN odometry bridge, an indoor
+ * positioning daemon, a simulator...) feed locations into Geoclue by sending
+ * datagrams to a Unix socket. Each datagram carries exactly one fix in the
+ * following little-endian layout (64 bytes):
+ *
+ *   offset  size  field
+ *        0     4  magic, "GCFX" (0x58464347)
+ *        4     2  version, 1
+ *        6     2  flags, see SocketFixFlags
+ *        8     8  timestamp, seconds since the epoch, 0 for now
+ *       16     8  latitude, degrees (IEEE 754 double)
+ *       24     8  longitude, degrees
+ *       32     8  altitude, meters
+ *       40     8  accuracy radius, meters
+ *       48     8  speed, meters per second
+ *       56     8  heading, degrees clockwise from north
+ *
+ * The source advertises the accuracy level matching the last fix, and drops
+ * back to no accuracy when no fix arrived for SOCKET_SOURCE_STALE_TIMEOUT.
+ **/
+
+#define SOCKET_SOURCE_DIR "/run/geoclue"
+#define SOCKET_SOURCE_PATH SOCKET_SOURCE_DIR "/socket-source"
+
+#define SOCKET_FIX_MAGIC 0x58464347 /* "GCFX" */
+#define SOCKET_FIX_VERSION 1
+#define SOCKET_FIX_SIZE 64
+
+/* Stop advertising an accuracy level when the feeding process went quiet.
+ * In seconds.
+ */
+#define SOCKET_SOURCE_STALE_TIMEOUT 30
+
+typedef enum {
+        SOCKET_FIX_HAS_ALTITUDE = 1 << 0,
+        SOCKET_FIX_HAS_SPEED    = 1 << 1,
+        SOCKET_FIX_HAS_HEADING  = 1 << 2,
+} SocketFixFlags;
+
+#define GCLUE_TYPE_SOCKET_SOURCE gclue_socket_source_get_type ()
+
+G_DECLARE_FINAL_TYPE (GClueSocketSource,
+                      gclue_socket_source,
+                      GCLUE, SOCKET_SOURCE,
+                      GClueLocationSource)
+
+struct _GClueSocketSource {
+        /* <private> */
+        GClueLocationSource parent_instance;
+
+        GSocket *socket;
+        GSource *socket_source;
+        guint stale_timeout_id;
+
+        guint fixes, rejected;
+};
+
+G_DEFINE_TYPE (GClueSocketSource,
+               gclue_socket_source,
+               GCLUE_TYPE_LOCATION_SOURCE)
+
+static void
+set_accuracy_level (GClueSocketSource  *source,
+                    GClueAccuracyLevel  level)
+{
+        gboolean scramble_location;
+
+        g_object_get (G_OBJECT (source), "scramble-location",
+                      &scramble_location, NULL);
+        if (scramble_location && level > GCLUE_ACCURACY_LEVEL_CITY)
+                level = GCLUE_ACCURACY_LEVEL_CITY;
+
+        if (gclue_location_source_get_available_accuracy_level
+                (GCLUE_LOCATION_SOURCE (source)) == level)
+                return;
+
+        g_debug ("Available accuracy level from %s: %u",
+                 G_OBJECT_TYPE_NAME (source), level);
+        g_object_set (G_OBJECT (source),
+                      "available-accuracy-level", level,
+                      NULL);
+}
+
+static gboolean
+on_stale_timeout (gpointer user_data)
+{
+        GClueSocketSource *source = GCLUE_SOCKET_SOURCE (user_data);
+
+        g_debug ("No fix received on " SOCKET_SOURCE_PATH " for %u seconds",
+                 SOCKET_SOURCE_STALE_TIMEOUT);
+        source->stale_timeout_id = 0;
+        set_accuracy_level (source, GCLUE_ACCURACY_LEVEL_NONE);
+
+        return G_SOURCE_REMOVE;
+}
+
+static guint16
+read_u16 (const guint8 *p)
+{
+        guint16 v;
+
+        memcpy (&v, p, sizeof (v));
+        return GUINT16_FROM_LE (v);
+}
+
+static guint32
+read_u32 (const guint8 *p)
+{
+        guint32 v;
+
+        memcpy (&v, p, sizeof (v));
+        return GUINT32_FROM_LE (v);
+}
+
+static guint64
+read_u64 (const guint8 *p)
+{
+        guint64 v;
+
+        memcpy (&v, p, sizeof (v));
+        return GUINT64_FROM_LE (v);
+}
+
+static gdouble
+read_double (const guint8 *p)
+{
+        guint64 bits = read_u64 (p);
+        gdouble v;
+
+        memcpy (&v, &bits, sizeof (v));
+        return v;
+}
+
+static GClueLocation *
+parse_fix (const guint8 *buf)
+{
+        g_autoptr(GClueLocation) location = NULL;
+        gdouble latitude, longitude, accuracy;
+        guint16 flags;
+
+        if (read_u32 (buf) != SOCKET_FIX_MAGIC ||
+            read_u16 (buf + 4) != SOCKET_FIX_VERSION)
+                return NULL;
+
+        flags = read_u16 (buf + 6);
+        latitude = read_double (buf + 16);
+        longitude = read_double (buf + 24);
+        accuracy = read_double (buf + 40);
+        if (!(latitude >= -90 && latitude <= 90) ||
+            !(longitude >= -180 && longitude <= 180) ||
+            !(accuracy >= 0))
+                return NULL;
+
+        location = gclue_location_new_full
+                (latitude, longitude, accuracy,
+                 (flags & SOCKET_FIX_HAS_SPEED) ?
+                        read_double (buf + 48) : GCLUE_LOCATION_SPEED_UNKNOWN,
+                 (flags & SOCKET_FIX_HAS_HEADING) ?
+                        read_double (buf + 56) : GCLUE_LOCATION_HEADING_UNKNOWN,
+                 (flags & SOCKET_FIX_HAS_ALTITUDE) ?
+                        read_double (buf + 32) : GCLUE_LOCATION_ALTITUDE_UNKNOWN,
+                 read_u64 (buf + 8),
+                 "Socket source");
+
+        return g_steal_pointer (&location);
+}
+
+static gboolean
+on_socket_readable (GSocket      *socket,
+                    GIOCondition  condition,
+                    gpointer      user_data)
+{
+        GClueSocketSource *source = GCLUE_SOCKET_SOURCE (user_data);
+        g_autoptr(GClueLocation) location = NULL;
+        guint8 buf[SOCKET_FIX_SIZE + 1];
+
+        /* Drain the queue, only the newest fix is worth publishing. */
+        for (;;) {
+                g_autoptr(GError) error = NULL;
+                g_autoptr(GClueLocation) fix = NULL;
+                gssize len;
+
+                len = g_socket_receive (socket, (gchar *) buf, sizeof (buf),
+                                        NULL, &error);
+                if (len < 0) {
+                        if (!g_error_matches (error, G_IO_ERROR,
+                                              G_IO_ERROR_WOULD_BLOCK))
+                                g_warning ("Failed to read from "
+                                           SOCKET_SOURCE_PATH ": %s",
+                                           error->message);
+                        break;
+                }
+
+                if (len == SOCKET_FIX_SIZE)
+                        fix = parse_fix (buf);
+                if (fix == NULL) {
+                        source->rejected++;
+                        g_debug ("Rejected invalid fix on " SOCKET_SOURCE_PATH
+                                 " (%u so far)", source->rejected);
+                        continue;
+                }
+
+                source->fixes++;
+                g_set_object (&location, fix);
+        }
+
+        if (location == NULL)
+                return G_SOURCE_CONTINUE;
+
+        set_accuracy_level (source, gclue_plugin_accuracy_level_for
+                                (gclue_location_get_accuracy (location)));
+
+        g_clear_handle_id (&source->stale_timeout_id, g_source_remove);
+        source->stale_timeout_id =
+                g_timeout_add_seconds (SOCKET_SOURCE_STALE_TIMEOUT,
+                                       on_stale_timeout, source);
+
+        gclue_location_source_set_location (GCLUE_LOCATION_SOURCE (source),
+                                            location);
+
+        return G_SOURCE_CONTINUE;
+}
+
+static void
+open_socket (GClueSocketSource *source)
+{
+        g_autoptr(GSocket) socket = NULL;
+        g_autoptr(GSocketAddress) address = NULL;
+        g_autoptr(GError) error = NULL;
+        mode_t old_umask;
+        gboolean bound;
+
+        if (g_mkdir_with_parents (SOCKET_SOURCE_DIR, 0755) < 0) {
+                g_warning ("Failed to create " SOCKET_SOURCE_DIR ": %s",
+                           g_strerror (errno));
+                return;
+        }
+
+        socket = g_socket_new (G_SOCKET_FAMILY_UNIX,
+                               G_SOCKET_TYPE_DATAGRAM,
+                               G_SOCKET_PROTOCOL_DEFAULT,
+                               &error);
+        if (socket == NULL) {
+                g_warning ("Failed to create socket: %s", error->message);
+                return;
+        }
+        g_socket_set_blocking (socket, FALSE);
+
+        /* A stale socket file from a previous run would make bind() fail. */
+        g_unlink (SOCKET_SOURCE_PATH);
+
+        /* Whoever can write here can set the location, keep it private to
+         * the geoclue user (and root). The socket is created 0600 rather
+         * than chmod'ed after bind(), which would leave a window in which
+         * anyone could connect.
+         */
+        address = g_unix_socket_address_new (SOCKET_SOURCE_PATH);
+        old_umask = umask (0177);
+        bound = g_socket_bind (socket, address, FALSE, &error);
+        umask (old_umask);
+        if (!bound) {
+                g_warning ("Failed to bind " SOCKET_SOURCE_PATH ": %s",
+                           error->message);
+                return;
+        }
+
+        source->socket = g_steal_pointer (&socket);
+        source->socket_source = g_socket_create_source (source->socket,
+                                                        G_IO_IN, NULL);
+        g_source_set_callback (source->socket_source,
+                               (GSourceFunc) on_socket_readable,
+                               source, NULL);
+        g_source_attach (source->socket_source, NULL);
+
+        g_debug ("Listening for fixes on " SOCKET_SOURCE_PATH);
+}
+
+static void
+gclue_socket_source_finalize (GObject *object)
+{
+        GClueSocketSource *source = GCLUE_SOCKET_SOURCE (object);
+
+        g_clear_handle_id (&source->stale_timeout_id, g_source_remove);
+        if (source->socket_source != NULL) {
+                g_source_destroy (source->socket_source);
+                g_clear_pointer (&source->socket_source, g_source_unref);
+                g_unlink (SOCKET_SOURCE_PATH);
+        }
+        g_clear_object (&source->socket);
+
+        G_OBJECT_CLASS (gclue_socket_source_parent_class)->finalize (object);
+}
+
+static void
+gclue_socket_source_class_init (GClueSocketSourceClass *klass)
+{
+        GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+        object_class->finalize = gclue_socket_source_finalize;
+}
+
+static void
+gclue_socket_source_init (GClueSocketSource *source)
+{
+}
+
+/* The socket is shared: the EXACT instance owns it and the scrambled one,
+ * for locators at lower accuracy levels, follows its locations.
+ */
+static GClueSocketSource *sources[] = { NULL, NULL };
+
+static void
+on_exact_location_notify (GObject    *gobject,
+                          GParamSpec *pspec,
+                          gpointer    user_data)
+{
+        GClueLocationSource *exact = GCLUE_LOCATION_SOURCE (gobject);
+        GClueSocketSource *scrambled = GCLUE_SOCKET_SOURCE (user_data);
+        GClueLocation *location = gclue_location_source_get_location (exact);
+
+        set_accuracy_level (scrambled,
+                            gclue_location_source_get_available_accuracy_level
+                                (exact));
+        if (location != NULL)
+                gclue_location_source_set_location
+                        (GCLUE_LOCATION_SOURCE (scrambled), location);
+}
+
+static GClueSocketSource *
+get_singleton (gboolean is_exact)
+{
+        int i = is_exact ? 0 : 1;
+
+        if (sources[i] != NULL)
+                return g_object_ref (sources[i]);
+
+        sources[i] = g_object_new (GCLUE_TYPE_SOCKET_SOURCE,
+                                   "compute-movement", FALSE,
+                                   "scramble-location", !is_exact,
+                                   NULL);
+        g_object_add_weak_pointer (G_OBJECT (sources[i]),
+                                   (gpointer) &sources[i]);
+
+        if (is_exact) {
+                open_socket (sources[i]);
+        } else {
+                GClueSocketSource *exact = get_singleton (TRUE);
+
+                /* The scrambled instance keeps the exact one alive. */
+                g_object_set_data_full (G_OBJECT (sources[i]), "exact-source",
+                                        exact, g_object_unref);
+                g_signal_connect_object (exact, "notify::location",
+                                         G_CALLBACK (on_exact_location_notify),
+                                         sources[i], 0);
+                g_signal_connect_object (exact,
+                                         "notify::available-accuracy-level",
+                                         G_CALLBACK (on_exact_location_notify),
+                                         sources[i], 0);
+        }
+
+        return sources[i];
+}
+
+static GClueLocationSource *
+create_source (GClueAccuracyLevel level)
+{
+        if (level < GCLUE_ACCURACY_LEVEL_CITY)
+                return NULL;
+
+        return GCLUE_LOCATION_SOURCE
+                (get_singleton (level == GCLUE_ACCURACY_LEVEL_EXACT));
+}
+
+static const GCluePluginInfo plugin_info = {
+        .abi_version = GCLUE_PLUGIN_ABI_VERSION,
+        .name = "socket-source",
+        .create_source = create_source,
+};
+
+const GCluePluginInfo *
+gclue_plugin_get_info (void)
+{
+        return &plugin_info;
+}
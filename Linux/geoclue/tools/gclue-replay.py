@@ -0,0 +1,1327 @@
+#!/usr/bin/env python3
+
+# Replays a recorded scenario against a geoclue binary and reports how fast
+# and how cheaply it delivered locations.
+#
+# The daemon runs on a private D-Bus system bus, next to stand-ins for the
+# services it talks to: a fake wpa_supplicant serving the scenario's BSS
+# lists, a fake ModemManager reporting its cell towers and NMEA, a local
+# HTTP locate server and an NMEA socket. Nothing on the host is touched, so
+# the same scenario gives the same numbers on every run.
+#
+# Reported per scenario:
+#   - daemon startup: from spawning the daemon to it owning its bus name,
+#     and to the first client's GetClient reply
+#   - time to first fix of each client
+#   - update latency: from a change in the environment (new BSS list, cell
+#     handover, NMEA fix) to the client receiving LocationUpdated
+#   - daemon CPU time per delivered fix
+#   - web queries issued, and the daemon's own metrics
+#   - with --libgeoclue, the bus messages a GClueSimple client exchanges
+#     per location update
+#
+# Requires python3-gi and dbus-daemon. See HACKING.md for usage.
+
+import argparse
+import http.server
+import json
+import math
+import os
+import shlex
+import shutil
+import signal
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+try:
+    from gi.repository import Gio, GLib
+except ImportError:
+    print('gclue-replay needs PyGObject (python3-gi)', file=sys.stderr)
+    sys.exit(-1)
+
+BUS_NAME = 'org.freedesktop.GeoClue2'
+APP_ID = 'geoclue-replay'
+DAEMON_START_TIMEOUT = 10
+CLK_TCK = os.sysconf('SC_CLK_TCK')
+
+DBUS_CONFIG = '''<!DOCTYPE busconfig PUBLIC
+ "-//freedesktop//DTD D-BUS Bus Configuration 1.0//EN"
+ "http://www.freedesktop.org/standards/dbus/1.0/busconfig.dtd">
+<busconfig>
+  <type>system</type>
+  <listen>unix:path={path}</listen>
+  <auth>EXTERNAL</auth>
+  <policy context="default">
+    <allow user="*"/>
+    <allow own="*"/>
+    <allow send_destination="*" eavesdrop="true"/>
+    <allow eavesdrop="true"/>
+  </policy>
+</busconfig>
+'''
+
+GEOCLUE_CONFIG = '''[agent]
+whitelist={app_id}
+
+[wifi]
+enable={wifi}
+url=http://127.0.0.1:{port}/v1/geolocate?key=replay
+submit-data=false
+
+[3g]
+enable={modem}
+
+[cdma]
+enable=false
+
+[modem-gps]
+enable={modem}
+
+[network-nmea]
+enable={nmea}
+nmea-socket={nmea_socket}
+
+[compass]
+enable=false
+
+[static-source]
+enable=false
+
+[plugins]
+enable=false
+
+[metrics]
+enable=true
+
+[last-location]
+enable=false
+
+[{app_id}]
+allowed=true
+system=true
+users=
+'''
+
+WPA_XML = '''<node>
+  <interface name="fi.w1.wpa_supplicant1">
+    <signal name="InterfaceAdded">
+      <arg name="path" type="o"/>
+      <arg name="properties" type="a{sv}"/>
+    </signal>
+    <signal name="InterfaceRemoved">
+      <arg name="path" type="o"/>
+    </signal>
+    <property access="read" name="Interfaces" type="ao"/>
+  </interface>
+  <interface name="fi.w1.wpa_supplicant1.Interface">
+    <method name="Scan">
+      <arg direction="in" name="args" type="a{sv}"/>
+    </method>
+    <signal name="BSSAdded">
+      <arg name="path" type="o"/>
+      <arg name="properties" type="a{sv}"/>
+    </signal>
+    <signal name="BSSRemoved">
+      <arg name="path" type="o"/>
+    </signal>
+    <signal name="ScanDone">
+      <arg name="success" type="b"/>
+    </signal>
+    <property access="read" name="State" type="s"/>
+    <property access="read" name="Ifname" type="s"/>
+    <property access="read" name="BSSs" type="ao"/>
+  </interface>
+  <interface name="fi.w1.wpa_supplicant1.BSS">
+    <property access="read" name="SSID" type="ay"/>
+    <property access="read" name="BSSID" type="ay"/>
+    <property access="read" name="Signal" type="n"/>
+    <property access="read" name="Frequency" type="q"/>
+    <property access="read" name="Age" type="u"/>
+  </interface>
+</node>'''
+
+MM_XML = '''<node>
+  <interface name="org.freedesktop.DBus.ObjectManager">
+    <method name="GetManagedObjects">
+      <arg name="objects" type="a{oa{sa{sv}}}" direction="out"/>
+    </method>
+    <signal name="InterfacesAdded">
+      <arg name="object" type="o"/>
+      <arg name="interfaces" type="a{sa{sv}}"/>
+    </signal>
+    <signal name="InterfacesRemoved">
+      <arg name="object" type="o"/>
+      <arg name="interfaces" type="as"/>
+    </signal>
+  </interface>
+  <interface name="org.freedesktop.ModemManager1">
+    <property name="Version" type="s" access="read"/>
+  </interface>
+  <interface name="org.freedesktop.ModemManager1.Modem">
+    <property name="State" type="i" access="read"/>
+    <property name="AccessTechnologies" type="u" access="read"/>
+    <property name="Manufacturer" type="s" access="read"/>
+    <property name="Model" type="s" access="read"/>
+  </interface>
+  <interface name="org.freedesktop.ModemManager1.Modem.Location">
+    <method name="Setup">
+      <arg name="sources" type="u" direction="in"/>
+      <arg name="signal_location" type="b" direction="in"/>
+    </method>
+    <method name="GetLocation">
+      <arg name="Location" type="a{uv}" direction="out"/>
+    </method>
+    <method name="SetGpsRefreshRate">
+      <arg name="rate" type="u" direction="in"/>
+    </method>
+    <property name="Capabilities" type="u" access="read"/>
+    <property name="Enabled" type="u" access="read"/>
+    <property name="SignalsLocation" type="b" access="read"/>
+    <property name="Location" type="a{uv}" access="read"/>
+    <property name="SuplServer" type="s" access="read"/>
+    <property name="GpsRefreshRate" type="u" access="read"/>
+  </interface>
+</node>'''
+
+AGENT_XML = '''<node>
+  <interface name="org.freedesktop.GeoClue2.Agent">
+    <method name="AuthorizeApp">
+      <arg name="desktop_id" type="s" direction="in"/>
+      <arg name="req_accuracy_level" type="u" direction="in"/>
+      <arg name="authorized" type="b" direction="out"/>
+      <arg name="allowed_accuracy_level" type="u" direction="out"/>
+    </method>
+    <property name="MaxAccuracyLevel" type="u" access="read"/>
+  </interface>
+</node>'''
+
+# From ModemManager's MMModemLocationSource and MMModemState
+MM_LOCATION_3GPP_LAC_CI = 1 << 0
+MM_LOCATION_GPS_NMEA = 1 << 2
+MM_MODEM_STATE_REGISTERED = 8
+MM_ACCESS_TECHNOLOGY_LTE = 1 << 14
+
+GCLUE_ACCURACY_LEVEL_EXACT = 8
+
+
+def now():
+    return time.monotonic()
+
+
+def percentile(values, p):
+    if not values:
+        return None
+    values = sorted(values)
+    k = (len(values) - 1) * p / 100
+    lower = int(k)
+    upper = min(lower + 1, len(values) - 1)
+    return values[lower] + (values[upper] - values[lower]) * (k - lower)
+
+
+def nmea_sentence(body):
+    checksum = 0
+    for c in body:
+        checksum ^= ord(c)
+    return '${}*{:02X}'.format(body, checksum)
+
+
+def nmea_coordinate(value, degree_digits, positive, negative):
+    hemisphere = positive if value >= 0 else negative
+    value = abs(value)
+    degrees = int(value)
+    minutes = (value - degrees) * 60
+    return '{:0{}d}{:07.4f}'.format(degrees, degree_digits, minutes), hemisphere
+
+
+def nmea_gga(fix):
+    utc = time.gmtime()
+    lat, ns = nmea_coordinate(fix['lat'], 2, 'N', 'S')
+    lon, ew = nmea_coordinate(fix['lon'], 3, 'E', 'W')
+    return nmea_sentence('{}GGA,{}.00,{},{},{},{},{},{:02d},{:.1f},{:.1f},M,0.0,M,,'.format(
+        fix.get('talker', 'GP'), time.strftime('%H%M%S', utc), lat, ns,
+        lon, ew, fix.get('quality', 1), fix.get('satellites', 8),
+        fix.get('hdop', 1.0), fix.get('altitude', 0.0)))
+
+
+def nmea_rmc(fix):
+    utc = time.gmtime()
+    lat, ns = nmea_coordinate(fix['lat'], 2, 'N', 'S')
+    lon, ew = nmea_coordinate(fix['lon'], 3, 'E', 'W')
+    return nmea_sentence('{}RMC,{}.00,A,{},{},{},{},{:.1f},{:.1f},{},,,A'.format(
+        fix.get('talker', 'GP'), time.strftime('%H%M%S', utc), lat, ns,
+        lon, ew, fix.get('speed', 0.0), fix.get('heading', 0.0),
+        time.strftime('%d%m%y', utc)))
+
+
+def event_sentences(event):
+    '''The NMEA of an event: raw 'sentences' as they are, a list of
+    'fixes' of any talker and type stamped with the current time, or the
+    event itself as one GPGGA fix.'''
+    if 'sentences' in event:
+        return list(event['sentences'])
+    if 'fixes' in event:
+        return [nmea_rmc(fix) if fix.get('type') == 'RMC' else nmea_gga(fix)
+                for fix in event['fixes']]
+    return [nmea_gga(event)]
+
+
+def distance(lat1, lon1, lat2, lon2):
+    '''Great circle distance in meters.'''
+    lat1, lon1, lat2, lon2 = map(math.radians, (lat1, lon1, lat2, lon2))
+    a = (math.sin((lat2 - lat1) / 2) ** 2 +
+         math.cos(lat1) * math.cos(lat2) * math.sin((lon2 - lon1) / 2) ** 2)
+    return 6371000 * 2 * math.asin(math.sqrt(a))
+
+
+def mac_bytes(bssid):
+    return bytes(int(x, 16) for x in bssid.split(':'))
+
+
+class Bus:
+    '''A private system bus for one run.'''
+
+    def __init__(self, workdir):
+        path = os.path.join(workdir, 'system_bus_socket')
+        config = os.path.join(workdir, 'bus.conf')
+        with open(config, 'w') as f:
+            f.write(DBUS_CONFIG.format(path=path))
+
+        self.address = 'unix:path=' + path
+        self.process = subprocess.Popen(['dbus-daemon', '--nofork',
+                                         '--config-file=' + config],
+                                        stdout=subprocess.DEVNULL)
+        for _ in range(100):
+            if os.path.exists(path):
+                break
+            time.sleep(0.05)
+
+    def connect(self):
+        flags = (Gio.DBusConnectionFlags.AUTHENTICATION_CLIENT |
+                 Gio.DBusConnectionFlags.MESSAGE_BUS_CONNECTION)
+        return Gio.DBusConnection.new_for_address_sync(self.address, flags,
+                                                       None, None)
+
+    def stop(self):
+        self.process.terminate()
+        self.process.wait()
+
+
+def call_async(connection, path, interface, method, args, on_reply,
+               on_error):
+    def on_finish(connection, result):
+        try:
+            reply = connection.call_finish(result)
+        except GLib.Error as e:
+            on_error('{}.{} failed: {}'.format(interface, method, e.message))
+            return
+        if on_reply is not None:
+            on_reply(reply.unpack())
+
+    connection.call(BUS_NAME, path, interface, method, args, None,
+                    Gio.DBusCallFlags.NONE, -1, None, on_finish)
+
+
+def own_name(connection, name):
+    connection.call_sync('org.freedesktop.DBus', '/org/freedesktop/DBus',
+                         'org.freedesktop.DBus', 'RequestName',
+                         GLib.Variant('(su)', (name, 4)), None,
+                         Gio.DBusCallFlags.NONE, -1, None)
+
+
+class DBusObject:
+    '''Exports the @interfaces of @xml at @path, dispatching to methods named
+    after the D-Bus methods and to get_property().'''
+
+    def __init__(self, connection, path, xml, interfaces):
+        self.connection = connection
+        self.path = path
+        self.registrations = []
+        for interface in Gio.DBusNodeInfo.new_for_xml(xml).interfaces:
+            if interface.name not in interfaces:
+                continue
+            self.registrations.append(connection.register_object(
+                path, interface, self._on_method_call,
+                self._on_get_property, None))
+
+    def _on_method_call(self, connection, sender, path, interface, method,
+                        parameters, invocation):
+        handler = getattr(self, method, None)
+        if handler is None:
+            invocation.return_dbus_error('org.freedesktop.DBus.Error.UnknownMethod',
+                                         method)
+            return
+        handler(invocation, *parameters.unpack())
+
+    def _on_get_property(self, connection, sender, path, interface, name):
+        return self.get_property(interface, name)
+
+    def emit(self, interface, name, signature, args):
+        self.connection.emit_signal(None, self.path, interface, name,
+                                    GLib.Variant(signature, args))
+
+    def properties_changed(self, interface, changed):
+        self.emit('org.freedesktop.DBus.Properties', 'PropertiesChanged',
+                  '(sa{sv}as)', (interface, changed, []))
+
+    def unregister(self):
+        for registration in self.registrations:
+            self.connection.unregister_object(registration)
+
+
+class FakeBss(DBusObject):
+    def __init__(self, connection, path, bss):
+        self.bss = bss
+        super().__init__(connection, path, WPA_XML,
+                         ['fi.w1.wpa_supplicant1.BSS'])
+
+    def properties(self):
+        return {
+            'SSID': GLib.Variant('ay', self.bss.get('ssid', '').encode()),
+            'BSSID': GLib.Variant('ay', mac_bytes(self.bss['bssid'])),
+            'Signal': GLib.Variant('n', self.bss.get('signal', -60)),
+            'Frequency': GLib.Variant('q', self.bss.get('frequency', 2412)),
+            'Age': GLib.Variant('u', 0),
+        }
+
+    def get_property(self, interface, name):
+        return self.properties().get(name)
+
+
+class FakeWpaSupplicant(DBusObject):
+    '''wpa_supplicant with one interface, whose BSS list follows the
+    scenario. Changes are announced right away, as with a background scan,
+    and Scan() completes after the scenario's scan delay.'''
+
+    PATH = '/fi/w1/wpa_supplicant1'
+    INTERFACE_PATH = PATH + '/Interfaces/0'
+    INTERFACE = 'fi.w1.wpa_supplicant1.Interface'
+
+    def __init__(self, connection, scan_delay):
+        super().__init__(connection, self.PATH, WPA_XML,
+                         ['fi.w1.wpa_supplicant1'])
+        self.interface = DBusObject(connection, self.INTERFACE_PATH, WPA_XML,
+                                    [self.INTERFACE])
+        self.interface.get_property = self._get_interface_property
+        self.interface.Scan = self._scan
+        self.scan_delay = scan_delay
+        self.bsss = {}  # bssid -> FakeBss
+        self.next_bss = 0
+        self.scans = 0
+
+    def get_property(self, interface, name):
+        if name == 'Interfaces':
+            return GLib.Variant('ao', [self.INTERFACE_PATH])
+        return None
+
+    def _get_interface_property(self, interface, name):
+        if name == 'State':
+            return GLib.Variant('s', 'completed')
+        if name == 'Ifname':
+            return GLib.Variant('s', 'wlan0')
+        if name == 'BSSs':
+            return GLib.Variant('ao', [b.path for b in self.bsss.values()])
+        return None
+
+    def _scan(self, invocation, args):
+        self.scans += 1
+        invocation.return_value(None)
+        GLib.timeout_add(int(self.scan_delay * 1000), self._on_scan_done)
+
+    def _on_scan_done(self):
+        self.interface.emit(self.INTERFACE, 'ScanDone', '(b)', (True,))
+        return GLib.SOURCE_REMOVE
+
+    def set_bss_list(self, bss_list, announce):
+        wanted = {bss['bssid']: bss for bss in bss_list}
+
+        for bssid in list(self.bsss):
+            if bssid in wanted:
+                self.bsss[bssid].bss = wanted.pop(bssid)
+                continue
+            bss = self.bsss.pop(bssid)
+            bss.unregister()
+            if announce:
+                self.interface.emit(self.INTERFACE, 'BSSRemoved', '(o)',
+                                    (bss.path,))
+
+        for bssid, data in wanted.items():
+            path = '{}/BSSs/{}'.format(self.INTERFACE_PATH, self.next_bss)
+            self.next_bss += 1
+            bss = FakeBss(self.connection, path, data)
+            self.bsss[bssid] = bss
+            if announce:
+                self.interface.emit(self.INTERFACE, 'BSSAdded', '(oa{sv})',
+                                    (path, bss.properties()))
+
+        if announce:
+            self.interface.emit(self.INTERFACE, 'ScanDone', '(b)', (True,))
+
+
+class FakeModemManager(DBusObject):
+    '''ModemManager with one registered LTE modem whose 3GPP and NMEA
+    locations follow the scenario.'''
+
+    PATH = '/org/freedesktop/ModemManager1'
+    MODEM_PATH = PATH + '/Modem/0'
+    LOCATION = 'org.freedesktop.ModemManager1.Modem.Location'
+
+    def __init__(self, connection):
+        super().__init__(connection, self.PATH, MM_XML,
+                         ['org.freedesktop.DBus.ObjectManager',
+                          'org.freedesktop.ModemManager1'])
+        self.modem = DBusObject(connection, self.MODEM_PATH, MM_XML,
+                                ['org.freedesktop.ModemManager1.Modem',
+                                 self.LOCATION])
+        self.modem.get_property = self._get_modem_property
+        self.modem.Setup = self._setup
+        self.modem.GetLocation = self._get_location
+        self.modem.SetGpsRefreshRate = self._set_gps_refresh_rate
+        self.enabled = 0
+        self.signals_location = False
+        self.location = {}
+
+    def _modem_properties(self):
+        return {
+            'org.freedesktop.ModemManager1.Modem': {
+                'State': GLib.Variant('i', MM_MODEM_STATE_REGISTERED),
+                'AccessTechnologies': GLib.Variant('u', MM_ACCESS_TECHNOLOGY_LTE),
+                'Manufacturer': GLib.Variant('s', 'geoclue'),
+                'Model': GLib.Variant('s', 'replay'),
+            },
+            self.LOCATION: {
+                'Capabilities': GLib.Variant('u', MM_LOCATION_3GPP_LAC_CI |
+                                                  MM_LOCATION_GPS_NMEA),
+                'Enabled': GLib.Variant('u', self.enabled),
+                'SignalsLocation': GLib.Variant('b', self.signals_location),
+                'Location': self._location_variant(),
+                'SuplServer': GLib.Variant('s', ''),
+                'GpsRefreshRate': GLib.Variant('u', 1),
+            },
+        }
+
+    def _location(self):
+        return {source: GLib.Variant('s', value)
+                for source, value in self.location.items()
+                if self.enabled & source}
+
+    def _location_variant(self):
+        return GLib.Variant('a{uv}', self._location())
+
+    def GetManagedObjects(self, invocation):
+        invocation.return_value(GLib.Variant('(a{oa{sa{sv}}})', (
+            {self.MODEM_PATH: self._modem_properties()},)))
+
+    def get_property(self, interface, name):
+        if name == 'Version':
+            return GLib.Variant('s', '1.20.0')
+        return None
+
+    def _get_modem_property(self, interface, name):
+        return self._modem_properties().get(interface, {}).get(name)
+
+    def _setup(self, invocation, sources, signal_location):
+        self.enabled = sources
+        self.signals_location = signal_location
+        invocation.return_value(None)
+        self.modem.properties_changed(self.LOCATION, {
+            'Enabled': GLib.Variant('u', self.enabled),
+            'SignalsLocation': GLib.Variant('b', self.signals_location),
+            'Location': self._location_variant(),
+        })
+
+    def _get_location(self, invocation):
+        invocation.return_value(GLib.Variant('(a{uv})', (self._location(),)))
+
+    def _set_gps_refresh_rate(self, invocation, rate):
+        invocation.return_value(None)
+
+    def set_cell(self, cell):
+        # MCC and MNC in decimal, the rest in hex as ModemManager does.
+        self.location[MM_LOCATION_3GPP_LAC_CI] = '{},{},{:X},{:X},{:X}'.format(
+            cell['mcc'], cell['mnc'], cell['lac'], cell['cell_id'],
+            cell.get('tac', 0))
+        self._location_changed()
+
+    def set_nmea(self, sentences):
+        self.location[MM_LOCATION_GPS_NMEA] = '\r\n'.join(sentences)
+        self._location_changed()
+
+    def _location_changed(self):
+        if self.signals_location:
+            self.modem.properties_changed(self.LOCATION, {
+                'Location': self._location_variant()})
+
+
+class FakeAgent(DBusObject):
+    PATH = '/org/freedesktop/GeoClue2/Agent'
+
+    def __init__(self, connection):
+        super().__init__(connection, self.PATH, AGENT_XML,
+                         ['org.freedesktop.GeoClue2.Agent'])
+
+    def AuthorizeApp(self, invocation, desktop_id, level):
+        invocation.return_value(GLib.Variant('(bu)', (True, level)))
+
+    def get_property(self, interface, name):
+        if name == 'MaxAccuracyLevel':
+            return GLib.Variant('u', GCLUE_ACCURACY_LEVEL_EXACT)
+        return None
+
+
+class LocateServer(http.server.ThreadingHTTPServer):
+    '''A Mozilla/Ichnaea style locate and submit service. Requests are
+    matched against the scenario's answers by the BSSIDs and cell towers
+    they contain.'''
+
+    def __init__(self, locate):
+        super().__init__(('127.0.0.1', 0), LocateHandler)
+        self.answers = locate.get('answers', [])
+        self.default = locate.get('default')
+        self.delay = locate.get('delay', 0)
+        self.lock = threading.Lock()
+        self.queries = {'locate': 0, 'submit': 0, 'unanswered': 0}
+
+    def count(self, kind):
+        with self.lock:
+            self.queries[kind] += 1
+
+    def answer(self, request):
+        bssids = {ap.get('macAddress', '').lower()
+                  for ap in request.get('wifiAccessPoints', [])}
+        cells = {(c.get('mobileCountryCode'), c.get('mobileNetworkCode'),
+                  c.get('locationAreaCode'), c.get('cellId'))
+                 for c in request.get('cellTowers', [])}
+
+        best, best_score = None, 0
+        for answer in self.answers:
+            score = len(bssids & {b.lower() for b in answer.get('bssids', [])})
+            cell = answer.get('cell')
+            if cell and (cell['mcc'], cell['mnc'], cell['lac'],
+                         cell['cell_id']) in cells:
+                score += 1000
+            if score > best_score:
+                best, best_score = answer, score
+
+        return best if best is not None else self.default
+
+
+class LocateHandler(http.server.BaseHTTPRequestHandler):
+    def do_POST(self):
+        length = int(self.headers.get('Content-Length', 0))
+        try:
+            request = json.loads(self.rfile.read(length) or b'{}')
+        except ValueError:
+            request = {}
+
+        if self.path.startswith('/v2/geosubmit'):
+            self.server.count('submit')
+            self._reply(200, {})
+            return
+
+        self.server.count('locate')
+        if self.server.delay:
+            time.sleep(self.server.delay)
+
+        answer = self.server.answer(request)
+        if answer is None:
+            self.server.count('unanswered')
+            self._reply(404, {'error': {'code': 404, 'message': 'Not found'}})
+            return
+
+        self._reply(200, {'location': {'lat': answer['lat'],
+                                       'lng': answer['lon']},
+                          'accuracy': answer['accuracy']})
+
+    def _reply(self, status, body):
+        data = json.dumps(body).encode()
+        self.send_response(status)
+        self.send_header('Content-Type', 'application/json')
+        self.send_header('Content-Length', str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def log_message(self, format, *args):
+        pass
+
+
+class NmeaReplayer:
+    '''Serves NMEA sentences on the Unix socket the network NMEA source
+    reads from.'''
+
+    def __init__(self, path):
+        self.service = Gio.SocketService()
+        self.service.add_address(Gio.UnixSocketAddress.new(path),
+                                 Gio.SocketType.STREAM,
+                                 Gio.SocketProtocol.DEFAULT, None)
+        self.service.connect('incoming', self._on_incoming)
+        self.service.start()
+        self.connections = []
+
+    def _on_incoming(self, service, connection, source_object):
+        self.connections.append(connection)
+        return True
+
+    def send(self, sentences):
+        data = ''.join(s + '\r\n' for s in sentences).encode()
+        for connection in list(self.connections):
+            try:
+                connection.get_output_stream().write_all(data, None)
+            except GLib.Error:
+                self.connections.remove(connection)
+
+    def stop(self):
+        self.service.stop()
+        for connection in self.connections:
+            connection.close(None)
+
+
+class Client:
+    '''One geoclue client, on its own bus connection since geoclue hands
+    out one client per peer.'''
+
+    def __init__(self, run, connection, index):
+        self.run = run
+        self.connection = connection
+        self.index = index
+        self.path = None
+        self.started = None
+        self.first_fix = None
+        self.updates = 0
+        self.last = None
+
+    def call(self, path, interface, method, args, callback=None):
+        call_async(self.connection, path, interface, method, args, callback,
+                   self.run.fail)
+
+    def set_property(self, name, value, callback):
+        self.call(self.path, 'org.freedesktop.DBus.Properties', 'Set',
+                  GLib.Variant('(ssv)', ('org.freedesktop.GeoClue2.Client',
+                                         name, value)),
+                  lambda _: callback())
+
+    def start(self):
+        self.call('/org/freedesktop/GeoClue2/Manager',
+                  'org.freedesktop.GeoClue2.Manager', 'GetClient', None,
+                  self._on_client)
+
+    def _on_client(self, reply):
+        self.path = reply[0]
+        if self.run.first_client is None:
+            self.run.first_client = now() - self.run.spawned
+        self.connection.signal_subscribe(BUS_NAME,
+                                         'org.freedesktop.GeoClue2.Client',
+                                         'LocationUpdated', self.path, None,
+                                         Gio.DBusSignalFlags.NONE,
+                                         self._on_location_updated)
+        self.set_property('DesktopId', GLib.Variant('s', APP_ID),
+                          self._set_accuracy)
+
+    def _set_accuracy(self):
+        self.set_property('RequestedAccuracyLevel',
+                          GLib.Variant('u', self.run.scenario.get(
+                              'accuracy', GCLUE_ACCURACY_LEVEL_EXACT)),
+                          self._set_threshold)
+
+    def _set_threshold(self):
+        self.set_property('DistanceThreshold',
+                          GLib.Variant('u', self.run.scenario.get(
+                              'distance_threshold', 0)),
+                          self._start)
+
+    def _start(self):
+        self.started = now()
+        self.call(self.path, 'org.freedesktop.GeoClue2.Client', 'Start', None)
+
+    def _on_location_updated(self, connection, sender, path, interface,
+                             signal, parameters):
+        received = now()
+        self.updates += 1
+        if self.first_fix is None:
+            self.first_fix = received - self.started
+        self.run.on_update(self, received)
+
+        new_path = parameters.unpack()[1]
+        self.call(new_path, 'org.freedesktop.DBus.Properties', 'GetAll',
+                  GLib.Variant('(s)', ('org.freedesktop.GeoClue2.Location',)),
+                  self._on_location)
+
+    def _on_location(self, reply):
+        self.last = reply[0]
+        if self.run.verbose:
+            print('client {}: {:.6f}, {:.6f} ±{:.0f} m'.format(
+                self.index, self.last['Latitude'], self.last['Longitude'],
+                self.last['Accuracy']))
+
+
+class SimpleClient:
+    '''A GClueSimple client from a libgeoclue build, in a child process
+    since libgeoclue talks to the system bus singleton. A monitor
+    connection counts the messages it exchanges.'''
+
+    def __init__(self, run, libgeoclue, accuracy):
+        self.run = run
+        self.name = None
+        self.started = now()
+        self.first_fix = None
+        self.updates = 0
+        self.messages = 0
+        self.match_rules = 0
+        self.get_alls = 0
+        self.at_first_fix = None
+
+        self.monitor = run.bus.connect()
+        self.monitor.add_filter(self._filter)
+        self.monitor.call_sync('org.freedesktop.DBus', '/org/freedesktop/DBus',
+                               'org.freedesktop.DBus.Monitoring',
+                               'BecomeMonitor',
+                               GLib.Variant('(asu)', ([], 0)), None,
+                               Gio.DBusCallFlags.NONE, -1, None)
+
+        search_path = [libgeoclue]
+        if 'GI_TYPELIB_PATH' in os.environ:
+            search_path.append(os.environ['GI_TYPELIB_PATH'])
+        library_path = [libgeoclue]
+        if 'LD_LIBRARY_PATH' in os.environ:
+            library_path.append(os.environ['LD_LIBRARY_PATH'])
+        env = dict(os.environ,
+                   DBUS_SYSTEM_BUS_ADDRESS=run.bus.address,
+                   GI_TYPELIB_PATH=os.pathsep.join(search_path),
+                   LD_LIBRARY_PATH=os.pathsep.join(library_path))
+        env.pop('GTK_USE_PORTAL', None)
+        self.process = subprocess.Popen([sys.executable, __file__,
+                                         '--simple-client', str(accuracy)],
+                                        env=env, stdout=subprocess.PIPE,
+                                        text=True)
+        self.watch_id = GLib.io_add_watch(self.process.stdout.fileno(),
+                                          GLib.PRIORITY_DEFAULT,
+                                          GLib.IOCondition.IN |
+                                          GLib.IOCondition.HUP,
+                                          self._on_output)
+
+    def _filter(self, connection, message, incoming):
+        # Runs in the GDBus worker thread. A monitor must never reply, so
+        # nothing is passed on.
+        if self.name is None:
+            return None
+        sender = message.get_sender()
+        if self.name not in (sender, message.get_destination()):
+            return None
+        self.messages += 1
+        if (sender == self.name and
+                message.get_message_type() == Gio.DBusMessageType.METHOD_CALL):
+            member = message.get_member()
+            if member in ('AddMatch', 'RemoveMatch'):
+                self.match_rules += 1
+            elif member == 'GetAll':
+                self.get_alls += 1
+        return None
+
+    def _on_output(self, fd, condition):
+        line = self.process.stdout.readline()
+        if not line:
+            return GLib.SOURCE_REMOVE
+        kind, _, value = line.strip().partition(' ')
+        if kind == 'name':
+            self.name = value
+        elif kind == 'location':
+            self.updates += 1
+            if self.first_fix is None:
+                self.first_fix = now() - self.started
+                self.at_first_fix = self._counts()
+        return GLib.SOURCE_CONTINUE
+
+    def _counts(self):
+        return (self.messages, self.match_rules, self.get_alls)
+
+    def result(self):
+        if self.updates < 2:
+            per_update = (None, None, None)
+        else:
+            per_update = tuple((end - start) / (self.updates - 1)
+                               for start, end in zip(self.at_first_fix,
+                                                     self._counts()))
+        return {
+            'ttff': self.first_fix,
+            'updates': self.updates,
+            'messages_per_update': per_update[0],
+            'match_rules_per_update': per_update[1],
+            'get_alls_per_update': per_update[2],
+        }
+
+    def stop(self):
+        GLib.source_remove(self.watch_id)
+        self.process.terminate()
+        self.process.wait()
+        self.monitor.close_sync(None)
+
+
+def simple_client(accuracy):
+    '''The child process of SimpleClient.'''
+    import gi
+    gi.require_version('Geoclue', '2.0')
+    from gi.repository import Geoclue
+
+    bus = Gio.bus_get_sync(Gio.BusType.SYSTEM, None)
+    print('name', bus.get_unique_name(), flush=True)
+
+    def on_location(simple, pspec):
+        if simple.get_location() is not None:
+            print('location', flush=True)
+
+    def on_ready(source, result):
+        simple = Geoclue.Simple.new_finish(result)
+        simple.connect('notify::location', on_location)
+        on_location(simple, None)
+        # Keep it alive
+        loop.simple = simple
+
+    loop = GLib.MainLoop()
+    Geoclue.Simple.new(APP_ID, accuracy, None, on_ready)
+    loop.run()
+
+
+class Run:
+    '''One replay of a scenario against a fresh daemon.'''
+
+    def __init__(self, scenario, args):
+        self.scenario = scenario
+        self.geoclue = args.geoclue
+        self.libgeoclue = args.libgeoclue
+        self.simple = None
+        self.command = args.command
+        self.command_process = None
+        self.finished = False
+        self.verbose = args.verbose
+        self.keep = args.keep
+        self.error = None
+        self.clients = []
+        self.pending_events = []  # injection times not yet delivered
+        self.latencies = []
+        self.metrics = {}
+        self.cpu_start = None
+        self.cpu_seconds = None
+        self.daemon_startup = None
+        self.first_client = None
+
+    def fail(self, message):
+        if self.error is None:
+            self.error = message
+        self.loop.quit()
+
+    def execute(self):
+        self.workdir = tempfile.mkdtemp(prefix='gclue-replay-')
+        self.loop = GLib.MainLoop()
+        bus = Bus(self.workdir)
+        self.bus = bus
+        try:
+            self._setup(bus)
+            GLib.timeout_add_seconds(int(self.scenario.get('duration', 60)) +
+                                     DAEMON_START_TIMEOUT * 2,
+                                     self._on_watchdog)
+            self.loop.run()
+        finally:
+            self._teardown(bus)
+
+        if self.error is not None:
+            raise RuntimeError(self.error)
+
+        return self._result()
+
+    def _setup(self, bus):
+        scenario = self.scenario
+        connection = bus.connect()
+        self.connection = connection
+
+        own_name(connection, 'fi.w1.wpa_supplicant1')
+        self.wpa = FakeWpaSupplicant(connection,
+                                     scenario.get('wifi', {}).get('scan_delay', 0.5))
+        own_name(connection, 'org.freedesktop.ModemManager1')
+        self.modem = FakeModemManager(connection)
+        self.agent = FakeAgent(connection)
+
+        self.locate = LocateServer(scenario.get('locate', {}))
+        threading.Thread(target=self.locate.serve_forever, daemon=True).start()
+
+        nmea_socket = os.path.join(self.workdir, 'nmea.sock')
+        self.nmea = NmeaReplayer(nmea_socket)
+
+        config_dir = os.path.join(self.workdir, 'etc')
+        os.makedirs(os.path.join(config_dir, 'conf.d'))
+        with open(os.path.join(config_dir, 'geoclue.conf'), 'w') as f:
+            f.write(GEOCLUE_CONFIG.format(
+                app_id=APP_ID,
+                port=self.locate.server_address[1],
+                wifi=str('wifi' in scenario).lower(),
+                modem=str('modem' in scenario).lower(),
+                nmea=str('nmea' in scenario).lower(),
+                nmea_socket=nmea_socket))
+
+        # What is there before the daemon starts
+        self.timeline = []
+        for kind in ('wifi', 'modem', 'nmea'):
+            for event in scenario.get(kind, {}).get('events', []):
+                self.timeline.append((event.get('at', 0), kind, event))
+        self.timeline.sort(key=lambda e: e[0])
+        while self.timeline and self.timeline[0][0] <= 0:
+            self._apply(*self.timeline.pop(0)[1:], announce=False)
+
+        env = dict(os.environ,
+                   DBUS_SYSTEM_BUS_ADDRESS=bus.address,
+                   GIO_USE_NETWORK_MONITOR='base',
+                   GSETTINGS_BACKEND='memory')
+        if self.verbose:
+            env['G_MESSAGES_DEBUG'] = 'Geoclue'
+        log = open(os.path.join(self.workdir, 'geoclue.log'), 'w')
+        self.spawned = now()
+        self.daemon = subprocess.Popen([self.geoclue, '--timeout', '0',
+                                        '--config-dir', config_dir],
+                                       env=env, stdout=log,
+                                       stderr=subprocess.STDOUT)
+        log.close()
+
+        self.watch_id = Gio.bus_watch_name_on_connection(
+            connection, BUS_NAME, Gio.BusNameWatcherFlags.NONE,
+            self._on_daemon_appeared, None)
+
+    def _on_daemon_appeared(self, connection, name, owner):
+        if self.daemon_startup is not None:
+            return
+        self.daemon_startup = now() - self.spawned
+
+        # Clients wait for an agent of their user before they get started.
+        call_async(self.connection, '/org/freedesktop/GeoClue2/Manager',
+                   'org.freedesktop.GeoClue2.Manager', 'AddAgent',
+                   GLib.Variant('(s)', (APP_ID,)),
+                   lambda _: self._start_clients(), self.fail)
+
+    def _start_clients(self):
+        self.cpu_start = self._daemon_cpu()
+        self.t0 = now()
+        for i in range(self.scenario.get('clients', 1)):
+            client = Client(self, self.bus.connect(), i)
+            self.clients.append(client)
+            client.start()
+        if self.libgeoclue is not None:
+            self.simple = SimpleClient(self, self.libgeoclue,
+                                       self.scenario.get(
+                                           'accuracy',
+                                           GCLUE_ACCURACY_LEVEL_EXACT))
+        if self.command is not None:
+            # Ends the run early if it exits before the scenario does
+            self.command_process = subprocess.Popen(
+                shlex.split(self.command),
+                env=dict(os.environ, DBUS_SYSTEM_BUS_ADDRESS=self.bus.address))
+            GLib.child_watch_add(GLib.PRIORITY_DEFAULT,
+                                 self.command_process.pid,
+                                 lambda *_: self._on_finished())
+
+        for at, kind, event in self.timeline:
+            GLib.timeout_add(int(at * 1000), self._on_event, kind, event)
+        GLib.timeout_add(int(self.scenario.get('duration', 60) * 1000),
+                         self._on_finished)
+
+    def _on_event(self, kind, event):
+        self._apply(kind, event, announce=True)
+        return GLib.SOURCE_REMOVE
+
+    def _apply(self, kind, event, announce):
+        if announce and not event.get('silent', False):
+            self.pending_events.append(now())
+
+        if kind == 'wifi':
+            self.wpa.set_bss_list(event.get('bss', []), announce)
+        elif kind == 'modem':
+            if 'cell' in event:
+                self.modem.set_cell(event['cell'])
+            if 'nmea' in event:
+                self.modem.set_nmea(event_sentences(event['nmea']))
+        elif kind == 'nmea':
+            self.nmea.send(event_sentences(event))
+
+    def on_update(self, client, received):
+        # Latency is only tracked on the first client, the others see the
+        # same locations.
+        if client.index != 0 or not self.pending_events:
+            return
+        self.latencies.append(received - self.pending_events[0])
+        self.pending_events.clear()
+
+    def _on_finished(self):
+        if self.finished:
+            return GLib.SOURCE_REMOVE
+        self.finished = True
+        self.cpu_seconds = self._daemon_cpu() - self.cpu_start
+
+        error = self._check_expected()
+        if error is not None:
+            self.keep = True
+            self.fail(error)
+            return GLib.SOURCE_REMOVE
+
+        def on_metrics(connection, result):
+            try:
+                self.metrics = connection.call_finish(result).unpack()[0]
+            except GLib.Error as e:
+                print('No daemon metrics: ' + e.message, file=sys.stderr)
+            self.loop.quit()
+
+        self.connection.call(BUS_NAME, '/org/freedesktop/GeoClue2/Metrics',
+                             'org.freedesktop.GeoClue2.Metrics', 'GetMetrics',
+                             None, None, Gio.DBusCallFlags.NONE, 5000, None,
+                             on_metrics)
+        return GLib.SOURCE_REMOVE
+
+    def _check_expected(self):
+        '''Checks the last location of every client against the scenario's
+        'expect', if it has one.'''
+        expect = self.scenario.get('expect')
+        if expect is None:
+            return None
+        for client in self.clients:
+            if client.last is None:
+                return 'client {} got no location'.format(client.index)
+            off = distance(client.last['Latitude'], client.last['Longitude'],
+                           expect['lat'], expect['lon'])
+            if off > expect.get('within', 10):
+                return ('client {} ended at {:.6f}, {:.6f}, {:.0f} m from '
+                        'the expected location'.format(
+                            client.index, client.last['Latitude'],
+                            client.last['Longitude'], off))
+        return None
+
+    def _on_watchdog(self):
+        self.fail('Scenario did not finish, see ' +
+                  os.path.join(self.workdir, 'geoclue.log'))
+        self.keep = True
+        return GLib.SOURCE_REMOVE
+
+    def _daemon_cpu(self):
+        with open('/proc/{}/stat'.format(self.daemon.pid)) as f:
+            # The command name may contain spaces, skip past it
+            fields = f.read().rsplit(')', 1)[1].split()
+        return (int(fields[11]) + int(fields[12])) / CLK_TCK
+
+    def _teardown(self, bus):
+        if self.simple is not None:
+            self.simple.stop()
+        if self.command_process is not None:
+            # Lets it print what it measured
+            self.command_process.send_signal(signal.SIGTERM)
+            try:
+                self.command_process.wait(5)
+            except subprocess.TimeoutExpired:
+                self.command_process.kill()
+        if getattr(self, 'daemon', None) is not None:
+            self.daemon.send_signal(signal.SIGTERM)
+            try:
+                self.daemon.wait(5)
+            except subprocess.TimeoutExpired:
+                self.daemon.kill()
+        if getattr(self, 'nmea', None) is not None:
+            self.nmea.stop()
+        if getattr(self, 'locate', None) is not None:
+            self.locate.shutdown()
+            self.locate.server_close()
+        bus.stop()
+        if self.keep:
+            print('Kept ' + self.workdir, file=sys.stderr)
+        else:
+            shutil.rmtree(self.workdir, ignore_errors=True)
+
+    def _result(self):
+        fixes = sum(c.updates for c in self.clients)
+        return {
+            'daemon_startup': self.daemon_startup,
+            'first_client': self.first_client,
+            'ttff': [c.first_fix for c in self.clients
+                     if c.first_fix is not None],
+            'latencies': self.latencies,
+            'fixes': fixes,
+            'cpu_seconds': self.cpu_seconds,
+            'scans': self.wpa.scans,
+            'queries': dict(self.locate.queries),
+            'metrics': self.metrics,
+            'simple': self.simple.result() if self.simple else None,
+        }
+
+
+def summarize(name, runs):
+    def stats(values):
+        ms = [v * 1000 for v in values if v is not None]
+        return {
+            'count': len(ms),
+            'p50': percentile(ms, 50),
+            'p90': percentile(ms, 90),
+            'p99': percentile(ms, 99),
+            'max': max(ms) if ms else None,
+        }
+
+    fixes = sum(r['fixes'] for r in runs)
+    cpu = sum(r['cpu_seconds'] for r in runs)
+    queries = {}
+    for r in runs:
+        for kind, n in r['queries'].items():
+            queries[kind] = queries.get(kind, 0) + n
+    simple = [r['simple'] for r in runs if r['simple'] is not None]
+
+    def mean(key):
+        values = [s[key] for s in simple if s[key] is not None]
+        return sum(values) / len(values) if values else None
+
+    return {
+        'scenario': name,
+        'runs': len(runs),
+        'daemon_startup_ms': stats([r['daemon_startup'] for r in runs]),
+        'first_client_ms': stats([r['first_client'] for r in runs]),
+        'ttff_ms': stats([t for r in runs for t in r['ttff']]),
+        'update_latency_ms': stats([l for r in runs for l in r['latencies']]),
+        'fixes': fixes,
+        'cpu_ms_per_fix': cpu * 1000 / fixes if fixes else None,
+        'wifi_scans_per_run': sum(r['scans'] for r in runs) / len(runs),
+        'web_queries_per_run': {k: v / len(runs) for k, v in queries.items()},
+        'daemon_metrics': runs[-1]['metrics'],
+        'simple_ttff_ms': stats([s['ttff'] for s in simple]),
+        'simple_messages_per_update': mean('messages_per_update'),
+        'simple_match_rules_per_update': mean('match_rules_per_update'),
+        'simple_get_alls_per_update': mean('get_alls_per_update'),
+    }
+
+
+def print_summary(summary):
+    def fmt(value):
+        return '-' if value is None else '{:.1f}'.format(value)
+
+    print('{} ({} runs)'.format(summary['scenario'], summary['runs']))
+    for key, label in (('daemon_startup_ms', 'daemon startup'),
+                       ('first_client_ms', 'first client'),
+                       ('ttff_ms', 'time to first fix'),
+                       ('update_latency_ms', 'update latency')):
+        s = summary[key]
+        print('  {:<20} p50 {:>8} ms  p90 {:>8} ms  p99 {:>8} ms  (n={})'.format(
+            label, fmt(s['p50']), fmt(s['p90']), fmt(s['p99']), s['count']))
+    print('  {:<20} {} ms over {} fixes'.format('cpu per fix',
+                                               fmt(summary['cpu_ms_per_fix']),
+                                               summary['fixes']))
+    print('  {:<20} {}'.format('wifi scans per run',
+                               fmt(summary['wifi_scans_per_run'])))
+    queries = summary['web_queries_per_run']
+    print('  {:<20} {} locate, {} submit, {} unanswered'.format(
+        'web queries per run', fmt(queries.get('locate')),
+        fmt(queries.get('submit')), fmt(queries.get('unanswered'))))
+    if summary['simple_ttff_ms']['count']:
+        print('  {:<20} {} messages, {} match rules, {} GetAll '
+              'per update'.format(
+                  'GClueSimple client',
+                  fmt(summary['simple_messages_per_update']),
+                  fmt(summary['simple_match_rules_per_update']),
+                  fmt(summary['simple_get_alls_per_update'])))
+
+
+# Values where lower is better, compared against a baseline.
+GUARDED = (
+    ('first_client_ms', 'p50'),
+    ('ttff_ms', 'p50'),
+    ('update_latency_ms', 'p99'),
+    ('cpu_ms_per_fix', None),
+    ('web_queries_per_run', 'locate'),
+    ('simple_messages_per_update', None),
+)
+
+
+def check_regressions(summary, baseline, tolerance):
+    regressions = []
+    for key, sub in GUARDED:
+        old, new = baseline.get(key), summary.get(key)
+        if sub is not None:
+            old = old.get(sub) if isinstance(old, dict) else None
+            new = new.get(sub) if isinstance(new, dict) else None
+        if old is None or new is None:
+            continue
+        if new > old * (1 + tolerance) and new - old > 1e-6:
+            regressions.append('{}{}: {:.2f} -> {:.2f}'.format(
+                key, '.' + sub if sub else '', old, new))
+    return regressions
+
+
+def main():
+    if len(sys.argv) == 3 and sys.argv[1] == '--simple-client':
+        simple_client(int(sys.argv[2]))
+        return 0
+
+    parser = argparse.ArgumentParser(
+        description='Replay a scenario against geoclue and measure it')
+    parser.add_argument('scenario', nargs='+',
+                        help='scenario JSON file(s)')
+    parser.add_argument('--geoclue', default='build/src/geoclue',
+                        help='daemon binary (default: %(default)s)')
+    parser.add_argument('--runs', type=int, default=3,
+                        help='replays per scenario (default: %(default)s)')
+    parser.add_argument('--json', metavar='FILE',
+                        help='write the results as JSON to FILE')
+    parser.add_argument('--baseline', metavar='FILE',
+                        help='fail if results regressed against FILE, as '
+                             'written by --json')
+    parser.add_argument('--tolerance', type=float, default=0.1,
+                        help='allowed regression against the baseline '
+                             '(default: %(default)s)')
+    parser.add_argument('--libgeoclue', metavar='DIR',
+                        help='also run a GClueSimple client from the '
+                             'libgeoclue build in DIR, which needs the '
+                             'typelib, and count its bus messages')
+    parser.add_argument('--command', metavar='CMD',
+                        help='also run CMD, e.g. geoclue-load, against the '
+                             'private bus while the scenario plays; the run '
+                             'ends early if it exits')
+    parser.add_argument('--keep', action='store_true',
+                        help='keep the work directory with the daemon log')
+    parser.add_argument('-v', '--verbose', action='store_true')
+    args = parser.parse_args()
+
+    if shutil.which('dbus-daemon') is None:
+        print('dbus-daemon not found', file=sys.stderr)
+        return -1
+
+    results = {}
+    for path in args.scenario:
+        with open(path) as f:
+            scenario = json.load(f)
+        name = scenario.get('name', os.path.basename(path))
+
+        runs = []
+        for _ in range(args.runs):
+            try:
+                runs.append(Run(scenario, args).execute())
+            except RuntimeError as e:
+                print('{}: {}'.format(name, e), file=sys.stderr)
+                return 1
+
+        results[name] = summarize(name, runs)
+        print_summary(results[name])
+
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+
+        failed = False
+        for name, summary in results.items():
+            if name not in baseline:
+                continue
+            for regression in check_regressions(summary, baseline[name],
+                                                args.tolerance):
+                print('REGRESSION {}: {}'.format(name, regression))
+                failed = True
+        if failed:
+            return 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -1,239 +1,609 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
+#include <glib-unix.h>
 #include <geoclue.h>
 #include <unistd.h>
-#include <pthread.h>
-#include <sys/wait.h>
 #include <signal.h>
 
+/* Output buffer size; records are only written out when it fills up, once
+ * per FLUSH_INTERVAL or at exit.
+ */
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+#define FLUSH_INTERVAL 1 /* seconds */
+
+#define DESKTOP_ID "spictera"
+
+#define AGENT_PATH "/org/freedesktop/GeoClue2/Agent"
+#define MANAGER_PATH "/org/freedesktop/GeoClue2/Manager"
+
+/* Tracing chatter, only with --verbose */
+#define TRACE(...) do { if (verbose) fprintf (stderr, __VA_ARGS__); } while (0)
+
+typedef enum {
+	FORMAT_TEXT,
+	FORMAT_JSON,
+	FORMAT_BINARY,
+} OutputFormat;
+
+/* One fix in --format=binary, in host byte order. Unknown altitude is
+ * -G_MAXDOUBLE, unknown speed and heading are -1, as in geoclue.
+ */
+typedef struct {
+	guint64 timestamp;	/* microseconds since the Epoch */
+	gdouble latitude;
+	gdouble longitude;
+	gdouble accuracy;
+	gdouble altitude;
+	gdouble speed;
+	gdouble heading;
+} LocationRecord;
+
+G_STATIC_ASSERT (sizeof (LocationRecord) == 56);
 
 /* Commandline options */
 static gint timeout = 30; /* seconds */
 static GClueAccuracyLevel accuracy_level = GCLUE_ACCURACY_LEVEL_EXACT;
 static gint time_threshold;
+static gint distance_threshold;
+static gchar *format_name = NULL;
+static gchar *output_path = NULL;
+static gint64 rotate_size;
+static gchar *agent_id = NULL;
+static gboolean use_agent = FALSE;
+static gboolean verbose = FALSE;
+
+static GOptionEntry entries[] =
+{
+	{ "timeout", 't', 0, G_OPTION_ARG_INT, &timeout,
+	  "Exit after T seconds, 0 to run until interrupted. Default: 30", "T" },
+	{ "accuracy", 'a', 0, G_OPTION_ARG_INT, &accuracy_level,
+	  "Requested accuracy level: 1 country, 4 city, 5 neighborhood, "
+	  "6 street, 8 exact. Default: 8", "LEVEL" },
+	{ "time-threshold", 'i', 0, G_OPTION_ARG_INT, &time_threshold,
+	  "Minimum seconds between fixes", "SECONDS" },
+	{ "distance-threshold", 'd', 0, G_OPTION_ARG_INT, &distance_threshold,
+	  "Minimum meters between fixes", "METERS" },
+	{ "format", 'f', 0, G_OPTION_ARG_STRING, &format_name,
+	  "Output format: text, json (one object per line) or binary "
+	  "(56 byte records). Default: text", "FORMAT" },
+	{ "output", 'o', 0, G_OPTION_ARG_FILENAME, &output_path,
+	  "Append fixes to FILE instead of stdout", "FILE" },
+	{ "rotate-size", 'r', 0, G_OPTION_ARG_INT64, &rotate_size,
+	  "Move FILE to FILE.1 once it reaches BYTES", "BYTES" },
+	{ "agent", 0, 0, G_OPTION_ARG_NONE, &use_agent,
+	  "Register a built-in agent that only authorizes this tool. It "
+	  "replaces the desktop's agent, which stays gone until it registers "
+	  "again: use only where no other agent runs", NULL },
+	{ "agent-id", 0, 0, G_OPTION_ARG_STRING, &agent_id,
+	  "Desktop ID to register the built-in agent as, which must be in "
+	  "the agent whitelist of geoclue.conf. Default: geoclue-demo-agent", "ID" },
+	{ "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose,
+	  "Trace calls on stderr", NULL },
+	{ NULL }
+};
+
+static OutputFormat format = FORMAT_TEXT;
+static FILE *output = NULL;
+static gint64 output_size;
+static guint flush_id = 0;
 
 GClueSimple *simple = NULL;
 GClueClient *client = NULL;
 GMainLoop *main_loop;
-pid_t agent_pid = 0;
+GDBusConnection *connection = NULL;
+guint agent_registration_id = 0;
 
-static gboolean on_location_timeout(gpointer user_data)
+static gboolean open_output(void)
+{
+	GStatBuf st;
+
+	if (output_path == NULL) {
+		output = stdout;
+	} else {
+		output = fopen(output_path, format == FORMAT_BINARY ? "ab" : "a");
+		if (output == NULL) {
+			fprintf(stderr, "Failed to open %s: %s\n",
+			        output_path, g_strerror(errno));
+			return FALSE;
+		}
+	}
+
+	output_size = 0;
+	if (output_path != NULL && g_stat(output_path, &st) == 0)
+		output_size = st.st_size;
+
+	/* Keep a terminal interactive, batch everything else */
+	if (format == FORMAT_TEXT && isatty(fileno(output)))
+		setvbuf(output, NULL, _IOLBF, 0);
+	else
+		setvbuf(output, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+
+	return TRUE;
+}
+
+static void close_output(void)
+{
+	if (output == NULL)
+		return;
+
+	if (output == stdout)
+		fflush(output);
+	else
+		fclose(output);
+	output = NULL;
+}
+
+static void rotate_output(void)
+{
+	g_autofree gchar *rotated = NULL;
+
+	if (output_path == NULL || rotate_size <= 0 || output_size < rotate_size)
+		return;
+
+	close_output();
+	rotated = g_strconcat(output_path, ".1", NULL);
+	if (g_rename(output_path, rotated) != 0)
+		fprintf(stderr, "Failed to rotate %s: %s\n",
+		        output_path, g_strerror(errno));
+	if (!open_output())
+		g_main_loop_quit(main_loop);
+}
+
+static gboolean on_flush_timeout(gpointer user_data)
+{
+	flush_id = 0;
+	if (output != NULL)
+		fflush(output);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void quit(void)
 {
-	printf("%s():ENTRY\n",__FUNCTION__);
+	g_clear_handle_id(&flush_id, g_source_remove);
+	close_output();
 
 	g_clear_object (&client);
 	g_clear_object (&simple);
+	if (agent_registration_id != 0)
+	{
+		g_dbus_connection_unregister_object (connection, agent_registration_id);
+		agent_registration_id = 0;
+	}
 	g_main_loop_quit (main_loop);
+}
 
-	printf("%s():LEAVING:return false\n",__FUNCTION__);
+static gboolean on_location_timeout(gpointer user_data)
+{
+	TRACE("%s():ENTRY\n",__FUNCTION__);
+
+	quit();
+
+	TRACE("%s():LEAVING:return false\n",__FUNCTION__);
 	return FALSE;
 }
 
-static void print_location(GClueSimple *simple)
+static gboolean on_quit_signal(gpointer user_data)
+{
+	TRACE("%s():signal %d\n",__FUNCTION__,GPOINTER_TO_INT(user_data));
+
+	quit();
+
+	return G_SOURCE_REMOVE;
+}
+
+/* The write_*() functions return the number of bytes written, or a
+ * negative value on error.
+ */
+static gint64 write_text(GClueLocation *location, guint64 sec, guint64 usec)
 {
-	GClueLocation *location;
 	gdouble altitude, speed, heading;
-	GVariant *timestamp;
-	GTimeVal tv = { 0 };
 	GDateTime *date_time;
 	const char *desc;
 	gchar *str;
+	gint64 n = 0;
 
-	printf("%s():ENTRY\n",__FUNCTION__);
-
-        printf("%s():gclue_simple_get_location()\n",__FUNCTION__);
-	location = gclue_simple_get_location (simple);
+	n += fprintf(output, "Latitude: %f°\n", gclue_location_get_latitude (location));
+	n += fprintf(output, "Longitude: %f°\n", gclue_location_get_longitude (location));
+	n += fprintf(output, "Accuracy: %f meters\n", gclue_location_get_accuracy (location));
 
-        printf("%s():Latitude: %f°\n", __FUNCTION__, gclue_location_get_latitude (location));
-        printf("%s():Longitude: %f°\n", __FUNCTION__, gclue_location_get_longitude (location));
-	printf("%s():Accuracy: %f meters\n", __FUNCTION__,gclue_location_get_accuracy (location));
-
-        printf("%s():gclue_simple_get_altitude()\n",__FUNCTION__);
 	altitude = gclue_location_get_altitude(location);
 	if(altitude != -G_MAXDOUBLE)
-		printf("%s():Altitude: %f meters\n", __FUNCTION__,altitude);
+		n += fprintf(output, "Altitude: %f meters\n", altitude);
 
-        printf("%s():gclue_simple_get_altitude()\n",__FUNCTION__);
 	speed = gclue_location_get_speed(location);
 	if(speed >= 0)
-		printf("%s():Speed: %f meters/second\n", __FUNCTION__,speed);
+		n += fprintf(output, "Speed: %f meters/second\n", speed);
 
-        printf("%s():gclue_simple_get_heading()\n",__FUNCTION__);
 	heading = gclue_location_get_heading(location);
 	if(heading >= 0)
-		printf("%s():Heading: %f°\n", __FUNCTION__,heading);
+		n += fprintf(output, "Heading: %f°\n", heading);
 
-        printf("%s():gclue_simple_get_description()\n",__FUNCTION__);
 	desc = gclue_location_get_description(location);
-        if(strlen (desc) > 0)
-		printf("%s():Description: %s\n", __FUNCTION__,desc);
+	if(desc != NULL && strlen (desc) > 0)
+		n += fprintf(output, "Description: %s\n", desc);
 
-        printf("%s():gclue_simple_get_timestamp()\n",__FUNCTION__);
-	timestamp = gclue_location_get_timestamp(location);
-	if (timestamp) 
+	if (sec > 0)
 	{
-		g_variant_get(timestamp, "(tt)", &tv.tv_sec, &tv.tv_usec);
-
-		date_time = g_date_time_new_from_timeval_local(&tv);
+		date_time = g_date_time_new_from_unix_local((gint64) sec);
 		str = g_date_time_format(date_time, "%c (%s seconds since the Epoch)");
 		g_date_time_unref (date_time);
 
-		printf("%s():Timestamp: %s\n", __FUNCTION__,str);
+		n += fprintf(output, "Timestamp: %s\n", str);
 		g_free (str);
 	}
-	printf("%s():LEAVING\n",__FUNCTION__);
+
+	return n;
+}
+
+static gint64 write_json(GClueLocation *location, guint64 sec, guint64 usec)
+{
+	gdouble altitude, speed, heading;
+	gint64 n = 0;
+
+	n += fprintf(output, "{\"ts\":%" G_GUINT64_FORMAT ".%06" G_GUINT64_FORMAT
+	             ",\"lat\":%.7f,\"lon\":%.7f,\"acc\":%.1f",
+	             sec, usec,
+	             gclue_location_get_latitude (location),
+	             gclue_location_get_longitude (location),
+	             gclue_location_get_accuracy (location));
+
+	altitude = gclue_location_get_altitude(location);
+	if(altitude != -G_MAXDOUBLE)
+		n += fprintf(output, ",\"alt\":%.1f", altitude);
+
+	speed = gclue_location_get_speed(location);
+	if(speed >= 0)
+		n += fprintf(output, ",\"speed\":%.2f", speed);
+
+	heading = gclue_location_get_heading(location);
+	if(heading >= 0)
+		n += fprintf(output, ",\"heading\":%.1f", heading);
+
+	n += fprintf(output, "}\n");
+
+	return n;
+}
+
+static gint64 write_binary(GClueLocation *location, guint64 sec, guint64 usec)
+{
+	LocationRecord record;
+
+	record.timestamp = sec * G_USEC_PER_SEC + usec;
+	record.latitude = gclue_location_get_latitude (location);
+	record.longitude = gclue_location_get_longitude (location);
+	record.accuracy = gclue_location_get_accuracy (location);
+	record.altitude = gclue_location_get_altitude (location);
+	record.speed = gclue_location_get_speed (location);
+	record.heading = gclue_location_get_heading (location);
+
+	if (fwrite(&record, sizeof (record), 1, output) != 1)
+		return -1;
+
+	return sizeof (record);
+}
+
+static void print_location(GClueSimple *simple)
+{
+	GClueLocation *location;
+	GVariant *timestamp;
+	guint64 sec = 0, usec = 0;
+	gint64 written = 0;
+
+	TRACE("%s():ENTRY\n",__FUNCTION__);
+
+	location = gclue_simple_get_location (simple);
+	if (location == NULL || output == NULL)
+	{
+		TRACE("%s():LEAVING:no location\n",__FUNCTION__);
+		return;
+	}
+
+	timestamp = gclue_location_get_timestamp(location);
+	if (timestamp)
+		g_variant_get(timestamp, "(tt)", &sec, &usec);
+
+	switch (format)
+	{
+	case FORMAT_TEXT:
+		written = write_text(location, sec, usec);
+		break;
+	case FORMAT_JSON:
+		written = write_json(location, sec, usec);
+		break;
+	case FORMAT_BINARY:
+		written = write_binary(location, sec, usec);
+		break;
+	}
+	output_size += written;
+
+	if (written < 0 || ferror(output))
+	{
+		fprintf(stderr, "Failed to write location: %s\n", g_strerror(errno));
+		quit();
+		return;
+	}
+
+	rotate_output();
+	if (output != NULL && flush_id == 0)
+		flush_id = g_timeout_add_seconds(FLUSH_INTERVAL, on_flush_timeout, NULL);
+
+	TRACE("%s():LEAVING\n",__FUNCTION__);
 }
 
 static void on_client_active_notify (GClueClient *client, GParamSpec *pspec, gpointer user_data)
 {
-	printf("%s():ENTRY\n",__FUNCTION__);
+	TRACE("%s():ENTRY\n",__FUNCTION__);
 
-        printf("%s():gclue_get_active()\n",__FUNCTION__);
 	if (gclue_client_get_active(client))
-        {
-		printf("%s():LEAVING\n",__FUNCTION__);
+	{
+		TRACE("%s():LEAVING\n",__FUNCTION__);
 		return;
-        }
+	}
 
-	printf("%s():Geolocation disabled. Quitting.\n",__FUNCTION__);
+	fprintf(stderr, "Geolocation disabled. Quitting.\n");
 	on_location_timeout(NULL);
 
-	printf("%s():LEAVING\n",__FUNCTION__);
+	TRACE("%s():LEAVING\n",__FUNCTION__);
 }
 
 static void on_simple_ready (GObject *source_object, GAsyncResult *res, gpointer user_data)
 {
 	GError *error = NULL;
 
-	printf("%s():ENTRY\n",__FUNCTION__);
+	TRACE("%s():ENTRY\n",__FUNCTION__);
 
-        printf("%s():gclue_simple_new_finish()\n",__FUNCTION__);
-	simple = gclue_simple_new_finish (res, &error);
-	if (error != NULL) 
+	simple = gclue_simple_new_with_thresholds_finish (res, &error);
+	if (error != NULL)
 	{
-		printf("%s():ERROR:%s\n",__FUNCTION__,error->message);
+		fprintf(stderr, "Failed to connect to GeoClue2 service: %s\n", error->message);
+		g_error_free (error);
 
-		g_clear_object (&client);
-		g_clear_object (&simple);
-		g_main_loop_quit (main_loop);
+		quit();
 
-		printf("%s():LEAVING\n",__FUNCTION__);
+		TRACE("%s():LEAVING\n",__FUNCTION__);
 		return;
 	}
 
-	printf("%s():gclue_simple_get_client()\n",__FUNCTION__);
 	client = gclue_simple_get_client(simple);
 
 	g_object_ref(client);
-	printf("%s():Client object: %s\n", __FUNCTION__,g_dbus_proxy_get_object_path (G_DBUS_PROXY (client)));
-	
-	if (time_threshold > 0) 
-	{
-		gclue_client_set_time_threshold(client, time_threshold);
-	}
+	TRACE("%s():Client object: %s\n", __FUNCTION__,g_dbus_proxy_get_object_path (G_DBUS_PROXY (client)));
 
 	print_location (simple);
 
 	g_signal_connect (simple, "notify::location", G_CALLBACK (print_location), NULL);
 	g_signal_connect (client, "notify::active", G_CALLBACK (on_client_active_notify), NULL);
 
-	printf("%s():LEAVING\n",__FUNCTION__);
+	TRACE("%s():LEAVING\n",__FUNCTION__);
 }
 
-int getlocation(void)
+static void start_location(void)
 {
-	GOptionContext *context;
+	TRACE("%s():gclue_simple_new_with_thresholds(%d)\n",__FUNCTION__,accuracy_level);
+	gclue_simple_new_with_thresholds (DESKTOP_ID, accuracy_level,
+	                                  time_threshold, distance_threshold,
+	                                  NULL, on_simple_ready, NULL);
+}
 
-	printf("%s():ENTRY\n",__FUNCTION__);
-	g_timeout_add_seconds (timeout, on_location_timeout, NULL);
+/* A minimal in-process agent: geoclue asks the agent of our user whether an
+ * app may get its location, this one only allows ourselves.
+ */
+static const char agent_introspection[] =
+	"<node>"
+	"  <interface name='org.freedesktop.GeoClue2.Agent'>"
+	"    <method name='AuthorizeApp'>"
+	"      <arg name='desktop_id' type='s' direction='in'/>"
+	"      <arg name='req_accuracy_level' type='u' direction='in'/>"
+	"      <arg name='authorized' type='b' direction='out'/>"
+	"      <arg name='allowed_accuracy_level' type='u' direction='out'/>"
+	"    </method>"
+	"    <property name='MaxAccuracyLevel' type='u' access='read'/>"
+	"  </interface>"
+	"</node>";
+
+static void agent_method_call(GDBusConnection *connection,
+                              const char *sender,
+                              const char *object_path,
+                              const char *interface_name,
+                              const char *method_name,
+                              GVariant *parameters,
+                              GDBusMethodInvocation *invocation,
+                              gpointer user_data)
+{
+	const char *desktop_id;
+	guint32 level;
+	gboolean authorized;
 
-	printf("%s():gclue_simple_new(%d)\n",__FUNCTION__,accuracy_level);
-	gclue_simple_new ("spictera", accuracy_level, NULL, on_simple_ready, NULL);
+	if (g_strcmp0(method_name, "AuthorizeApp") != 0)
+	{
+		g_dbus_method_invocation_return_error (invocation,
+		                                       G_DBUS_ERROR,
+		                                       G_DBUS_ERROR_UNKNOWN_METHOD,
+		                                       "Unknown method %s",
+		                                       method_name);
+		return;
+	}
 
-	main_loop = g_main_loop_new (NULL, FALSE);
-	g_main_loop_run (main_loop);
+	g_variant_get(parameters, "(&su)", &desktop_id, &level);
+	authorized = g_strcmp0(desktop_id, DESKTOP_ID) == 0;
+	TRACE("%s():%s '%s' at level %u\n",__FUNCTION__,
+	      authorized ? "authorized" : "denied", desktop_id, level);
 
-	printf("%s():LEAVING\n",__FUNCTION__);
-	return EXIT_SUCCESS;
+	g_dbus_method_invocation_return_value (invocation,
+	                                       g_variant_new("(bu)", authorized, level));
 }
 
-// Function to run the agent program
-void* run_agent(void* arg) {
-    const char *agent_path = "geoclue/build/demo/agent";
+static GVariant *agent_get_property(GDBusConnection *connection,
+                                    const char *sender,
+                                    const char *object_path,
+                                    const char *interface_name,
+                                    const char *property_name,
+                                    GError **error,
+                                    gpointer user_data)
+{
+	if (g_strcmp0(property_name, "MaxAccuracyLevel") == 0)
+		return g_variant_new_uint32(GCLUE_ACCURACY_LEVEL_EXACT);
 
-    // Check if the agent program exists and is executable
-    if (access(agent_path, X_OK) != 0) {
-        perror("Error: agent program not found or not executable");
-        pthread_exit((void*)1);
-    }
+	g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_PROPERTY,
+	             "Unknown property %s", property_name);
+	return NULL;
+}
 
-    // Execute the agent program in the background
-    agent_pid = fork();
-    if (agent_pid == 0) {
-        // Child process
-        execl(agent_path, agent_path, (char*)NULL);
-        perror("Error executing agent program");
-        exit(1);
-    } else if (agent_pid < 0) {
-        // Fork failed
-        perror("Error forking process for agent program");
-        pthread_exit((void*)1);
-    }
+static const GDBusInterfaceVTable agent_vtable = {
+	agent_method_call, agent_get_property, NULL, { 0 }
+};
+
+/* AddAgent only returns once geoclue has set up the agent, so the location
+ * can be requested right away instead of after some guessed delay.
+ */
+static void on_add_agent_ready(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	GVariant *reply;
+	GError *error = NULL;
+
+	reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object), res, &error);
+	if (reply == NULL)
+	{
+		/* Apps allowed in geoclue.conf or by another agent still work */
+		fprintf(stderr, "Failed to register agent: %s\n", error->message);
+		g_error_free (error);
+	}
+	else
+	{
+		TRACE("%s():agent ready\n",__FUNCTION__);
+		g_variant_unref (reply);
+	}
 
-    // Parent process
-    printf("Agent program started with PID %d.\n", agent_pid);
-    pthread_exit((void*)0);
+	start_location();
 }
 
-// Function to run the getlocation function
-void* run_getlocation(void* arg) {
-    // Assuming getlocation is defined somewhere else
-    extern int getlocation();
-    sleep(1); // Delay for 1 second after agent starts
-    int rc = getlocation();
-    pthread_exit((void*)(long)rc);
+static void register_agent(void)
+{
+	GDBusNodeInfo *node_info;
+	GError *error = NULL;
+
+	TRACE("%s():ENTRY\n",__FUNCTION__);
+
+	node_info = g_dbus_node_info_new_for_xml (agent_introspection, NULL);
+	agent_registration_id = g_dbus_connection_register_object (connection,
+	                                                            AGENT_PATH,
+	                                                            node_info->interfaces[0],
+	                                                            &agent_vtable,
+	                                                            NULL, NULL,
+	                                                            &error);
+	g_dbus_node_info_unref (node_info);
+	if (agent_registration_id == 0)
+	{
+		fprintf(stderr, "Failed to export agent: %s\n", error->message);
+		g_error_free (error);
+		start_location();
+		return;
+	}
+
+	g_dbus_connection_call (connection,
+	                        "org.freedesktop.GeoClue2",
+	                        MANAGER_PATH,
+	                        "org.freedesktop.GeoClue2.Manager",
+	                        "AddAgent",
+	                        g_variant_new ("(s)", agent_id),
+	                        NULL,
+	                        G_DBUS_CALL_FLAGS_NONE,
+	                        -1,
+	                        NULL,
+	                        on_add_agent_ready,
+	                        NULL);
+
+	TRACE("%s():LEAVING\n",__FUNCTION__);
 }
 
-int main() {
-    pthread_t agent_thread, getlocation_thread;
-    void *agent_status, *getlocation_status;
+static void on_bus_ready(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	GError *error = NULL;
 
-    // Create the agent thread
-    if (pthread_create(&agent_thread, NULL, run_agent, NULL) != 0) {
-        perror("Error creating agent thread");
-        return 1;
-    }
+	/* The shared system bus connection, which GClueSimple uses as well */
+	connection = g_bus_get_finish (res, &error);
+	if (connection == NULL)
+	{
+		fprintf(stderr, "Failed to connect to the system bus: %s\n", error->message);
+		g_error_free (error);
+		quit();
+		return;
+	}
 
-    // Create the getlocation thread
-    if (pthread_create(&getlocation_thread, NULL, run_getlocation, NULL) != 0) {
-        perror("Error creating getlocation thread");
-        return 1;
-    }
+	register_agent();
+}
 
-    // Wait for the getlocation thread to finish
-    if (pthread_join(getlocation_thread, &getlocation_status) != 0) {
-        perror("Error joining getlocation thread");
-        return 1;
-    }
+int getlocation(void)
+{
+	TRACE("%s():ENTRY\n",__FUNCTION__);
+
+	if (!open_output())
+		return EXIT_FAILURE;
+
+	if (timeout > 0)
+		g_timeout_add_seconds (timeout, on_location_timeout, NULL);
+	g_unix_signal_add (SIGINT, on_quit_signal, GINT_TO_POINTER (SIGINT));
+	g_unix_signal_add (SIGTERM, on_quit_signal, GINT_TO_POINTER (SIGTERM));
+
+	if (use_agent)
+		g_bus_get (G_BUS_TYPE_SYSTEM, NULL, on_bus_ready, NULL);
+	else
+		start_location();
+
+	main_loop = g_main_loop_new (NULL, FALSE);
+	g_main_loop_run (main_loop);
+
+	g_clear_object (&connection);
 
-    // Check the return status of getlocation
-    if ((long)getlocation_status != 0) {
-        fprintf(stderr, "Getlocation thread returned with status %ld\n", (long)getlocation_status);
+	TRACE("%s():LEAVING\n",__FUNCTION__);
+	return EXIT_SUCCESS;
+}
+
+static gboolean parse_options(int *argc, char ***argv)
+{
+    GOptionContext *context;
+    GError *error = NULL;
+
+    context = g_option_context_new ("- Report or record the current location");
+    g_option_context_add_main_entries (context, entries, NULL);
+    if (!g_option_context_parse (context, argc, argv, &error)) {
+        fprintf(stderr, "%s\n", error->message);
+        g_error_free (error);
+        g_option_context_free (context);
+        return FALSE;
+    }
+    g_option_context_free (context);
+
+    if (format_name == NULL || g_strcmp0(format_name, "text") == 0) {
+        format = FORMAT_TEXT;
+    } else if (g_strcmp0(format_name, "json") == 0) {
+        format = FORMAT_JSON;
+    } else if (g_strcmp0(format_name, "binary") == 0) {
+        format = FORMAT_BINARY;
     } else {
-        printf("Getlocation thread executed successfully.\n");
+        fprintf(stderr, "Unknown format '%s'\n", format_name);
+        return FALSE;
     }
-    
-     // Terminate the agent process
-    if (agent_pid > 0) {
-        if (kill(agent_pid, SIGTERM) == 0) {
-            printf("Agent program (PID %d) terminated successfully.\n", agent_pid);
-        } else {
-            perror("Error terminating agent program");
-        }
+
+    if (format == FORMAT_BINARY && output_path == NULL && isatty(STDOUT_FILENO)) {
+        fprintf(stderr, "Refusing to write binary records to a terminal\n");
+        return FALSE;
     }
 
+    if (agent_id == NULL)
+        agent_id = g_strdup("geoclue-demo-agent");
 
-    return 0;
+    return TRUE;
 }
 
+int main(int argc, char **argv) {
+    if (!parse_options(&argc, &argv))
+        return 1;
+
+    return getlocation();
+}
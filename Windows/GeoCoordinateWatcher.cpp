@@ -1,66 +1,160 @@
 #include "GeoCoordinateWatcher.h"
+#include <cmath>
+#include <cstdio>
+
+namespace {
+    const double kEarthRadiusMetres = 6372795.0;
+
+    // Great-circle distance, as in gclue_location_get_distance_from().
+    double distanceBetween(double latitude1, double longitude1, double latitude2, double longitude2)
+    {
+        const double toRadians = 3.14159265358979323846 / 180.0;
+        double dlat = (latitude2 - latitude1) * toRadians;
+        double dlon = (longitude2 - longitude1) * toRadians;
+        double a = sin(dlat / 2) * sin(dlat / 2) +
+                   cos(latitude1 * toRadians) * cos(latitude2 * toRadians) *
+                   sin(dlon / 2) * sin(dlon / 2);
+        double c = 2 * atan2(sqrt(a), sqrt(1 - a));
+        return kEarthRadiusMetres * c;
+    }
+}
 
-IID REPORT_TYPES[] = { IID_ILatLongReport };
 GeoCoordinateWatcher* GeoCoordinateWatcher::_instance;
 
-GeoCoordinateWatcher::GeoCoordinateWatcher()
+GeoCoordinateWatcher::GeoCoordinateWatcher(unique_ptr<LocationProvider> provider)
+    : provider(std::move(provider))
 {
     _instance = this;
-    hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED | COINIT_DISABLE_OLE1DDE);;
-    if (SUCCEEDED(hr))
+    dispatcher = make_unique<ReportDispatcher<RawReport>>(
+            kReportQueueCapacity, OverflowPolicy::DropOldest,
+            [this](RawReport &report) { dispatch(report); });
+}
+
+GeoCoordinateWatcher::~GeoCoordinateWatcher()
+{
+    if (provider)
     {
-        hr = spLocation.CoCreateInstance(CLSID_Location);
+        provider->stop();
     }
+    dispatcher->stop();
+
+    if (_instance == this)
+        _instance = nullptr;
 }
 
-GeoCoordinateWatcher::~GeoCoordinateWatcher()
+SubscriptionHandle GeoCoordinateWatcher::subscribe(function<void(const GeoCoordinate &)> func, const SubscriptionOptions &options)
+{
+    auto subscriber = make_shared<Subscriber>();
+    subscriber->callback = std::move(func);
+    subscriber->options = options;
+
+    lock_guard<mutex> lock(subscribersMutex);
+    subscriber->handle = nextHandle++;
+    auto updated = make_shared<SubscriberList>(*subscribers);
+    updated->push_back(subscriber);
+    subscribers = std::move(updated);
+    return subscriber->handle;
+}
+
+void GeoCoordinateWatcher::unsubscribe(SubscriptionHandle handle)
 {
-    if (SUCCEEDED(hr))
+    lock_guard<mutex> lock(subscribersMutex);
+    auto updated = make_shared<SubscriberList>();
+    updated->reserve(subscribers->size());
+    for (const auto &subscriber : *subscribers)
     {
-        for (auto index : REPORT_TYPES)
-        {
-            spLocation->UnregisterForReport(index);
-        }
+        if (subscriber->handle == handle)
+            subscriber->active = false;
+        else
+            updated->push_back(subscriber);
     }
+    subscribers = std::move(updated);
+}
 
-    if (nullptr != pLocationEvents)
+bool GeoCoordinateWatcher::start(bool isHighAccuracy)
+{
     {
-        pLocationEvents->Release();
-        pLocationEvents = nullptr;
+        lock_guard<mutex> lock(subscribersMutex);
+        if (started || !provider)
+            return started;
+        started = true;
     }
+    return provider->start(isHighAccuracy, this);
+}
+
+void GeoCoordinateWatcher::onPositionChange(bool isHighAccuracy, function<void(const GeoCoordinate &)> func)
+{
+    if (positionChangeHandle != 0)
+        unsubscribe(positionChangeHandle);
+    positionChangeHandle = subscribe(std::move(func));
+    start(isHighAccuracy);
 }
 
-GeoCoordinateWatcher* GeoCoordinateWatcher::GetInstance()
+bool GeoCoordinateWatcher::Subscriber::accepts(const Info &info) const
 {
-    if (_instance == nullptr)
-        _instance = new GeoCoordinateWatcher();
-    return _instance;
+    if (options.requiredAccuracy > 0.0 && info.getHorizontalAccuracy() > options.requiredAccuracy)
+        return false;
+    if (!hasLast)
+        return true;
+    if (options.timeThreshold > 0 &&
+        info.getTimestamp() - lastTimestamp < options.timeThreshold * 1000)
+        return false;
+    if (options.distanceThreshold > 0.0 &&
+        distanceBetween(lastLatitude, lastLongitude, info.getLatitude(), info.getLongitude()) < options.distanceThreshold)
+        return false;
+    return true;
 }
 
-void GeoCoordinateWatcher::onPositionChange(bool isHighAccuracy, std::function<void(GeoCoordinate)> func)
+void GeoCoordinateWatcher::onReport(const RawReport &report)
 {
-    this->callback = std::move(func);
-    if (SUCCEEDED(hr))
+    dispatcher->post(report);
+}
+
+void GeoCoordinateWatcher::dispatch(RawReport &report)
+{
+    const GeoCoordinate geoCoordinate = normalizer.normalize(report);
+    const Info &info = geoCoordinate.getInfo();
+
+    shared_ptr<const SubscriberList> snapshot;
     {
-        hr = CComObject<CLocationEvents>::CreateInstance(&pLocationEvents);
-        if (nullptr != pLocationEvents)
-        {
-            pLocationEvents->AddRef();
-        }
+        lock_guard<mutex> lock(subscribersMutex);
+        snapshot = subscribers;
     }
 
-    if (SUCCEEDED(hr))
+    for (const auto &subscriber : *snapshot)
     {
-        hr = spLocation->RequestPermissions(nullptr, REPORT_TYPES, ARRAYSIZE(REPORT_TYPES), FALSE);
-        if (FAILED(hr))
-        {
-            wprintf(L"Warning: Unable to request permissions.\n");
-        }
-
-        for (auto index : REPORT_TYPES)
-        {
-            spLocation->SetDesiredAccuracy(IID_ILatLongReport, isHighAccuracy ? LOCATION_DESIRED_ACCURACY_HIGH : LOCATION_DESIRED_ACCURACY_DEFAULT);
-            hr = spLocation->RegisterForReport(pLocationEvents, index, 0);
-        }
+        if (!subscriber->active || !subscriber->accepts(info))
+            continue;
+        subscriber->hasLast = true;
+        subscriber->lastLatitude = info.getLatitude();
+        subscriber->lastLongitude = info.getLongitude();
+        subscriber->lastTimestamp = info.getTimestamp();
+        subscriber->callback(geoCoordinate);
+    }
+}
+
+ReportQueueStats GeoCoordinateWatcher::getQueueStats() const
+{
+    return dispatcher->stats();
+}
+
+void GeoCoordinateWatcher::onStatus(ProviderStatus status)
+{
+    switch (status) {
+        case ProviderStatus::NotSupported:
+            printf("\nNo devices detected.\n");
+            break;
+        case ProviderStatus::Error:
+            printf("\nReport error.\n");
+            break;
+        case ProviderStatus::AccessDenied:
+            printf("\nAccess denied to reports.\n");
+            break;
+        case ProviderStatus::Initializing:
+            printf("\nReport is initializing.\n");
+            break;
+        case ProviderStatus::Running:
+            printf("\nRunning.\n");
+            break;
     }
 }
@@ -1,29 +1,81 @@
 #pragma once
-#include "LocationCallback.h"
-#include <Windows.h>
-#include <atlbase.h>
-#include <atlcom.h>
-#include <locationapi.h>
+#include <atomic>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include "GeoStruct.h"
+#include "LocationProvider.h"
+#include "ReportQueue.h"
+#include "ReportNormalizer.h"
 
 using namespace std;
+using namespace GeoLocation;
 
-class GeoCoordinateWatcher
+// Per-subscriber filter, after geoclue's DistanceThreshold/TimeThreshold: a
+// fix is delivered only if it is both far enough and late enough from the
+// last one delivered to that subscriber, and accurate enough. Zero disables a
+// threshold.
+struct SubscriptionOptions
+{
+    double distanceThreshold = 0.0;     // metres
+    int64_t timeThreshold = 0;          // seconds
+    double requiredAccuracy = 0.0;      // maximum horizontal accuracy, metres
+};
+
+using SubscriptionHandle = uint64_t;
+
+class GeoCoordinateWatcher : public LocationSink
 {
 public:
+    explicit GeoCoordinateWatcher(unique_ptr<LocationProvider> provider);
+    // Defined by the platform backend; on Windows the watcher is backed by the
+    // Location API.
     static GeoCoordinateWatcher* GetInstance();
-    void onPositionChange(bool isHighAccuracy, function<void(GeoCoordinate)> func);
-    function<void(GeoCoordinate)> callback;
-    ~GeoCoordinateWatcher();
-protected:
-    GeoCoordinateWatcher();
+    ~GeoCoordinateWatcher() override;
+
+    // Callbacks run on the dispatcher thread and share one GeoCoordinate per
+    // fix. Safe to call from any thread, including from a callback.
+    SubscriptionHandle subscribe(function<void(const GeoCoordinate &)> func, const SubscriptionOptions &options = {});
+    void unsubscribe(SubscriptionHandle handle);
+    // Registers with the provider; the first call decides the accuracy.
+    bool start(bool isHighAccuracy);
+    // Replaces the subscription made by the previous call, then starts.
+    void onPositionChange(bool isHighAccuracy, function<void(const GeoCoordinate &)> func);
+
+    // Called on the provider's thread; only queues the report. Normalization
+    // and the callbacks run on the watcher's dispatcher thread.
+    void onReport(const RawReport &report) override;
+    void onStatus(ProviderStatus status) override;
+    ReportQueueStats getQueueStats() const;
 private:
+    struct Subscriber
+    {
+        SubscriptionHandle handle;
+        function<void(const GeoCoordinate &)> callback;
+        SubscriptionOptions options;
+        atomic<bool> active{true};
+        // Only touched on the dispatcher thread.
+        bool hasLast = false;
+        double lastLatitude = 0.0;
+        double lastLongitude = 0.0;
+        int64_t lastTimestamp = 0;
+
+        bool accepts(const Info &info) const;
+    };
+    using SubscriberList = vector<shared_ptr<Subscriber>>;
+
+    static constexpr size_t kReportQueueCapacity = 64;
+    void dispatch(RawReport &report);
     static GeoCoordinateWatcher* _instance;
-    class CInitializeATL : public CAtlExeModuleT<CInitializeATL> {};
-    CInitializeATL g_InitializeATL;
-    HRESULT hr;
-    CComPtr<ILocation> spLocation;
-    CComObject<CLocationEvents>* pLocationEvents = nullptr;
+    unique_ptr<LocationProvider> provider;
+    ReportNormalizer normalizer;
+    mutex subscribersMutex;
+    // Replaced, never modified, so the dispatcher can iterate a snapshot
+    // without holding the mutex.
+    shared_ptr<const SubscriberList> subscribers = make_shared<const SubscriberList>();
+    SubscriptionHandle nextHandle = 1;
+    SubscriptionHandle positionChangeHandle = 0;
+    bool started = false;
+    unique_ptr<ReportDispatcher<RawReport>> dispatcher;
 };
-
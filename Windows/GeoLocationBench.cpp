@@ -0,0 +1,191 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include "GeoSerializer.h"
+#include "LocationProvider.h"
+#include "ReportQueue.h"
+#include "TimestampFormatter.h"
+#include "GeoStruct.h"
+
+using namespace GeoLocation;
+
+namespace {
+
+    template<typename F>
+    double nanosecondsPerOp(size_t iterations, F &&op) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++)
+            op(i);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        return std::chrono::duration<double, std::nano>(elapsed).count() / (double) iterations;
+    }
+
+    void report(const char *name, double nsPerOp) {
+        printf("%-36s %10.1f ns/op\n", name, nsPerOp);
+    }
+
+    volatile size_t g_sink;
+
+    void benchCoordinateConstruction(size_t iterations) {
+        report("CPUID read", nanosecondsPerOp(iterations, [](size_t) {
+            g_sink = readCpuId().size();
+        }));
+        report("GeoCoordinate construction", nanosecondsPerOp(iterations, [](size_t i) {
+            GeoCoordinate coordinate;
+            coordinate.getMutableInfo().setLatitude((double) i);
+            g_sink = coordinate.getCpuid().size();
+        }));
+    }
+
+    GeoCoordinate makeSampleCoordinate() {
+        GeoCoordinate coordinate;
+        Info &info = coordinate.getMutableInfo();
+        info.setLatitude(31.230416);
+        info.setLongitude(121.473701);
+        info.setAltitude(12.5);
+        info.setHorizontalAccuracy(35.0);
+        info.setVerticalAccuracy(8.25);
+        info.setSpeed(1.2861111111111112);
+        info.setCourse(271.5);
+        info.setIntervals(10000000);
+        info.setTimestamp(1718000000123);
+        info.setFormatTimestamp("2024-06-10 14:13:20");
+        return coordinate;
+    }
+
+    // Compares writeCompactJson() against dump() of the same tree, on values
+    // that hit every number layout and string escape. Returns the number of
+    // documents that do not parse back to the same JSON value.
+    size_t checkCompactJson() {
+        const double numbers[] = {0.0, -0.0, 1.0, -35.0, 0.1, 1e-4, 1.5e-5, 31.230416, 1e15, 1e16,
+                                  123456789012345680.0, 1.2861111111111112, -1e-300, 1.7976931348623157e308};
+        size_t mismatches = 0, different = 0, checked = 0;
+        char text[1024];
+
+        for (double number : numbers) {
+            GeoCoordinate coordinate = makeSampleCoordinate();
+            Info &info = coordinate.getMutableInfo();
+            info.setLatitude(number);
+            info.setSpeed(-number);
+            info.setFormatTimestamp("tab\t\b\f\n\r\x01\x1f \"q\" \\ \xc3\xa9");
+
+            json j = json::object();
+            j["cpuid"] = coordinate.getCpuid();
+            j["info"] = info.toJsonObject();
+            j["software_ver"] = coordinate.getSoftwareVer();
+            std::string expected = j.dump();
+
+            size_t length = writeCompactJson(coordinate, text, sizeof(text));
+            std::string actual(text, std::min(length, sizeof(text)));
+            json parsed = json::parse(actual, nullptr, false);
+            checked++;
+            if (parsed.is_discarded() || parsed != j) {
+                printf("    MISMATCH %s\n      vs %s\n", actual.c_str(), expected.c_str());
+                mismatches++;
+            } else if (actual != expected) {
+                different++;
+            }
+        }
+        printf("writeCompactJson round trip: %zu documents, %zu mismatched, %zu equal but not byte-identical\n",
+               checked, mismatches, different);
+        return mismatches;
+    }
+
+    void benchSerialization(size_t iterations) {
+        const GeoCoordinate coordinate = makeSampleCoordinate();
+        char text[512];
+        uint8_t record[kBinaryRecordSize];
+
+        report("toJson (DOM, dump(4))", nanosecondsPerOp(iterations, [&](size_t) {
+            g_sink = coordinate.toJson().size();
+        }));
+        report("to_cbor (DOM)", nanosecondsPerOp(iterations, [&](size_t) {
+            json j = json::object();
+            j["cpuid"] = coordinate.getCpuid();
+            j["info"] = coordinate.getInfo().toJsonObject();
+            j["software_ver"] = coordinate.getSoftwareVer();
+            g_sink = json::to_cbor(j).size();
+        }));
+        report("writeCompactJson", nanosecondsPerOp(iterations, [&](size_t) {
+            g_sink = writeCompactJson(coordinate, text, sizeof(text));
+        }));
+        report("writeBinaryRecord", nanosecondsPerOp(iterations, [&](size_t) {
+            g_sink = writeBinaryRecord(coordinate, record, sizeof(record));
+        }));
+    }
+}
+
+namespace {
+
+    void benchTimestampFormatting(size_t iterations) {
+        const int64_t base = 1718000000;
+        char text[64];
+
+        report("localtime + strftime", nanosecondsPerOp(iterations, [&](size_t i) {
+            time_t t = (time_t) (base + (int64_t) i);
+            g_sink = strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", localtime(&t));
+        }));
+        TimestampFormatter formatter;
+        report("TimestampFormatter, 1 fix/s", nanosecondsPerOp(iterations, [&](size_t i) {
+            formatter.format(base + (int64_t) i, text);
+            g_sink = text[18];
+        }));
+    }
+
+    // Pushes iterations reports from a synthetic producer thread through a
+    // ReportDispatcher whose handler busy-waits consumerNanoseconds per report.
+    void benchDispatch(const char *name, size_t iterations, OverflowPolicy policy, int64_t consumerNanoseconds) {
+        size_t outOfOrder = 0;
+        double last = -1.0;
+        auto start = std::chrono::steady_clock::now();
+        ReportQueueStats stats;
+        {
+            ReportDispatcher<RawReport> dispatcher(64, policy, [&](RawReport &raw) {
+                if (raw.latitude <= last)
+                    outOfOrder++;
+                last = raw.latitude;
+                auto until = std::chrono::steady_clock::now() + std::chrono::nanoseconds(consumerNanoseconds);
+                while (consumerNanoseconds > 0 && std::chrono::steady_clock::now() < until);
+            });
+            std::thread producer([&] {
+                RawReport raw;
+                for (size_t i = 0; i < iterations; i++) {
+                    raw.latitude = (double) i;
+                    dispatcher.post(raw);
+                }
+            });
+            producer.join();
+            dispatcher.stop();
+            stats = dispatcher.stats();
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        report(name, std::chrono::duration<double, std::nano>(elapsed).count() / (double) iterations);
+        printf("    pushed %llu, dispatched %llu, dropped %llu, out of order %zu\n",
+               (unsigned long long) stats.pushed, (unsigned long long) stats.dispatched,
+               (unsigned long long) stats.dropped, outOfOrder);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    size_t iterations = 1000000;
+    if (argc > 1)
+        iterations = strtoull(argv[1], nullptr, 10);
+    if (iterations == 0)
+        iterations = 1;
+
+    printf("%zu iterations\n", iterations);
+    benchCoordinateConstruction(iterations);
+    if (checkCompactJson() != 0)
+        return 1;
+    benchSerialization(iterations);
+    benchTimestampFormatting(iterations);
+    benchDispatch("dispatch, idle consumer", iterations, OverflowPolicy::DropOldest, 0);
+    benchDispatch("dispatch, 2us consumer, drop oldest", iterations, OverflowPolicy::DropOldest, 2000);
+    benchDispatch("dispatch, 2us consumer, drop newest", iterations, OverflowPolicy::DropNewest, 2000);
+    return 0;
+}
@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "GeoCoordinateWatcher.h"
+#include "GeoSerializer.h"
+#include "ReplayLocationProvider.h"
+#include "TimestampFormatter.h"
+
+using namespace GeoLocation;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+    // Records when each report left the provider, then forwards it.
+    class TimingProvider : public LocationProvider, public LocationSink {
+    public:
+        TimingProvider(ReplayLocationProvider *replay, size_t reports)
+            : m_replay(replay), m_injected(reports) {}
+
+        bool start(bool isHighAccuracy, LocationSink *sink) override {
+            m_next = sink;
+            return m_replay->start(isHighAccuracy, this);
+        }
+
+        void stop() override { m_replay->stop(); }
+
+        void onReport(const RawReport &report) override {
+            size_t index = m_count.load(std::memory_order_relaxed);
+            m_injected[index] = {FileTimeToUnixMillis(*report.fileTime), Clock::now()};
+            m_count.store(index + 1, std::memory_order_release);
+            m_next->onReport(report);
+        }
+
+        void onStatus([[maybe_unused]] ProviderStatus status) override {}
+
+        // Called on the dispatcher thread, in report order.
+        bool injectedAt(int64_t timestamp, Clock::time_point *when) {
+            size_t count = m_count.load(std::memory_order_acquire);
+            while (m_cursor < count && m_injected[m_cursor].first < timestamp)
+                m_cursor++;
+            if (m_cursor >= count || m_injected[m_cursor].first != timestamp)
+                return false;
+            *when = m_injected[m_cursor].second;
+            return true;
+        }
+
+    private:
+        ReplayLocationProvider *m_replay;
+        LocationSink *m_next = nullptr;
+        std::vector<std::pair<int64_t, Clock::time_point>> m_injected;
+        std::atomic<size_t> m_count{0};
+        size_t m_cursor = 0;
+    };
+
+    // A 10 Hz walk around a 1 km circle.
+    std::vector<RawReport> syntheticTrace(size_t count) {
+        std::vector<RawReport> reports(count);
+        const int64_t start = UnixMillisToFileTime(1718000000000LL);
+        for (size_t i = 0; i < count; i++) {
+            double angle = (double) i / 6000.0 * 2.0 * 3.14159265358979323846;
+            reports[i].latitude = 31.23 + 0.009 * std::sin(angle);
+            reports[i].longitude = 121.47 + 0.0105 * std::cos(angle);
+            reports[i].altitude = 12.0;
+            reports[i].errorRadius = 5.0;
+            reports[i].speedKnots = 2.0;
+            reports[i].headingDegrees = std::fmod(angle * 180.0 / 3.14159265358979323846, 360.0);
+            reports[i].fileTime = start + (int64_t) i * 1000000;
+        }
+        return reports;
+    }
+
+    // Latency is matched up by timestamp, so make them present and strictly
+    // increasing at millisecond resolution.
+    void makeTimestampsUnique(std::vector<RawReport> &reports) {
+        int64_t previous = UnixMillisToFileTime(0);
+        for (auto &report : reports) {
+            if (!report.fileTime || FileTimeToUnixMillis(*report.fileTime) <= FileTimeToUnixMillis(previous))
+                report.fileTime = previous + 10000;
+            previous = *report.fileTime;
+        }
+    }
+
+    double percentile(const std::vector<double> &sorted, double p) {
+        if (sorted.empty())
+            return 0.0;
+        size_t index = (size_t) std::ceil(p / 100.0 * (double) sorted.size());
+        return sorted[std::min(sorted.size() - 1, index == 0 ? 0 : index - 1)];
+    }
+
+    void usage(const char *program) {
+        fprintf(stderr, "Usage: %s [--rate RATE] [--count N] [TRACE]\n"
+                        "  TRACE   NMEA log or JSON lines of Info records; synthetic if omitted\n"
+                        "  --rate  1 replays in real time, 0 (default) as fast as possible\n"
+                        "  --count number of synthetic fixes (default 100000)\n", program);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    double rate = 0.0;
+    size_t count = 100000;
+    const char *path = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            rate = strtod(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+            count = strtoull(argv[++i], nullptr, 10);
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            path = argv[i];
+        }
+    }
+
+    std::vector<RawReport> reports = path ? ReplayLocationProvider::LoadFile(path) : syntheticTrace(count);
+    if (reports.empty()) {
+        fprintf(stderr, "No fixes to replay\n");
+        return 1;
+    }
+    makeTimestampsUnique(reports);
+    size_t total = reports.size();
+
+    auto replay = std::make_unique<ReplayLocationProvider>(std::move(reports), rate);
+    ReplayLocationProvider *replayPtr = replay.get();
+    auto timing = std::make_unique<TimingProvider>(replayPtr, total);
+    TimingProvider *timingPtr = timing.get();
+
+    std::vector<double> latencies;
+    latencies.reserve(total);
+    ReportQueueStats stats;
+    Clock::time_point started, finished;
+    {
+        GeoCoordinateWatcher watcher(std::move(timing));
+        char text[512];
+        watcher.subscribe([&](const GeoCoordinate &coordinate) {
+            Clock::time_point injected;
+            writeCompactJson(coordinate, text, sizeof(text));
+            auto now = Clock::now();
+            if (timingPtr->injectedAt(coordinate.getInfo().getTimestamp(), &injected))
+                latencies.push_back(std::chrono::duration<double, std::micro>(now - injected).count());
+            finished = now;
+        });
+
+        started = Clock::now();
+        watcher.start(true);
+        replayPtr->wait();
+        // Destroying the watcher drains its queue.
+        stats = watcher.getQueueStats();
+    }
+    double seconds = std::chrono::duration<double>(finished - started).count();
+    std::sort(latencies.begin(), latencies.end());
+
+    printf("fixes        %zu replayed, %zu delivered, %llu dropped\n",
+           total, latencies.size(), (unsigned long long) stats.dropped);
+    printf("throughput   %.0f fixes/s over %.3f s\n",
+           seconds > 0 ? (double) latencies.size() / seconds : 0.0, seconds);
+    printf("latency us   p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+           percentile(latencies, 50), percentile(latencies, 90),
+           percentile(latencies, 99), latencies.empty() ? 0.0 : latencies.back());
+    return 0;
+}
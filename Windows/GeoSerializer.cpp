@@ -0,0 +1,233 @@
+#include "GeoSerializer.h"
+
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+namespace GeoLocation {
+
+    namespace {
+
+        class BufferWriter {
+        public:
+            BufferWriter(char *buffer, size_t size) : m_buffer(buffer), m_size(size) {}
+
+            void put(char c) {
+                if (m_length < m_size)
+                    m_buffer[m_length] = c;
+                m_length++;
+            }
+
+            void put(const char *data, size_t length) {
+                if (m_length < m_size)
+                    memcpy(m_buffer + m_length, data, std::min(length, m_size - m_length));
+                m_length += length;
+            }
+
+            template<size_t N>
+            void literal(const char (&text)[N]) {
+                put(text, N - 1);
+            }
+
+            void string(std::string_view value) {
+                static const char hex[] = "0123456789abcdef";
+
+                put('"');
+                for (unsigned char c : value) {
+                    switch (c) {
+                        case '"':
+                            literal("\\\"");
+                            break;
+                        case '\\':
+                            literal("\\\\");
+                            break;
+                        case '\b':
+                            literal("\\b");
+                            break;
+                        case '\f':
+                            literal("\\f");
+                            break;
+                        case '\n':
+                            literal("\\n");
+                            break;
+                        case '\r':
+                            literal("\\r");
+                            break;
+                        case '\t':
+                            literal("\\t");
+                            break;
+                        default:
+                            if (c < 0x20) {
+                                char escaped[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+                                put(escaped, sizeof(escaped));
+                            } else {
+                                put((char) c);
+                            }
+                    }
+                }
+                put('"');
+            }
+
+            // Shortest round-trip digits, laid out like json::dump(): plain
+            // decimals (with ".0" if integral) for exponents from -4 to 15,
+            // d.ddde+XX otherwise, and null for non-finite values.
+            void number(double value) {
+                if (!std::isfinite(value)) {
+                    literal("null");
+                    return;
+                }
+                if (value == 0.0) {
+                    if (std::signbit(value))
+                        put('-');
+                    literal("0.0");
+                    return;
+                }
+
+                // "-d.ddde-XX" from to_chars gives the digits and exponent.
+                char scientific[32];
+                auto result = std::to_chars(scientific, scientific + sizeof(scientific), value,
+                                            std::chars_format::scientific);
+                const char *p = scientific;
+                if (*p == '-') {
+                    put('-');
+                    p++;
+                }
+                const char *e = static_cast<const char *>(memchr(p, 'e', result.ptr - p));
+                char digits[20];
+                int k = 0;
+                for (const char *d = p; d < e; d++) {
+                    if (*d != '.')
+                        digits[k++] = *d;
+                }
+                // to_chars does not NUL-terminate, so no atoi() here.
+                int exponent = 0;
+                for (const char *d = e + 2; d < result.ptr; d++)
+                    exponent = exponent * 10 + (*d - '0');
+                if (e[1] == '-')
+                    exponent = -exponent;
+                // Decimal point position: value = 0.digits * 10^n.
+                int n = exponent + 1;
+
+                if (k <= n && n <= 15) {
+                    put(digits, k);
+                    for (int i = k; i < n; i++)
+                        put('0');
+                    literal(".0");
+                } else if (0 < n && n <= 15) {
+                    put(digits, n);
+                    put('.');
+                    put(digits + n, k - n);
+                } else if (-4 < n && n <= 0) {
+                    literal("0.");
+                    for (int i = n; i < 0; i++)
+                        put('0');
+                    put(digits, k);
+                } else {
+                    put(digits[0]);
+                    if (k > 1) {
+                        put('.');
+                        put(digits + 1, k - 1);
+                    }
+                    put('e');
+                    put(exponent < 0 ? '-' : '+');
+                    exponent = std::abs(exponent);
+                    if (exponent < 10)
+                        put('0');
+                    char exponentDigits[4];
+                    auto end = std::to_chars(exponentDigits, exponentDigits + sizeof(exponentDigits), exponent);
+                    put(exponentDigits, end.ptr - exponentDigits);
+                }
+            }
+
+            void number(int64_t value) {
+                char digits[24];
+                auto result = std::to_chars(digits, digits + sizeof(digits), value);
+                put(digits, result.ptr - digits);
+            }
+
+            [[nodiscard]] size_t length() const { return m_length; }
+
+        private:
+            char *m_buffer;
+            size_t m_size;
+            size_t m_length = 0;
+        };
+
+        uint8_t *putLittleEndian(uint8_t *out, uint64_t value) {
+            for (int i = 0; i < 8; i++)
+                *out++ = (uint8_t) (value >> (8 * i));
+            return out;
+        }
+
+        uint8_t *putDouble(uint8_t *out, double value) {
+            uint64_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            return putLittleEndian(out, bits);
+        }
+    }
+
+    size_t writeCompactJson(const GeoCoordinate &coordinate, char *buffer, size_t size) {
+        const Info &info = coordinate.getInfo();
+        BufferWriter out(buffer, size);
+
+        // Keys in the order json::dump() emits them.
+        out.literal("{\"cpuid\":");
+        out.string(coordinate.getCpuid());
+        out.literal(",\"info\":{\"altitude\":");
+        out.number(info.getAltitude());
+        out.literal(",\"course\":");
+        out.number(info.getCourse());
+        out.literal(",\"format_timestamp\":");
+        out.string(info.getFormatTimestamp());
+        out.literal(",\"horizontal_accuracy\":");
+        out.number(info.getHorizontalAccuracy());
+        out.literal(",\"intervals\":");
+        out.number(info.getIntervals());
+        out.literal(",\"latitude\":");
+        out.number(info.getLatitude());
+        out.literal(",\"longitude\":");
+        out.number(info.getLongitude());
+        out.literal(",\"speed\":");
+        out.number(info.getSpeed());
+        out.literal(",\"timestamp\":");
+        out.number(info.getTimestamp());
+        out.literal(",\"vertical_accuracy\":");
+        out.number(info.getVerticalAccuracy());
+        out.literal("},\"software_ver\":");
+        out.string(coordinate.getSoftwareVer());
+        out.put('}');
+
+        return out.length();
+    }
+
+    size_t writeBinaryRecord(const GeoCoordinate &coordinate, uint8_t *buffer, size_t size) {
+        if (buffer == nullptr || size < kBinaryRecordSize)
+            return 0;
+
+        const Info &info = coordinate.getInfo();
+        uint8_t *out = buffer;
+
+        *out++ = 'G';
+        *out++ = 'C';
+        *out++ = kBinaryRecordVersion;
+        *out++ = 0;
+        out = putDouble(out, info.getLatitude());
+        out = putDouble(out, info.getLongitude());
+        out = putDouble(out, info.getAltitude());
+        out = putDouble(out, info.getHorizontalAccuracy());
+        out = putDouble(out, info.getVerticalAccuracy());
+        out = putDouble(out, info.getSpeed());
+        out = putDouble(out, info.getCourse());
+        out = putLittleEndian(out, (uint64_t) info.getTimestamp());
+        out = putLittleEndian(out, (uint64_t) info.getIntervals());
+
+        const std::string &cpuid = coordinate.getCpuid();
+        size_t cpuidLength = std::min(cpuid.size(), (size_t) 16);
+        memset(out, 0, 16);
+        memcpy(out, cpuid.data(), cpuidLength);
+        out += 16;
+
+        return out - buffer;
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "GeoStruct.h"
+
+namespace GeoLocation {
+
+    // Writes the document of GeoCoordinate::toJson() as json::dump() without
+    // indentation would, but without building a json tree, into buffer.
+    // Numbers are the shortest digits that round-trip; on the rare values
+    // where dump()'s Grisu2 picks longer digits, the JSON values still compare
+    // equal. Returns the length of the full document; if that is larger than
+    // size, the output was truncated. The output is not NUL-terminated.
+    size_t writeCompactJson(const GeoCoordinate &coordinate, char *buffer, size_t size);
+
+    // Fixed-layout little-endian record:
+    //   0  char[2]  magic "GC"
+    //   2  uint8    version (kBinaryRecordVersion)
+    //   3  uint8    reserved, 0
+    //   4  double   latitude, longitude, altitude, horizontal accuracy,
+    //               vertical accuracy, speed, course
+    //  60  int64    timestamp (ms since the Unix epoch), intervals
+    //  76  char[16] cpuid, zero-padded
+    // The formatted timestamp and software version are not included.
+    constexpr uint8_t kBinaryRecordVersion = 1;
+    constexpr size_t kBinaryRecordSize = 92;
+
+    // Returns kBinaryRecordSize, or 0 without writing anything if size is too
+    // small.
+    size_t writeBinaryRecord(const GeoCoordinate &coordinate, uint8_t *buffer, size_t size);
+}
@@ -1,10 +1,20 @@
 #pragma once
 
 #include "json.hpp"
+#include "TimestampFormatter.h"
 
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
 #include <optional>
 #include <stdexcept>
 #include <regex>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <cpuid.h>
+#endif
 
 namespace GeoLocation {
     using nlohmann::json;
@@ -29,7 +39,9 @@ namespace GeoLocation {
     private:
         double altitude = 0.0;
         double course = 0.0;
-        std::string formatTimestamp;
+        // Fixed size, as a 19 character std::string doesn't fit the small
+        // string buffer and would cost an allocation per fix and per copy.
+        char formatTimestamp[TimestampFormatter::kLength + 1] = {};
         double horizontalAccuracy = 0.0;
         double latitude = 0.0;
         double longitude = 0.0;
@@ -51,11 +63,16 @@ namespace GeoLocation {
 
         void setCourse(const double &value) { this->course = value; }
 
-        [[nodiscard]] const std::string &getFormatTimestamp() const { return formatTimestamp; }
+        [[nodiscard]] std::string_view getFormatTimestamp() const { return formatTimestamp; }
 
-        std::string &getMutableFormatTimestamp() { return formatTimestamp; }
+        // Room for TimestampFormatter::kLength characters and the NUL.
+        char *getMutableFormatTimestamp() { return formatTimestamp; }
 
-        void setFormatTimestamp(const std::string &value) { this->formatTimestamp = value; }
+        // Longer values are cut at TimestampFormatter::kLength characters.
+        void setFormatTimestamp(std::string_view value) {
+            size_t length = value.copy(formatTimestamp, TimestampFormatter::kLength);
+            formatTimestamp[length] = '\0';
+        }
 
         [[nodiscard]] const double &getHorizontalAccuracy() const { return horizontalAccuracy; }
 
@@ -103,7 +120,7 @@ namespace GeoLocation {
             json j = json::object();
             j["altitude"] = this->getAltitude();
             j["course"] = this->getCourse();
-            j["format_timestamp"] = this->getFormatTimestamp();
+            j["format_timestamp"] = std::string(this->getFormatTimestamp());
             j["horizontal_accuracy"] = this->getHorizontalAccuracy();
             j["latitude"] = this->getLatitude();
             j["longitude"] = this->getLongitude();
@@ -116,6 +133,59 @@ namespace GeoLocation {
 
     };
 
+    // Reads the processor signature and feature flags. CPUID is a serializing
+    // instruction and may trap under virtualization, so use getDeviceId().
+    inline std::string readCpuId() {
+        char pCpuId[32] = "";
+        int dwBuf[4] = {0};
+        #if defined(__GNUC__)
+        #if defined(__i386__) || defined(__x86_64__)
+                    __get_cpuid(1, (unsigned int *) &dwBuf[0], (unsigned int *) &dwBuf[1],
+                                (unsigned int *) &dwBuf[2], (unsigned int *) &dwBuf[3]);
+        #endif
+        #elif defined(_MSC_VER)
+        #if defined(_MSC_VER)
+        #if defined(_WIN64)
+                    __cpuidex((int *) (void *) (unsigned int *) dwBuf, 1, 0);
+        #else
+            auto* CPUInfo = (unsigned int *) dwBuf;
+            if (nullptr == CPUInfo)
+                throw std::exception("CPUInfo is nullptr");
+            _asm {
+                mov edi, CPUInfo;
+                mov eax, 1;
+                mov ecx, 0;
+                cpuid;
+                mov[edi], eax;
+                mov[edi + 4], ebx;
+                mov[edi + 8], ecx;
+                mov[edi + 12], edx;
+            }
+        #endif
+        #endif
+        #endif
+        sprintf(pCpuId, "%08X", dwBuf[3]);
+        sprintf(pCpuId + 8, "%08X", dwBuf[0]);
+        return pCpuId;
+    }
+
+    // The identity of this device, computed once per process.
+    inline const std::string &getDeviceId() {
+        static const std::string deviceId = readCpuId();
+        return deviceId;
+    }
+
+    // Returns a process-lifetime copy of value, shared by all coordinates
+    // carrying the same id.
+    inline const std::string &internDeviceId(const std::string &value) {
+        if (value == getDeviceId())
+            return getDeviceId();
+        static std::mutex mutex;
+        static std::unordered_set<std::string> ids;
+        std::lock_guard<std::mutex> lock(mutex);
+        return *ids.insert(value).first;
+    }
+
     class GeoCoordinate {
     public:
         GeoCoordinate() = default;
@@ -123,47 +193,14 @@ namespace GeoLocation {
         virtual ~GeoCoordinate() = default;
 
     private:
-        std::string cpuid = getCpuId();
+        const std::string *cpuid = &getDeviceId();
         Info info;
         std::string softwareVer = "V1.0.0";
 
-        static std::string getCpuId() {
-            char pCpuId[32] = "";
-            int dwBuf[4];
-            #if defined(__GNUC__)
-                        __cpuid(InfoType, CPUInfo[0], CPUInfo[1], CPUInfo[2], CPUInfo[3]);
-            #elif defined(_MSC_VER)
-            #if defined(_MSC_VER)
-            #if defined(_WIN64)
-                        __cpuidex((int *) (void *) (unsigned int *) dwBuf, 1, 0);
-            #else
-                auto* CPUInfo = (unsigned int *) dwBuf;
-                if (nullptr == CPUInfo)
-                    throw std::exception("CPUInfo is nullptr");
-                _asm {
-                    mov edi, CPUInfo;
-                    mov eax, 1;
-                    mov ecx, 0;
-                    cpuid;
-                    mov[edi], eax;
-                    mov[edi + 4], ebx;
-                    mov[edi + 8], ecx;
-                    mov[edi + 12], edx;
-                }
-            #endif
-            #endif
-            #endif
-            sprintf(pCpuId, "%08X", dwBuf[3]);
-            sprintf(pCpuId + 8, "%08X", dwBuf[0]);
-            return pCpuId;
-        }
-
     public:
-        [[nodiscard]] const std::string &getCpuid() const { return cpuid; }
-
-        std::string &getMutableCpuid() { return cpuid; }
+        [[nodiscard]] const std::string &getCpuid() const { return *cpuid; }
 
-        void setCpuid(const std::string &value) { this->cpuid = value; }
+        void setCpuid(const std::string &value) { this->cpuid = &internDeviceId(value); }
 
         [[nodiscard]] const Info &getInfo() const { return info; }
 
@@ -6,9 +6,7 @@
 #include <locationapi.h>
 #include <sensors.h>
 #include <propvarutil.h>
-#include <ctime>
-#include <chrono>
-#include "GeoStruct.h"
+#include "LocationProvider.h"
 #pragma comment( lib, "propsys.lib" )
 #pragma comment( lib, "locationapi.lib")
 
@@ -19,7 +17,7 @@ class CLocationEvents :
     public ILocationEvents
 {
 public:
-    CLocationEvents() : m_previousTime(0) {}
+    CLocationEvents() : m_sink(nullptr) {}
 
     virtual ~CLocationEvents() = default;
 
@@ -32,8 +30,10 @@ public:
     STDMETHOD(OnLocationChanged)(__RPC__in REFIID reportType, __RPC__in_opt ILocationReport* pLocationReport);
     STDMETHOD(OnStatusChanged)(__RPC__in REFIID reportType, LOCATION_REPORT_STATUS status);
 
+    void setSink(LocationSink *sink) { m_sink = sink; }
+
 private:
 
-    int64_t m_previousTime;
+    LocationSink *m_sink;
 
 };
\ No newline at end of file
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+namespace GeoLocation {
+
+    enum class ProviderStatus {
+        NotSupported,
+        Error,
+        AccessDenied,
+        Initializing,
+        Running
+    };
+
+    // A fix as delivered by a provider, before any unit conversion.
+    struct RawReport {
+        double latitude = 0.0;
+        double longitude = 0.0;
+        double altitude = 0.0;
+        double errorRadius = 0.0;
+        double altitudeError = 0.0;
+        std::optional<double> headingDegrees;
+        std::optional<double> speedKnots;
+        // Provider timestamp in FILETIME units (100ns ticks since 1601-01-01 UTC).
+        std::optional<int64_t> fileTime;
+    };
+
+    class LocationSink {
+    public:
+        virtual ~LocationSink() = default;
+
+        virtual void onReport(const RawReport &report) = 0;
+
+        virtual void onStatus(ProviderStatus status) = 0;
+    };
+
+    class LocationProvider {
+    public:
+        virtual ~LocationProvider() = default;
+
+        // Starts delivering reports to sink. The sink must outlive the provider
+        // or a later stop() call.
+        virtual bool start(bool isHighAccuracy, LocationSink *sink) = 0;
+
+        virtual void stop() = 0;
+    };
+}
@@ -0,0 +1,319 @@
+#include "ReplayLocationProvider.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <utility>
+#include "GeoStruct.h"
+#include "TimestampFormatter.h"
+
+namespace GeoLocation {
+
+    namespace {
+
+        const double kMetresPerSecondToKnots = 900.0 / 463.0;
+
+        // Same estimate as geoclue's get_accuracy_from_hdop().
+        double accuracyFromHdop(double hdop) {
+            if (hdop <= 1)
+                return 0;
+            else if (hdop <= 2)
+                return 1;
+            else if (hdop <= 5)
+                return 3;
+            else if (hdop <= 10)
+                return 50;
+            else if (hdop <= 20)
+                return 100;
+            else
+                return 300;
+        }
+
+        // False if key is there but not a number; json::value() would throw.
+        template<typename N>
+        bool numberField(const json &info, const char *key, N *value) {
+            auto it = info.find(key);
+            if (it == info.end())
+                return true;
+            if (!it->is_number())
+                return false;
+            *value = it->get<N>();
+            return true;
+        }
+
+        bool parseReportJson(const std::string &line, RawReport *report) {
+            json document = json::parse(line, nullptr, false);
+            if (document.is_discarded() || !document.is_object())
+                return false;
+
+            const json &info = document.contains("info") ? document["info"] : document;
+            if (!info.is_object() || !info.contains("latitude") || !info.contains("longitude"))
+                return false;
+
+            double course = 0.0, speed = 0.0;
+            int64_t timestamp = 0;
+            if (!numberField(info, "latitude", &report->latitude) ||
+                !numberField(info, "longitude", &report->longitude) ||
+                !numberField(info, "altitude", &report->altitude) ||
+                !numberField(info, "horizontal_accuracy", &report->errorRadius) ||
+                !numberField(info, "vertical_accuracy", &report->altitudeError) ||
+                !numberField(info, "course", &course) ||
+                !numberField(info, "speed", &speed) ||
+                !numberField(info, "timestamp", &timestamp))
+                return false;
+
+            if (info.contains("course"))
+                report->headingDegrees = course;
+            if (info.contains("speed"))
+                report->speedKnots = speed * kMetresPerSecondToKnots;
+            if (info.contains("timestamp"))
+                report->fileTime = UnixMillisToFileTime(timestamp);
+            return true;
+        }
+
+        std::vector<std::string> splitFields(const std::string &sentence) {
+            std::vector<std::string> fields;
+            size_t start = 0;
+            for (;;) {
+                size_t comma = sentence.find(',', start);
+                fields.push_back(sentence.substr(start, comma - start));
+                if (comma == std::string::npos)
+                    return fields;
+                start = comma + 1;
+            }
+        }
+
+        // Strips "$" and "*hh", checking the checksum if there is one.
+        bool nmeaBody(const std::string &line, std::string *body) {
+            size_t end = line.find_last_not_of("\r\n");
+            if (line.empty() || line[0] != '$' || end == std::string::npos)
+                return false;
+
+            size_t star = line.find('*');
+            if (star == std::string::npos) {
+                *body = line.substr(1, end);
+                return true;
+            }
+            if (star + 2 > end)
+                return false;
+
+            unsigned checksum = 0;
+            for (size_t i = 1; i < star; i++)
+                checksum ^= (unsigned char) line[i];
+            if (strtoul(line.substr(star + 1, 2).c_str(), nullptr, 16) != checksum)
+                return false;
+
+            *body = line.substr(1, star - 1);
+            return true;
+        }
+
+        // ddmm.mmmm / dddmm.mmmm plus hemisphere.
+        bool parseCoordinate(const std::string &value, const std::string &hemisphere, double *degrees) {
+            if (value.empty() || hemisphere.empty())
+                return false;
+            double raw = strtod(value.c_str(), nullptr);
+            double whole = std::floor(raw / 100.0);
+            *degrees = whole + (raw - whole * 100.0) / 60.0;
+            if (hemisphere[0] == 'S' || hemisphere[0] == 'W')
+                *degrees = -*degrees;
+            return true;
+        }
+
+        // hhmmss.sss as milliseconds of the day.
+        bool parseTimeOfDay(const std::string &value, int64_t *millis) {
+            if (value.size() < 6)
+                return false;
+            int hours = atoi(value.substr(0, 2).c_str());
+            int minutes = atoi(value.substr(2, 2).c_str());
+            double seconds = strtod(value.c_str() + 4, nullptr);
+            *millis = (hours * 3600 + minutes * 60) * 1000LL + (int64_t) std::llround(seconds * 1000.0);
+            return true;
+        }
+
+        // ddmmyy as days since the Unix epoch.
+        bool parseDate(const std::string &value, int64_t *days) {
+            if (value.size() != 6)
+                return false;
+            unsigned day = (unsigned) atoi(value.substr(0, 2).c_str());
+            unsigned month = (unsigned) atoi(value.substr(2, 2).c_str());
+            int year = atoi(value.substr(4, 2).c_str());
+            year += year < 80 ? 2000 : 1900;
+            *days = DaysFromCivil(year, month, day);
+            return true;
+        }
+
+        class NmeaAssembler {
+        public:
+            explicit NmeaAssembler(std::vector<RawReport> *reports) : m_reports(reports) {}
+
+            void add(const std::string &body) {
+                std::vector<std::string> fields = splitFields(body);
+                if (fields[0].size() < 5)
+                    return;
+                std::string type = fields[0].substr(fields[0].size() - 3);
+
+                if (type == "GGA" && fields.size() > 9)
+                    addGga(fields);
+                else if (type == "RMC" && fields.size() > 9)
+                    addRmc(fields);
+            }
+
+            void flush() {
+                if (m_hasPosition) {
+                    if (m_timeOfDay >= 0)
+                        m_current.fileTime = UnixMillisToFileTime(m_day * 86400000LL + m_timeOfDay);
+                    m_reports->push_back(m_current);
+                }
+                m_current = RawReport();
+                m_hasPosition = false;
+            }
+
+        private:
+            // A new epoch starts when the UTC time changes. Without a date
+            // from RMC, time going backwards means the next day.
+            void beginEpoch(const std::string &time, const int64_t *day = nullptr) {
+                int64_t timeOfDay;
+                if (!parseTimeOfDay(time, &timeOfDay))
+                    return;
+                if (timeOfDay != m_timeOfDay) {
+                    flush();
+                    if (day == nullptr && timeOfDay < m_timeOfDay)
+                        m_day++;
+                    m_timeOfDay = timeOfDay;
+                }
+                // Only once the previous epoch went out with its own date.
+                if (day != nullptr)
+                    m_day = *day;
+            }
+
+            void addGga(const std::vector<std::string> &fields) {
+                if (fields[6].empty() || fields[6] == "0")
+                    return;
+                beginEpoch(fields[1]);
+                if (!parseCoordinate(fields[2], fields[3], &m_current.latitude) ||
+                    !parseCoordinate(fields[4], fields[5], &m_current.longitude))
+                    return;
+                if (!fields[8].empty())
+                    m_current.errorRadius = accuracyFromHdop(strtod(fields[8].c_str(), nullptr));
+                if (!fields[9].empty())
+                    m_current.altitude = strtod(fields[9].c_str(), nullptr);
+                m_hasPosition = true;
+            }
+
+            void addRmc(const std::vector<std::string> &fields) {
+                if (fields[2] != "A")
+                    return;
+                int64_t day;
+                beginEpoch(fields[1], parseDate(fields[9], &day) ? &day : nullptr);
+                if (!parseCoordinate(fields[3], fields[4], &m_current.latitude) ||
+                    !parseCoordinate(fields[5], fields[6], &m_current.longitude))
+                    return;
+                if (!fields[7].empty())
+                    m_current.speedKnots = strtod(fields[7].c_str(), nullptr);
+                if (!fields[8].empty())
+                    m_current.headingDegrees = strtod(fields[8].c_str(), nullptr);
+                m_hasPosition = true;
+            }
+
+            std::vector<RawReport> *m_reports;
+            RawReport m_current;
+            bool m_hasPosition = false;
+            int64_t m_day = 0;
+            int64_t m_timeOfDay = -1;
+        };
+    }
+
+    ReplayLocationProvider::ReplayLocationProvider(std::vector<RawReport> reports, double rate)
+        : m_reports(std::make_shared<const std::vector<RawReport>>(std::move(reports))), m_rate(rate) {}
+
+    ReplayLocationProvider::~ReplayLocationProvider() {
+        stop();
+    }
+
+    bool ReplayLocationProvider::start([[maybe_unused]] bool isHighAccuracy, LocationSink *sink) {
+        if (sink == nullptr || m_thread.joinable())
+            return false;
+
+        m_stopped = std::make_shared<std::atomic<bool>>(false);
+        m_thread = std::thread(&ReplayLocationProvider::run, m_reports, m_rate, m_stopped, sink);
+        return true;
+    }
+
+    void ReplayLocationProvider::stop() {
+        if (m_stopped)
+            *m_stopped = true;
+        wait();
+    }
+
+    void ReplayLocationProvider::wait() {
+        if (!m_thread.joinable())
+            return;
+        if (m_thread.get_id() == std::this_thread::get_id())
+            m_thread.detach();
+        else
+            m_thread.join();
+    }
+
+    void ReplayLocationProvider::run(std::shared_ptr<const std::vector<RawReport>> reports, double rate,
+                                     std::shared_ptr<std::atomic<bool>> stopped, LocationSink *sink) {
+        sink->onStatus(ProviderStatus::Initializing);
+        sink->onStatus(ProviderStatus::Running);
+
+        auto start = std::chrono::steady_clock::now();
+        std::optional<int64_t> firstFileTime;
+        for (const auto &report : *reports) {
+            if (*stopped)
+                break;
+
+            if (rate > 0.0 && report.fileTime) {
+                if (!firstFileTime)
+                    firstFileTime = report.fileTime;
+                // FILETIME ticks are 100ns.
+                auto offset = std::chrono::duration<double, std::micro>((*report.fileTime - *firstFileTime) / 10.0 / rate);
+                std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(offset));
+            }
+            sink->onReport(report);
+        }
+    }
+
+    std::vector<RawReport> ReplayLocationProvider::LoadJsonLines(std::istream &in) {
+        std::vector<RawReport> reports;
+        std::string line;
+        while (std::getline(in, line)) {
+            RawReport report;
+            if (parseReportJson(line, &report))
+                reports.push_back(report);
+        }
+        return reports;
+    }
+
+    std::vector<RawReport> ReplayLocationProvider::LoadNmea(std::istream &in) {
+        std::vector<RawReport> reports;
+        NmeaAssembler assembler(&reports);
+        std::string line, body;
+        while (std::getline(in, line)) {
+            if (nmeaBody(line, &body))
+                assembler.add(body);
+        }
+        assembler.flush();
+        return reports;
+    }
+
+    std::vector<RawReport> ReplayLocationProvider::LoadFile(const std::string &path) {
+        std::ifstream in(path);
+        std::string line;
+        while (in && in.peek() != EOF) {
+            int c = in.peek();
+            if (c == '\n' || c == '\r' || c == ' ' || c == '\t') {
+                in.get();
+                continue;
+            }
+            if (c == '$')
+                return LoadNmea(in);
+            return LoadJsonLines(in);
+        }
+        return {};
+    }
+}
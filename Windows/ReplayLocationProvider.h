@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <istream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "LocationProvider.h"
+
+namespace GeoLocation {
+
+    // Feeds recorded reports to the sink from its own thread, like the Windows
+    // Location API does. Stands in for it off Windows and in benchmarks.
+    class ReplayLocationProvider : public LocationProvider {
+    public:
+        // rate scales the recorded time between reports: 1.0 replays in real
+        // time, 2.0 twice as fast, 0 as fast as possible.
+        explicit ReplayLocationProvider(std::vector<RawReport> reports, double rate = 0.0);
+
+        ~ReplayLocationProvider() override;
+
+        bool start(bool isHighAccuracy, LocationSink *sink) override;
+
+        void stop() override;
+
+        // Blocks until every report has been delivered or stop() was called.
+        // From a sink callback, which runs on the replay thread, it detaches
+        // the thread instead: it ends once the callback returns, and the
+        // provider may be started again or destroyed right away.
+        void wait();
+
+        // One Info or GeoCoordinate JSON document per line, as written by
+        // toJson() or writeCompactJson(). Unparsable lines are skipped.
+        static std::vector<RawReport> LoadJsonLines(std::istream &in);
+
+        // GGA and RMC sentences from any talker; sentences sharing a UTC time
+        // make up one report. Sentences with a bad checksum are skipped.
+        static std::vector<RawReport> LoadNmea(std::istream &in);
+
+        // Picks the format from the first non-empty line.
+        static std::vector<RawReport> LoadFile(const std::string &path);
+
+    private:
+        // Only touches what it was handed, not the provider, so a detached
+        // thread can outlive it.
+        static void run(std::shared_ptr<const std::vector<RawReport>> reports, double rate,
+                        std::shared_ptr<std::atomic<bool>> stopped, LocationSink *sink);
+
+        std::shared_ptr<const std::vector<RawReport>> m_reports;
+        double m_rate;
+        // One per start(), so restarting doesn't revive a detached thread.
+        std::shared_ptr<std::atomic<bool>> m_stopped;
+        std::thread m_thread;
+    };
+}
@@ -0,0 +1,52 @@
+#include "ReportNormalizer.h"
+
+#include <chrono>
+
+namespace GeoLocation {
+
+    const double kKnotsToMetresPerSecondConversionFactor = 463.0 / 900.0;
+
+    void ConvertKnotsToMetresPerSecond(double *knots) {
+        *knots *= kKnotsToMetresPerSecondConversionFactor;
+    }
+
+    int64_t GetUnixTime() {
+        int64_t times = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        return times;
+    }
+
+    GeoCoordinate ReportNormalizer::normalize(const RawReport &report) {
+        int64_t diffTime = 0;
+        int64_t unixTime;
+        if (report.fileTime) {
+            int64_t currentTime = *report.fileTime;
+            diffTime = (currentTime > m_previousTime) ? (currentTime - m_previousTime) : 0;
+            if (m_previousTime == 0) diffTime = 0;
+            m_previousTime = currentTime;
+            unixTime = FileTimeToUnixMillis(currentTime);
+        } else {
+            unixTime = GetUnixTime();
+        }
+
+        double speed = 0.0;
+        if (report.speedKnots) {
+            speed = *report.speedKnots;
+            ConvertKnotsToMetresPerSecond(&speed);
+        }
+
+        GeoCoordinate geoCoordinate;
+        Info &info = geoCoordinate.getMutableInfo();
+        info.setLatitude(report.latitude);
+        info.setLongitude(report.longitude);
+        info.setAltitude(report.altitude);
+        info.setHorizontalAccuracy(report.errorRadius);
+        info.setVerticalAccuracy(report.altitudeError);
+        info.setSpeed(speed);
+        info.setCourse(report.headingDegrees.value_or(0.0));
+        info.setIntervals(diffTime);
+        info.setTimestamp(unixTime);
+        m_formatter.format(unixTime >= 0 ? unixTime / 1000 : (unixTime - 999) / 1000,
+                           info.getMutableFormatTimestamp());
+        return geoCoordinate;
+    }
+}
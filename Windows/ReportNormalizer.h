@@ -0,0 +1,24 @@
+#pragma once
+
+#include "GeoStruct.h"
+#include "LocationProvider.h"
+#include "TimestampFormatter.h"
+
+namespace GeoLocation {
+
+    void ConvertKnotsToMetresPerSecond(double *knots);
+
+    int64_t GetUnixTime();
+
+    // Turns provider reports into GeoCoordinates. Keeps the timestamp of the
+    // previous report to fill in Info::intervals, so use one per report stream.
+    // The timestamps come from the report itself when the provider has one.
+    class ReportNormalizer {
+    public:
+        GeoCoordinate normalize(const RawReport &report);
+
+    private:
+        int64_t m_previousTime = 0;
+        TimestampFormatter m_formatter;
+    };
+}
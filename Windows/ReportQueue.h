@@ -0,0 +1,213 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace GeoLocation {
+
+    enum class OverflowPolicy {
+        // Discard the oldest queued report to make room; the consumer always
+        // catches up with the most recent fixes.
+        DropOldest,
+        // Discard the incoming report.
+        DropNewest
+    };
+
+    struct ReportQueueStats {
+        uint64_t pushed = 0;
+        uint64_t dropped = 0;
+        uint64_t dispatched = 0;
+    };
+
+    // Bounded single-producer/single-consumer ring. Each slot carries a
+    // sequence number, so under DropOldest the producer can take the oldest
+    // slot away from the consumer without either side locking or reading a
+    // slot the other is writing.
+    template<typename T>
+    class ReportQueue {
+    public:
+        explicit ReportQueue(size_t capacity, OverflowPolicy policy = OverflowPolicy::DropOldest)
+            : m_capacity(capacity < 2 ? 2 : capacity), m_policy(policy),
+              m_slots(new Slot[m_capacity]) {
+            for (size_t i = 0; i < m_capacity; i++)
+                m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        ReportQueue(const ReportQueue &) = delete;
+
+        ReportQueue &operator=(const ReportQueue &) = delete;
+
+        // Producer side. Returns false if value itself was dropped.
+        bool push(const T &value) {
+            m_pushed.fetch_add(1, std::memory_order_relaxed);
+            for (;;) {
+                size_t pos = m_tail.load(std::memory_order_relaxed);
+                Slot &slot = m_slots[pos % m_capacity];
+                size_t sequence = slot.sequence.load(std::memory_order_acquire);
+
+                if (sequence == pos) {
+                    slot.value = value;
+                    m_tail.store(pos + 1, std::memory_order_relaxed);
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+
+                // Full: the slot still holds the report from one lap ago.
+                if (m_policy == OverflowPolicy::DropNewest) {
+                    m_dropped.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+
+                // Take that report away from the consumer. If the consumer
+                // has just claimed it, wait for it to hand the slot back
+                // rather than dropping a second report.
+                size_t oldest = pos - m_capacity;
+                if (sequence == oldest + 1 &&
+                    m_head.compare_exchange_strong(oldest, oldest + 1, std::memory_order_acq_rel)) {
+                    slot.value = value;
+                    m_tail.store(pos + 1, std::memory_order_relaxed);
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    m_dropped.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+                std::this_thread::yield();
+            }
+        }
+
+        // Consumer side.
+        bool pop(T &value) {
+            if (!take(value))
+                return false;
+            m_dispatched.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        [[nodiscard]] bool empty() const {
+            size_t pos = m_head.load(std::memory_order_seq_cst);
+            return m_slots[pos % m_capacity].sequence.load(std::memory_order_seq_cst) != pos + 1;
+        }
+
+        [[nodiscard]] size_t capacity() const { return m_capacity; }
+
+        [[nodiscard]] ReportQueueStats stats() const {
+            ReportQueueStats stats;
+            stats.pushed = m_pushed.load(std::memory_order_relaxed);
+            stats.dropped = m_dropped.load(std::memory_order_relaxed);
+            stats.dispatched = m_dispatched.load(std::memory_order_relaxed);
+            return stats;
+        }
+
+    private:
+        struct Slot {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+
+        bool take(T &value) {
+            size_t pos = m_head.load(std::memory_order_relaxed);
+            for (;;) {
+                Slot &slot = m_slots[pos % m_capacity];
+                size_t sequence = slot.sequence.load(std::memory_order_acquire);
+
+                if (sequence < pos + 1)
+                    return false;
+                if (sequence == pos + 1 &&
+                    m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = std::move(slot.value);
+                    slot.sequence.store(pos + m_capacity, std::memory_order_release);
+                    return true;
+                }
+                if (sequence != pos + 1)
+                    pos = m_head.load(std::memory_order_relaxed);
+            }
+        }
+
+        const size_t m_capacity;
+        const OverflowPolicy m_policy;
+        std::unique_ptr<Slot[]> m_slots;
+        alignas(64) std::atomic<size_t> m_head{0};
+        alignas(64) std::atomic<size_t> m_tail{0};
+        alignas(64) std::atomic<uint64_t> m_pushed{0};
+        std::atomic<uint64_t> m_dropped{0};
+        std::atomic<uint64_t> m_dispatched{0};
+    };
+
+    // Runs a consumer thread that drains a ReportQueue into handler. The
+    // producer only takes the mutex for the first report after the consumer
+    // went to sleep.
+    template<typename T>
+    class ReportDispatcher {
+    public:
+        ReportDispatcher(size_t capacity, OverflowPolicy policy, std::function<void(T &)> handler)
+            : m_queue(capacity, policy), m_handler(std::move(handler)) {
+            m_thread = std::thread(&ReportDispatcher::run, this);
+        }
+
+        ~ReportDispatcher() { stop(); }
+
+        ReportDispatcher(const ReportDispatcher &) = delete;
+
+        ReportDispatcher &operator=(const ReportDispatcher &) = delete;
+
+        bool post(const T &value) {
+            bool queued = m_queue.push(value);
+            // Pairs with the fence in run(): either we see the consumer
+            // asleep, or it sees the report. The push alone is only a
+            // release store, which may pass the load below.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (m_sleeping.load(std::memory_order_seq_cst) &&
+                m_sleeping.exchange(false, std::memory_order_seq_cst)) {
+                { std::lock_guard<std::mutex> lock(m_mutex); }
+                m_wakeup.notify_one();
+            }
+            return queued;
+        }
+
+        // Delivers what is still queued, then joins the consumer thread.
+        void stop() {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_stopping)
+                    return;
+                m_stopping = true;
+            }
+            m_wakeup.notify_one();
+            if (m_thread.joinable())
+                m_thread.join();
+        }
+
+        [[nodiscard]] ReportQueueStats stats() const { return m_queue.stats(); }
+
+    private:
+        void run() {
+            T value;
+            for (;;) {
+                while (m_queue.pop(value))
+                    m_handler(value);
+
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_sleeping.store(true, std::memory_order_seq_cst);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                m_wakeup.wait(lock, [this] { return m_stopping || !m_queue.empty(); });
+                m_sleeping.store(false, std::memory_order_relaxed);
+                if (m_stopping && m_queue.empty())
+                    return;
+            }
+        }
+
+        ReportQueue<T> m_queue;
+        std::function<void(T &)> m_handler;
+        std::mutex m_mutex;
+        std::condition_variable m_wakeup;
+        std::atomic<bool> m_sleeping{false};
+        bool m_stopping = false;
+        std::thread m_thread;
+    };
+}
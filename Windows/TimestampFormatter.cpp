@@ -0,0 +1,104 @@
+#include "TimestampFormatter.h"
+
+#include <cstring>
+#include <ctime>
+
+namespace GeoLocation {
+
+    namespace {
+
+        // Between 1601-01-01 and 1970-01-01, in 100ns ticks.
+        const int64_t kFileTimeUnixEpoch = 116444736000000000LL;
+
+        int64_t floorDiv(int64_t value, int64_t divisor) {
+            int64_t quotient = value / divisor;
+            if ((value % divisor != 0) && ((value < 0) != (divisor < 0)))
+                quotient--;
+            return quotient;
+        }
+
+        // Howard Hinnant's civil_from_days, the inverse of DaysFromCivil().
+        void civilFromDays(int64_t days, int64_t *year, unsigned *month, unsigned *day) {
+            days += 719468;
+            const int64_t era = floorDiv(days, 146097);
+            const unsigned doe = (unsigned) (days - era * 146097);
+            const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+            const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+            const unsigned mp = (5 * doy + 2) / 153;
+            *day = doy - (153 * mp + 2) / 5 + 1;
+            *month = mp < 10 ? mp + 3 : mp - 9;
+            *year = (int64_t) yoe + era * 400 + (*month <= 2);
+        }
+
+        int64_t localOffset(int64_t unixSeconds) {
+            time_t t = (time_t) unixSeconds;
+            struct tm tm = {};
+#if defined(_WIN32)
+            localtime_s(&tm, &t);
+#else
+            localtime_r(&t, &tm);
+#endif
+            int64_t local = DaysFromCivil(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday) * 86400 +
+                            tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec;
+            return local - unixSeconds;
+        }
+
+        void putDigits(char *out, unsigned value, int width) {
+            for (int i = width - 1; i >= 0; i--) {
+                out[i] = (char) ('0' + value % 10);
+                value /= 10;
+            }
+        }
+    }
+
+    int64_t FileTimeToUnixMillis(int64_t fileTime) {
+        return floorDiv(fileTime - kFileTimeUnixEpoch, 10000);
+    }
+
+    int64_t UnixMillisToFileTime(int64_t unixMillis) {
+        return unixMillis * 10000 + kFileTimeUnixEpoch;
+    }
+
+    // Howard Hinnant's days_from_civil.
+    int64_t DaysFromCivil(int64_t year, unsigned month, unsigned day) {
+        year -= month <= 2;
+        const int64_t era = floorDiv(year, 400);
+        const unsigned yoe = (unsigned) (year - era * 400);
+        const unsigned doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+        const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        return era * 146097 + (int64_t) doe - 719468;
+    }
+
+    void TimestampFormatter::format(int64_t unixSeconds, char *buffer) {
+        int64_t minute = floorDiv(unixSeconds, 60);
+        if (minute != m_minute) {
+            int64_t quarter = floorDiv(unixSeconds, 900);
+            if (quarter != m_quarter) {
+                m_offset = localOffset(unixSeconds);
+                m_quarter = quarter;
+            }
+
+            int64_t local = unixSeconds + m_offset;
+            int64_t days = floorDiv(local, 86400);
+            int64_t secondOfDay = local - days * 86400;
+            int64_t year;
+            unsigned month, day;
+            civilFromDays(days, &year, &month, &day);
+
+            putDigits(m_prefix, (unsigned) year, 4);
+            m_prefix[4] = '-';
+            putDigits(m_prefix + 5, month, 2);
+            m_prefix[7] = '-';
+            putDigits(m_prefix + 8, day, 2);
+            m_prefix[10] = ' ';
+            putDigits(m_prefix + 11, (unsigned) (secondOfDay / 3600), 2);
+            m_prefix[13] = ':';
+            putDigits(m_prefix + 14, (unsigned) (secondOfDay / 60 % 60), 2);
+            m_prefix[16] = ':';
+            m_minute = minute;
+        }
+
+        memcpy(buffer, m_prefix, kPrefixLength);
+        putDigits(buffer + kPrefixLength, (unsigned) (unixSeconds - minute * 60), 2);
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace GeoLocation {
+
+    // Unix milliseconds for a FILETIME value (100ns ticks since 1601-01-01 UTC),
+    // such as SystemTimeToFileTime() makes of a report's SYSTEMTIME.
+    int64_t FileTimeToUnixMillis(int64_t fileTime);
+
+    int64_t UnixMillisToFileTime(int64_t unixMillis);
+
+    // Days since 1970-01-01 of a proleptic Gregorian date.
+    int64_t DaysFromCivil(int64_t year, unsigned month, unsigned day);
+
+    // Renders Unix time as local "YYYY-MM-DD HH:MM:SS". The UTC offset is
+    // looked up once per quarter hour, which is as often as a DST transition
+    // can fall, and the "YYYY-MM-DD HH:MM:" prefix rendered once per minute;
+    // within a minute only the seconds are written.
+    //
+    // An instance is not safe to share between threads.
+    class TimestampFormatter {
+    public:
+        static constexpr size_t kLength = 19;
+
+        // Writes kLength characters, not NUL-terminated.
+        void format(int64_t unixSeconds, char *buffer);
+
+    private:
+        static constexpr size_t kPrefixLength = 17;
+
+        int64_t m_quarter = INT64_MIN;
+        int64_t m_offset = 0;
+        int64_t m_minute = INT64_MIN;
+        char m_prefix[kPrefixLength] = {};
+    };
+}
@@ -0,0 +1,80 @@
+#include "WindowsLocationProvider.h"
+#include "GeoCoordinateWatcher.h"
+
+IID REPORT_TYPES[] = { IID_ILatLongReport };
+
+GeoCoordinateWatcher* GeoCoordinateWatcher::GetInstance()
+{
+    if (_instance == nullptr)
+        _instance = new GeoCoordinateWatcher(make_unique<WindowsLocationProvider>());
+    return _instance;
+}
+
+WindowsLocationProvider::WindowsLocationProvider()
+{
+    hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED | COINIT_DISABLE_OLE1DDE);
+    if (SUCCEEDED(hr))
+    {
+        hr = spLocation.CoCreateInstance(CLSID_Location);
+    }
+}
+
+WindowsLocationProvider::~WindowsLocationProvider()
+{
+    stop();
+
+    if (nullptr != pLocationEvents)
+    {
+        pLocationEvents->Release();
+        pLocationEvents = nullptr;
+    }
+}
+
+bool WindowsLocationProvider::start(bool isHighAccuracy, LocationSink *sink)
+{
+    if (SUCCEEDED(hr) && nullptr == pLocationEvents)
+    {
+        hr = CComObject<CLocationEvents>::CreateInstance(&pLocationEvents);
+        if (nullptr != pLocationEvents)
+        {
+            pLocationEvents->AddRef();
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        pLocationEvents->setSink(sink);
+
+        hr = spLocation->RequestPermissions(nullptr, REPORT_TYPES, ARRAYSIZE(REPORT_TYPES), FALSE);
+        if (FAILED(hr))
+        {
+            wprintf(L"Warning: Unable to request permissions.\n");
+        }
+
+        for (auto index : REPORT_TYPES)
+        {
+            spLocation->SetDesiredAccuracy(index, isHighAccuracy ? LOCATION_DESIRED_ACCURACY_HIGH : LOCATION_DESIRED_ACCURACY_DEFAULT);
+            hr = spLocation->RegisterForReport(pLocationEvents, index, 0);
+        }
+        registered = SUCCEEDED(hr);
+    }
+
+    return registered;
+}
+
+void WindowsLocationProvider::stop()
+{
+    if (registered)
+    {
+        for (auto index : REPORT_TYPES)
+        {
+            spLocation->UnregisterForReport(index);
+        }
+        registered = false;
+    }
+
+    if (nullptr != pLocationEvents)
+    {
+        pLocationEvents->setSink(nullptr);
+    }
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "LocationCallback.h"
+#include <Windows.h>
+#include <atlbase.h>
+#include <atlcom.h>
+#include <locationapi.h>
+#include "LocationProvider.h"
+
+using namespace GeoLocation;
+
+class WindowsLocationProvider : public LocationProvider
+{
+public:
+    WindowsLocationProvider();
+    ~WindowsLocationProvider() override;
+    bool start(bool isHighAccuracy, LocationSink *sink) override;
+    void stop() override;
+private:
+    class CInitializeATL : public CAtlExeModuleT<CInitializeATL> {};
+    CInitializeATL g_InitializeATL;
+    HRESULT hr;
+    bool registered = false;
+    CComPtr<ILocation> spLocation;
+    CComObject<CLocationEvents>* pLocationEvents = nullptr;
+};